@@ -0,0 +1,89 @@
+#ifndef _ASM_X86_QSPINLOCK_H
+#define _ASM_X86_QSPINLOCK_H
+
+/*
+ * Queued spinlocks
+ *
+ * The fastpath is a single cmpxchg of the whole lock word from 0 to
+ * _Q_LOCKED_VAL; everything else is handled out of line by
+ * queued_spin_lock_slowpath() in arch/x86/kernel/qspinlock.c.
+ *
+ * Unlock only needs to clear the locked byte: x86 does not reorder stores
+ * with older loads or stores, so a compiler barrier is all the release
+ * ordering required (modulo the PPro/OOSTORE errata below).
+ */
+
+extern void queued_spin_lock_slowpath(arch_spinlock_t *lock, u32 val);
+
+static inline int queued_spin_is_locked(arch_spinlock_t *lock)
+{
+	return atomic_read(&lock->val);
+}
+
+static inline int queued_spin_is_contended(arch_spinlock_t *lock)
+{
+	return atomic_read(&lock->val) & ~_Q_LOCKED_MASK;
+}
+
+static __always_inline int queued_spin_trylock(arch_spinlock_t *lock)
+{
+	if (!atomic_read(&lock->val) &&
+	    (atomic_cmpxchg(&lock->val, 0, _Q_LOCKED_VAL) == 0))
+		return 1;
+	return 0;
+}
+
+static __always_inline void queued_spin_lock(arch_spinlock_t *lock)
+{
+	u32 val;
+
+	val = atomic_cmpxchg(&lock->val, 0, _Q_LOCKED_VAL);
+	if (likely(val == 0))
+		return;
+	queued_spin_lock_slowpath(lock, val);
+}
+
+static __always_inline void queued_spin_unlock(arch_spinlock_t *lock)
+{
+#if defined(CONFIG_X86_32) && \
+	(defined(CONFIG_X86_OOSTORE) || defined(CONFIG_X86_PPRO_FENCE))
+	smp_mb();
+#else
+	barrier();
+#endif
+	ACCESS_ONCE(lock->locked) = 0;
+}
+
+static inline int arch_spin_is_locked(arch_spinlock_t *lock)
+{
+	return queued_spin_is_locked(lock);
+}
+
+static inline int arch_spin_is_contended(arch_spinlock_t *lock)
+{
+	return queued_spin_is_contended(lock);
+}
+#define arch_spin_is_contended	arch_spin_is_contended
+
+static __always_inline void arch_spin_lock(arch_spinlock_t *lock)
+{
+	queued_spin_lock(lock);
+}
+
+static __always_inline int arch_spin_trylock(arch_spinlock_t *lock)
+{
+	return queued_spin_trylock(lock);
+}
+
+static __always_inline void arch_spin_unlock(arch_spinlock_t *lock)
+{
+	queued_spin_unlock(lock);
+}
+
+static __always_inline void arch_spin_lock_flags(arch_spinlock_t *lock,
+						  unsigned long flags)
+{
+	arch_spin_lock(lock);
+}
+
+#endif /* _ASM_X86_QSPINLOCK_H */
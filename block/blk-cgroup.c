@@ -179,6 +179,23 @@ static inline void blkio_update_group_iops(struct blkio_group *blkg,
 	}
 }
 
+static inline void blkio_update_group_lat_target(struct blkio_group *blkg,
+			unsigned int lat_usec)
+{
+	struct blkio_policy_type *blkiop;
+
+	list_for_each_entry(blkiop, &blkio_list, list) {
+
+		/* If this policy does not own the blkg, do not send updates */
+		if (blkiop->plid != blkg->plid)
+			continue;
+
+		if (blkiop->ops.blkio_update_group_lat_target_fn)
+			blkiop->ops.blkio_update_group_lat_target_fn(blkg->key,
+							blkg, lat_usec);
+	}
+}
+
 /*
  * Add to the appropriate stat variable depending on the request type.
  * This should be called with the blkg->stats_lock held.
@@ -855,6 +872,14 @@ static int blkio_policy_parse_and_set(char *buf,
 			break;
 		}
 		break;
+	case BLKIO_POLICY_LATENCY:
+		if (temp > UINT_MAX)
+			goto out;
+
+		newpn->plid = plid;
+		newpn->fileid = fileid;
+		newpn->val.lat_usec = (unsigned int)temp;
+		break;
 	default:
 		BUG();
 	}
@@ -950,6 +975,22 @@ unsigned int blkcg_get_write_iops(struct blkio_cgroup *blkcg, dev_t dev)
 	return iops;
 }
 
+unsigned int blkcg_get_lat_target(struct blkio_cgroup *blkcg, dev_t dev)
+{
+	struct blkio_policy_node *pn;
+	unsigned long flags;
+	unsigned int lat_usec = 0;
+
+	spin_lock_irqsave(&blkcg->lock, flags);
+	pn = blkio_policy_search_node(blkcg, dev, BLKIO_POLICY_LATENCY,
+				BLKIO_LAT_target_device);
+	if (pn)
+		lat_usec = pn->val.lat_usec;
+	spin_unlock_irqrestore(&blkcg->lock, flags);
+
+	return lat_usec;
+}
+
 /* Checks whether user asked for deleting a policy rule */
 static bool blkio_delete_rule_command(struct blkio_policy_node *pn)
 {
@@ -971,6 +1012,10 @@ static bool blkio_delete_rule_command(struct blkio_policy_node *pn)
 				return 1;
 		}
 		break;
+	case BLKIO_POLICY_LATENCY:
+		if (pn->val.lat_usec == 0)
+			return 1;
+		break;
 	default:
 		BUG();
 	}
@@ -996,6 +1041,9 @@ static void blkio_update_policy_rule(struct blkio_policy_node *oldpn,
 			oldpn->val.iops = newpn->val.iops;
 		}
 		break;
+	case BLKIO_POLICY_LATENCY:
+		oldpn->val.lat_usec = newpn->val.lat_usec;
+		break;
 	default:
 		BUG();
 	}
@@ -1031,6 +1079,9 @@ static void blkio_update_blkg_policy(struct blkio_cgroup *blkcg,
 			break;
 		}
 		break;
+	case BLKIO_POLICY_LATENCY:
+		blkio_update_group_lat_target(blkg, pn->val.lat_usec);
+		break;
 	default:
 		BUG();
 	}
@@ -1142,6 +1193,11 @@ blkio_print_policy_node(struct seq_file *m, struct blkio_policy_node *pn)
 				break;
 			}
 			break;
+		case BLKIO_POLICY_LATENCY:
+			if (pn->fileid == BLKIO_LAT_target_device)
+				seq_printf(m, "%u:%u\t%u\n", MAJOR(pn->dev),
+					MINOR(pn->dev), pn->val.lat_usec);
+			break;
 		default:
 			BUG();
 	}
@@ -1195,6 +1251,15 @@ static int blkiocg_file_read(struct cgroup *cgrp, struct cftype *cft,
 			BUG();
 		}
 		break;
+	case BLKIO_POLICY_LATENCY:
+		switch (name) {
+		case BLKIO_LAT_target_device:
+			blkio_read_policy_node_files(cft, blkcg, m);
+			return 0;
+		default:
+			BUG();
+		}
+		break;
 	default:
 		BUG();
 	}
@@ -1305,6 +1370,24 @@ static int blkiocg_file_read_map(struct cgroup *cgrp, struct cftype *cft,
 			BUG();
 		}
 		break;
+	case BLKIO_POLICY_LATENCY:
+		switch (name) {
+		case BLKIO_LAT_io_service_bytes:
+			return blkio_read_blkg_stats(blkcg, cft, cb,
+					BLKIO_STAT_CPU_SERVICE_BYTES, 1, 1);
+		case BLKIO_LAT_io_serviced:
+			return blkio_read_blkg_stats(blkcg, cft, cb,
+						BLKIO_STAT_CPU_SERVICED, 1, 1);
+		case BLKIO_LAT_io_service_time:
+			return blkio_read_blkg_stats(blkcg, cft, cb,
+						BLKIO_STAT_SERVICE_TIME, 1, 0);
+		case BLKIO_LAT_io_wait_time:
+			return blkio_read_blkg_stats(blkcg, cft, cb,
+						BLKIO_STAT_WAIT_TIME, 1, 0);
+		default:
+			BUG();
+		}
+		break;
 	default:
 		BUG();
 	}
@@ -1499,6 +1582,41 @@ struct cftype blkio_files[] = {
 	},
 #endif /* CONFIG_BLK_DEV_THROTTLING */
 
+#ifdef CONFIG_BLK_CGROUP_IOLATENCY
+	{
+		.name = "latency.target_device",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_LATENCY,
+				BLKIO_LAT_target_device),
+		.read_seq_string = blkiocg_file_read,
+		.write_string = blkiocg_file_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "latency.io_service_bytes",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_LATENCY,
+				BLKIO_LAT_io_service_bytes),
+		.read_map = blkiocg_file_read_map,
+	},
+	{
+		.name = "latency.io_serviced",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_LATENCY,
+				BLKIO_LAT_io_serviced),
+		.read_map = blkiocg_file_read_map,
+	},
+	{
+		.name = "latency.io_service_time",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_LATENCY,
+				BLKIO_LAT_io_service_time),
+		.read_map = blkiocg_file_read_map,
+	},
+	{
+		.name = "latency.io_wait_time",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_LATENCY,
+				BLKIO_LAT_io_wait_time),
+		.read_map = blkiocg_file_read_map,
+	},
+#endif /* CONFIG_BLK_CGROUP_IOLATENCY */
+
 #ifdef CONFIG_DEBUG_BLK_CGROUP
 	{
 		.name = "avg_queue_size",
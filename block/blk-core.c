@@ -29,11 +29,13 @@
 #include <linux/fault-inject.h>
 #include <linux/list_sort.h>
 #include <linux/delay.h>
+#include <linux/blk-mq.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/block.h>
 
 #include "blk.h"
+#include "blk-mq.h"
 
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_bio_remap);
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_rq_remap);
@@ -56,7 +58,7 @@ struct kmem_cache *blk_requestq_cachep;
  */
 static struct workqueue_struct *kblockd_workqueue;
 
-static void drive_stat_acct(struct request *rq, int new_io)
+void drive_stat_acct(struct request *rq, int new_io)
 {
 	struct hd_struct *part;
 	int rw = rq_data_dir(rq);
@@ -286,7 +288,11 @@ EXPORT_SYMBOL(blk_stop_queue);
 void blk_sync_queue(struct request_queue *q)
 {
 	del_timer_sync(&q->timeout);
-	cancel_delayed_work_sync(&q->delay_work);
+
+	if (q->mq_ops)
+		blk_mq_sync_queue(q);
+	else
+		cancel_delayed_work_sync(&q->delay_work);
 }
 EXPORT_SYMBOL(blk_sync_queue);
 
@@ -435,6 +441,8 @@ void blk_cleanup_queue(struct request_queue *q)
 	 */
 	if (q->elevator)
 		blk_drain_queue(q, true);
+	else if (q->mq_ops)
+		blk_mq_drain_queue(q);
 
 	/* @q won't process any more request, flush async actions */
 	del_timer_sync(&q->backing_dev_info.laptop_mode_wb_timer);
@@ -498,8 +506,19 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	if (err)
 		goto fail_id;
 
+	/*
+	 * By default initialize queue_lock to internal lock and driver can
+	 * override it later if need be.  blk_throtl_exit() needs it when
+	 * unwinding below.
+	 */
+	spin_lock_init(&q->__queue_lock);
+	q->queue_lock = &q->__queue_lock;
+
 	if (blk_throtl_init(q))
-		goto fail_id;
+		goto fail_bdi;
+
+	if (blk_iolat_init(q))
+		goto fail_throtl;
 
 	setup_timer(&q->backing_dev_info.laptop_mode_wb_timer,
 		    laptop_mode_timer_fn, (unsigned long) q);
@@ -514,16 +533,14 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	kobject_init(&q->kobj, &blk_queue_ktype);
 
 	mutex_init(&q->sysfs_lock);
-	spin_lock_init(&q->__queue_lock);
-
-	/*
-	 * By default initialize queue_lock to internal lock and driver can
-	 * override it later if need be.
-	 */
-	q->queue_lock = &q->__queue_lock;
 
 	return q;
 
+fail_throtl:
+	blk_throtl_exit(q);
+	blk_throtl_release(q);
+fail_bdi:
+	bdi_destroy(&q->backing_dev_info);
 fail_id:
 	ida_simple_remove(&blk_queue_ida, q->id);
 fail_q:
@@ -979,6 +996,9 @@ struct request *blk_get_request(struct request_queue *q, int rw, gfp_t gfp_mask)
 
 	BUG_ON(rw != READ && rw != WRITE);
 
+	if (q->mq_ops)
+		return blk_mq_alloc_request(q, rw, gfp_mask);
+
 	spin_lock_irq(q->queue_lock);
 	if (gfp_mask & __GFP_WAIT)
 		rq = get_request_wait(q, rw, NULL);
@@ -1129,6 +1149,12 @@ void __blk_put_request(struct request_queue *q, struct request *req)
 	if (unlikely(--req->ref_count))
 		return;
 
+	if (q->mq_ops) {
+		blk_mq_free_request(req);
+		return;
+	}
+
+	wbt_done(q->rq_wb, req);
 	elv_completed_request(q, req);
 
 	/* this is a bio leak */
@@ -1155,6 +1181,11 @@ void blk_put_request(struct request *req)
 	unsigned long flags;
 	struct request_queue *q = req->q;
 
+	if (q->mq_ops) {
+		__blk_put_request(q, req);
+		return;
+	}
+
 	spin_lock_irqsave(q->queue_lock, flags);
 	__blk_put_request(q, req);
 	spin_unlock_irqrestore(q->queue_lock, flags);
@@ -1246,15 +1277,21 @@ static bool bio_attempt_front_merge(struct request_queue *q,
 }
 
 /**
- * attempt_plug_merge - try to merge with %current's plugged list
+ * blk_attempt_plug_merge - try to merge with %current's plugged list
  * @q: request_queue new bio is being queued at
  * @bio: new bio being queued
- * @request_count: out parameter for number of traversed plugged requests
+ * @request_count: out parameter for number of plugged requests for @q
+ * @same_queue_rq: out parameter for the last plugged request for @q
  *
  * Determine whether @bio being queued on @q can be merged with a request
  * on %current's plugged list.  Returns %true if merge was successful,
  * otherwise %false.
  *
+ * The plugged list is kept grouped by queue: a new request goes in right
+ * after @same_queue_rq rather than at the tail.  So the scan can stop as
+ * soon as it has walked past @q's requests, instead of visiting every
+ * request the task has plugged for every device.
+ *
  * Plugging coalesces IOs from the same issuer for the same purpose without
  * going through @q->queue_lock.  As such it's more of an issuing mechanism
  * than scheduling, and the request, while may have elvpriv data, is not
@@ -1262,25 +1299,36 @@ static bool bio_attempt_front_merge(struct request_queue *q,
  * reliable access to the elevator outside queue lock.  Only check basic
  * merging parameters without querying the elevator.
  */
-static bool attempt_plug_merge(struct request_queue *q, struct bio *bio,
-			       unsigned int *request_count)
+bool blk_attempt_plug_merge(struct request_queue *q, struct bio *bio,
+			    unsigned int *request_count,
+			    struct request **same_queue_rq)
 {
 	struct blk_plug *plug;
+	struct list_head *plug_list;
 	struct request *rq;
 	bool ret = false;
 
+	*same_queue_rq = NULL;
 	plug = current->plug;
 	if (!plug)
 		goto out;
 	*request_count = 0;
 
-	list_for_each_entry_reverse(rq, &plug->list, queuelist) {
+	plug_list = q->mq_ops ? &plug->mq_list : &plug->list;
+	list_for_each_entry_reverse(rq, plug_list, queuelist) {
 		int el_ret;
 
-		if (rq->q == q)
-			(*request_count)++;
+		if (rq->q != q) {
+			if (*same_queue_rq)
+				break;
+			continue;
+		}
+
+		if (!*same_queue_rq)
+			*same_queue_rq = rq;
+		(*request_count)++;
 
-		if (rq->q != q || !blk_rq_merge_ok(rq, bio))
+		if (!blk_rq_merge_ok(rq, bio))
 			continue;
 
 		el_ret = blk_try_merge(rq, bio);
@@ -1298,6 +1346,26 @@ out:
 	return ret;
 }
 
+/*
+ * The last request %current has plugged for @q.  For flushes, which are
+ * plugged without trying a plug merge first.
+ */
+static struct request *blk_plug_last_rq(struct request_queue *q)
+{
+	struct blk_plug *plug = current->plug;
+	struct request *rq;
+
+	if (!plug)
+		return NULL;
+
+	list_for_each_entry_reverse(rq, &plug->list, queuelist)
+		if (rq->q == q)
+			return rq;
+	return NULL;
+}
+
+static void blk_flush_plug_queue(struct blk_plug *plug, struct request *rq);
+
 void init_request_from_bio(struct request *req, struct bio *bio)
 {
 	req->cmd_type = REQ_TYPE_FS;
@@ -1317,8 +1385,9 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	const bool sync = !!(bio->bi_rw & REQ_SYNC);
 	struct blk_plug *plug;
 	int el_ret, rw_flags, where = ELEVATOR_INSERT_SORT;
-	struct request *req;
+	struct request *req, *same_queue_rq = NULL;
 	unsigned int request_count = 0;
+	bool wb_acct;
 
 	/*
 	 * low level driver can indicate that it wants pages above a
@@ -1328,6 +1397,7 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	blk_queue_bounce(q, &bio);
 
 	if (bio->bi_rw & (REQ_FLUSH | REQ_FUA)) {
+		same_queue_rq = blk_plug_last_rq(q);
 		spin_lock_irq(q->queue_lock);
 		where = ELEVATOR_INSERT_FLUSH;
 		goto get_rq;
@@ -1337,7 +1407,7 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	 * Check if we can merge with the plugged list before grabbing
 	 * any locks.
 	 */
-	if (attempt_plug_merge(q, bio, &request_count))
+	if (blk_attempt_plug_merge(q, bio, &request_count, &same_queue_rq))
 		return;
 
 	spin_lock_irq(q->queue_lock);
@@ -1369,12 +1439,16 @@ get_rq:
 	if (sync)
 		rw_flags |= REQ_SYNC;
 
+	wb_acct = wbt_wait(q->rq_wb, bio, q->queue_lock);
+
 	/*
 	 * Grab a free request. This is might sleep but can not fail.
 	 * Returns with the queue unlocked.
 	 */
 	req = get_request_wait(q, rw_flags, bio);
 	if (unlikely(!req)) {
+		if (wb_acct)
+			wbt_cancel(q->rq_wb);
 		bio_endio(bio, -ENODEV);	/* @q is dead */
 		goto out_unlock;
 	}
@@ -1386,6 +1460,8 @@ get_rq:
 	 * often, and the elevators are able to handle it.
 	 */
 	init_request_from_bio(req, bio);
+	if (wb_acct)
+		req->cmd_flags |= REQ_WB_TRACKED;
 
 	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags))
 		req->cpu = raw_smp_processor_id();
@@ -1394,26 +1470,24 @@ get_rq:
 	if (plug) {
 		/*
 		 * If this is the first request added after a plug, fire
-		 * of a plug trace. If others have been added before, check
-		 * if we have multiple devices in this plug. If so, make a
-		 * note to sort the list before dispatch.
+		 * of a plug trace.  If @q already has a full batch plugged,
+		 * send just that batch down; other devices' requests stay
+		 * plugged.  Either way @req joins @q's group on the list.
+		 * Sleeping for the request flushes the whole plug, which
+		 * leaves @same_queue_rq stale but the list empty.
 		 */
-		if (list_empty(&plug->list))
+		if (list_empty(&plug->list)) {
+			same_queue_rq = NULL;
+			trace_block_plug(q);
+		} else if (request_count >= BLK_MAX_REQUEST_COUNT) {
+			blk_flush_plug_queue(plug, same_queue_rq);
+			same_queue_rq = NULL;
 			trace_block_plug(q);
-		else {
-			if (!plug->should_sort) {
-				struct request *__rq;
-
-				__rq = list_entry_rq(plug->list.prev);
-				if (__rq->q != q)
-					plug->should_sort = 1;
-			}
-			if (request_count >= BLK_MAX_REQUEST_COUNT) {
-				blk_flush_plug_list(plug, false);
-				trace_block_plug(q);
-			}
 		}
-		list_add_tail(&req->queuelist, &plug->list);
+		if (same_queue_rq)
+			list_add(&req->queuelist, &same_queue_rq->queuelist);
+		else
+			list_add_tail(&req->queuelist, &plug->list);
 		drive_stat_acct(req, 1);
 	} else {
 		spin_lock_irq(q->queue_lock);
@@ -1597,6 +1671,8 @@ generic_make_request_checks(struct bio *bio)
 	if (blk_throtl_bio(q, bio))
 		return false;	/* throttled, will be resubmitted later */
 
+	blk_iolat_bio(q, bio);
+
 	trace_block_bio_queue(q, bio);
 	return true;
 
@@ -1869,7 +1945,7 @@ static void blk_account_io_completion(struct request *req, unsigned int bytes)
 	}
 }
 
-static void blk_account_io_done(struct request *req)
+void blk_account_io_done(struct request *req)
 {
 	/*
 	 * Account IO completion.  flush_rq isn't accounted as a
@@ -1889,6 +1965,7 @@ static void blk_account_io_done(struct request *req)
 		part_stat_add(cpu, part, ticks[rw], duration);
 		part_round_stats(cpu, part);
 		part_dec_in_flight(part, rw);
+		blk_io_hist_done(req, cpu);
 
 		hd_struct_put(part);
 		part_stat_unlock();
@@ -2041,6 +2118,8 @@ void blk_start_request(struct request *req)
 	if (unlikely(blk_bidi_rq(req)))
 		req->next_rq->resid_len = blk_rq_bytes(req->next_rq);
 
+	wbt_issue(req->q->rq_wb, req);
+	blk_io_hist_issue(req);
 	blk_add_timer(req);
 }
 EXPORT_SYMBOL(blk_start_request);
@@ -2303,9 +2382,10 @@ static void blk_finish_request(struct request *req, int error)
 
 	blk_account_io_done(req);
 
-	if (req->end_io)
+	if (req->end_io) {
+		wbt_done(req->q->rq_wb, req);
 		req->end_io(req, error);
-	else {
+	} else {
 		if (blk_bidi_rq(req))
 			__blk_put_request(req->next_rq->q, req->next_rq);
 
@@ -2706,6 +2786,19 @@ int kblockd_schedule_delayed_work(struct request_queue *q,
 }
 EXPORT_SYMBOL(kblockd_schedule_delayed_work);
 
+/*
+ * Like kblockd_schedule_delayed_work(), but on @cpu.  A zero @delay
+ * queues the work right away instead of going through a timer.
+ */
+int kblockd_schedule_delayed_work_on(int cpu, struct delayed_work *dwork,
+				     unsigned long delay)
+{
+	if (!delay)
+		return queue_work_on(cpu, kblockd_workqueue, &dwork->work);
+	return queue_delayed_work_on(cpu, kblockd_workqueue, dwork, delay);
+}
+EXPORT_SYMBOL(kblockd_schedule_delayed_work_on);
+
 #define PLUG_MAGIC	0x91827364
 
 /**
@@ -2728,8 +2821,8 @@ void blk_start_plug(struct blk_plug *plug)
 
 	plug->magic = PLUG_MAGIC;
 	INIT_LIST_HEAD(&plug->list);
+	INIT_LIST_HEAD(&plug->mq_list);
 	INIT_LIST_HEAD(&plug->cb_list);
-	plug->should_sort = 0;
 
 	/*
 	 * If this is a nested plug, don't actually assign it. It will be
@@ -2750,7 +2843,8 @@ static int plug_rq_cmp(void *priv, struct list_head *a, struct list_head *b)
 	struct request *rqa = container_of(a, struct request, queuelist);
 	struct request *rqb = container_of(b, struct request, queuelist);
 
-	return !(rqa->q <= rqb->q);
+	return !(rqa->q < rqb->q ||
+		 (rqa->q == rqb->q && blk_rq_pos(rqa) < blk_rq_pos(rqb)));
 }
 
 /*
@@ -2806,49 +2900,22 @@ static void flush_plug_callbacks(struct blk_plug *plug)
 	}
 }
 
-void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
+/*
+ * Insert @list, @q's plugged requests sorted by sector, under a single
+ * hold of the queue_lock.  Sorted, each request usually merges straight
+ * into the one before it through the last_merge hint or the merge hash.
+ * Called with interrupts disabled.
+ */
+static void flush_plug_queue(struct request_queue *q, struct list_head *list,
+			     bool from_schedule)
 {
-	struct request_queue *q;
-	unsigned long flags;
+	unsigned int depth = 0, merged = 0;
 	struct request *rq;
-	LIST_HEAD(list);
-	unsigned int depth;
-
-	BUG_ON(plug->magic != PLUG_MAGIC);
 
-	flush_plug_callbacks(plug);
-	if (list_empty(&plug->list))
-		return;
-
-	list_splice_init(&plug->list, &list);
-
-	if (plug->should_sort) {
-		list_sort(NULL, &list, plug_rq_cmp);
-		plug->should_sort = 0;
-	}
-
-	q = NULL;
-	depth = 0;
-
-	/*
-	 * Save and disable interrupts here, to avoid doing it for every
-	 * queue lock we have to take.
-	 */
-	local_irq_save(flags);
-	while (!list_empty(&list)) {
-		rq = list_entry_rq(list.next);
+	spin_lock(q->queue_lock);
+	while (!list_empty(list)) {
+		rq = list_entry_rq(list->next);
 		list_del_init(&rq->queuelist);
-		BUG_ON(!rq->q);
-		if (rq->q != q) {
-			/*
-			 * This drops the queue lock
-			 */
-			if (q)
-				queue_unplugged(q, depth, from_schedule);
-			q = rq->q;
-			depth = 0;
-			spin_lock(q->queue_lock);
-		}
 
 		/*
 		 * Short-circuit if @q is dead
@@ -2863,18 +2930,82 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 		 */
 		if (rq->cmd_flags & (REQ_FLUSH | REQ_FUA))
 			__elv_add_request(q, rq, ELEVATOR_INSERT_FLUSH);
-		else
-			__elv_add_request(q, rq, ELEVATOR_INSERT_SORT_MERGE);
+		else if (__elv_add_request(q, rq, ELEVATOR_INSERT_SORT_MERGE))
+			merged++;
 
 		depth++;
 	}
 
+	trace_block_plug_flush(q, depth, merged);
+
 	/*
 	 * This drops the queue lock
 	 */
-	if (q)
-		queue_unplugged(q, depth, from_schedule);
+	queue_unplugged(q, depth, from_schedule);
+}
+
+/*
+ * Send down only the requests plugged for one queue, the group ending
+ * at @rq, once that queue has a full batch.
+ */
+static void blk_flush_plug_queue(struct blk_plug *plug, struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	unsigned long flags;
+	struct request *prev;
+	LIST_HEAD(list);
+
+	while (&rq->queuelist != &plug->list && rq->q == q) {
+		prev = list_entry_rq(rq->queuelist.prev);
+		list_move(&rq->queuelist, &list);
+		rq = prev;
+	}
+	list_sort(NULL, &list, plug_rq_cmp);
+
+	local_irq_save(flags);
+	flush_plug_queue(q, &list, false);
+	local_irq_restore(flags);
+}
+
+void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
+{
+	struct request_queue *q;
+	unsigned long flags;
+	struct request *rq;
+	LIST_HEAD(list);
+	LIST_HEAD(batch);
+
+	BUG_ON(plug->magic != PLUG_MAGIC);
+
+	flush_plug_callbacks(plug);
 
+	if (!list_empty(&plug->mq_list))
+		blk_mq_flush_plug_list(plug, from_schedule);
+
+	if (list_empty(&plug->list))
+		return;
+
+	list_splice_init(&plug->list, &list);
+	list_sort(NULL, &list, plug_rq_cmp);
+
+	/*
+	 * Save and disable interrupts here, to avoid doing it for every
+	 * queue lock we have to take.
+	 */
+	local_irq_save(flags);
+	while (!list_empty(&list)) {
+		q = list_entry_rq(list.next)->q;
+		BUG_ON(!q);
+
+		/* cut off this queue's batch, the list is sorted by queue */
+		rq = list_entry_rq(list.next);
+		while (rq->queuelist.next != &list &&
+		       list_entry_rq(rq->queuelist.next)->q == q)
+			rq = list_entry_rq(rq->queuelist.next);
+		list_cut_position(&batch, &list, &rq->queuelist);
+
+		flush_plug_queue(q, &batch, from_schedule);
+	}
 	local_irq_restore(flags);
 }
 
@@ -0,0 +1,189 @@
+/*
+ * Per-device I/O histograms
+ *
+ * /proc/diskstats only has totals, which hide the tail.  This keeps, for
+ * each request-based queue and each of read, write and discard, a
+ * histogram of completion latency and one of request size.  Latency runs
+ * from the request being handed to the driver to its completion; sizes
+ * are counted at the same point, so they show what merging achieved.
+ * Buckets are powers of two, of microseconds and of 512 byte sectors,
+ * and the counters are per CPU so completions never share a cache line.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+
+#include "blk.h"
+
+enum {
+	IOHIST_READ,
+	IOHIST_WRITE,
+	IOHIST_DISCARD,
+	IOHIST_NR_OPS,
+};
+
+/* <2us, 2-4us, ... 4-8s, >=8s */
+#define IOHIST_LAT_BUCKETS	24
+/* 1 sector, 2-3, 4-7, ... 2-4MB, >=4MB */
+#define IOHIST_SIZE_BUCKETS	14
+
+struct blk_io_hist {
+	unsigned long lat[IOHIST_NR_OPS][IOHIST_LAT_BUCKETS];
+	unsigned long size[IOHIST_NR_OPS][IOHIST_SIZE_BUCKETS];
+};
+
+static const char *iohist_op_name[IOHIST_NR_OPS] = {
+	[IOHIST_READ]		= "read",
+	[IOHIST_WRITE]		= "write",
+	[IOHIST_DISCARD]	= "discard",
+};
+
+static int iohist_op(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_DISCARD)
+		return IOHIST_DISCARD;
+	return rq_data_dir(rq) == READ ? IOHIST_READ : IOHIST_WRITE;
+}
+
+static unsigned int iohist_bucket(u64 val, unsigned int nr)
+{
+	if (!val)
+		return 0;
+	return min_t(unsigned int, ilog2(val), nr - 1);
+}
+
+/*
+ * @rq is being handed to the driver: stamp it for blk_io_hist_done(),
+ * and count its size unless it was requeued, or bounced back by a busy
+ * driver, after an earlier dispatch.
+ */
+void blk_io_hist_issue(struct request *rq)
+{
+	struct blk_io_hist __percpu *hist = rq->q->io_hist;
+	unsigned int b;
+
+	if (!hist || !blk_do_io_stat(rq))
+		return;
+
+	rq->issue_time_ns = ktime_to_ns(ktime_get());
+	if (rq->cmd_flags & REQ_IO_HIST)
+		return;
+	rq->cmd_flags |= REQ_IO_HIST;
+	b = iohist_bucket(blk_rq_sectors(rq), IOHIST_SIZE_BUCKETS);
+	this_cpu_inc(hist->size[iohist_op(rq)][b]);
+}
+
+/*
+ * @rq has completed.  Called from blk_account_io_done(), which already
+ * checked blk_do_io_stat() and keeps us on @cpu.
+ */
+void blk_io_hist_done(struct request *rq, int cpu)
+{
+	struct blk_io_hist __percpu *hist = rq->q->io_hist;
+	u64 now, usec;
+
+	if (!hist || !rq->issue_time_ns)
+		return;
+
+	now = ktime_to_ns(ktime_get());
+	usec = div_u64(now - rq->issue_time_ns, NSEC_PER_USEC);
+	per_cpu_ptr(hist, cpu)->lat[iohist_op(rq)][iohist_bucket(usec,
+						IOHIST_LAT_BUCKETS)]++;
+}
+
+/*
+ * One line per operation, the name and then the buckets.  Sums are
+ * taken without stopping updates, so they can be off by the handful of
+ * requests completing meanwhile.
+ */
+static ssize_t iohist_show(struct blk_io_hist __percpu *hist, char *page,
+			   bool lat)
+{
+	unsigned int nr = lat ? IOHIST_LAT_BUCKETS : IOHIST_SIZE_BUCKETS;
+	ssize_t len = 0;
+	int op, b, cpu;
+
+	for (op = 0; op < IOHIST_NR_OPS; op++) {
+		len += sprintf(page + len, "%s", iohist_op_name[op]);
+		for (b = 0; b < nr; b++) {
+			unsigned long sum = 0;
+
+			for_each_possible_cpu(cpu) {
+				struct blk_io_hist *h = per_cpu_ptr(hist, cpu);
+
+				sum += lat ? h->lat[op][b] : h->size[op][b];
+			}
+			len += sprintf(page + len, " %lu", sum);
+		}
+		len += sprintf(page + len, "\n");
+	}
+	return len;
+}
+
+static void iohist_reset(struct blk_io_hist __percpu *hist, bool lat)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_io_hist *h = per_cpu_ptr(hist, cpu);
+
+		if (lat)
+			memset(h->lat, 0, sizeof(h->lat));
+		else
+			memset(h->size, 0, sizeof(h->size));
+	}
+}
+
+ssize_t blk_io_hist_lat_show(struct request_queue *q, char *page)
+{
+	if (!q->io_hist)
+		return -EINVAL;
+	return iohist_show(q->io_hist, page, true);
+}
+
+ssize_t blk_io_hist_size_show(struct request_queue *q, char *page)
+{
+	if (!q->io_hist)
+		return -EINVAL;
+	return iohist_show(q->io_hist, page, false);
+}
+
+/* writing anything clears the histogram */
+ssize_t blk_io_hist_lat_store(struct request_queue *q, const char *page,
+			      size_t count)
+{
+	if (!q->io_hist)
+		return -EINVAL;
+	iohist_reset(q->io_hist, true);
+	return count;
+}
+
+ssize_t blk_io_hist_size_store(struct request_queue *q, const char *page,
+			       size_t count)
+{
+	if (!q->io_hist)
+		return -EINVAL;
+	iohist_reset(q->io_hist, false);
+	return count;
+}
+
+int blk_io_hist_init(struct request_queue *q)
+{
+	struct blk_io_hist __percpu *hist;
+
+	hist = alloc_percpu(struct blk_io_hist);
+	if (!hist)
+		return -ENOMEM;
+
+	q->io_hist = hist;
+	return 0;
+}
+
+void blk_io_hist_exit(struct request_queue *q)
+{
+	free_percpu(q->io_hist);
+	q->io_hist = NULL;
+}
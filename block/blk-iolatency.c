@@ -0,0 +1,673 @@
+/*
+ * Per-cgroup completion latency targets
+ *
+ * A group with a target on a device is protected: every window its mean
+ * bio completion latency is checked against the target, and if it was
+ * missed, each group with no target or a looser one has the number of
+ * bios it may have in flight on that device halved.  Once every group
+ * makes its target again the limits are doubled back until they go away.
+ *
+ * This works on bios as they enter generic_make_request(), so it sits
+ * above whatever elevator the queue uses, and applies equally to
+ * bio-based and multi-queue drivers.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/mempool.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/blktrace_api.h>
+#include "blk-cgroup.h"
+#include "blk.h"
+
+/* Latency is judged, and limits adjusted, once per window */
+static unsigned long iolat_window = HZ/10;	/* 100 ms */
+
+static struct kmem_cache *iolat_bio_cache;
+static mempool_t *iolat_bio_pool;
+
+struct iolat_grp {
+	/* List of iolat groups on the request queue */
+	struct hlist_node node;
+
+	struct blkio_group blkg;
+	atomic_t ref;
+
+	/* Completion latency target in usec, 0 if this group has none */
+	unsigned int target_usec;
+
+	/* Max bios in flight, 0 for no limit */
+	unsigned int max_depth;
+	atomic_t inflight;
+	wait_queue_head_t wait;
+
+	/* Samples of the current window, protected by lock */
+	spinlock_t lock;
+	unsigned int win_nr;
+	u64 win_lat;
+	/* Most bios seen in flight during the current window */
+	unsigned int win_peak;
+
+	struct rcu_head rcu_head;
+};
+
+struct iolat_data {
+	/* List of iolat groups */
+	struct hlist_head grp_list;
+
+	struct iolat_grp *root_grp;
+	struct request_queue *queue;
+
+	/* number of total undestroyed groups */
+	unsigned int nr_undestroyed_grps;
+
+	/* Groups with a target; none means nothing to do */
+	atomic_t nr_targets;
+
+	struct timer_list window_timer;
+};
+
+/* Carried by a bio between admission and completion */
+struct iolat_bio {
+	bio_end_io_t *end_io;
+	void *private;
+	struct iolat_grp *ig;
+	u64 start_time;
+	u64 issue_time;
+};
+
+#define iolat_log_grp(td, ig, fmt, args...)				\
+	blk_add_trace_msg((td)->queue, "iolat %s " fmt,			\
+				blkg_path(&(ig)->blkg), ##args)
+
+static inline struct iolat_grp *ig_of_blkg(struct blkio_group *blkg)
+{
+	if (blkg)
+		return container_of(blkg, struct iolat_grp, blkg);
+
+	return NULL;
+}
+
+static void iolat_free_grp(struct rcu_head *head)
+{
+	struct iolat_grp *ig;
+
+	ig = container_of(head, struct iolat_grp, rcu_head);
+	free_percpu(ig->blkg.stats_cpu);
+	kfree(ig);
+}
+
+static void iolat_put_grp(struct iolat_grp *ig)
+{
+	BUG_ON(atomic_read(&ig->ref) <= 0);
+	if (!atomic_dec_and_test(&ig->ref))
+		return;
+
+	/* Lookups under rcu may still see the group, free it after them */
+	call_rcu(&ig->rcu_head, iolat_free_grp);
+}
+
+static void iolat_set_target(struct iolat_data *td, struct iolat_grp *ig,
+			     unsigned int lat_usec)
+{
+	unsigned int old = xchg(&ig->target_usec, lat_usec);
+
+	if (!old && lat_usec)
+		atomic_inc(&td->nr_targets);
+	else if (old && !lat_usec)
+		atomic_dec(&td->nr_targets);
+}
+
+static void iolat_init_group(struct iolat_grp *ig)
+{
+	INIT_HLIST_NODE(&ig->node);
+	atomic_set(&ig->inflight, 0);
+	init_waitqueue_head(&ig->wait);
+	spin_lock_init(&ig->lock);
+
+	/*
+	 * The initial reference is shared by the cgroup and the request
+	 * queue and dropped by whichever goes away first.  Each tracked
+	 * bio holds one more until it completes.
+	 */
+	atomic_set(&ig->ref, 1);
+}
+
+static void
+__iolat_grp_fill_dev_details(struct iolat_data *td, struct iolat_grp *ig)
+{
+	struct backing_dev_info *bdi = &td->queue->backing_dev_info;
+	unsigned int major, minor;
+
+	if (!ig || ig->blkg.dev)
+		return;
+
+	/*
+	 * Fill in device details for a group which might not have been
+	 * filled at group creation time as queue was being instantiated
+	 * and driver had not attached a device yet
+	 */
+	if (bdi->dev && dev_name(bdi->dev)) {
+		sscanf(dev_name(bdi->dev), "%u:%u", &major, &minor);
+		ig->blkg.dev = MKDEV(major, minor);
+	}
+}
+
+static void
+iolat_grp_fill_dev_details(struct iolat_data *td, struct iolat_grp *ig)
+{
+	if (!ig || ig->blkg.dev)
+		return;
+
+	spin_lock_irq(td->queue->queue_lock);
+	__iolat_grp_fill_dev_details(td, ig);
+	spin_unlock_irq(td->queue->queue_lock);
+}
+
+/* Should be called with rcu read lock held (needed for blkcg) */
+static void iolat_init_add_grp_lists(struct iolat_data *td,
+			struct iolat_grp *ig, struct blkio_cgroup *blkcg)
+{
+	__iolat_grp_fill_dev_details(td, ig);
+
+	/* Add group onto cgroup list */
+	blkiocg_add_blkio_group(blkcg, &ig->blkg, (void *)td,
+				ig->blkg.dev, BLKIO_POLICY_LATENCY);
+
+	iolat_set_target(td, ig, blkcg_get_lat_target(blkcg, ig->blkg.dev));
+
+	hlist_add_head(&ig->node, &td->grp_list);
+	td->nr_undestroyed_grps++;
+}
+
+/* Should be called without queue lock and outside of rcu period */
+static struct iolat_grp *iolat_alloc_grp(struct iolat_data *td)
+{
+	struct iolat_grp *ig;
+
+	ig = kzalloc_node(sizeof(*ig), GFP_ATOMIC, td->queue->node);
+	if (!ig)
+		return NULL;
+
+	if (blkio_alloc_blkg_stats(&ig->blkg)) {
+		kfree(ig);
+		return NULL;
+	}
+
+	iolat_init_group(ig);
+	return ig;
+}
+
+/* Free a group that never made it onto any list */
+static void iolat_discard_grp(struct iolat_grp *ig)
+{
+	if (!ig)
+		return;
+	free_percpu(ig->blkg.stats_cpu);
+	kfree(ig);
+}
+
+static struct iolat_grp *
+iolat_find_grp(struct iolat_data *td, struct blkio_cgroup *blkcg)
+{
+	struct iolat_grp *ig;
+
+	/* The common case when there are no blkio cgroups */
+	if (blkcg == &blkio_root_cgroup)
+		ig = td->root_grp;
+	else
+		ig = ig_of_blkg(blkiocg_lookup_group(blkcg, td));
+
+	__iolat_grp_fill_dev_details(td, ig);
+	return ig;
+}
+
+/*
+ * Find or allocate the group of the current task.  Called with queue
+ * lock held, which is dropped around the allocation.
+ */
+static struct iolat_grp *iolat_get_grp(struct iolat_data *td)
+{
+	struct iolat_grp *ig, *__ig;
+	struct blkio_cgroup *blkcg;
+	struct request_queue *q = td->queue;
+
+	if (unlikely(blk_queue_dead(q)))
+		return NULL;
+
+	rcu_read_lock();
+	blkcg = task_blkio_cgroup(current);
+	ig = iolat_find_grp(td, blkcg);
+	rcu_read_unlock();
+	if (ig)
+		return ig;
+
+	/*
+	 * Allocation of per cpu stats takes a mutex and can block, so
+	 * drop the queue lock around it.
+	 */
+	spin_unlock_irq(q->queue_lock);
+	ig = iolat_alloc_grp(td);
+	spin_lock_irq(q->queue_lock);
+
+	if (unlikely(blk_queue_dead(q))) {
+		iolat_discard_grp(ig);
+		return NULL;
+	}
+
+	rcu_read_lock();
+	blkcg = task_blkio_cgroup(current);
+
+	/* Someone else may have set the group up meanwhile */
+	__ig = iolat_find_grp(td, blkcg);
+	if (__ig) {
+		iolat_discard_grp(ig);
+		rcu_read_unlock();
+		return __ig;
+	}
+
+	/* Allocation failed, account the bio to the root group */
+	if (!ig) {
+		rcu_read_unlock();
+		return td->root_grp;
+	}
+
+	iolat_init_add_grp_lists(td, ig, blkcg);
+	rcu_read_unlock();
+	return ig;
+}
+
+static void iolat_destroy_grp(struct iolat_data *td, struct iolat_grp *ig)
+{
+	/* Something wrong if we are trying to remove same group twice */
+	BUG_ON(hlist_unhashed(&ig->node));
+
+	hlist_del_init(&ig->node);
+	iolat_set_target(td, ig, 0);
+
+	/* Let anyone still held back go */
+	ig->max_depth = 0;
+	wake_up_all(&ig->wait);
+
+	iolat_put_grp(ig);
+	td->nr_undestroyed_grps--;
+}
+
+static void iolat_release_grps(struct iolat_data *td)
+{
+	struct hlist_node *pos, *n;
+	struct iolat_grp *ig;
+
+	hlist_for_each_entry_safe(ig, pos, n, &td->grp_list, node) {
+		/*
+		 * If cgroup removal path got to blk_group first and removed
+		 * it from cgroup list, then it will take care of destroying
+		 * the group also.
+		 */
+		if (!blkiocg_del_blkio_group(&ig->blkg))
+			iolat_destroy_grp(td, ig);
+	}
+}
+
+/*
+ * The cgroup is going away.  Called under rcu_read_lock(), which keeps
+ * the iolat_data behind "key" valid; see throtl_unlink_blkio_group().
+ */
+static void iolat_unlink_blkio_group(void *key, struct blkio_group *blkg)
+{
+	struct iolat_data *td = key;
+	unsigned long flags;
+
+	spin_lock_irqsave(td->queue->queue_lock, flags);
+	iolat_destroy_grp(td, ig_of_blkg(blkg));
+	spin_unlock_irqrestore(td->queue->queue_lock, flags);
+}
+
+/*
+ * Called under blkcg->lock, which keeps blkg and key valid.  The queue
+ * lock must not be taken here.
+ */
+static void iolat_update_blkio_group_lat_target(void *key,
+			struct blkio_group *blkg, unsigned int lat_usec)
+{
+	iolat_set_target(key, ig_of_blkg(blkg), lat_usec);
+}
+
+static struct blkio_policy_type blkio_policy_iolat = {
+	.ops = {
+		.blkio_unlink_group_fn = iolat_unlink_blkio_group,
+		.blkio_update_group_lat_target_fn =
+					iolat_update_blkio_group_lat_target,
+	},
+	.plid = BLKIO_POLICY_LATENCY,
+};
+
+static void iolat_scale_down(struct iolat_data *td, struct iolat_grp *ig,
+			     unsigned int peak)
+{
+	unsigned int depth;
+
+	/* Idle over the window, it is not what hurt the others */
+	if (!peak)
+		return;
+
+	depth = ig->max_depth ? ig->max_depth : td->queue->nr_requests;
+	depth = max(min(depth, peak) / 2, 1U);
+	if (depth == ig->max_depth)
+		return;
+
+	ig->max_depth = depth;
+	iolat_log_grp(td, ig, "depth=%u peak=%u", depth, peak);
+}
+
+static void iolat_scale_up(struct iolat_data *td, struct iolat_grp *ig)
+{
+	unsigned int depth = ig->max_depth * 2;
+
+	if (depth >= td->queue->nr_requests)
+		depth = 0;
+
+	ig->max_depth = depth;
+	wake_up_all(&ig->wait);
+	iolat_log_grp(td, ig, "depth=%u", depth);
+}
+
+static void iolat_arm_timer(struct iolat_data *td)
+{
+	if (!timer_pending(&td->window_timer))
+		mod_timer(&td->window_timer, jiffies + iolat_window);
+}
+
+static void iolat_window_fn(unsigned long data)
+{
+	struct iolat_data *td = (struct iolat_data *)data;
+	struct request_queue *q = td->queue;
+	struct iolat_grp *ig;
+	struct hlist_node *n;
+	unsigned int missed = 0;
+	unsigned long flags;
+	bool busy = false;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+
+	/* Find the tightest target that was missed */
+	hlist_for_each_entry(ig, n, &td->grp_list, node) {
+		unsigned int target = ACCESS_ONCE(ig->target_usec);
+		unsigned int nr;
+		u64 lat;
+
+		spin_lock(&ig->lock);
+		nr = ig->win_nr;
+		lat = ig->win_lat;
+		ig->win_nr = 0;
+		ig->win_lat = 0;
+		spin_unlock(&ig->lock);
+
+		if (nr || ig->max_depth || atomic_read(&ig->inflight))
+			busy = true;
+		if (!target || !nr)
+			continue;
+
+		iolat_log_grp(td, ig, "target=%u mean=%llu nr=%u", target,
+			      div_u64(lat, nr * NSEC_PER_USEC), nr);
+		if (div_u64(lat, nr) > (u64)target * NSEC_PER_USEC &&
+		    (!missed || target < missed))
+			missed = target;
+	}
+
+	/* Squeeze everyone less deserving, or let all of them recover */
+	hlist_for_each_entry(ig, n, &td->grp_list, node) {
+		unsigned int target = ACCESS_ONCE(ig->target_usec);
+		unsigned int peak = ig->win_peak;
+
+		ig->win_peak = atomic_read(&ig->inflight);
+		if (missed && (!target || target > missed))
+			iolat_scale_down(td, ig, peak);
+		else if (!missed && ig->max_depth)
+			iolat_scale_up(td, ig);
+	}
+
+	if (busy)
+		iolat_arm_timer(td);
+
+	spin_unlock_irqrestore(q->queue_lock, flags);
+}
+
+static bool iolat_may_queue(struct iolat_grp *ig)
+{
+	int depth = ACCESS_ONCE(ig->max_depth);
+	int cur = atomic_read(&ig->inflight);
+
+	if (!depth)
+		depth = INT_MAX;
+
+	for (;;) {
+		int old;
+
+		if (cur >= depth)
+			return false;
+		old = atomic_cmpxchg(&ig->inflight, cur, cur + 1);
+		if (old == cur)
+			return true;
+		cur = old;
+	}
+}
+
+/*
+ * Wait until @ig is below its depth limit and count the bio in flight.
+ *
+ * Never sleep from inside another make_request_fn, where bios admitted
+ * earlier sit on current->bio_list and cannot complete before we return,
+ * nor in a workqueue worker, which submits on behalf of others
+ * (blk-throttle, dm-crypt) and would stall all of them.
+ */
+static void iolat_wait(struct iolat_data *td, struct iolat_grp *ig)
+{
+	DEFINE_WAIT(wait);
+	unsigned int inflight;
+
+	if (iolat_may_queue(ig))
+		goto out;
+
+	if (current->bio_list || (current->flags & PF_WQ_WORKER)) {
+		atomic_inc(&ig->inflight);
+		goto out;
+	}
+
+	for (;;) {
+		prepare_to_wait_exclusive(&ig->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		if (iolat_may_queue(ig))
+			break;
+		iolat_arm_timer(td);
+		io_schedule();
+	}
+	finish_wait(&ig->wait, &wait);
+out:
+	inflight = atomic_read(&ig->inflight);
+	if (inflight > ACCESS_ONCE(ig->win_peak))
+		ig->win_peak = inflight;
+}
+
+static void iolat_end_io(struct bio *bio, int err)
+{
+	struct iolat_bio *ib = bio->bi_private;
+	struct iolat_grp *ig = ib->ig;
+	bool rw = bio_data_dir(bio);
+	u64 now = sched_clock();
+	unsigned long flags;
+	int inflight, depth;
+
+	bio->bi_end_io = ib->end_io;
+	bio->bi_private = ib->private;
+
+	if (ACCESS_ONCE(ig->target_usec) && time_after64(now, ib->issue_time)) {
+		spin_lock_irqsave(&ig->lock, flags);
+		ig->win_nr++;
+		ig->win_lat += now - ib->issue_time;
+		spin_unlock_irqrestore(&ig->lock, flags);
+	}
+	blkiocg_update_completion_stats(&ig->blkg, ib->start_time,
+			ib->issue_time, rw, rw_is_sync(bio->bi_rw));
+
+	inflight = atomic_dec_return(&ig->inflight);
+	depth = ACCESS_ONCE(ig->max_depth);
+	if (waitqueue_active(&ig->wait) && (!depth || inflight < depth))
+		wake_up(&ig->wait);
+
+	mempool_free(ib, iolat_bio_pool);
+	iolat_put_grp(ig);
+
+	bio_endio(bio, err);
+}
+
+/**
+ * blk_iolat_bio - apply cgroup latency targets to a bio
+ * @q: the queue the bio is for
+ * @bio: the bio
+ *
+ * Nothing is done unless some group has a target on @q.  Otherwise the
+ * bio may wait for its group to get below its depth limit, and its
+ * completion is hooked to sample the latency.
+ */
+void blk_iolat_bio(struct request_queue *q, struct bio *bio)
+{
+	struct iolat_data *td = q->iolat;
+	struct blkio_cgroup *blkcg;
+	struct iolat_grp *ig;
+	struct iolat_bio *ib;
+	bool rw = bio_data_dir(bio);
+	u64 start;
+
+	if (!bio->bi_size || (bio->bi_rw & REQ_DISCARD))
+		return;
+
+	rcu_read_lock();
+	blkcg = task_blkio_cgroup(current);
+	ig = iolat_find_grp(td, blkcg);
+	if (ig) {
+		iolat_grp_fill_dev_details(td, ig);
+		/* A group found under rcu may be on its way out */
+		if (!atomic_read(&td->nr_targets) ||
+		    !atomic_inc_not_zero(&ig->ref)) {
+			rcu_read_unlock();
+			return;
+		}
+	}
+	rcu_read_unlock();
+
+	if (!ig) {
+		spin_lock_irq(q->queue_lock);
+		ig = iolat_get_grp(td);
+		if (ig)
+			atomic_inc(&ig->ref);
+		spin_unlock_irq(q->queue_lock);
+		if (unlikely(!ig))
+			return;
+		if (!atomic_read(&td->nr_targets)) {
+			iolat_put_grp(ig);
+			return;
+		}
+	}
+
+	start = sched_clock();
+	iolat_wait(td, ig);
+	blkiocg_update_dispatch_stats(&ig->blkg, bio->bi_size, rw,
+				      rw_is_sync(bio->bi_rw));
+
+	ib = mempool_alloc(iolat_bio_pool, GFP_NOIO);
+	ib->end_io = bio->bi_end_io;
+	ib->private = bio->bi_private;
+	ib->ig = ig;
+	ib->start_time = start;
+	ib->issue_time = sched_clock();
+
+	bio->bi_end_io = iolat_end_io;
+	bio->bi_private = ib;
+
+	iolat_arm_timer(td);
+}
+
+int blk_iolat_init(struct request_queue *q)
+{
+	struct iolat_data *td;
+	struct iolat_grp *ig;
+
+	td = kzalloc_node(sizeof(*td), GFP_KERNEL, q->node);
+	if (!td)
+		return -ENOMEM;
+
+	INIT_HLIST_HEAD(&td->grp_list);
+	atomic_set(&td->nr_targets, 0);
+	setup_timer(&td->window_timer, iolat_window_fn, (unsigned long)td);
+
+	/* alloc and init root group */
+	td->queue = q;
+	ig = iolat_alloc_grp(td);
+	if (!ig) {
+		kfree(td);
+		return -ENOMEM;
+	}
+	td->root_grp = ig;
+
+	rcu_read_lock();
+	iolat_init_add_grp_lists(td, ig, &blkio_root_cgroup);
+	rcu_read_unlock();
+
+	q->iolat = td;
+	return 0;
+}
+
+void blk_iolat_exit(struct request_queue *q)
+{
+	struct iolat_data *td = q->iolat;
+	bool wait = false;
+
+	BUG_ON(!td);
+
+	del_timer_sync(&td->window_timer);
+
+	spin_lock_irq(q->queue_lock);
+	iolat_release_grps(td);
+
+	/* If there are other groups */
+	if (td->nr_undestroyed_grps > 0)
+		wait = true;
+
+	spin_unlock_irq(q->queue_lock);
+
+	/*
+	 * Wait for ig->blkg->key accessors to exit their grace periods,
+	 * but only if the cgroup side still holds groups; see
+	 * blk_throtl_exit() for why not unconditionally.
+	 */
+	if (wait)
+		synchronize_rcu();
+
+	del_timer_sync(&td->window_timer);
+}
+
+void blk_iolat_release(struct request_queue *q)
+{
+	kfree(q->iolat);
+}
+
+static int __init iolat_init(void)
+{
+	iolat_bio_cache = KMEM_CACHE(iolat_bio, 0);
+	if (!iolat_bio_cache)
+		panic("Failed to create iolat_bio cache\n");
+
+	iolat_bio_pool = mempool_create_slab_pool(BIO_POOL_SIZE,
+						  iolat_bio_cache);
+	if (!iolat_bio_pool)
+		panic("Failed to create iolat_bio pool\n");
+
+	blkio_policy_register(&blkio_policy_iolat);
+	return 0;
+}
+
+module_init(iolat_init);
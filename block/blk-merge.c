@@ -225,6 +225,20 @@ no_merge:
 	return 0;
 }
 
+/*
+ * Would appending @next to @prev leave a gap the device cannot describe?
+ * See bvec_gap_to_prev().
+ */
+static bool bio_will_gap(struct request_queue *q, struct bio *prev,
+			 struct bio *next)
+{
+	if (!queue_virt_boundary(q) || !prev->bi_vcnt || !next->bi_vcnt)
+		return false;
+
+	return bvec_gap_to_prev(q, bio_iovec_idx(prev, prev->bi_vcnt - 1),
+				bio_iovec(next)->bv_offset);
+}
+
 int ll_back_merge_fn(struct request_queue *q, struct request *req,
 		     struct bio *bio)
 {
@@ -241,6 +255,8 @@ int ll_back_merge_fn(struct request_queue *q, struct request *req,
 			q->last_merge = NULL;
 		return 0;
 	}
+	if (bio_will_gap(q, req->biotail, bio))
+		return 0;
 	if (!bio_flagged(req->biotail, BIO_SEG_VALID))
 		blk_recount_segments(q, req->biotail);
 	if (!bio_flagged(bio, BIO_SEG_VALID))
@@ -266,6 +282,8 @@ int ll_front_merge_fn(struct request_queue *q, struct request *req,
 			q->last_merge = NULL;
 		return 0;
 	}
+	if (bio_will_gap(q, bio, req->bio))
+		return 0;
 	if (!bio_flagged(bio, BIO_SEG_VALID))
 		blk_recount_segments(q, bio);
 	if (!bio_flagged(req->bio, BIO_SEG_VALID))
@@ -294,6 +312,9 @@ static int ll_merge_requests_fn(struct request_queue *q, struct request *req,
 	if ((blk_rq_sectors(req) + blk_rq_sectors(next)) > queue_max_sectors(q))
 		return 0;
 
+	if (bio_will_gap(q, req->biotail, next->bio))
+		return 0;
+
 	total_phys_segments = req->nr_phys_segments + next->nr_phys_segments;
 	if (blk_phys_contig_segment(q, req->biotail, next->bio)) {
 		if (req->nr_phys_segments == 1)
@@ -393,6 +414,9 @@ static int attempt_merge(struct request_queue *q, struct request *req,
 	    || next->special)
 		return 0;
 
+	if (!elv_allow_rq_merge(q, req, next))
+		return 0;
+
 	/*
 	 * If we are allowed to merge, then append bio list
 	 * from next to rq and release next. merge_requests_fn
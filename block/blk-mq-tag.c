@@ -0,0 +1,120 @@
+/*
+ * Tag allocation for the multi-queue block layer
+ *
+ * Every hardware queue owns a fixed set of tags, each backed by a request
+ * allocated up front.  A tag is a bit in a plain bitmap; each software
+ * queue remembers where it found its last tag, so CPUs sharing a hardware
+ * queue tend to work in different parts of the map.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/blkdev.h>
+
+#include <linux/blk-mq.h>
+#include "blk-mq.h"
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags,
+				     unsigned int cmd_size, int node)
+{
+	struct blk_mq_tags *tags;
+	unsigned int i;
+
+	tags = kzalloc_node(sizeof(*tags), GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	tags->nr_tags = nr_tags;
+	init_waitqueue_head(&tags->wait);
+	tags->bitmap = kzalloc_node(BITS_TO_LONGS(nr_tags) * sizeof(long),
+				    GFP_KERNEL, node);
+	tags->rqs = kzalloc_node(nr_tags * sizeof(struct request *),
+				 GFP_KERNEL, node);
+	if (!tags->bitmap || !tags->rqs)
+		goto fail;
+
+	for (i = 0; i < nr_tags; i++) {
+		tags->rqs[i] = kzalloc_node(sizeof(struct request) + cmd_size,
+					    GFP_KERNEL, node);
+		if (!tags->rqs[i])
+			goto fail;
+	}
+
+	return tags;
+
+fail:
+	blk_mq_free_tags(tags);
+	return NULL;
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	unsigned int i;
+
+	if (tags->rqs)
+		for (i = 0; i < tags->nr_tags; i++)
+			kfree(tags->rqs[i]);
+	kfree(tags->rqs);
+	kfree(tags->bitmap);
+	kfree(tags);
+}
+
+/*
+ * Grab a free tag, starting the search at *@hint.  Returns -1 if all
+ * tags are in use.  Never sleeps.
+ */
+int blk_mq_get_tag(struct blk_mq_tags *tags, unsigned int *hint)
+{
+	unsigned int start = *hint, tag;
+
+	if (start >= tags->nr_tags)
+		start = 0;
+
+	tag = start;
+	do {
+		tag = find_next_zero_bit(tags->bitmap, tags->nr_tags, tag);
+		if (tag >= tags->nr_tags) {
+			if (!start)
+				return -1;
+			/* Wrap around once and search up to the hint. */
+			tag = find_first_zero_bit(tags->bitmap, start);
+			if (tag >= start)
+				return -1;
+		}
+	} while (test_and_set_bit(tag, tags->bitmap));
+
+	*hint = tag + 1;
+	return tag;
+}
+
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	BUG_ON(tag >= tags->nr_tags);
+
+	clear_bit(tag, tags->bitmap);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&tags->wait))
+		wake_up(&tags->wait);
+}
+
+/*
+ * Sleep until a tag may be free.  The caller retries blk_mq_get_tag()
+ * afterwards; another waiter may have beaten it to the tag.
+ */
+void blk_mq_wait_for_tags(struct blk_mq_tags *tags)
+{
+	DEFINE_WAIT(wait);
+
+	prepare_to_wait_exclusive(&tags->wait, &wait, TASK_UNINTERRUPTIBLE);
+	if (find_first_zero_bit(tags->bitmap, tags->nr_tags) >= tags->nr_tags)
+		io_schedule();
+	finish_wait(&tags->wait, &wait);
+}
+
+unsigned int blk_mq_tags_busy(struct blk_mq_tags *tags)
+{
+	return bitmap_weight(tags->bitmap, tags->nr_tags);
+}
@@ -0,0 +1,1133 @@
+/*
+ * Multi-queue block layer
+ *
+ * Requests come from a fixed set of tags per hardware queue and are queued
+ * on a per-cpu software queue (struct blk_mq_ctx).  Running a hardware
+ * queue hands everything pending on its software queues to the driver
+ * through ->queue_rq().  There is no queue_lock and no elevator on this
+ * path: the software queue lock is shared only by the submitting CPU and
+ * whoever runs the queue, and the hardware queue lock only protects
+ * requests the driver could not take yet.
+ *
+ * Completions are sent back to the submitting CPU with an IPI, unless the
+ * completing CPU shares a cache with it.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/writeback.h>
+#include <linux/smp.h>
+#include <linux/list_sort.h>
+#include <linux/cpu.h>
+#include <linux/cache.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/completion.h>
+#include <linux/percpu.h>
+#include <linux/hrtimer.h>
+
+#include <trace/events/block.h>
+
+#include <linux/blk-mq.h>
+#include "blk.h"
+#include "blk-mq.h"
+
+/* How long to wait before retrying a queue the driver said was busy. */
+#define BLK_MQ_BUSY_DELAY	msecs_to_jiffies(3)
+
+static DEFINE_MUTEX(all_q_mutex);
+static LIST_HEAD(all_q_list);
+
+static struct blk_mq_ctx *blk_mq_get_ctx(struct request_queue *q)
+{
+	return per_cpu_ptr(q->queue_ctx, get_cpu());
+}
+
+static void blk_mq_put_ctx(struct blk_mq_ctx *ctx)
+{
+	put_cpu();
+}
+
+/**
+ * blk_mq_map_queue - default CPU to hardware queue mapping
+ * @q:		the queue
+ * @cpu:	the submitting CPU
+ *
+ * Uses the map set up by blk_mq_init_queue(), which spreads the CPUs
+ * evenly over the hardware queues.
+ */
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static struct blk_mq_hw_ctx *blk_mq_ctx_to_hctx(struct blk_mq_ctx *ctx)
+{
+	struct request_queue *q = ctx->queue;
+
+	return q->mq_ops->map_queue(q, ctx->cpu);
+}
+
+/*
+ * Flag @ctx as having requests for @hctx.  Called with ctx->lock held.
+ */
+static void blk_mq_hctx_mark_pending(struct blk_mq_hw_ctx *hctx,
+				     struct blk_mq_ctx *ctx)
+{
+	if (!test_bit(ctx->index_hw, hctx->ctx_map))
+		set_bit(ctx->index_hw, hctx->ctx_map);
+}
+
+static struct request *__blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx,
+					      struct blk_mq_ctx *ctx, int rw)
+{
+	struct request *rq;
+	int tag;
+
+	tag = blk_mq_get_tag(hctx->tags, &ctx->tag_hint);
+	if (tag < 0)
+		return NULL;
+
+	rq = hctx->tags->rqs[tag];
+	blk_rq_init(hctx->queue, rq);
+	rq->mq_ctx = ctx;
+	rq->tag = tag;
+	rq->cmd_flags = rw;
+	if (blk_queue_io_stat(hctx->queue))
+		rq->cmd_flags |= REQ_IO_STAT;
+
+	return rq;
+}
+
+static struct request *blk_mq_get_request(struct request_queue *q, int rw,
+					  gfp_t gfp)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	if (unlikely(blk_queue_dead(q)))
+		return NULL;
+
+	for (;;) {
+		ctx = blk_mq_get_ctx(q);
+		hctx = q->mq_ops->map_queue(q, ctx->cpu);
+		rq = __blk_mq_alloc_request(hctx, ctx, rw);
+		blk_mq_put_ctx(ctx);
+
+		if (rq || !(gfp & __GFP_WAIT))
+			return rq;
+
+		blk_mq_wait_for_tags(hctx->tags);
+		if (unlikely(blk_queue_dead(q)))
+			return NULL;
+	}
+}
+
+/**
+ * blk_mq_alloc_request - allocate a request for a driver private command
+ * @q:		the queue
+ * @rw:		READ or WRITE, plus any REQ_* flags
+ * @gfp:	whether to wait for a free tag (__GFP_WAIT) or fail
+ *
+ * Returns %NULL if @q is dead, or if no tag is free and @gfp does not
+ * allow sleeping.  Release the request with blk_mq_free_request() or
+ * blk_put_request().
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp)
+{
+	return blk_mq_get_request(q, rw, gfp);
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+/**
+ * blk_mq_free_request - give a request and its tag back
+ * @rq:		the request
+ */
+void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_hw_ctx *hctx = blk_mq_ctx_to_hctx(rq->mq_ctx);
+
+	rq->cmd_flags = 0;
+	blk_mq_put_tag(hctx->tags, rq->tag);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+/*
+ * Keep a running average of how long polled requests take, for sizing
+ * the sleep in blk_mq_poll_hybrid_sleep().  Lost updates between CPUs
+ * only skew the estimate a little.
+ */
+static void blk_mq_poll_account(struct request *rq)
+{
+	unsigned long *mean = &rq->q->poll_mean_nsec[rq_data_dir(rq)];
+	u64 lat = ktime_to_ns(ktime_get()) - rq->issue_time_ns;
+
+	if (!*mean)
+		*mean = lat;
+	else
+		*mean = *mean - (*mean >> 3) + (lat >> 3);
+}
+
+/**
+ * blk_mq_end_io - end a request entirely
+ * @rq:		the request, as passed to ->queue_rq()
+ * @error:	%0 for success, < %0 for error
+ *
+ * Completes every bio in @rq, accounts it and frees it, or hands it to
+ * rq->end_io for requests issued through blk_execute_rq().
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (rq->issue_time_ns && blk_queue_poll(rq->q))
+		blk_mq_poll_account(rq);
+
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	if (unlikely(laptop_mode) && rq->cmd_type == REQ_TYPE_FS)
+		laptop_io_completion(&rq->q->backing_dev_info);
+
+	/* before wbt_done(), which clears issue_time_ns */
+	blk_account_io_done(rq);
+	wbt_done(rq->q->rq_wb, rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void __blk_mq_complete_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	if (q->softirq_done_fn)
+		q->softirq_done_fn(rq);
+	else
+		blk_mq_end_io(rq, rq->errors);
+}
+
+#if defined(CONFIG_SMP) && defined(CONFIG_USE_GENERIC_SMP_HELPERS)
+static void blk_mq_complete_request_remote(void *data)
+{
+	__blk_mq_complete_request(data);
+}
+
+/*
+ * Send the completion to the CPU @rq was submitted from, if that CPU does
+ * not share a cache with us.  Called with preemption disabled.
+ */
+static bool blk_mq_complete_remote(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	int cpu = smp_processor_id(), submit_cpu = rq->mq_ctx->cpu;
+
+	if (!test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
+	    cpu == submit_cpu || !cpu_online(submit_cpu))
+		return false;
+	if (!test_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags) &&
+	    cpus_share_cache(cpu, submit_cpu))
+		return false;
+
+	rq->csd.func = blk_mq_complete_request_remote;
+	rq->csd.info = rq;
+	rq->csd.flags = 0;
+	__smp_call_function_single(submit_cpu, &rq->csd, 0);
+	return true;
+}
+#else
+static bool blk_mq_complete_remote(struct request *rq)
+{
+	return false;
+}
+#endif
+
+/**
+ * blk_mq_complete_request - end I/O on a request
+ * @rq:		the request being processed
+ *
+ * Called by the driver when the hardware is done with @rq, from any
+ * context.  ->complete() then runs for @rq, on the submitting CPU if the
+ * queue asks for same-CPU completion.
+ */
+void blk_mq_complete_request(struct request *rq)
+{
+	preempt_disable();
+	if (!blk_mq_complete_remote(rq))
+		__blk_mq_complete_request(rq);
+	preempt_enable();
+}
+EXPORT_SYMBOL(blk_mq_complete_request);
+
+/*
+ * Called with ctx->lock held.
+ */
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct request *rq, bool at_head)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+
+	trace_block_rq_insert(hctx->queue, rq);
+
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	blk_mq_hctx_mark_pending(hctx, ctx);
+}
+
+static void blk_mq_queue_request(struct request *rq, bool at_head,
+				 bool run_queue, bool async)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct blk_mq_hw_ctx *hctx = blk_mq_ctx_to_hctx(ctx);
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	__blk_mq_insert_request(hctx, rq, at_head);
+	spin_unlock_irqrestore(&ctx->lock, flags);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, async);
+}
+
+/**
+ * blk_mq_insert_request - queue a prepared request
+ * @q:		the queue
+ * @rq:		request from blk_mq_alloc_request()
+ * @at_head:	queue @rq ahead of everything else on its software queue
+ * @run_queue:	run the hardware queue afterwards
+ */
+void blk_mq_insert_request(struct request_queue *q, struct request *rq,
+			   bool at_head, bool run_queue)
+{
+	blk_mq_queue_request(rq, at_head, run_queue, false);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+static void blk_mq_kick_hw_queue(struct blk_mq_hw_ctx *hctx,
+				 unsigned long delay)
+{
+	int cpu = raw_smp_processor_id();
+
+	if (!cpumask_test_cpu(cpu, hctx->cpumask))
+		cpu = cpumask_first_and(hctx->cpumask, cpu_online_mask);
+
+	if (cpu < nr_cpu_ids)
+		kblockd_schedule_delayed_work_on(cpu, &hctx->run_work, delay);
+	else
+		kblockd_schedule_delayed_work(hctx->queue, &hctx->run_work,
+					      delay);
+}
+
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, ret;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	/* Requests the driver bounced last time go first. */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock_irq(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock_irq(&hctx->lock);
+	}
+
+	/*
+	 * The bit is cleared before the list is emptied; a submitter adding
+	 * a request meanwhile sets it again under ctx->lock.
+	 */
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		clear_bit(bit, hctx->ctx_map);
+		ctx = hctx->ctxs[bit];
+		spin_lock_irq(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock_irq(&ctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		trace_block_rq_issue(q, rq);
+		if (blk_queue_poll(q))
+			rq->issue_time_ns = ktime_to_ns(ktime_get());
+		wbt_issue(q->rq_wb, rq);
+		blk_io_hist_issue(rq);
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK)
+			continue;
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			trace_block_rq_requeue(q, rq);
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+
+		if (ret != BLK_MQ_RQ_QUEUE_ERROR)
+			pr_err("blk-mq: bad return on queue: %d\n", ret);
+		rq->errors = -EIO;
+		blk_mq_end_io(rq, rq->errors);
+	}
+
+	if (list_empty(&rq_list))
+		return;
+
+	spin_lock_irq(&hctx->lock);
+	list_splice(&rq_list, &hctx->dispatch);
+	spin_unlock_irq(&hctx->lock);
+
+	/*
+	 * A driver that stopped the queue restarts it once it has room
+	 * again.  Pairs with the barrier in blk_mq_start_hw_queue(): either
+	 * the restart finds our requests on ->dispatch, or we see the queue
+	 * running and retry ourselves.
+	 */
+	smp_mb();
+	if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+		blk_mq_kick_hw_queue(hctx, BLK_MQ_BUSY_DELAY);
+}
+
+/**
+ * blk_mq_run_hw_queue - send pending requests to the driver
+ * @hctx:	the hardware queue
+ * @async:	leave the work to kblockd
+ *
+ * The queue runs right away if the current CPU maps to @hctx and the
+ * caller is in process context with interrupts on; otherwise kblockd
+ * runs it on one of the CPUs that map to it.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	int cpu;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (!async && !in_interrupt() && !irqs_disabled()) {
+		cpu = get_cpu();
+		if (cpumask_test_cpu(cpu, hctx->cpumask)) {
+			__blk_mq_run_hw_queue(hctx);
+			put_cpu();
+			return;
+		}
+		put_cpu();
+	}
+
+	blk_mq_kick_hw_queue(hctx, 0);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work.work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_stop_hw_queue - stop feeding requests to the driver
+ * @hctx:	the hardware queue
+ *
+ * Typically called from ->queue_rq() when the hardware is full, before
+ * returning %BLK_MQ_RQ_QUEUE_BUSY.  Safe from any context.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	__cancel_delayed_work(&hctx->run_work);
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+	smp_mb__after_clear_bit();
+	blk_mq_run_hw_queue(hctx, false);
+}
+EXPORT_SYMBOL(blk_mq_start_hw_queue);
+
+void blk_mq_stop_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_stop_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queues);
+
+/**
+ * blk_mq_start_stopped_hw_queues - restart stopped hardware queues
+ * @q:		the queue
+ * @async:	run the restarted queues from kblockd
+ *
+ * Usually called from the completion path once the hardware has room
+ * again, which needs @async set when in interrupt context.
+ */
+void blk_mq_start_stopped_hw_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_flush_plug_queue(struct blk_plug *plug, struct request *rq);
+
+/*
+ * Turn @bio into a request and queue it.  If @use_plug is set and the
+ * task has a plug, the request waits there until the plug is flushed.
+ */
+static void blk_mq_queue_bio(struct request_queue *q, struct bio *bio,
+			     bool use_plug)
+{
+	struct blk_plug *plug = use_plug ? current->plug : NULL;
+	struct request *rq, *same_queue_rq = NULL;
+	unsigned int request_count = 0;
+	bool wb_acct;
+	int rw_flags;
+
+	if (plug && !blk_queue_nomerges(q) &&
+	    blk_attempt_plug_merge(q, bio, &request_count, &same_queue_rq))
+		return;
+
+	rw_flags = bio_data_dir(bio);
+	if (rw_is_sync(bio->bi_rw))
+		rw_flags |= REQ_SYNC;
+
+	wb_acct = wbt_wait(q->rq_wb, bio, NULL);
+
+	rq = blk_mq_get_request(q, rw_flags, GFP_NOIO);
+	if (unlikely(!rq)) {
+		if (wb_acct)
+			wbt_cancel(q->rq_wb);
+		bio_endio(bio, -ENODEV);	/* @q is dead */
+		return;
+	}
+	trace_block_getrq(q, bio, rw_flags & 1);
+
+	init_request_from_bio(rq, bio);
+	if (wb_acct)
+		rq->cmd_flags |= REQ_WB_TRACKED;
+	drive_stat_acct(rq, 1);
+	bio->bi_cookie = blk_tag_to_qc_t(rq->tag,
+				blk_mq_ctx_to_hctx(rq->mq_ctx)->queue_num);
+
+	if (plug) {
+		/* keep the plugged list grouped by queue, see blk-core */
+		if (list_empty(&plug->mq_list)) {
+			same_queue_rq = NULL;
+			trace_block_plug(q);
+		} else if (request_count >= BLK_MAX_REQUEST_COUNT) {
+			blk_mq_flush_plug_queue(plug, same_queue_rq);
+			same_queue_rq = NULL;
+			trace_block_plug(q);
+		}
+		if (same_queue_rq)
+			list_add(&rq->queuelist, &same_queue_rq->queuelist);
+		else
+			list_add_tail(&rq->queuelist, &plug->mq_list);
+		return;
+	}
+
+	/* Let kblockd batch up async writes, issue sync I/O right away. */
+	blk_mq_queue_request(rq, false, true, !(rw_flags & REQ_SYNC));
+}
+
+struct blk_mq_flush_wait {
+	struct completion	done;
+	int			error;
+};
+
+static void blk_mq_flush_end_io(struct request *rq, int error)
+{
+	struct blk_mq_flush_wait *wait = rq->end_io_data;
+
+	wait->error = error;
+	blk_mq_free_request(rq);
+	complete(&wait->done);
+}
+
+/*
+ * Issue an empty cache flush to the device and wait for it.
+ */
+static int blk_mq_issue_flush(struct request_queue *q)
+{
+	struct blk_mq_flush_wait wait;
+	struct request *rq;
+
+	rq = blk_mq_get_request(q, WRITE_FLUSH, GFP_NOIO);
+	if (unlikely(!rq))
+		return -ENODEV;
+
+	rq->cmd_type = REQ_TYPE_FS;
+	init_completion(&wait.done);
+	rq->end_io = blk_mq_flush_end_io;
+	rq->end_io_data = &wait;
+	blk_mq_insert_request(q, rq, false, true);
+	wait_for_completion(&wait.done);
+
+	return wait.error;
+}
+
+static void blk_mq_fua_end_io(struct bio *bio, int error)
+{
+	struct blk_mq_flush_wait *wait = bio->bi_private;
+
+	wait->error = error;
+	complete(&wait->done);
+}
+
+/*
+ * Sequence a REQ_FLUSH/REQ_FUA bio.  Drivers only ever see empty flushes
+ * and, if they advertise it, FUA writes; a flush ahead of data is issued
+ * and waited for first, and FUA on a device without it becomes a write
+ * followed by a flush.  Doing this synchronously keeps the fast path free
+ * of flush state; such bios are rare and their submitters wait for them
+ * anyway.
+ */
+static void blk_mq_flush_bio(struct request_queue *q, struct bio *bio)
+{
+	struct blk_mq_flush_wait wait;
+	bio_end_io_t *end_io;
+	void *private;
+	int error;
+
+	if (!bio->bi_size) {
+		if (bio->bi_rw & REQ_FLUSH) {
+			bio->bi_rw &= ~REQ_FUA;
+			blk_mq_queue_bio(q, bio, false);
+		} else
+			bio_endio(bio, 0);
+		return;
+	}
+
+	if (bio->bi_rw & REQ_FLUSH) {
+		error = blk_mq_issue_flush(q);
+		if (error) {
+			bio_endio(bio, error);
+			return;
+		}
+		bio->bi_rw &= ~REQ_FLUSH;
+	}
+
+	if (!(bio->bi_rw & REQ_FUA) || (q->flush_flags & REQ_FUA)) {
+		blk_mq_queue_bio(q, bio, false);
+		return;
+	}
+
+	bio->bi_rw &= ~REQ_FUA;
+	init_completion(&wait.done);
+	end_io = bio->bi_end_io;
+	private = bio->bi_private;
+	bio->bi_end_io = blk_mq_fua_end_io;
+	bio->bi_private = &wait;
+
+	blk_mq_queue_bio(q, bio, false);
+	wait_for_completion(&wait.done);
+
+	bio->bi_end_io = end_io;
+	bio->bi_private = private;
+
+	error = wait.error;
+	if (!error)
+		error = blk_mq_issue_flush(q);
+	bio_endio(bio, error);
+}
+
+static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	blk_queue_bounce(q, &bio);
+
+	if (unlikely(bio->bi_rw & (REQ_FLUSH | REQ_FUA))) {
+		blk_mq_flush_bio(q, bio);
+		return;
+	}
+
+	blk_mq_queue_bio(q, bio, true);
+}
+
+static int plug_ctx_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	struct request *rqa = container_of(a, struct request, queuelist);
+	struct request *rqb = container_of(b, struct request, queuelist);
+
+	return !(rqa->mq_ctx < rqb->mq_ctx ||
+		 (rqa->mq_ctx == rqb->mq_ctx &&
+		  blk_rq_pos(rqa) < blk_rq_pos(rqb)));
+}
+
+static void blk_mq_insert_requests(struct blk_mq_ctx *ctx,
+				   struct list_head *list, unsigned int depth,
+				   bool from_schedule)
+{
+	struct blk_mq_hw_ctx *hctx = blk_mq_ctx_to_hctx(ctx);
+	struct request *rq;
+	unsigned long flags;
+
+	trace_block_unplug(ctx->queue, depth, !from_schedule);
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	while (!list_empty(list)) {
+		rq = list_first_entry(list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+		__blk_mq_insert_request(hctx, rq, false);
+	}
+	spin_unlock_irqrestore(&ctx->lock, flags);
+
+	blk_mq_run_hw_queue(hctx, from_schedule);
+}
+
+/*
+ * Move plugged requests to their software queues, one batch per software
+ * queue, and run the hardware queues behind them.
+ */
+static void blk_mq_insert_plugged(struct list_head *list, bool from_schedule)
+{
+	struct blk_mq_ctx *this_ctx = NULL;
+	unsigned int depth = 0;
+	struct request *rq;
+	LIST_HEAD(ctx_list);
+
+	list_sort(NULL, list, plug_ctx_cmp);
+
+	while (!list_empty(list)) {
+		rq = list_entry_rq(list->next);
+		list_del_init(&rq->queuelist);
+		if (rq->mq_ctx != this_ctx) {
+			if (this_ctx)
+				blk_mq_insert_requests(this_ctx, &ctx_list,
+						       depth, from_schedule);
+			this_ctx = rq->mq_ctx;
+			depth = 0;
+		}
+		depth++;
+		list_add_tail(&rq->queuelist, &ctx_list);
+	}
+
+	if (this_ctx)
+		blk_mq_insert_requests(this_ctx, &ctx_list, depth,
+				       from_schedule);
+}
+
+/*
+ * Send down only the requests plugged for one queue, the group ending
+ * at @rq, once that queue has a full batch.
+ */
+static void blk_mq_flush_plug_queue(struct blk_plug *plug, struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct request *prev;
+	LIST_HEAD(list);
+
+	while (&rq->queuelist != &plug->mq_list && rq->q == q) {
+		prev = list_entry_rq(rq->queuelist.prev);
+		list_move(&rq->queuelist, &list);
+		rq = prev;
+	}
+	blk_mq_insert_plugged(&list, false);
+}
+
+/* Send down everything plugged for multi-queue devices */
+void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule)
+{
+	LIST_HEAD(list);
+
+	list_splice_init(&plug->mq_list, &list);
+	blk_mq_insert_plugged(&list, from_schedule);
+}
+
+/*
+ * Hybrid polling: rather than spin for the whole time a request is on the
+ * device, sleep until it has been there for half the mean completion time
+ * (or the fixed poll_nsec), then spin.  Returns true if it slept; the
+ * caller checks for completion and polls again.
+ */
+static bool blk_mq_poll_hybrid_sleep(struct request_queue *q,
+				     struct blk_mq_hw_ctx *hctx,
+				     struct request *rq)
+{
+	struct hrtimer_sleeper hs;
+	u64 issued, now, nsecs;
+
+	issued = ACCESS_ONCE(rq->issue_time_ns);
+	if (q->poll_nsec < 0 || !issued)
+		return false;
+
+	if (q->poll_nsec > 0)
+		nsecs = q->poll_nsec;
+	else
+		nsecs = q->poll_mean_nsec[rq_data_dir(rq)] / 2;
+
+	now = ktime_to_ns(ktime_get());
+	if (now - issued >= nsecs)
+		return false;
+	nsecs -= now - issued;
+
+	/*
+	 * The caller set our task state before checking for completion,
+	 * and the completion wakes us, so nothing is lost if it comes first.
+	 */
+	hrtimer_init_on_stack(&hs.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_init_sleeper(&hs, current);
+	hrtimer_start(&hs.timer, ns_to_ktime(nsecs), HRTIMER_MODE_REL);
+	if (hs.task)
+		io_schedule();
+	hrtimer_cancel(&hs.timer);
+	destroy_hrtimer_on_stack(&hs.timer);
+	__set_current_state(TASK_RUNNING);
+
+	hctx->poll_sleeps++;
+	hctx->poll_sleep_nsec += ktime_to_ns(ktime_get()) - now;
+	return true;
+}
+
+/**
+ * blk_poll - poll for the completion of a request
+ * @q:		the queue the request went to
+ * @cookie:	bio->bi_cookie of a bio in the request
+ *
+ * Called by a task waiting for I/O it just submitted, with its state
+ * already set for sleeping.  Spins on the driver's completion queue,
+ * after a nap for hybrid polling, until something completes, the task
+ * is woken or should reschedule, or the request takes much longer than
+ * usual.
+ *
+ * Returns true if the caller should check for its completion again,
+ * false if it should go to sleep and wait for the interrupt.
+ */
+bool blk_poll(struct request_queue *q, blk_qc_t cookie)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_plug *plug;
+	struct request *rq;
+	u64 deadline = 0;
+	unsigned int tag;
+	long state;
+
+	if (!q->mq_ops || !q->mq_ops->poll || !blk_queue_poll(q) ||
+	    !blk_qc_t_valid(cookie) ||
+	    blk_qc_t_to_queue_num(cookie) >= q->nr_hw_queues)
+		return false;
+
+	hctx = q->queue_hw_ctx[blk_qc_t_to_queue_num(cookie)];
+	tag = blk_qc_t_to_tag(cookie);
+	if (tag >= hctx->tags->nr_tags)
+		return false;
+	rq = hctx->tags->rqs[tag];
+
+	plug = current->plug;
+	if (plug)
+		blk_flush_plug_list(plug, false);
+
+	if (blk_mq_poll_hybrid_sleep(q, hctx, rq))
+		return true;
+
+	/* Give up on outliers and let the interrupt handle them. */
+	if (!q->poll_nsec && q->poll_mean_nsec[rq_data_dir(rq)] &&
+	    rq->issue_time_ns)
+		deadline = rq->issue_time_ns +
+			   4 * q->poll_mean_nsec[rq_data_dir(rq)];
+
+	hctx->poll_invoked++;
+	state = current->state;
+	while (!need_resched()) {
+		int ret = q->mq_ops->poll(hctx);
+
+		if (ret > 0) {
+			hctx->poll_success++;
+			set_current_state(TASK_RUNNING);
+			return true;
+		}
+		if (signal_pending_state(state, current))
+			set_current_state(TASK_RUNNING);
+		if (current->state == TASK_RUNNING)
+			return true;
+		if (ret < 0)
+			break;
+		if (deadline && ktime_to_ns(ktime_get()) > deadline)
+			break;
+		cpu_relax();
+	}
+
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
+/*
+ * Wait for every request on @q to be handed back, kicking the hardware
+ * queues meanwhile.  The caller has marked @q dead.
+ */
+void blk_mq_drain_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int busy;
+	int i;
+
+	while (true) {
+		busy = 0;
+		queue_for_each_hw_ctx(q, hctx, i) {
+			blk_mq_run_hw_queue(hctx, false);
+			busy += blk_mq_tags_busy(hctx->tags);
+		}
+		if (!busy)
+			break;
+		msleep(10);
+	}
+}
+
+void blk_mq_sync_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		cancel_delayed_work_sync(&hctx->run_work);
+}
+
+static void blk_mq_free_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!hctx)
+			continue;
+		cancel_delayed_work_sync(&hctx->run_work);
+		if (hctx->tags)
+			blk_mq_free_tags(hctx->tags);
+		kfree(hctx->ctx_map);
+		kfree(hctx->ctxs);
+		free_cpumask_var(hctx->cpumask);
+		kfree(hctx);
+	}
+	kfree(q->queue_hw_ctx);
+	q->queue_hw_ctx = NULL;
+	q->nr_hw_queues = 0;
+}
+
+/*
+ * Called from blk_release_queue() once the last reference is gone.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	mutex_lock(&all_q_mutex);
+	list_del_init(&q->all_q_node);
+	mutex_unlock(&all_q_mutex);
+
+	blk_mq_free_hw_queues(q);
+	free_percpu(q->queue_ctx);
+	q->queue_ctx = NULL;
+	kfree(q->mq_map);
+	q->mq_map = NULL;
+}
+
+static int blk_mq_init_hw_queues(struct request_queue *q,
+				 struct blk_mq_reg *reg, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i, node = reg->numa_node;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		hctx->queue = q;
+		hctx->queue_num = i;
+		hctx->queue_depth = reg->queue_depth;
+		hctx->numa_node = node;
+		hctx->flags = reg->flags;
+		hctx->driver_data = driver_data;
+
+		if (!zalloc_cpumask_var_node(&hctx->cpumask, GFP_KERNEL, node))
+			return -ENOMEM;
+		hctx->ctxs = kmalloc_node(nr_cpu_ids * sizeof(void *),
+					  GFP_KERNEL, node);
+		hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+					     sizeof(unsigned long),
+					     GFP_KERNEL, node);
+		hctx->tags = blk_mq_init_tags(reg->queue_depth, reg->cmd_size,
+					      node);
+		if (!hctx->ctxs || !hctx->ctx_map || !hctx->tags)
+			return -ENOMEM;
+
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i))
+			return -ENODEV;
+	}
+
+	return 0;
+}
+
+static void blk_mq_init_cpu_queues(struct request_queue *q,
+				   struct blk_mq_reg *reg)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i, j;
+
+	for_each_possible_cpu(i) {
+		struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, i);
+
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = i;
+		ctx->queue = q;
+
+		hctx = reg->ops->map_queue(q, i);
+		cpumask_set_cpu(i, hctx->cpumask);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	/* Start each software queue's tag search in a different spot. */
+	queue_for_each_hw_ctx(q, hctx, i)
+		for (j = 0; j < hctx->nr_ctx; j++)
+			hctx->ctxs[j]->tag_hint =
+				j * hctx->queue_depth / hctx->nr_ctx;
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:	number and depth of hardware queues, driver operations
+ * @driver_data: stored in q->queuedata and each hctx->driver_data
+ *
+ * Description:
+ *    Allocates the software and hardware queues and all requests up
+ *    front; @reg->cmd_size bytes of driver data follow each request (see
+ *    blk_mq_rq_to_pdu()).  Returns %NULL on failure.  Like any request
+ *    queue, it must be released with blk_cleanup_queue().
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct request_queue *q;
+	int i;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->ops->map_queue || !reg->queue_depth ||
+	    reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues * sizeof(hctx),
+				       GFP_KERNEL, reg->numa_node);
+	q->mq_map = kzalloc_node(nr_cpu_ids * sizeof(*q->mq_map), GFP_KERNEL,
+				 reg->numa_node);
+	if (!q->queue_ctx || !q->queue_hw_ctx || !q->mq_map)
+		goto err;
+
+	q->nr_hw_queues = reg->nr_hw_queues;
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+		if (!hctx)
+			goto err;
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_DELAYED_WORK(&hctx->run_work, blk_mq_run_work_fn);
+		q->queue_hw_ctx[i] = hctx;
+	}
+
+	q->queuedata = driver_data;
+	blk_mq_update_queue_map(q->mq_map, reg->nr_hw_queues);
+	if (blk_mq_init_hw_queues(q, reg, driver_data))
+		goto err;
+	blk_mq_init_cpu_queues(q, reg);
+
+	q->queue_flags |= QUEUE_FLAG_MQ_DEFAULT;
+	if (!(reg->flags & BLK_MQ_F_SHOULD_MERGE))
+		queue_flag_set_unlocked(QUEUE_FLAG_NOMERGES, q);
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->nr_requests = reg->queue_depth;
+	blk_queue_softirq_done(q, reg->ops->complete);
+	q->sg_reserved_size = INT_MAX;
+
+	q->mq_ops = reg->ops;
+	q->poll_nsec = 0;
+
+	mutex_lock(&all_q_mutex);
+	list_add_tail(&q->all_q_node, &all_q_list);
+	mutex_unlock(&all_q_mutex);
+
+	return q;
+
+err:
+	/* ->mq_ops is still NULL, so releasing @q won't look at these */
+	blk_mq_free_hw_queues(q);
+	free_percpu(q->queue_ctx);
+	kfree(q->mq_map);
+	blk_cleanup_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Requests still sitting on a dead CPU's software queue are moved to the
+ * hardware queue's dispatch list, so that nothing waits for that CPU to
+ * run the queue again.
+ */
+static void blk_mq_cpu_dead(struct request_queue *q, unsigned int cpu)
+{
+	struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, cpu);
+	struct blk_mq_hw_ctx *hctx = blk_mq_ctx_to_hctx(ctx);
+	LIST_HEAD(tmp);
+
+	spin_lock_irq(&ctx->lock);
+	list_splice_init(&ctx->rq_list, &tmp);
+	clear_bit(ctx->index_hw, hctx->ctx_map);
+	spin_unlock_irq(&ctx->lock);
+
+	if (list_empty(&tmp))
+		return;
+
+	spin_lock_irq(&hctx->lock);
+	list_splice_tail(&tmp, &hctx->dispatch);
+	spin_unlock_irq(&hctx->lock);
+
+	blk_mq_run_hw_queue(hctx, true);
+}
+
+static int __cpuinit blk_mq_cpu_notify(struct notifier_block *nb,
+				       unsigned long action, void *hcpu)
+{
+	struct request_queue *q;
+
+	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
+		return NOTIFY_OK;
+
+	mutex_lock(&all_q_mutex);
+	list_for_each_entry(q, &all_q_list, all_q_node)
+		blk_mq_cpu_dead(q, (unsigned long)hcpu);
+	mutex_unlock(&all_q_mutex);
+
+	return NOTIFY_OK;
+}
+
+static int __init blk_mq_init(void)
+{
+	hotcpu_notifier(blk_mq_cpu_notify, 0);
+	return 0;
+}
+subsys_initcall(blk_mq_init);
@@ -0,0 +1,49 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+/*
+ * Per-cpu software queue.  Requests sit here between submission and the
+ * next run of the hardware queue this CPU maps to.
+ */
+struct blk_mq_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	rq_list;
+	} ____cacheline_aligned_in_smp;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* bit in hctx->ctx_map */
+	unsigned int		tag_hint;	/* next free tag, maybe */
+
+	struct request_queue	*queue;
+};
+
+void blk_mq_drain_queue(struct request_queue *q);
+void blk_mq_free_queue(struct request_queue *q);
+void blk_mq_sync_queue(struct request_queue *q);
+void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule);
+
+/*
+ * CPU -> queue mappings
+ */
+void blk_mq_update_queue_map(unsigned int *map, unsigned int nr_queues);
+
+/*
+ * Tags
+ */
+struct blk_mq_tags {
+	unsigned int		nr_tags;
+	unsigned long		*bitmap;
+	wait_queue_head_t	wait;
+	struct request		**rqs;	/* preallocated, indexed by tag */
+};
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags,
+				     unsigned int cmd_size, int node);
+void blk_mq_free_tags(struct blk_mq_tags *tags);
+int blk_mq_get_tag(struct blk_mq_tags *tags, unsigned int *hint);
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag);
+void blk_mq_wait_for_tags(struct blk_mq_tags *tags);
+unsigned int blk_mq_tags_busy(struct blk_mq_tags *tags);
+
+#endif
@@ -7,8 +7,10 @@
 #include <linux/bio.h>
 #include <linux/blkdev.h>
 #include <linux/blktrace_api.h>
+#include <linux/blk-mq.h>
 
 #include "blk.h"
+#include "blk-mq.h"
 
 struct queue_sysfs_entry {
 	struct attribute attr;
@@ -78,6 +80,8 @@ queue_requests_store(struct request_queue *q, const char *page, size_t count)
 		wake_up(&rl->wait[BLK_RW_ASYNC]);
 	}
 	spin_unlock_irq(q->queue_lock);
+
+	wbt_set_queue_depth(q->rq_wb, nr);
 	return ret;
 }
 
@@ -273,6 +277,109 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+static ssize_t queue_poll_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_queue_poll(q), page);
+}
+
+static ssize_t queue_poll_store(struct request_queue *q, const char *page,
+				size_t count)
+{
+	unsigned long poll_on;
+	ssize_t ret;
+
+	if (!q->mq_ops || !q->mq_ops->poll)
+		return -EINVAL;
+
+	ret = queue_var_store(&poll_on, page, count);
+	if (poll_on)
+		queue_flag_set_unlocked(QUEUE_FLAG_POLL, q);
+	else
+		queue_flag_clear_unlocked(QUEUE_FLAG_POLL, q);
+
+	return ret;
+}
+
+static ssize_t queue_poll_delay_show(struct request_queue *q, char *page)
+{
+	int val = q->poll_nsec;
+
+	if (val > 0)
+		val /= NSEC_PER_USEC;
+	return sprintf(page, "%d\n", val);
+}
+
+static ssize_t queue_poll_delay_store(struct request_queue *q,
+				      const char *page, size_t count)
+{
+	long val;
+
+	if (!q->mq_ops || !q->mq_ops->poll)
+		return -EINVAL;
+	if (kstrtol(page, 10, &val) || val < -1 ||
+	    val > INT_MAX / NSEC_PER_USEC)
+		return -EINVAL;
+
+	q->poll_nsec = val > 0 ? val * NSEC_PER_USEC : val;
+	return count;
+}
+
+static ssize_t queue_poll_stats_show(struct request_queue *q, char *page)
+{
+	unsigned long invoked = 0, success = 0, sleeps = 0;
+	struct blk_mq_hw_ctx *hctx;
+	u64 sleep_nsec = 0;
+	unsigned int i;
+
+	if (!q->mq_ops)
+		return -EINVAL;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		invoked += hctx->poll_invoked;
+		success += hctx->poll_success;
+		sleeps += hctx->poll_sleeps;
+		sleep_nsec += hctx->poll_sleep_nsec;
+	}
+
+	return sprintf(page, "%lu %lu %lu %llu %lu %lu\n", invoked, success,
+		       sleeps, (unsigned long long) sleep_nsec / NSEC_PER_USEC,
+		       q->poll_mean_nsec[READ] / NSEC_PER_USEC,
+		       q->poll_mean_nsec[WRITE] / NSEC_PER_USEC);
+}
+
+#ifdef CONFIG_BLK_WBT
+static ssize_t queue_wb_lat_show(struct request_queue *q, char *page)
+{
+	if (!q->rq_wb)
+		return -EINVAL;
+
+	return sprintf(page, "%llu\n",
+		       div_u64(wbt_get_min_lat(q->rq_wb), NSEC_PER_USEC));
+}
+
+static ssize_t queue_wb_lat_store(struct request_queue *q, const char *page,
+				  size_t count)
+{
+	unsigned long long val;
+
+	if (!q->rq_wb)
+		return -EINVAL;
+	if (kstrtoull(page, 10, &val) || val > ULLONG_MAX / NSEC_PER_USEC)
+		return -EINVAL;
+
+	wbt_set_min_lat(q->rq_wb, val * NSEC_PER_USEC);
+	return count;
+}
+
+static ssize_t queue_wb_state_show(struct request_queue *q, char *page)
+{
+	if (!q->rq_wb)
+		return -EINVAL;
+
+	return wbt_state_show(q->rq_wb, page);
+}
+#endif
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -387,6 +494,50 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+static struct queue_sysfs_entry queue_poll_entry = {
+	.attr = {.name = "io_poll", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_show,
+	.store = queue_poll_store,
+};
+
+static struct queue_sysfs_entry queue_poll_delay_entry = {
+	.attr = {.name = "io_poll_delay", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_delay_show,
+	.store = queue_poll_delay_store,
+};
+
+static struct queue_sysfs_entry queue_poll_stats_entry = {
+	.attr = {.name = "io_poll_stats", .mode = S_IRUGO },
+	.show = queue_poll_stats_show,
+};
+
+#ifdef CONFIG_BLK_WBT
+static struct queue_sysfs_entry queue_wb_lat_entry = {
+	.attr = {.name = "wbt_lat_usec", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_wb_lat_show,
+	.store = queue_wb_lat_store,
+};
+
+static struct queue_sysfs_entry queue_wb_state_entry = {
+	.attr = {.name = "wbt_state", .mode = S_IRUGO },
+	.show = queue_wb_state_show,
+};
+#endif
+
+#ifdef CONFIG_BLK_IO_HIST
+static struct queue_sysfs_entry queue_lat_hist_entry = {
+	.attr = {.name = "io_lat_hist", .mode = S_IRUGO | S_IWUSR },
+	.show = blk_io_hist_lat_show,
+	.store = blk_io_hist_lat_store,
+};
+
+static struct queue_sysfs_entry queue_size_hist_entry = {
+	.attr = {.name = "io_size_hist", .mode = S_IRUGO | S_IWUSR },
+	.show = blk_io_hist_size_show,
+	.store = blk_io_hist_size_store,
+};
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -409,6 +560,17 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+	&queue_poll_entry.attr,
+	&queue_poll_delay_entry.attr,
+	&queue_poll_stats_entry.attr,
+#ifdef CONFIG_BLK_WBT
+	&queue_wb_lat_entry.attr,
+	&queue_wb_state_entry.attr,
+#endif
+#ifdef CONFIG_BLK_IO_HIST
+	&queue_lat_hist_entry.attr,
+	&queue_size_hist_entry.attr,
+#endif
 	NULL,
 };
 
@@ -487,6 +649,9 @@ static void blk_release_queue(struct kobject *kobj)
 	}
 
 	blk_throtl_exit(q);
+	blk_iolat_exit(q);
+	wbt_exit(q);
+	blk_io_hist_exit(q);
 
 	if (rl->rq_pool)
 		mempool_destroy(rl->rq_pool);
@@ -494,7 +659,11 @@ static void blk_release_queue(struct kobject *kobj)
 	if (q->queue_tags)
 		__blk_queue_free_tags(q);
 
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+
 	blk_throtl_release(q);
+	blk_iolat_release(q);
 	blk_trace_shutdown(q);
 
 	bdi_destroy(&q->backing_dev_info);
@@ -535,6 +704,13 @@ int blk_register_queue(struct gendisk *disk)
 
 	kobject_uevent(&q->kobj, KOBJ_ADD);
 
+	/* throttling is best effort, go on without it */
+	if ((q->request_fn || q->mq_ops) && !q->rq_wb)
+		wbt_init(q);
+	/* so are the histograms */
+	if ((q->request_fn || q->mq_ops) && !q->io_hist)
+		blk_io_hist_init(q);
+
 	if (!q->request_fn)
 		return 0;
 
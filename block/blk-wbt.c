@@ -0,0 +1,365 @@
+/*
+ * Writeback throttling
+ *
+ * Buffered writeback is issued in large bursts.  Left alone it fills the
+ * elevator and the device queue, and reads on the same disk wait behind
+ * all of it.  This limits how many async writes a queue has in flight,
+ * and adjusts that limit by watching read latency, in the manner of
+ * CoDel: over each window, if the fastest read was slower than the
+ * target, the limit is halved and the window shortened; if reads were
+ * fine while writes were going on, the limit is doubled again.
+ *
+ * Only plain async writes are throttled.  Sync writes, O_DIRECT, flushes
+ * and discards go through untouched.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/timer.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+
+#include "blk.h"
+
+/* in-flight writes at scale step 0 */
+#define RWB_DEF_DEPTH		16
+
+/* read latency targets, rotational and not */
+#define RWB_LAT_ROT_NSEC	(75 * NSEC_PER_MSEC)
+#define RWB_LAT_NONROT_NSEC	(2 * NSEC_PER_MSEC)
+
+#define RWB_WINDOW_NSEC		(100 * NSEC_PER_MSEC)
+
+struct rq_wb {
+	struct request_queue	*q;
+
+	/*
+	 * Limits, recomputed from scale_step by wbt_calc_limits().  A
+	 * positive step means reads suffered and writes get less room, a
+	 * negative one that nothing but writes is going on.
+	 */
+	unsigned int		queue_depth;
+	unsigned int		wb_max;
+	int			scale_step;
+	bool			scaled_max;
+
+	u64			min_lat_nsec;	/* target, 0 if disabled */
+	u64			cur_win_nsec;
+
+	atomic_t		inflight;
+	wait_queue_head_t	wait;
+	struct timer_list	window_timer;
+
+	spinlock_t		lock;		/* window samples, scaling */
+	u64			win_min_lat;
+	unsigned int		win_reads;
+	unsigned int		win_writes;
+	u64			last_min_lat;	/* of the last window */
+};
+
+static void wbt_calc_limits(struct rq_wb *rwb)
+{
+	unsigned int depth = min_t(unsigned int, RWB_DEF_DEPTH,
+				   rwb->queue_depth);
+
+	rwb->scaled_max = false;
+	if (rwb->scale_step > 0) {
+		depth = 1 + ((depth - 1) >> min(31, rwb->scale_step));
+	} else if (rwb->scale_step < 0) {
+		unsigned int maxd = max(3 * rwb->queue_depth / 4, 1U);
+
+		depth = 1 + ((depth - 1) << min(31, -rwb->scale_step));
+		if (depth > maxd) {
+			depth = maxd;
+			rwb->scaled_max = true;
+		}
+	}
+	rwb->wb_max = depth;
+
+	/* CoDel: the further we scaled down, the sooner we look again */
+	rwb->cur_win_nsec = div_u64(RWB_WINDOW_NSEC << 4,
+			int_sqrt((max(rwb->scale_step, 0) + 1) << 8));
+}
+
+static void wbt_scale_up(struct rq_wb *rwb)
+{
+	if (rwb->scaled_max)
+		return;
+	rwb->scale_step--;
+	wbt_calc_limits(rwb);
+	wake_up_all(&rwb->wait);
+}
+
+static void wbt_scale_down(struct rq_wb *rwb)
+{
+	if (rwb->wb_max == 1)
+		return;
+	rwb->scale_step++;
+	wbt_calc_limits(rwb);
+}
+
+static void wbt_arm_timer(struct rq_wb *rwb)
+{
+	if (!timer_pending(&rwb->window_timer))
+		mod_timer(&rwb->window_timer,
+			  jiffies + nsecs_to_jiffies(rwb->cur_win_nsec));
+}
+
+static void wbt_window_fn(unsigned long data)
+{
+	struct rq_wb *rwb = (struct rq_wb *) data;
+	unsigned int reads, writes, inflight;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rwb->lock, flags);
+	reads = rwb->win_reads;
+	writes = rwb->win_writes;
+	rwb->last_min_lat = rwb->win_min_lat;
+	rwb->win_reads = rwb->win_writes = 0;
+	rwb->win_min_lat = 0;
+	inflight = atomic_read(&rwb->inflight);
+
+	if (!rwb->min_lat_nsec)
+		goto out;
+
+	if (!reads) {
+		/* nothing to judge by, drift back to the default */
+		if (rwb->scale_step > 0)
+			wbt_scale_up(rwb);
+		else if (rwb->scale_step < 0 && !writes && !inflight)
+			wbt_scale_down(rwb);
+	} else if (rwb->last_min_lat > rwb->min_lat_nsec) {
+		wbt_scale_down(rwb);
+	} else if (writes || inflight) {
+		wbt_scale_up(rwb);
+	}
+
+	if (reads || writes || inflight)
+		wbt_arm_timer(rwb);
+out:
+	spin_unlock_irqrestore(&rwb->lock, flags);
+}
+
+static bool wbt_should_throttle(struct bio *bio)
+{
+	const unsigned long mask = REQ_WRITE | REQ_SYNC | REQ_DISCARD |
+				   REQ_FLUSH | REQ_FUA;
+
+	return (bio->bi_rw & mask) == REQ_WRITE;
+}
+
+static bool atomic_inc_below(atomic_t *v, int below)
+{
+	int cur = atomic_read(v);
+
+	for (;;) {
+		int old;
+
+		if (cur >= below)
+			return false;
+		old = atomic_cmpxchg(v, cur, cur + 1);
+		if (old == cur)
+			return true;
+		cur = old;
+	}
+}
+
+static bool wbt_may_queue(struct rq_wb *rwb)
+{
+	/* disabled meanwhile: count it, so completion can drop it */
+	if (!ACCESS_ONCE(rwb->min_lat_nsec)) {
+		atomic_inc(&rwb->inflight);
+		return true;
+	}
+	return atomic_inc_below(&rwb->inflight, ACCESS_ONCE(rwb->wb_max));
+}
+
+/**
+ * wbt_wait - throttle a bio about to get a request
+ * @rwb:	the queue's throttle, may be %NULL
+ * @bio:	the bio
+ * @lock:	queue_lock if held, dropped while sleeping
+ *
+ * Returns true if the bio counts against the limit; the caller then
+ * marks the request REQ_WB_TRACKED, or calls wbt_cancel() if it ends
+ * up without one.
+ */
+bool wbt_wait(struct rq_wb *rwb, struct bio *bio, spinlock_t *lock)
+{
+	DEFINE_WAIT(wait);
+
+	if (!rwb || !ACCESS_ONCE(rwb->min_lat_nsec) ||
+	    !wbt_should_throttle(bio))
+		return false;
+
+	wbt_arm_timer(rwb);
+
+	if (!waitqueue_active(&rwb->wait) && wbt_may_queue(rwb))
+		return true;
+
+	for (;;) {
+		prepare_to_wait_exclusive(&rwb->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		if (wbt_may_queue(rwb))
+			break;
+		if (lock)
+			spin_unlock_irq(lock);
+		io_schedule();
+		if (lock)
+			spin_lock_irq(lock);
+	}
+	finish_wait(&rwb->wait, &wait);
+	return true;
+}
+
+/*
+ * Drop a write that counted against the limit.  Waiters are let in in
+ * batches, once half the limit is free, rather than one at a time: as
+ * many as there is room for, all of them if throttling is off.
+ */
+void wbt_cancel(struct rq_wb *rwb)
+{
+	int inflight = atomic_dec_return(&rwb->inflight);
+	int limit = ACCESS_ONCE(rwb->wb_max);
+
+	if (!waitqueue_active(&rwb->wait))
+		return;
+	if (!ACCESS_ONCE(rwb->min_lat_nsec))
+		wake_up_all(&rwb->wait);
+	else if (!inflight || inflight < limit / 2)
+		wake_up_nr(&rwb->wait, max(limit - inflight, 1));
+}
+
+/*
+ * A request is being handed to the driver.  Reads are timed from here.
+ */
+void wbt_issue(struct rq_wb *rwb, struct request *rq)
+{
+	if (!rwb || !rwb->min_lat_nsec || rq_data_dir(rq) != READ)
+		return;
+
+	rq->issue_time_ns = ktime_to_ns(ktime_get());
+	wbt_arm_timer(rwb);
+}
+
+/*
+ * A request is done, or was merged into another one.
+ */
+void wbt_done(struct rq_wb *rwb, struct request *rq)
+{
+	unsigned long flags;
+	u64 lat;
+
+	if (!rwb)
+		return;
+
+	if (rq->cmd_flags & REQ_WB_TRACKED) {
+		rq->cmd_flags &= ~REQ_WB_TRACKED;
+		wbt_cancel(rwb);
+
+		spin_lock_irqsave(&rwb->lock, flags);
+		rwb->win_writes++;
+		spin_unlock_irqrestore(&rwb->lock, flags);
+		return;
+	}
+
+	if (rq_data_dir(rq) != READ || !rq->issue_time_ns ||
+	    rq->cmd_type != REQ_TYPE_FS)
+		return;
+
+	lat = ktime_to_ns(ktime_get()) - rq->issue_time_ns;
+	rq->issue_time_ns = 0;
+	spin_lock_irqsave(&rwb->lock, flags);
+	if (!rwb->win_reads || lat < rwb->win_min_lat)
+		rwb->win_min_lat = lat;
+	rwb->win_reads++;
+	spin_unlock_irqrestore(&rwb->lock, flags);
+}
+
+void wbt_set_queue_depth(struct rq_wb *rwb, unsigned int depth)
+{
+	unsigned long flags;
+
+	if (!rwb)
+		return;
+
+	spin_lock_irqsave(&rwb->lock, flags);
+	rwb->queue_depth = depth;
+	wbt_calc_limits(rwb);
+	spin_unlock_irqrestore(&rwb->lock, flags);
+	wake_up_all(&rwb->wait);
+}
+
+/*
+ * Set the read latency target, 0 to stop throttling.  Starts over from
+ * the default limit.
+ */
+void wbt_set_min_lat(struct rq_wb *rwb, u64 nsec)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&rwb->lock, flags);
+	rwb->min_lat_nsec = nsec;
+	rwb->scale_step = 0;
+	wbt_calc_limits(rwb);
+	spin_unlock_irqrestore(&rwb->lock, flags);
+	wake_up_all(&rwb->wait);
+}
+
+u64 wbt_get_min_lat(struct rq_wb *rwb)
+{
+	return rwb->min_lat_nsec;
+}
+
+ssize_t wbt_state_show(struct rq_wb *rwb, char *page)
+{
+	unsigned long flags;
+	ssize_t ret;
+
+	spin_lock_irqsave(&rwb->lock, flags);
+	ret = sprintf(page, "%d %u %d %llu %llu\n", rwb->scale_step,
+		      rwb->wb_max, atomic_read(&rwb->inflight),
+		      div_u64(rwb->cur_win_nsec, NSEC_PER_USEC),
+		      div_u64(rwb->last_min_lat, NSEC_PER_USEC));
+	spin_unlock_irqrestore(&rwb->lock, flags);
+	return ret;
+}
+
+int wbt_init(struct request_queue *q)
+{
+	struct rq_wb *rwb;
+
+	rwb = kzalloc_node(sizeof(*rwb), GFP_KERNEL, q->node);
+	if (!rwb)
+		return -ENOMEM;
+
+	rwb->q = q;
+	atomic_set(&rwb->inflight, 0);
+	init_waitqueue_head(&rwb->wait);
+	spin_lock_init(&rwb->lock);
+	setup_timer(&rwb->window_timer, wbt_window_fn, (unsigned long) rwb);
+
+	rwb->queue_depth = q->nr_requests;
+	rwb->min_lat_nsec = blk_queue_nonrot(q) ? RWB_LAT_NONROT_NSEC :
+						  RWB_LAT_ROT_NSEC;
+	wbt_calc_limits(rwb);
+
+	q->rq_wb = rwb;
+	return 0;
+}
+
+void wbt_exit(struct request_queue *q)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (!rwb)
+		return;
+
+	del_timer_sync(&rwb->window_timer);
+	q->rq_wb = NULL;
+	kfree(rwb);
+}
@@ -34,6 +34,12 @@ void blk_delete_timer(struct request *);
 void blk_add_timer(struct request *);
 void __generic_unplug_device(struct request_queue *);
 
+void drive_stat_acct(struct request *rq, int new_io);
+void blk_account_io_done(struct request *req);
+bool blk_attempt_plug_merge(struct request_queue *q, struct bio *bio,
+			    unsigned int *request_count,
+			    struct request **same_queue_rq);
+
 /*
  * Internal atomic flags for request handling
  */
@@ -115,6 +121,19 @@ static inline void elv_deactivate_rq(struct request_queue *q, struct request *rq
 		e->type->ops.elevator_deactivate_req_fn(q, rq);
 }
 
+/*
+ * Query io scheduler to see if @next may be merged into @rq.
+ */
+static inline int elv_allow_rq_merge(struct request_queue *q,
+				     struct request *rq, struct request *next)
+{
+	struct elevator_queue *e = q->elevator;
+
+	if (e->type->ops.elevator_allow_rq_merge_fn)
+		return e->type->ops.elevator_allow_rq_merge_fn(q, rq, next);
+	return 1;
+}
+
 #ifdef CONFIG_FAIL_IO_TIMEOUT
 int blk_should_fake_timeout(struct request_queue *);
 ssize_t part_timeout_show(struct device *, struct device_attribute *, char *);
@@ -234,4 +253,69 @@ static inline void blk_throtl_exit(struct request_queue *q) { }
 static inline void blk_throtl_release(struct request_queue *q) { }
 #endif /* CONFIG_BLK_DEV_THROTTLING */
 
+/*
+ * Cgroup latency targets
+ */
+#ifdef CONFIG_BLK_CGROUP_IOLATENCY
+extern void blk_iolat_bio(struct request_queue *q, struct bio *bio);
+extern int blk_iolat_init(struct request_queue *q);
+extern void blk_iolat_exit(struct request_queue *q);
+extern void blk_iolat_release(struct request_queue *q);
+#else /* CONFIG_BLK_CGROUP_IOLATENCY */
+static inline void blk_iolat_bio(struct request_queue *q, struct bio *bio) { }
+static inline int blk_iolat_init(struct request_queue *q) { return 0; }
+static inline void blk_iolat_exit(struct request_queue *q) { }
+static inline void blk_iolat_release(struct request_queue *q) { }
+#endif /* CONFIG_BLK_CGROUP_IOLATENCY */
+
+/*
+ * Writeback throttling
+ */
+#ifdef CONFIG_BLK_WBT
+extern bool wbt_wait(struct rq_wb *rwb, struct bio *bio, spinlock_t *lock);
+extern void wbt_cancel(struct rq_wb *rwb);
+extern void wbt_issue(struct rq_wb *rwb, struct request *rq);
+extern void wbt_done(struct rq_wb *rwb, struct request *rq);
+extern void wbt_set_queue_depth(struct rq_wb *rwb, unsigned int depth);
+extern void wbt_set_min_lat(struct rq_wb *rwb, u64 nsec);
+extern u64 wbt_get_min_lat(struct rq_wb *rwb);
+extern ssize_t wbt_state_show(struct rq_wb *rwb, char *page);
+extern int wbt_init(struct request_queue *q);
+extern void wbt_exit(struct request_queue *q);
+#else /* CONFIG_BLK_WBT */
+static inline bool wbt_wait(struct rq_wb *rwb, struct bio *bio,
+			    spinlock_t *lock)
+{
+	return false;
+}
+static inline void wbt_cancel(struct rq_wb *rwb) { }
+static inline void wbt_issue(struct rq_wb *rwb, struct request *rq) { }
+static inline void wbt_done(struct rq_wb *rwb, struct request *rq) { }
+static inline void wbt_set_queue_depth(struct rq_wb *rwb,
+				       unsigned int depth) { }
+static inline int wbt_init(struct request_queue *q) { return 0; }
+static inline void wbt_exit(struct request_queue *q) { }
+#endif /* CONFIG_BLK_WBT */
+
+/*
+ * Latency and size histograms
+ */
+#ifdef CONFIG_BLK_IO_HIST
+extern void blk_io_hist_issue(struct request *rq);
+extern void blk_io_hist_done(struct request *rq, int cpu);
+extern ssize_t blk_io_hist_lat_show(struct request_queue *q, char *page);
+extern ssize_t blk_io_hist_lat_store(struct request_queue *q,
+				     const char *page, size_t count);
+extern ssize_t blk_io_hist_size_show(struct request_queue *q, char *page);
+extern ssize_t blk_io_hist_size_store(struct request_queue *q,
+				      const char *page, size_t count);
+extern int blk_io_hist_init(struct request_queue *q);
+extern void blk_io_hist_exit(struct request_queue *q);
+#else /* CONFIG_BLK_IO_HIST */
+static inline void blk_io_hist_issue(struct request *rq) { }
+static inline void blk_io_hist_done(struct request *rq, int cpu) { }
+static inline int blk_io_hist_init(struct request_queue *q) { return 0; }
+static inline void blk_io_hist_exit(struct request_queue *q) { }
+#endif /* CONFIG_BLK_IO_HIST */
+
 #endif /* BLK_INTERNAL_H */
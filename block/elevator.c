@@ -583,7 +583,11 @@ void elv_quiesce_end(struct request_queue *q)
 	spin_unlock_irq(q->queue_lock);
 }
 
-void __elv_add_request(struct request_queue *q, struct request *rq, int where)
+/*
+ * Returns true if @rq was merged into a request already queued, and so
+ * has been freed.  Only ELEVATOR_INSERT_SORT_MERGE ever does that.
+ */
+bool __elv_add_request(struct request_queue *q, struct request *rq, int where)
 {
 	trace_block_rq_insert(q, rq);
 
@@ -632,7 +636,7 @@ void __elv_add_request(struct request_queue *q, struct request *rq, int where)
 		 * so no need to do anything further.
 		 */
 		if (elv_attempt_insert_merge(q, rq))
-			break;
+			return true;
 	case ELEVATOR_INSERT_SORT:
 		BUG_ON(rq->cmd_type != REQ_TYPE_FS &&
 		       !(rq->cmd_flags & REQ_DISCARD));
@@ -661,6 +665,7 @@ void __elv_add_request(struct request_queue *q, struct request *rq, int where)
 		       __func__, where);
 		BUG();
 	}
+	return false;
 }
 EXPORT_SYMBOL(__elv_add_request);
 
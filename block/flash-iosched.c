@@ -0,0 +1,557 @@
+/*
+ *  Flash i/o scheduler.
+ *
+ *  For eMMC and SSDs.  There is no idling and no seek avoidance; requests
+ *  are kept sorted only so they merge and so a batch walks adjacent
+ *  sectors.  Reads, sync writes and async writes are queued separately,
+ *  each with its own budget per batch and its own deadline.  Within a
+ *  class, processes are kept from crowding each other out with a few
+ *  tokens per process, handed out again once everyone has spent theirs.
+ *
+ *  Based on the deadline scheduler.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/rbtree.h>
+#include <linux/iocontext.h>
+
+/*
+ * See Documentation/block/flash-iosched.txt
+ */
+static const int read_expire = HZ / 8;		/* max wait of a read */
+static const int sync_write_expire = HZ / 2;	/* ditto for sync writes */
+static const int async_write_expire = 2 * HZ;	/* ditto for async writes */
+static const int read_budget = 16;		/* reads per batch */
+static const int sync_write_budget = 8;		/* sync writes per batch */
+static const int async_write_budget = 4;	/* async writes per batch */
+static const int async_starved = 4;		/* max batches async waits */
+static const int tokens = 8;			/* per process per round */
+static const int dispatch_batch = 4;		/* moved per dispatch call */
+
+/* how far past a process out of tokens we look for one that has some */
+#define FLASH_TOKEN_LOOKAHEAD	8
+
+enum {
+	FLASH_READ,
+	FLASH_SYNC_WRITE,
+	FLASH_ASYNC_WRITE,
+	FLASH_NR_CLASSES,
+};
+
+struct flash_data {
+	/*
+	 * run time data
+	 */
+
+	/*
+	 * requests are present on both sort_list and fifo_list of their class
+	 */
+	struct rb_root sort_list[FLASH_NR_CLASSES];
+	struct list_head fifo_list[FLASH_NR_CLASSES];
+
+	/*
+	 * next in sort order, per class
+	 */
+	struct request *next_rq[FLASH_NR_CLASSES];
+	int cur_class;			/* class of the current batch */
+	int batch_left;			/* requests left in the current batch */
+	int starved;			/* batches async writes have waited */
+	unsigned long round;		/* token round, see flash_has_token() */
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int fifo_expire[FLASH_NR_CLASSES];
+	int budget[FLASH_NR_CLASSES];
+	int async_starved;
+	int tokens;
+	int dispatch_batch;
+	int front_merges;
+};
+
+/* per process and queue, for the tokens */
+struct flash_io_cq {
+	struct io_cq icq;		/* must be the first member */
+	unsigned long round;
+	int tokens;
+};
+
+#define RQ_FIC(rq)	icq_to_fic((rq)->elv.icq)
+#define RQ_CLASS(rq)	((long)(rq)->elv.priv[0])
+
+static inline struct flash_io_cq *icq_to_fic(struct io_cq *icq)
+{
+	/* fic->icq is the first member, %NULL will convert to %NULL */
+	return container_of(icq, struct flash_io_cq, icq);
+}
+
+static int flash_bio_class(struct bio *bio)
+{
+	if (bio_data_dir(bio) == READ)
+		return FLASH_READ;
+	return rw_is_sync(bio->bi_rw) ? FLASH_SYNC_WRITE : FLASH_ASYNC_WRITE;
+}
+
+static int flash_rq_class(struct request *rq)
+{
+	if (rq_data_dir(rq) == READ)
+		return FLASH_READ;
+	return rq_is_sync(rq) ? FLASH_SYNC_WRITE : FLASH_ASYNC_WRITE;
+}
+
+static inline struct rb_root *
+flash_rb_root(struct flash_data *fd, struct request *rq)
+{
+	return &fd->sort_list[RQ_CLASS(rq)];
+}
+
+/*
+ * get the request after `rq' in sector-sorted order
+ */
+static inline struct request *
+flash_latter_request(struct request *rq)
+{
+	struct rb_node *node = rb_next(&rq->rb_node);
+
+	if (node)
+		return rb_entry_rq(node);
+
+	return NULL;
+}
+
+static inline void
+flash_del_rq_rb(struct flash_data *fd, struct request *rq)
+{
+	const int class = RQ_CLASS(rq);
+
+	if (fd->next_rq[class] == rq)
+		fd->next_rq[class] = flash_latter_request(rq);
+
+	elv_rb_del(flash_rb_root(fd, rq), rq);
+}
+
+/*
+ * add rq to rbtree and fifo of its class
+ */
+static void
+flash_add_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	const int class = flash_rq_class(rq);
+
+	/* the class decides which tree rq is on, so it must not change */
+	rq->elv.priv[0] = (void *)(long)class;
+	elv_rb_add(flash_rb_root(fd, rq), rq);
+
+	rq_set_fifo_time(rq, jiffies + fd->fifo_expire[class]);
+	list_add_tail(&rq->queuelist, &fd->fifo_list[class]);
+}
+
+/*
+ * remove rq from rbtree and fifo.
+ */
+static void flash_remove_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	rq_fifo_clear(rq);
+	flash_del_rq_rb(fd, rq);
+}
+
+static int
+flash_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	struct request *__rq;
+
+	/*
+	 * check for front merge
+	 */
+	if (fd->front_merges) {
+		sector_t sector = bio->bi_sector + bio_sectors(bio);
+
+		__rq = elv_rb_find(&fd->sort_list[flash_bio_class(bio)],
+				   sector);
+		if (__rq) {
+			BUG_ON(sector != blk_rq_pos(__rq));
+
+			if (elv_rq_merge_ok(__rq, bio)) {
+				*req = __rq;
+				return ELEVATOR_FRONT_MERGE;
+			}
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void flash_merged_request(struct request_queue *q,
+				 struct request *req, int type)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	/*
+	 * if the merge was a front merge, we need to reposition request
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(flash_rb_root(fd, req), req);
+		elv_rb_add(flash_rb_root(fd, req), req);
+	}
+}
+
+static void
+flash_merged_requests(struct request_queue *q, struct request *req,
+		      struct request *next)
+{
+	/*
+	 * if next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo
+	 */
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
+			list_move(&req->queuelist, &next->queuelist);
+			rq_set_fifo_time(req, rq_fifo_time(next));
+		}
+	}
+
+	/*
+	 * kill knowledge of next, this one is a goner
+	 */
+	flash_remove_request(q, next);
+}
+
+/*
+ * Keep a sync write from waiting behind an async request it merged into,
+ * and the other way around.
+ */
+static int flash_allow_merge(struct request_queue *q, struct request *rq,
+			     struct bio *bio)
+{
+	return flash_rq_class(rq) == flash_bio_class(bio);
+}
+
+/* The same for requests merged with each other, on insert and after */
+static int flash_allow_rq_merge(struct request_queue *q, struct request *rq,
+				struct request *next)
+{
+	return flash_rq_class(rq) == flash_rq_class(next);
+}
+
+static inline int flash_fifo_expired(struct flash_data *fd, int class)
+{
+	struct request *rq = rq_entry_fifo(fd->fifo_list[class].next);
+
+	return time_after(jiffies, rq_fifo_time(rq));
+}
+
+/*
+ * Pick the class of the next batch.  An expired deadline goes first,
+ * reads before writes.  Otherwise reads and sync writes take turns, and
+ * async writes get a batch once they have waited async_starved batches
+ * or nothing else is queued.
+ */
+static int flash_next_class(struct flash_data *fd)
+{
+	const int reads = !list_empty(&fd->fifo_list[FLASH_READ]);
+	const int sync_writes = !list_empty(&fd->fifo_list[FLASH_SYNC_WRITE]);
+	const int async_writes = !list_empty(&fd->fifo_list[FLASH_ASYNC_WRITE]);
+	int class;
+
+	for (class = 0; class < FLASH_NR_CLASSES; class++)
+		if (!list_empty(&fd->fifo_list[class]) &&
+		    flash_fifo_expired(fd, class))
+			goto out;
+
+	if (async_writes &&
+	    (fd->starved++ >= fd->async_starved || (!reads && !sync_writes))) {
+		class = FLASH_ASYNC_WRITE;
+		goto out;
+	}
+
+	if (reads && sync_writes)
+		class = fd->cur_class == FLASH_READ ? FLASH_SYNC_WRITE :
+						      FLASH_READ;
+	else if (reads)
+		class = FLASH_READ;
+	else if (sync_writes)
+		class = FLASH_SYNC_WRITE;
+	else
+		return -1;
+out:
+	if (class == FLASH_ASYNC_WRITE)
+		fd->starved = 0;
+	return class;
+}
+
+/*
+ * Does the process that queued @rq still have a token this round?
+ * Requests without an io context are never held back.
+ */
+static int flash_has_token(struct flash_data *fd, struct request *rq)
+{
+	struct flash_io_cq *fic = RQ_FIC(rq);
+
+	if (!fic)
+		return 1;
+
+	if (fic->round != fd->round) {
+		fic->round = fd->round;
+		fic->tokens = fd->tokens;
+	}
+	return fic->tokens > 0;
+}
+
+/*
+ * Next request of @class: the oldest one if its deadline passed,
+ * otherwise the next in sector order whose process has a token.  If no
+ * process nearby has one left, everyone gets new tokens.
+ */
+static struct request *flash_choose_request(struct flash_data *fd, int class)
+{
+	struct request *rq, *__rq;
+	int i;
+
+	if (flash_fifo_expired(fd, class) || !fd->next_rq[class])
+		return rq_entry_fifo(fd->fifo_list[class].next);
+
+	rq = fd->next_rq[class];
+	for (i = 0, __rq = rq; __rq && i < FLASH_TOKEN_LOOKAHEAD;
+	     i++, __rq = flash_latter_request(__rq))
+		if (flash_has_token(fd, __rq))
+			return __rq;
+
+	fd->round++;
+	return rq;
+}
+
+/*
+ * move request from sort list to dispatch queue, charging its process
+ */
+static void
+flash_move_request(struct flash_data *fd, struct request *rq)
+{
+	struct flash_io_cq *fic = RQ_FIC(rq);
+	struct request_queue *q = rq->q;
+	const int class = RQ_CLASS(rq);
+
+	if (fic && flash_has_token(fd, rq))
+		fic->tokens--;
+
+	fd->next_rq[class] = flash_latter_request(rq);
+
+	flash_remove_request(q, rq);
+	elv_dispatch_add_tail(q, rq);
+}
+
+/*
+ * Move up to dispatch_batch requests to the dispatch queue, all of them
+ * if forced, so the driver finds several there for each time it has to
+ * call in here under queue_lock.
+ */
+static int flash_dispatch_requests(struct request_queue *q, int force)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	int max = force ? INT_MAX : max(fd->dispatch_batch, 1);
+	int dispatched = 0;
+	struct request *rq;
+
+	while (dispatched < max) {
+		if (fd->batch_left <= 0 ||
+		    list_empty(&fd->fifo_list[fd->cur_class])) {
+			int class = flash_next_class(fd);
+
+			if (class < 0)
+				break;
+			fd->cur_class = class;
+			fd->batch_left = max(fd->budget[class], 1);
+		}
+
+		rq = flash_choose_request(fd, fd->cur_class);
+		flash_move_request(fd, rq);
+		fd->batch_left--;
+		dispatched++;
+	}
+
+	return dispatched;
+}
+
+static void flash_exit_queue(struct elevator_queue *e)
+{
+	struct flash_data *fd = e->elevator_data;
+	int class;
+
+	for (class = 0; class < FLASH_NR_CLASSES; class++)
+		BUG_ON(!list_empty(&fd->fifo_list[class]));
+
+	kfree(fd);
+}
+
+/*
+ * initialize elevator private data (flash_data).
+ */
+static void *flash_init_queue(struct request_queue *q)
+{
+	struct flash_data *fd;
+	int class;
+
+	fd = kmalloc_node(sizeof(*fd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!fd)
+		return NULL;
+
+	for (class = 0; class < FLASH_NR_CLASSES; class++) {
+		INIT_LIST_HEAD(&fd->fifo_list[class]);
+		fd->sort_list[class] = RB_ROOT;
+	}
+	fd->fifo_expire[FLASH_READ] = read_expire;
+	fd->fifo_expire[FLASH_SYNC_WRITE] = sync_write_expire;
+	fd->fifo_expire[FLASH_ASYNC_WRITE] = async_write_expire;
+	fd->budget[FLASH_READ] = read_budget;
+	fd->budget[FLASH_SYNC_WRITE] = sync_write_budget;
+	fd->budget[FLASH_ASYNC_WRITE] = async_write_budget;
+	fd->async_starved = async_starved;
+	fd->tokens = tokens;
+	fd->dispatch_batch = dispatch_batch;
+	fd->front_merges = 1;
+	/* fresh io contexts are zeroed, so they get tokens on first use */
+	fd->round = 1;
+	return fd;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+flash_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+flash_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return flash_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(flash_read_expire_show, fd->fifo_expire[FLASH_READ], 1);
+SHOW_FUNCTION(flash_sync_write_expire_show,
+	      fd->fifo_expire[FLASH_SYNC_WRITE], 1);
+SHOW_FUNCTION(flash_async_write_expire_show,
+	      fd->fifo_expire[FLASH_ASYNC_WRITE], 1);
+SHOW_FUNCTION(flash_read_budget_show, fd->budget[FLASH_READ], 0);
+SHOW_FUNCTION(flash_sync_write_budget_show, fd->budget[FLASH_SYNC_WRITE], 0);
+SHOW_FUNCTION(flash_async_write_budget_show, fd->budget[FLASH_ASYNC_WRITE], 0);
+SHOW_FUNCTION(flash_async_starved_show, fd->async_starved, 0);
+SHOW_FUNCTION(flash_tokens_show, fd->tokens, 0);
+SHOW_FUNCTION(flash_dispatch_batch_show, fd->dispatch_batch, 0);
+SHOW_FUNCTION(flash_front_merges_show, fd->front_merges, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data;							\
+	int ret = flash_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(flash_read_expire_store, &fd->fifo_expire[FLASH_READ],
+	       0, INT_MAX, 1);
+STORE_FUNCTION(flash_sync_write_expire_store,
+	       &fd->fifo_expire[FLASH_SYNC_WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_async_write_expire_store,
+	       &fd->fifo_expire[FLASH_ASYNC_WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_read_budget_store, &fd->budget[FLASH_READ],
+	       1, INT_MAX, 0);
+STORE_FUNCTION(flash_sync_write_budget_store, &fd->budget[FLASH_SYNC_WRITE],
+	       1, INT_MAX, 0);
+STORE_FUNCTION(flash_async_write_budget_store,
+	       &fd->budget[FLASH_ASYNC_WRITE], 1, INT_MAX, 0);
+STORE_FUNCTION(flash_async_starved_store, &fd->async_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(flash_tokens_store, &fd->tokens, 1, INT_MAX, 0);
+STORE_FUNCTION(flash_dispatch_batch_store, &fd->dispatch_batch, 1, INT_MAX, 0);
+STORE_FUNCTION(flash_front_merges_store, &fd->front_merges, 0, 1, 0);
+#undef STORE_FUNCTION
+
+#define FD_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, flash_##name##_show, \
+				      flash_##name##_store)
+
+static struct elv_fs_entry flash_attrs[] = {
+	FD_ATTR(read_expire),
+	FD_ATTR(sync_write_expire),
+	FD_ATTR(async_write_expire),
+	FD_ATTR(read_budget),
+	FD_ATTR(sync_write_budget),
+	FD_ATTR(async_write_budget),
+	FD_ATTR(async_starved),
+	FD_ATTR(tokens),
+	FD_ATTR(dispatch_batch),
+	FD_ATTR(front_merges),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_flash = {
+	.ops = {
+		.elevator_merge_fn =		flash_merge,
+		.elevator_merged_fn =		flash_merged_request,
+		.elevator_merge_req_fn =	flash_merged_requests,
+		.elevator_allow_merge_fn =	flash_allow_merge,
+		.elevator_allow_rq_merge_fn =	flash_allow_rq_merge,
+		.elevator_dispatch_fn =		flash_dispatch_requests,
+		.elevator_add_req_fn =		flash_add_request,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_init_fn =		flash_init_queue,
+		.elevator_exit_fn =		flash_exit_queue,
+	},
+
+	.icq_size = sizeof(struct flash_io_cq),
+	.icq_align = __alignof__(struct flash_io_cq),
+	.elevator_attrs = flash_attrs,
+	.elevator_name = "flash",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init flash_init(void)
+{
+	return elv_register(&iosched_flash);
+}
+
+static void __exit flash_exit(void)
+{
+	elv_unregister(&iosched_flash);
+}
+
+module_init(flash_init);
+module_exit(flash_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("flash IO scheduler");
@@ -76,6 +76,8 @@
 #include <linux/sysfs.h>
 #include <linux/miscdevice.h>
 #include <linux/falloc.h>
+#include <linux/vmalloc.h>
+#include <linux/mempool.h>
 
 #include <asm/uaccess.h>
 
@@ -85,6 +87,29 @@ static DEFINE_MUTEX(loop_index_mutex);
 static int max_part;
 static int part_shift;
 
+/*
+ * Direct I/O mode: the backing file's blocks are mapped once, and bios are
+ * remapped onto the backing file system's device instead of going through
+ * the page cache.  Each extent covers a run of loop sectors that is
+ * contiguous on disk.
+ */
+struct loop_extent {
+	sector_t	start;		/* first loop sector */
+	sector_t	nr_sects;
+	sector_t	disk_sector;	/* where @start lives on the bdev */
+};
+
+/* one per bio submitted in direct I/O mode, shared by its clones */
+struct loop_dio {
+	struct loop_device	*lo;
+	struct bio		*orig;
+	atomic_t		pending;
+	int			error;
+};
+
+static mempool_t *loop_dio_pool;
+static struct bio_set *loop_dio_bs;
+
 /*
  * Transfer functions
  */
@@ -458,6 +483,308 @@ out:
 	return ret;
 }
 
+static struct block_device *loop_dio_bdev(struct loop_device *lo)
+{
+	return lo->lo_backing_file->f_mapping->host->i_sb->s_bdev;
+}
+
+#define LOOP_FIEMAP_EXTENTS	32
+
+/* Extents whose blocks we cannot read or write in place */
+#define LOOP_FIEMAP_REFUSE	(FIEMAP_EXTENT_UNKNOWN | \
+				 FIEMAP_EXTENT_ENCODED | \
+				 FIEMAP_EXTENT_NOT_ALIGNED | \
+				 FIEMAP_EXTENT_UNWRITTEN | \
+				 FIEMAP_EXTENT_SHARED)
+
+/*
+ * bmap() maps unwritten extents like written ones, although the file
+ * system reads them back as zeroes and has to convert them on writes.
+ * Shared extents must not be written in place either.  Ask fiemap,
+ * where the file system has it, whether [@start, @start + @len) has
+ * any such extents.
+ */
+static int loop_check_fiemap(struct inode *inode, u64 start, u64 len)
+{
+	struct fiemap_extent_info fieinfo;
+	struct fiemap_extent *fe;
+	u64 end = start + len;
+	mm_segment_t old_fs;
+	unsigned int i;
+	int err = 0;
+
+	if (!inode->i_op->fiemap)
+		return 0;
+
+	fe = kmalloc(LOOP_FIEMAP_EXTENTS * sizeof(*fe), GFP_KERNEL);
+	if (!fe)
+		return -ENOMEM;
+
+	filemap_write_and_wait(inode->i_mapping);
+
+	/* fiemap fills in a user buffer */
+	old_fs = get_fs();
+	set_fs(get_ds());
+	while (start < end) {
+		memset(&fieinfo, 0, sizeof(fieinfo));
+		fieinfo.fi_extents_max = LOOP_FIEMAP_EXTENTS;
+		fieinfo.fi_extents_start = (struct fiemap_extent __user *)fe;
+
+		err = inode->i_op->fiemap(inode, &fieinfo, start, end - start);
+		if (err || !fieinfo.fi_extents_mapped)
+			break;
+		for (i = 0; i < fieinfo.fi_extents_mapped; i++) {
+			if (fe[i].fe_flags & LOOP_FIEMAP_REFUSE) {
+				err = -EINVAL;
+				goto out;
+			}
+		}
+		i--;
+		if (fieinfo.fi_extents_mapped < LOOP_FIEMAP_EXTENTS ||
+		    (fe[i].fe_flags & FIEMAP_EXTENT_LAST) ||
+		    fe[i].fe_logical + fe[i].fe_length <= start)
+			break;
+		start = fe[i].fe_logical + fe[i].fe_length;
+	}
+out:
+	set_fs(old_fs);
+	kfree(fe);
+	return err;
+}
+
+/*
+ * Walk the backing file with bmap() and build the extent list for the
+ * current size of the device.  Fails if the file cannot be mapped this
+ * way, or has holes or unwritten or shared extents: writing to those
+ * must go through the file system.
+ */
+static int loop_map_extents(struct loop_device *lo, struct loop_extent **extp,
+			    unsigned int *nrp)
+{
+	struct address_space *mapping = lo->lo_backing_file->f_mapping;
+	struct inode *inode = mapping->host;
+	unsigned int shift = inode->i_blkbits - 9;
+	unsigned int blksize = 1 << inode->i_blkbits;
+	struct block_device *bdev = inode->i_sb->s_bdev;
+	struct loop_extent *ext = NULL;
+	unsigned int nr = 0, max = 0;
+	sector_t first, nr_blocks, i, pblk, prev = 0;
+	int pass, err;
+
+	if (!S_ISREG(inode->i_mode) || !mapping->a_ops->bmap || !bdev)
+		return -EINVAL;
+	if (lo->lo_encryption || (lo->lo_offset & (blksize - 1)))
+		return -EINVAL;
+	if (bdev_logical_block_size(bdev) > 512)
+		return -EINVAL;
+
+	first = lo->lo_offset >> inode->i_blkbits;
+	nr_blocks = (get_capacity(lo->lo_disk) + (1 << shift) - 1) >> shift;
+	if (!nr_blocks)
+		return -EINVAL;
+	err = loop_check_fiemap(inode, (u64)first << inode->i_blkbits,
+				(u64)nr_blocks << inode->i_blkbits);
+	if (err)
+		return err;
+
+	/* count the extents first, then fill them in */
+	for (pass = 0; pass < 2; pass++) {
+		nr = 0;
+		for (i = 0; i < nr_blocks; i++) {
+			pblk = bmap(inode, first + i);
+			if (!pblk)
+				goto fail;
+			if (!nr || pblk != prev + 1) {
+				if (ext) {
+					if (nr == max)
+						goto fail;
+					ext[nr].start = i << shift;
+					ext[nr].nr_sects = 0;
+					ext[nr].disk_sector = pblk << shift;
+				}
+				nr++;
+			}
+			if (ext)
+				ext[nr - 1].nr_sects += 1 << shift;
+			prev = pblk;
+			cond_resched();
+		}
+		if (!ext) {
+			ext = vmalloc(nr * sizeof(*ext));
+			if (!ext)
+				return -ENOMEM;
+			max = nr;
+		}
+	}
+
+	*extp = ext;
+	*nrp = nr;
+	return 0;
+
+fail:
+	vfree(ext);
+	return -EINVAL;
+}
+
+static struct loop_extent *loop_find_extent(struct loop_device *lo,
+					    sector_t sector)
+{
+	unsigned int l = 0, h = lo->lo_nr_extents;
+
+	while (l < h) {
+		unsigned int m = l + (h - l) / 2;
+		struct loop_extent *ext = &lo->lo_extents[m];
+
+		if (sector < ext->start)
+			h = m;
+		else if (sector >= ext->start + ext->nr_sects)
+			l = m + 1;
+		else
+			return ext;
+	}
+	return NULL;
+}
+
+static void loop_dio_put(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+
+	if (!atomic_dec_and_test(&dio->pending))
+		return;
+
+	bio_endio(dio->orig, dio->error);
+	mempool_free(dio, loop_dio_pool);
+	if (atomic_dec_and_test(&lo->lo_dio_inflight))
+		wake_up(&lo->lo_event);
+}
+
+static void loop_dio_end_io(struct bio *bio, int error)
+{
+	struct loop_dio *dio = bio->bi_private;
+
+	if (error)
+		dio->error = error;
+	bio_put(bio);
+	loop_dio_put(dio);
+}
+
+static struct bio *loop_dio_alloc_bio(struct loop_dio *dio, sector_t sector,
+				      int nr_vecs)
+{
+	struct bio *bio;
+
+	bio = bio_alloc_bioset(GFP_NOIO, nr_vecs, loop_dio_bs);
+	bio->bi_bdev = loop_dio_bdev(dio->lo);
+	bio->bi_sector = sector;
+	bio->bi_rw = dio->orig->bi_rw;
+	bio->bi_end_io = loop_dio_end_io;
+	bio->bi_private = dio;
+	atomic_inc(&dio->pending);
+	return bio;
+}
+
+/*
+ * Whether @bio goes to the disk as a single clone.  Only those are
+ * submitted from loop_make_request(): clones submitted there are only
+ * queued on current->bio_list until it returns, so allocating a second
+ * one from loop_dio_bs could wait for the first forever.
+ */
+static bool loop_dio_single(struct loop_device *lo, struct bio *bio)
+{
+	struct request_queue *q = bdev_get_queue(loop_dio_bdev(lo));
+	struct loop_extent *ext;
+
+	if (!bio->bi_size || (bio->bi_rw & REQ_DISCARD))
+		return true;
+	if (q->merge_bvec_fn || bio_segments(bio) > queue_max_segments(q) ||
+	    bio_sectors(bio) > queue_max_sectors(q))
+		return false;
+	ext = loop_find_extent(lo, bio->bi_sector);
+	return ext && bio->bi_sector + bio_sectors(bio) <=
+		      ext->start + ext->nr_sects;
+}
+
+/*
+ * Issue @bio straight to the disk under the backing file.  The bio is
+ * carved up at extent boundaries and wherever the lower queue will not
+ * take more, and completes when the last piece does.  Bios that need
+ * more than one piece are only submitted from the loop thread, where
+ * each piece is on its way to the disk before the next one is
+ * allocated.  The caller has already accounted @bio in lo_dio_inflight.
+ */
+static void loop_dio_submit(struct loop_device *lo, struct bio *bio)
+{
+	struct loop_extent *ext = NULL;
+	struct bio *clone = NULL;
+	struct loop_dio *dio;
+	struct bio_vec *bvec;
+	sector_t sector = bio->bi_sector, ext_end = 0;
+	int i;
+
+	dio = mempool_alloc(loop_dio_pool, GFP_NOIO);
+	dio->lo = lo;
+	dio->orig = bio;
+	atomic_set(&dio->pending, 1);
+	dio->error = 0;
+
+	/* the mapping must not change under us, so no hole punching */
+	if (bio->bi_rw & REQ_DISCARD) {
+		dio->error = -EOPNOTSUPP;
+		goto out;
+	}
+
+	/* empty flush: pass it on to the disk */
+	if (!bio->bi_size) {
+		generic_make_request(loop_dio_alloc_bio(dio, 0, 0));
+		goto out;
+	}
+
+	bio_for_each_segment(bvec, bio, i) {
+		unsigned int off = bvec->bv_offset, len = bvec->bv_len;
+
+		while (len) {
+			unsigned int chunk;
+
+			if (!ext || sector >= ext_end) {
+				if (clone)
+					generic_make_request(clone);
+				clone = NULL;
+				ext = loop_find_extent(lo, sector);
+				if (!ext) {
+					dio->error = -EIO;
+					goto out;
+				}
+				ext_end = ext->start + ext->nr_sects;
+			}
+
+			if (!clone)
+				clone = loop_dio_alloc_bio(dio,
+					ext->disk_sector + sector - ext->start,
+					min_t(int, bio->bi_vcnt - i,
+					      BIO_MAX_PAGES));
+
+			chunk = min_t(sector_t, len, (ext_end - sector) << 9);
+			if (bio_add_page(clone, bvec->bv_page, chunk,
+					 off) < chunk) {
+				if (!clone->bi_size) {
+					bio_endio(clone, -EIO);
+					goto out;
+				}
+				generic_make_request(clone);
+				clone = NULL;
+				continue;
+			}
+			sector += chunk >> 9;
+			off += chunk;
+			len -= chunk;
+		}
+	}
+	if (clone)
+		generic_make_request(clone);
+out:
+	loop_dio_put(dio);
+}
+
 /*
  * Add bio to back of pending list
  */
@@ -489,6 +816,13 @@ static void loop_make_request(struct request_queue *q, struct bio *old_bio)
 		goto out;
 	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
 		goto out;
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) && old_bio->bi_bdev &&
+	    loop_dio_single(lo, old_bio)) {
+		atomic_inc(&lo->lo_dio_inflight);
+		spin_unlock_irq(&lo->lo_lock);
+		loop_dio_submit(lo, old_bio);
+		return;
+	}
 	loop_add_bio(lo, old_bio);
 	wake_up(&lo->lo_event);
 	spin_unlock_irq(&lo->lo_lock);
@@ -501,16 +835,25 @@ out:
 
 struct switch_request {
 	struct file *file;
+	int direct_io;			/* -1: leave alone */
+	struct loop_extent *extents;
+	unsigned int nr_extents;
+	int error;
 	struct completion wait;
 };
 
 static void do_loop_switch(struct loop_device *, struct switch_request *);
+static void loop_update_dio(struct loop_device *, struct switch_request *);
 
 static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 {
 	if (unlikely(!bio->bi_bdev)) {
 		do_loop_switch(lo, bio->bi_private);
 		bio_put(bio);
+	} else if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		/* too big for one clone, or queued before the switch */
+		atomic_inc(&lo->lo_dio_inflight);
+		loop_dio_submit(lo, bio);
 	} else {
 		int ret = do_bio_filebacked(lo, bio);
 		bio_endio(bio, ret);
@@ -560,19 +903,28 @@ static int loop_thread(void *data)
  * First it needs to flush existing IO, it does this by sending a magic
  * BIO down the pipe. The completion of this BIO does the actual switch.
  */
-static int loop_switch(struct loop_device *lo, struct file *file)
+static int loop_send_switch(struct loop_device *lo, struct switch_request *w)
 {
-	struct switch_request w;
 	struct bio *bio = bio_alloc(GFP_KERNEL, 0);
 	if (!bio)
 		return -ENOMEM;
-	init_completion(&w.wait);
-	w.file = file;
-	bio->bi_private = &w;
+	init_completion(&w->wait);
+	w->error = 0;
+	bio->bi_private = w;
 	bio->bi_bdev = NULL;
 	loop_make_request(lo->lo_queue, bio);
-	wait_for_completion(&w.wait);
-	return 0;
+	wait_for_completion(&w->wait);
+	return w->error;
+}
+
+static int loop_switch(struct loop_device *lo, struct file *file)
+{
+	struct switch_request w = {
+		.file		= file,
+		.direct_io	= -1,
+	};
+
+	return loop_send_switch(lo, &w);
 }
 
 /*
@@ -587,6 +939,41 @@ static int loop_flush(struct loop_device *lo)
 	return loop_switch(lo, NULL);
 }
 
+/*
+ * Switch direct I/O on or off.  This runs in the loop thread, so every bio
+ * queued before the switch has been handled through the page cache by now.
+ * Write that back and drop it before the first bio goes around it, and
+ * drop anything cached meanwhile once the last direct bio is done.
+ */
+static void loop_update_dio(struct loop_device *lo, struct switch_request *p)
+{
+	struct address_space *mapping = lo->lo_backing_file->f_mapping;
+
+	if (p->direct_io) {
+		p->error = filemap_write_and_wait(mapping);
+		if (!p->error)
+			p->error = invalidate_inode_pages2(mapping);
+		if (p->error)
+			return;
+
+		spin_lock_irq(&lo->lo_lock);
+		lo->lo_extents = p->extents;
+		lo->lo_nr_extents = p->nr_extents;
+		lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+		spin_unlock_irq(&lo->lo_lock);
+	} else {
+		spin_lock_irq(&lo->lo_lock);
+		lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+		spin_unlock_irq(&lo->lo_lock);
+
+		wait_event(lo->lo_event, !atomic_read(&lo->lo_dio_inflight));
+		invalidate_inode_pages2(mapping);
+		p->extents = lo->lo_extents;
+		lo->lo_extents = NULL;
+		lo->lo_nr_extents = 0;
+	}
+}
+
 /*
  * Do the actual switch; called from the BIO completion routine
  */
@@ -596,6 +983,11 @@ static void do_loop_switch(struct loop_device *lo, struct switch_request *p)
 	struct file *old_file = lo->lo_backing_file;
 	struct address_space *mapping;
 
+	if (p->direct_io >= 0) {
+		loop_update_dio(lo, p);
+		goto out;
+	}
+
 	/* if no new file, only flush of queued bios requested */
 	if (!file)
 		goto out;
@@ -636,6 +1028,11 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
 		goto out;
 
+	/* and not mapped onto the old file's blocks */
+	error = -EBUSY;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		goto out;
+
 	error = -EBADF;
 	file = fget(arg);
 	if (!file)
@@ -743,11 +1140,19 @@ static ssize_t loop_attr_partscan_show(struct loop_device *lo, char *buf)
 	return sprintf(buf, "%s\n", partscan ? "1" : "0");
 }
 
+static ssize_t loop_attr_dio_show(struct loop_device *lo, char *buf)
+{
+	int dio = (lo->lo_flags & LO_FLAGS_DIRECT_IO);
+
+	return sprintf(buf, "%s\n", dio ? "1" : "0");
+}
+
 LOOP_ATTR_RO(backing_file);
 LOOP_ATTR_RO(offset);
 LOOP_ATTR_RO(sizelimit);
 LOOP_ATTR_RO(autoclear);
 LOOP_ATTR_RO(partscan);
+LOOP_ATTR_RO(dio);
 
 static struct attribute *loop_attrs[] = {
 	&loop_attr_backing_file.attr,
@@ -755,6 +1160,7 @@ static struct attribute *loop_attrs[] = {
 	&loop_attr_sizelimit.attr,
 	&loop_attr_autoclear.attr,
 	&loop_attr_partscan.attr,
+	&loop_attr_dio.attr,
 	NULL,
 };
 
@@ -785,10 +1191,12 @@ static void loop_config_discard(struct loop_device *lo)
 	 * We use punch hole to reclaim the free space used by the
 	 * image a.k.a. discard. However we do support discard if
 	 * encryption is enabled, because it may give an attacker
-	 * useful information.
+	 * useful information.  Nor in direct I/O mode, which relies on
+	 * the file's blocks staying where they are.
 	 */
 	if ((!file->f_op->fallocate) ||
-	    lo->lo_encrypt_key_size) {
+	    lo->lo_encrypt_key_size ||
+	    (lo->lo_flags & LO_FLAGS_DIRECT_IO)) {
 		q->limits.discard_granularity = 0;
 		q->limits.discard_alignment = 0;
 		q->limits.max_discard_sectors = 0;
@@ -804,6 +1212,34 @@ static void loop_config_discard(struct loop_device *lo)
 	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, q);
 }
 
+/*
+ * While in direct I/O mode the backing file is marked as a swap file, which
+ * keeps it from being truncated or having its blocks moved, just as for
+ * swapon.
+ */
+static int loop_dio_claim_file(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+	int err = 0;
+
+	mutex_lock(&inode->i_mutex);
+	if (IS_SWAPFILE(inode))
+		err = -EBUSY;
+	else
+		inode->i_flags |= S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+	return err;
+}
+
+static void loop_dio_release_file(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+
+	mutex_lock(&inode->i_mutex);
+	inode->i_flags &= ~S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+}
+
 static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 		       struct block_device *bdev, unsigned int arg)
 {
@@ -993,6 +1429,15 @@ static int loop_clr_fd(struct loop_device *lo)
 
 	kthread_stop(lo->lo_thread);
 
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		wait_event(lo->lo_event, !atomic_read(&lo->lo_dio_inflight));
+		invalidate_inode_pages2(filp->f_mapping);
+		vfree(lo->lo_extents);
+		lo->lo_extents = NULL;
+		lo->lo_nr_extents = 0;
+		loop_dio_release_file(filp);
+	}
+
 	spin_lock_irq(&lo->lo_lock);
 	lo->lo_backing_file = NULL;
 	spin_unlock_irq(&lo->lo_lock);
@@ -1055,6 +1500,12 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		return -ENXIO;
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
+	/* the block map only holds for the current offset and size */
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+	    (info->lo_encrypt_type ||
+	     lo->lo_offset != info->lo_offset ||
+	     lo->lo_sizelimit != info->lo_sizelimit))
+		return -EBUSY;
 
 	err = loop_release_xfer(lo);
 	if (err)
@@ -1254,6 +1705,43 @@ loop_get_status64(struct loop_device *lo, struct loop_info64 __user *arg) {
 	return err;
 }
 
+static int loop_set_dio(struct loop_device *lo, unsigned long arg)
+{
+	struct switch_request w = {
+		.direct_io	= !!arg,
+	};
+	struct file *file = lo->lo_backing_file;
+	int err;
+
+	if (lo->lo_state != Lo_bound)
+		return -ENXIO;
+	if (!!arg == !!(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return 0;
+
+	if (arg) {
+		err = loop_dio_claim_file(file);
+		if (err)
+			return err;
+		err = loop_map_extents(lo, &w.extents, &w.nr_extents);
+		if (!err)
+			err = loop_send_switch(lo, &w);
+		if (err) {
+			vfree(w.extents);
+			loop_dio_release_file(file);
+			return err;
+		}
+	} else {
+		err = loop_send_switch(lo, &w);
+		if (err)
+			return err;
+		vfree(w.extents);
+		loop_dio_release_file(file);
+	}
+
+	loop_config_discard(lo);
+	return 0;
+}
+
 static int loop_set_capacity(struct loop_device *lo, struct block_device *bdev)
 {
 	int err;
@@ -1263,6 +1751,9 @@ static int loop_set_capacity(struct loop_device *lo, struct block_device *bdev)
 	err = -ENXIO;
 	if (unlikely(lo->lo_state != Lo_bound))
 		goto out;
+	err = -EBUSY;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		goto out;
 	err = figure_loop_size(lo, lo->lo_offset, lo->lo_sizelimit);
 	if (unlikely(err))
 		goto out;
@@ -1323,6 +1814,12 @@ static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
 			err = loop_set_capacity(lo, bdev);
 		break;
+	case LOOP_SET_DIRECT_IO:
+		/* this bypasses the file system, write access is not enough */
+		err = -EPERM;
+		if (capable(CAP_SYS_ADMIN))
+			err = loop_set_dio(lo, arg);
+		break;
 	default:
 		err = lo->ioctl ? lo->ioctl(lo, cmd, arg) : -EINVAL;
 	}
@@ -1477,6 +1974,7 @@ static int lo_compat_ioctl(struct block_device *bdev, fmode_t mode,
 		arg = (unsigned long) compat_ptr(arg);
 	case LOOP_SET_FD:
 	case LOOP_CHANGE_FD:
+	case LOOP_SET_DIRECT_IO:
 		err = lo_ioctl(bdev, mode, cmd, arg);
 		break;
 	default:
@@ -1669,6 +2167,7 @@ static int loop_add(struct loop_device **l, int i)
 	lo->lo_number		= i;
 	lo->lo_thread		= NULL;
 	init_waitqueue_head(&lo->lo_event);
+	atomic_set(&lo->lo_dio_inflight, 0);
 	spin_lock_init(&lo->lo_lock);
 	disk->major		= LOOP_MAJOR;
 	disk->first_minor	= i << part_shift;
@@ -1866,8 +2365,18 @@ static int __init loop_init(void)
 		range = 1UL << MINORBITS;
 	}
 
-	if (register_blkdev(LOOP_MAJOR, "loop"))
-		return -EIO;
+	loop_dio_pool = mempool_create_kmalloc_pool(BIO_POOL_SIZE,
+						    sizeof(struct loop_dio));
+	loop_dio_bs = bioset_create(BIO_POOL_SIZE, 0);
+	if (!loop_dio_pool || !loop_dio_bs) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	if (register_blkdev(LOOP_MAJOR, "loop")) {
+		err = -EIO;
+		goto out_free;
+	}
 
 	blk_register_region(MKDEV(LOOP_MAJOR, 0), range,
 				  THIS_MODULE, loop_probe, NULL, NULL);
@@ -1880,6 +2389,14 @@ static int __init loop_init(void)
 
 	printk(KERN_INFO "loop: module loaded\n");
 	return 0;
+
+out_free:
+	if (loop_dio_bs)
+		bioset_free(loop_dio_bs);
+	if (loop_dio_pool)
+		mempool_destroy(loop_dio_pool);
+	misc_deregister(&loop_misc);
+	return err;
 }
 
 static int loop_exit_cb(int id, void *ptr, void *data)
@@ -1903,6 +2420,8 @@ static void __exit loop_exit(void)
 	blk_unregister_region(MKDEV(LOOP_MAJOR, 0), range);
 	unregister_blkdev(LOOP_MAJOR, "loop");
 
+	bioset_free(loop_dio_bs);
+	mempool_destroy(loop_dio_pool);
 	misc_deregister(&loop_misc);
 }
 
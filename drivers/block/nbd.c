@@ -115,7 +115,7 @@ static void nbd_end_request(struct request *req)
 	spin_unlock_irqrestore(q->queue_lock, flags);
 }
 
-static void sock_shutdown(struct nbd_device *nbd, int lock)
+static void sock_shutdown(struct nbd_sock *nsock)
 {
 	/* Forcibly shutdown the socket causing all listeners
 	 * to error
@@ -123,15 +123,7 @@ static void sock_shutdown(struct nbd_device *nbd, int lock)
 	 * FIXME: This code is duplicated from sys_shutdown, but
 	 * there should be a more generic interface rather than
 	 * calling socket ops directly here */
-	if (lock)
-		mutex_lock(&nbd->tx_lock);
-	if (nbd->sock) {
-		dev_warn(disk_to_dev(nbd->disk), "shutting down socket\n");
-		kernel_sock_shutdown(nbd->sock, SHUT_RDWR);
-		nbd->sock = NULL;
-	}
-	if (lock)
-		mutex_unlock(&nbd->tx_lock);
+	kernel_sock_shutdown(nsock->sock, SHUT_RDWR);
 }
 
 static void nbd_xmit_timeout(unsigned long arg)
@@ -146,10 +138,11 @@ static void nbd_xmit_timeout(unsigned long arg)
 /*
  *  Send or receive packet.
  */
-static int sock_xmit(struct nbd_device *nbd, int send, void *buf, int size,
+static int sock_xmit(struct nbd_sock *nsock, int send, void *buf, int size,
 		int msg_flags)
 {
-	struct socket *sock = nbd->sock;
+	struct nbd_device *nbd = nsock->nbd;
+	struct socket *sock = nsock->sock;
 	int result;
 	struct msghdr msg;
 	struct kvec iov;
@@ -200,7 +193,7 @@ static int sock_xmit(struct nbd_device *nbd, int send, void *buf, int size,
 				task_pid_nr(current), current->comm,
 				dequeue_signal_lock(current, &current->blocked, &info));
 			result = -EINTR;
-			sock_shutdown(nbd, !send);
+			sock_shutdown(nsock);
 			break;
 		}
 
@@ -218,20 +211,21 @@ static int sock_xmit(struct nbd_device *nbd, int send, void *buf, int size,
 	return result;
 }
 
-static inline int sock_send_bvec(struct nbd_device *nbd, struct bio_vec *bvec,
+static inline int sock_send_bvec(struct nbd_sock *nsock, struct bio_vec *bvec,
 		int flags)
 {
 	int result;
 	void *kaddr = kmap(bvec->bv_page);
-	result = sock_xmit(nbd, 1, kaddr + bvec->bv_offset,
+	result = sock_xmit(nsock, 1, kaddr + bvec->bv_offset,
 			   bvec->bv_len, flags);
 	kunmap(bvec->bv_page);
 	return result;
 }
 
-/* always call with the tx_lock held */
-static int nbd_send_req(struct nbd_device *nbd, struct request *req)
+/* always call with the connection's tx_lock held */
+static int nbd_send_req(struct nbd_sock *nsock, struct request *req)
 {
+	struct nbd_device *nbd = nsock->nbd;
 	int result, flags;
 	struct nbd_request request;
 	unsigned long size = blk_rq_bytes(req);
@@ -242,12 +236,12 @@ static int nbd_send_req(struct nbd_device *nbd, struct request *req)
 	request.len = htonl(size);
 	memcpy(request.handle, &req, sizeof(req));
 
-	dprintk(DBG_TX, "%s: request %p: sending control (%s@%llu,%uB)\n",
+	dprintk(DBG_TX, "%s: request %p: sending control (%s@%llu,%uB) on %d\n",
 			nbd->disk->disk_name, req,
 			nbdcmd_to_ascii(nbd_cmd(req)),
 			(unsigned long long)blk_rq_pos(req) << 9,
-			blk_rq_bytes(req));
-	result = sock_xmit(nbd, 1, &request, sizeof(request),
+			blk_rq_bytes(req), nsock->index);
+	result = sock_xmit(nsock, 1, &request, sizeof(request),
 			(nbd_cmd(req) == NBD_CMD_WRITE) ? MSG_MORE : 0);
 	if (result <= 0) {
 		dev_err(disk_to_dev(nbd->disk),
@@ -268,7 +262,7 @@ static int nbd_send_req(struct nbd_device *nbd, struct request *req)
 				flags = MSG_MORE;
 			dprintk(DBG_TX, "%s: request %p: sending %d bytes data\n",
 					nbd->disk->disk_name, req, bvec->bv_len);
-			result = sock_send_bvec(nbd, bvec, flags);
+			result = sock_send_bvec(nsock, bvec, flags);
 			if (result <= 0) {
 				dev_err(disk_to_dev(nbd->disk),
 					"Send data failed (result %d)\n",
@@ -283,25 +277,26 @@ error_out:
 	return -EIO;
 }
 
-static struct request *nbd_find_request(struct nbd_device *nbd,
+static struct request *nbd_find_request(struct nbd_sock *nsock,
 					struct request *xreq)
 {
 	struct request *req, *tmp;
 	int err;
 
-	err = wait_event_interruptible(nbd->active_wq, nbd->active_req != xreq);
+	err = wait_event_interruptible(nsock->active_wq,
+				       nsock->active_req != xreq);
 	if (unlikely(err))
 		goto out;
 
-	spin_lock(&nbd->queue_lock);
-	list_for_each_entry_safe(req, tmp, &nbd->queue_head, queuelist) {
+	spin_lock(&nsock->queue_lock);
+	list_for_each_entry_safe(req, tmp, &nsock->queue_head, queuelist) {
 		if (req != xreq)
 			continue;
 		list_del_init(&req->queuelist);
-		spin_unlock(&nbd->queue_lock);
+		spin_unlock(&nsock->queue_lock);
 		return req;
 	}
-	spin_unlock(&nbd->queue_lock);
+	spin_unlock(&nsock->queue_lock);
 
 	err = -ENOENT;
 
@@ -309,25 +304,39 @@ out:
 	return ERR_PTR(err);
 }
 
-static inline int sock_recv_bvec(struct nbd_device *nbd, struct bio_vec *bvec)
+static inline int sock_recv_bvec(struct nbd_sock *nsock, struct bio_vec *bvec)
 {
 	int result;
 	void *kaddr = kmap(bvec->bv_page);
-	result = sock_xmit(nbd, 0, kaddr + bvec->bv_offset, bvec->bv_len,
+	result = sock_xmit(nsock, 0, kaddr + bvec->bv_offset, bvec->bv_len,
 			MSG_WAITALL);
 	kunmap(bvec->bv_page);
 	return result;
 }
 
-/* NULL returned = something went wrong, inform userspace */
-static struct request *nbd_read_stat(struct nbd_device *nbd)
+/*
+ * Put a request back at the head of the queue for whichever connection
+ * is free next.  If none is left, nbd_clear_que() fails it.
+ */
+static void nbd_requeue_req(struct nbd_device *nbd, struct request *req)
 {
+	spin_lock_irq(&nbd->queue_lock);
+	list_add(&req->queuelist, &nbd->waiting_queue);
+	spin_unlock_irq(&nbd->queue_lock);
+
+	wake_up(&nbd->waiting_wq);
+}
+
+/* NULL returned = something went wrong, the connection is lost */
+static struct request *nbd_read_stat(struct nbd_sock *nsock)
+{
+	struct nbd_device *nbd = nsock->nbd;
 	int result;
 	struct nbd_reply reply;
 	struct request *req;
 
 	reply.magic = 0;
-	result = sock_xmit(nbd, 0, &reply, sizeof(reply), MSG_WAITALL);
+	result = sock_xmit(nsock, 0, &reply, sizeof(reply), MSG_WAITALL);
 	if (result <= 0) {
 		dev_err(disk_to_dev(nbd->disk),
 			"Receive control failed (result %d)\n", result);
@@ -341,7 +350,7 @@ static struct request *nbd_read_stat(struct nbd_device *nbd)
 		goto harderror;
 	}
 
-	req = nbd_find_request(nbd, *(struct request **)reply.handle);
+	req = nbd_find_request(nsock, *(struct request **)reply.handle);
 	if (IS_ERR(req)) {
 		result = PTR_ERR(req);
 		if (result != -ENOENT)
@@ -360,19 +369,20 @@ static struct request *nbd_read_stat(struct nbd_device *nbd)
 		return req;
 	}
 
-	dprintk(DBG_RX, "%s: request %p: got reply\n",
-			nbd->disk->disk_name, req);
+	dprintk(DBG_RX, "%s: request %p: got reply on %d\n",
+			nbd->disk->disk_name, req, nsock->index);
 	if (nbd_cmd(req) == NBD_CMD_READ) {
 		struct req_iterator iter;
 		struct bio_vec *bvec;
 
 		rq_for_each_segment(bvec, req, iter) {
-			result = sock_recv_bvec(nbd, bvec);
+			result = sock_recv_bvec(nsock, bvec);
 			if (result <= 0) {
 				dev_err(disk_to_dev(nbd->disk), "Receive data failed (result %d)\n",
 					result);
-				req->errors++;
-				return req;
+				/* the connection is gone, read it elsewhere */
+				nbd_requeue_req(nbd, req);
+				goto harderror;
 			}
 			dprintk(DBG_RX, "%s: request %p: got %d bytes data\n",
 				nbd->disk->disk_name, req, bvec->bv_len);
@@ -384,6 +394,62 @@ harderror:
 	return NULL;
 }
 
+/*
+ * @nsock's receiver has lost the connection.  Requests sent on it that
+ * were not answered are handed to the remaining connections, which
+ * send them again; reads and writes of the same blocks can be repeated.
+ * The last connection to go leaves its requests for nbd_clear_que().
+ */
+static void nbd_sock_dead(struct nbd_sock *nsock)
+{
+	struct nbd_device *nbd = nsock->nbd;
+	int live;
+
+	sock_shutdown(nsock);
+
+	/* the sender puts what it has sent on queue_head under tx_lock */
+	mutex_lock(&nsock->tx_lock);
+	nsock->dead = true;
+
+	spin_lock_irq(&nbd->queue_lock);
+	live = --nbd->live_connections;
+	if (live) {
+		spin_lock(&nsock->queue_lock);
+		list_splice_init(&nsock->queue_head, &nbd->waiting_queue);
+		spin_unlock(&nsock->queue_lock);
+	}
+	spin_unlock_irq(&nbd->queue_lock);
+	mutex_unlock(&nsock->tx_lock);
+
+	dev_warn(disk_to_dev(nbd->disk), "connection %d lost, %d left\n",
+		 nsock->index, live);
+
+	if (live)
+		wake_up(&nbd->waiting_wq);
+	else
+		wake_up(&nbd->conn_wq);
+}
+
+static int nbd_recv_thread(void *data)
+{
+	struct nbd_sock *nsock = data;
+	struct request *req;
+
+	while ((req = nbd_read_stat(nsock)) != NULL)
+		nbd_end_request(req);
+
+	nbd_sock_dead(nsock);
+
+	/* stay around for kthread_stop() */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
 static ssize_t pid_show(struct device *dev,
 			struct device_attribute *attr, char *buf)
 {
@@ -398,10 +464,67 @@ static struct device_attribute pid_attr = {
 	.show = pid_show,
 };
 
+static ssize_t connections_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct nbd_device *nbd = dev_to_disk(dev)->private_data;
+
+	return sprintf(buf, "%d %d\n", ACCESS_ONCE(nbd->live_connections),
+		       nbd->num_connections);
+}
+
+static struct device_attribute connections_attr = {
+	.attr = { .name = "connections", .mode = S_IRUGO},
+	.show = connections_show,
+};
+
+static int nbd_thread(void *data);
+
+static int nbd_start_sock(struct nbd_sock *nsock)
+{
+	struct nbd_device *nbd = nsock->nbd;
+	struct task_struct *thread;
+
+	thread = kthread_create(nbd_thread, nsock, "%s-send%d",
+				nbd->disk->disk_name, nsock->index);
+	if (IS_ERR(thread))
+		return PTR_ERR(thread);
+	nsock->send_thread = thread;
+
+	thread = kthread_create(nbd_recv_thread, nsock, "%s-recv%d",
+				nbd->disk->disk_name, nsock->index);
+	if (IS_ERR(thread)) {
+		kthread_stop(nsock->send_thread);
+		nsock->send_thread = NULL;
+		return PTR_ERR(thread);
+	}
+	nsock->recv_thread = thread;
+
+	spin_lock_irq(&nbd->queue_lock);
+	nbd->live_connections++;
+	spin_unlock_irq(&nbd->queue_lock);
+
+	wake_up_process(nsock->send_thread);
+	wake_up_process(nsock->recv_thread);
+	return 0;
+}
+
+static void nbd_shutdown_socks(struct nbd_device *nbd)
+{
+	int i;
+
+	for (i = 0; i < nbd->num_connections; i++)
+		sock_shutdown(nbd->socks[i]);
+}
+
+/*
+ * Serve the device over every connection set up with NBD_SET_SOCK,
+ * until the last of them is lost or nbd-client is killed.
+ */
 static int nbd_do_it(struct nbd_device *nbd)
 {
-	struct request *req;
-	int ret;
+	struct nbd_sock *nsock;
+	int i, ret;
 
 	BUG_ON(nbd->magic != NBD_MAGIC);
 
@@ -412,44 +535,110 @@ static int nbd_do_it(struct nbd_device *nbd)
 		nbd->pid = 0;
 		return ret;
 	}
+	if (device_create_file(disk_to_dev(nbd->disk), &connections_attr))
+		dev_warn(disk_to_dev(nbd->disk),
+			 "could not create connections attribute\n");
 
-	while ((req = nbd_read_stat(nbd)) != NULL)
-		nbd_end_request(req);
+	for (i = 0; i < nbd->num_connections; i++) {
+		ret = nbd_start_sock(nbd->socks[i]);
+		if (ret) {
+			dev_err(disk_to_dev(nbd->disk),
+				"could not start connection %d\n", i);
+			/* tear down what did start, like a lost connection */
+			nbd->harderror = ret;
+			ret = 0;
+			nbd_shutdown_socks(nbd);
+			break;
+		}
+	}
+
+	if (i && wait_event_interruptible(nbd->conn_wq,
+				!ACCESS_ONCE(nbd->live_connections))) {
+		/* nbd-client was killed, take all the connections down */
+		nbd_shutdown_socks(nbd);
+		wait_event(nbd->conn_wq, !ACCESS_ONCE(nbd->live_connections));
+	}
+
+	for (i = 0; i < nbd->num_connections; i++) {
+		nsock = nbd->socks[i];
+		if (!nsock->send_thread)
+			break;
+		kthread_stop(nsock->send_thread);
+		kthread_stop(nsock->recv_thread);
+		nsock->send_thread = nsock->recv_thread = NULL;
+	}
 
+	device_remove_file(disk_to_dev(nbd->disk), &connections_attr);
 	device_remove_file(disk_to_dev(nbd->disk), &pid_attr);
 	nbd->pid = 0;
-	return 0;
+	return ret;
 }
 
-static void nbd_clear_que(struct nbd_device *nbd)
+static void nbd_fail_list(struct list_head *list)
 {
 	struct request *req;
 
+	while (!list_empty(list)) {
+		req = list_entry(list->next, struct request, queuelist);
+		list_del_init(&req->queuelist);
+		req->errors++;
+		nbd_end_request(req);
+	}
+}
+
+static void nbd_clear_que(struct nbd_device *nbd, int n)
+{
+	struct nbd_sock *nsock;
+	LIST_HEAD(waiting);
+	int i;
+
 	BUG_ON(nbd->magic != NBD_MAGIC);
 
 	/*
-	 * Because we have set nbd->sock to NULL under the tx_lock, all
-	 * modifications to the list must have completed by now.  For
-	 * the same reason, the active_req must be NULL.
+	 * No thread is running by now, so nothing is added to the
+	 * connections' lists and their active_req must be NULL.
 	 *
-	 * As a consequence, we don't need to take the spin lock while
-	 * purging the list here.
+	 * As a consequence, we don't need to take their spin locks while
+	 * purging them here.  num_connections is 0 already, so nothing
+	 * is added to the waiting queue either.
 	 */
-	BUG_ON(nbd->sock);
-	BUG_ON(nbd->active_req);
-
-	while (!list_empty(&nbd->queue_head)) {
-		req = list_entry(nbd->queue_head.next, struct request,
-				 queuelist);
-		list_del_init(&req->queuelist);
-		req->errors++;
-		nbd_end_request(req);
+	for (i = 0; i < n; i++) {
+		nsock = nbd->socks[i];
+		BUG_ON(nsock->active_req);
+		nbd_fail_list(&nsock->queue_head);
 	}
+
+	spin_lock_irq(&nbd->queue_lock);
+	list_splice_init(&nbd->waiting_queue, &waiting);
+	spin_unlock_irq(&nbd->queue_lock);
+	nbd_fail_list(&waiting);
 }
 
+/* Must be called with tx_lock held, and no thread running */
+static void nbd_clear_sock(struct nbd_device *nbd)
+{
+	struct nbd_sock *nsock;
+	int i, n = nbd->num_connections;
+
+	/* do_nbd_request() fails requests from now on, rather than queue */
+	spin_lock_irq(&nbd->queue_lock);
+	nbd->num_connections = 0;
+	spin_unlock_irq(&nbd->queue_lock);
+
+	nbd_clear_que(nbd, n);
 
-static void nbd_handle_req(struct nbd_device *nbd, struct request *req)
+	for (i = 0; i < n; i++) {
+		nsock = nbd->socks[i];
+		nbd->socks[i] = NULL;
+		fput(nsock->file);
+		kfree(nsock);
+	}
+}
+
+static void nbd_handle_req(struct nbd_sock *nsock, struct request *req)
 {
+	struct nbd_device *nbd = nsock->nbd;
+
 	if (req->cmd_type != REQ_TYPE_FS)
 		goto error_out;
 
@@ -465,29 +654,38 @@ static void nbd_handle_req(struct nbd_device *nbd, struct request *req)
 
 	req->errors = 0;
 
-	mutex_lock(&nbd->tx_lock);
-	if (unlikely(!nbd->sock)) {
-		mutex_unlock(&nbd->tx_lock);
-		dev_err(disk_to_dev(nbd->disk),
-			"Attempted send on closed socket\n");
-		goto error_out;
+	mutex_lock(&nsock->tx_lock);
+	if (unlikely(nsock->dead || nsock->tx_dead)) {
+		mutex_unlock(&nsock->tx_lock);
+		nbd_requeue_req(nbd, req);
+		return;
 	}
 
-	nbd->active_req = req;
+	nsock->active_req = req;
 
-	if (nbd_send_req(nbd, req) != 0) {
-		dev_err(disk_to_dev(nbd->disk), "Request send failed\n");
-		req->errors++;
-		nbd_end_request(req);
-	} else {
-		spin_lock(&nbd->queue_lock);
-		list_add(&req->queuelist, &nbd->queue_head);
-		spin_unlock(&nbd->queue_lock);
+	if (nbd_send_req(nsock, req) != 0) {
+		dev_err(disk_to_dev(nbd->disk),
+			"Request send failed on connection %d\n", nsock->index);
+		/*
+		 * The receiver notices and fails the connection over.  Until
+		 * then, don't take any more requests for it.
+		 */
+		nsock->tx_dead = true;
+		sock_shutdown(nsock);
+		nsock->active_req = NULL;
+		mutex_unlock(&nsock->tx_lock);
+		wake_up_all(&nsock->active_wq);
+		nbd_requeue_req(nbd, req);
+		return;
 	}
 
-	nbd->active_req = NULL;
-	mutex_unlock(&nbd->tx_lock);
-	wake_up_all(&nbd->active_wq);
+	spin_lock(&nsock->queue_lock);
+	list_add(&req->queuelist, &nsock->queue_head);
+	spin_unlock(&nsock->queue_lock);
+
+	nsock->active_req = NULL;
+	mutex_unlock(&nsock->tx_lock);
+	wake_up_all(&nsock->active_wq);
 
 	return;
 
@@ -496,30 +694,38 @@ error_out:
 	nbd_end_request(req);
 }
 
+/*
+ * One per connection.  They all feed from the device's waiting queue,
+ * so requests go to whichever connection is free to send them.
+ */
 static int nbd_thread(void *data)
 {
-	struct nbd_device *nbd = data;
+	struct nbd_sock *nsock = data;
+	struct nbd_device *nbd = nsock->nbd;
 	struct request *req;
 
 	set_user_nice(current, -20);
-	while (!kthread_should_stop() || !list_empty(&nbd->waiting_queue)) {
+	while (!kthread_should_stop()) {
 		/* wait for something to do */
 		wait_event_interruptible(nbd->waiting_wq,
 					 kthread_should_stop() ||
-					 !list_empty(&nbd->waiting_queue));
+					 (!nsock->dead && !nsock->tx_dead &&
+					  !list_empty(&nbd->waiting_queue)));
 
 		/* extract request */
-		if (list_empty(&nbd->waiting_queue))
-			continue;
-
 		spin_lock_irq(&nbd->queue_lock);
+		if (nsock->dead || nsock->tx_dead ||
+		    list_empty(&nbd->waiting_queue)) {
+			spin_unlock_irq(&nbd->queue_lock);
+			continue;
+		}
 		req = list_entry(nbd->waiting_queue.next, struct request,
 				 queuelist);
 		list_del_init(&req->queuelist);
 		spin_unlock_irq(&nbd->queue_lock);
 
 		/* handle request */
-		nbd_handle_req(nbd, req);
+		nbd_handle_req(nsock, req);
 	}
 	return 0;
 }
@@ -534,7 +740,7 @@ static int nbd_thread(void *data)
 static void do_nbd_request(struct request_queue *q)
 {
 	struct request *req;
-	
+
 	while ((req = blk_fetch_request(q)) != NULL) {
 		struct nbd_device *nbd;
 
@@ -547,7 +753,9 @@ static void do_nbd_request(struct request_queue *q)
 
 		BUG_ON(nbd->magic != NBD_MAGIC);
 
-		if (unlikely(!nbd->sock)) {
+		spin_lock_irq(&nbd->queue_lock);
+		if (unlikely(!nbd->num_connections)) {
+			spin_unlock_irq(&nbd->queue_lock);
 			dev_err(disk_to_dev(nbd->disk),
 				"Attempted send on closed socket\n");
 			req->errors++;
@@ -555,8 +763,6 @@ static void do_nbd_request(struct request_queue *q)
 			spin_lock_irq(q->queue_lock);
 			continue;
 		}
-
-		spin_lock_irq(&nbd->queue_lock);
 		list_add_tail(&req->queuelist, &nbd->waiting_queue);
 		spin_unlock_irq(&nbd->queue_lock);
 
@@ -573,42 +779,62 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 {
 	switch (cmd) {
 	case NBD_DISCONNECT: {
+		struct nbd_sock *nsock;
 		struct request sreq;
+		int i;
 
 		dev_info(disk_to_dev(nbd->disk), "NBD_DISCONNECT\n");
 
 		blk_rq_init(NULL, &sreq);
 		sreq.cmd_type = REQ_TYPE_SPECIAL;
 		nbd_cmd(&sreq) = NBD_CMD_DISC;
-		if (!nbd->sock)
+		if (!nbd->num_connections)
 			return -EINVAL;
-		nbd_send_req(nbd, &sreq);
+		for (i = 0; i < nbd->num_connections; i++) {
+			nsock = nbd->socks[i];
+			mutex_lock(&nsock->tx_lock);
+			if (!nsock->dead && !nsock->tx_dead)
+				nbd_send_req(nsock, &sreq);
+			mutex_unlock(&nsock->tx_lock);
+		}
                 return 0;
 	}
- 
-	case NBD_CLEAR_SOCK: {
-		struct file *file;
 
-		nbd->sock = NULL;
-		file = nbd->file;
-		nbd->file = NULL;
-		nbd_clear_que(nbd);
-		BUG_ON(!list_empty(&nbd->queue_head));
-		if (file)
-			fput(file);
+	case NBD_CLEAR_SOCK:
+		/* while running, nbd_do_it() cleans up once they are down */
+		if (nbd->pid)
+			nbd_shutdown_socks(nbd);
+		else
+			nbd_clear_sock(nbd);
 		return 0;
-	}
 
 	case NBD_SET_SOCK: {
+		struct nbd_sock *nsock;
 		struct file *file;
-		if (nbd->file)
+
+		/* each call adds a connection, until the device runs */
+		if (nbd->pid || nbd->num_connections == NBD_MAX_CONNECTIONS)
 			return -EBUSY;
 		file = fget(arg);
 		if (file) {
 			struct inode *inode = file->f_path.dentry->d_inode;
 			if (S_ISSOCK(inode->i_mode)) {
-				nbd->file = file;
-				nbd->sock = SOCKET_I(inode);
+				nsock = kzalloc(sizeof(*nsock), GFP_KERNEL);
+				if (!nsock) {
+					fput(file);
+					return -ENOMEM;
+				}
+				nsock->nbd = nbd;
+				nsock->file = file;
+				nsock->sock = SOCKET_I(inode);
+				nsock->index = nbd->num_connections;
+				spin_lock_init(&nsock->queue_lock);
+				INIT_LIST_HEAD(&nsock->queue_head);
+				init_waitqueue_head(&nsock->active_wq);
+				mutex_init(&nsock->tx_lock);
+				spin_lock_irq(&nbd->queue_lock);
+				nbd->socks[nbd->num_connections++] = nsock;
+				spin_unlock_irq(&nbd->queue_lock);
 				if (max_part > 0)
 					bdev->bd_invalidated = 1;
 				return 0;
@@ -646,36 +872,20 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 		return 0;
 
 	case NBD_DO_IT: {
-		struct task_struct *thread;
-		struct file *file;
 		int error;
 
 		if (nbd->pid)
 			return -EBUSY;
-		if (!nbd->file)
+		if (!nbd->num_connections)
 			return -EINVAL;
 
 		mutex_unlock(&nbd->tx_lock);
-
-		thread = kthread_create(nbd_thread, nbd, nbd->disk->disk_name);
-		if (IS_ERR(thread)) {
-			mutex_lock(&nbd->tx_lock);
-			return PTR_ERR(thread);
-		}
-		wake_up_process(thread);
 		error = nbd_do_it(nbd);
-		kthread_stop(thread);
-
 		mutex_lock(&nbd->tx_lock);
 		if (error)
 			return error;
-		sock_shutdown(nbd, 0);
-		file = nbd->file;
-		nbd->file = NULL;
-		nbd_clear_que(nbd);
+		nbd_clear_sock(nbd);
 		dev_warn(disk_to_dev(nbd->disk), "queue cleared\n");
-		if (file)
-			fput(file);
 		nbd->bytesize = 0;
 		bdev->bd_inode->i_size = 0;
 		set_capacity(nbd->disk, 0);
@@ -689,16 +899,23 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 		 * This is for compatibility only.  The queue is always cleared
 		 * by NBD_DO_IT or NBD_CLEAR_SOCK.
 		 */
-		BUG_ON(!nbd->sock && !list_empty(&nbd->queue_head));
 		return 0;
 
-	case NBD_PRINT_DEBUG:
-		dev_info(disk_to_dev(nbd->disk),
-			"next = %p, prev = %p, head = %p\n",
-			nbd->queue_head.next, nbd->queue_head.prev,
-			&nbd->queue_head);
+	case NBD_PRINT_DEBUG: {
+		struct nbd_sock *nsock;
+		int i;
+
+		for (i = 0; i < nbd->num_connections; i++) {
+			nsock = nbd->socks[i];
+			dev_info(disk_to_dev(nbd->disk),
+				"%d: next = %p, prev = %p, head = %p%s\n", i,
+				nsock->queue_head.next, nsock->queue_head.prev,
+				&nsock->queue_head,
+				nsock->dead ? " (dead)" : "");
+		}
 		return 0;
 	}
+	}
 	return -ENOTTY;
 }
 
@@ -804,14 +1021,13 @@ static int __init nbd_init(void)
 
 	for (i = 0; i < nbds_max; i++) {
 		struct gendisk *disk = nbd_dev[i].disk;
-		nbd_dev[i].file = NULL;
+		nbd_dev[i].num_connections = 0;
 		nbd_dev[i].magic = NBD_MAGIC;
 		nbd_dev[i].flags = 0;
 		INIT_LIST_HEAD(&nbd_dev[i].waiting_queue);
 		spin_lock_init(&nbd_dev[i].queue_lock);
-		INIT_LIST_HEAD(&nbd_dev[i].queue_head);
 		mutex_init(&nbd_dev[i].tx_lock);
-		init_waitqueue_head(&nbd_dev[i].active_wq);
+		init_waitqueue_head(&nbd_dev[i].conn_wq);
 		init_waitqueue_head(&nbd_dev[i].waiting_wq);
 		nbd_dev[i].blksize = 1024;
 		nbd_dev[i].bytesize = 0;
@@ -20,6 +20,7 @@
 #include <linux/bio.h>
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/delay.h>
 #include <linux/errno.h>
 #include <linux/fs.h>
@@ -108,8 +109,6 @@ struct nvme_queue {
 	dma_addr_t sq_dma_addr;
 	dma_addr_t cq_dma_addr;
 	wait_queue_head_t sq_full;
-	wait_queue_t sq_cong_wait;
-	struct bio_list sq_cong;
 	u32 __iomem *q_db;
 	u16 q_depth;
 	u16 cq_vector;
@@ -198,15 +197,12 @@ static int alloc_cmdid_killable(struct nvme_queue *nvmeq, void *ctx,
 #define CMD_CTX_CANCELLED	(0x30C + CMD_CTX_BASE)
 #define CMD_CTX_COMPLETED	(0x310 + CMD_CTX_BASE)
 #define CMD_CTX_INVALID		(0x314 + CMD_CTX_BASE)
-#define CMD_CTX_FLUSH		(0x318 + CMD_CTX_BASE)
 
 static void special_completion(struct nvme_dev *dev, void *ctx,
 						struct nvme_completion *cqe)
 {
 	if (ctx == CMD_CTX_CANCELLED)
 		return;
-	if (ctx == CMD_CTX_FLUSH)
-		return;
 	if (ctx == CMD_CTX_COMPLETED) {
 		dev_warn(&dev->pci_dev->dev,
 				"completed id %d twice on queue %d\n",
@@ -357,33 +353,20 @@ static void nvme_free_iod(struct nvme_dev *dev, struct nvme_iod *iod)
 	kfree(iod);
 }
 
-static void requeue_bio(struct nvme_dev *dev, struct bio *bio)
-{
-	struct nvme_queue *nvmeq = get_nvmeq(dev);
-	if (bio_list_empty(&nvmeq->sq_cong))
-		add_wait_queue(&nvmeq->sq_full, &nvmeq->sq_cong_wait);
-	bio_list_add(&nvmeq->sq_cong, bio);
-	put_nvmeq(nvmeq);
-	wake_up_process(nvme_thread);
-}
-
-static void bio_completion(struct nvme_dev *dev, void *ctx,
+static void req_completion(struct nvme_dev *dev, void *ctx,
 						struct nvme_completion *cqe)
 {
 	struct nvme_iod *iod = ctx;
-	struct bio *bio = iod->private;
+	struct request *req = iod->private;
 	u16 status = le16_to_cpup(&cqe->status) >> 1;
 
-	dma_unmap_sg(&dev->pci_dev->dev, iod->sg, iod->nents,
-			bio_data_dir(bio) ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+	if (iod->nents)
+		dma_unmap_sg(&dev->pci_dev->dev, iod->sg, iod->nents,
+			rq_data_dir(req) ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
 	nvme_free_iod(dev, iod);
-	if (status) {
-		bio_endio(bio, -EIO);
-	} else if (bio->bi_vcnt > bio->bi_idx) {
-		requeue_bio(dev, bio);
-	} else {
-		bio_endio(bio, 0);
-	}
+
+	req->errors = status ? -EIO : 0;
+	blk_mq_complete_request(req);
 }
 
 /* length is in bytes.  gfp flags indicates whether we may sleep. */
@@ -468,169 +451,138 @@ static int nvme_setup_prps(struct nvme_dev *dev,
 	return total_len;
 }
 
-/* NVMe scatterlists require no holes in the virtual address */
-#define BIOVEC_NOT_VIRT_MERGEABLE(vec1, vec2)	((vec2)->bv_offset || \
-			(((vec1)->bv_offset + (vec1)->bv_len) % PAGE_SIZE))
-
-static int nvme_map_bio(struct device *dev, struct nvme_iod *iod,
-		struct bio *bio, enum dma_data_direction dma_dir, int psegs)
+/*
+ * NVMe scatterlists require no holes in the virtual address.  The queue's
+ * virt_boundary keeps the block layer from building such requests; this
+ * only catches a submitter that got around it.
+ */
+static bool nvme_sg_has_gaps(struct scatterlist *sgl, int nents)
 {
-	struct bio_vec *bvec, *bvprv = NULL;
-	struct scatterlist *sg = NULL;
-	int i, old_idx, length = 0, nsegs = 0;
+	struct scatterlist *sg;
+	int i;
 
-	sg_init_table(iod->sg, psegs);
-	old_idx = bio->bi_idx;
-	bio_for_each_segment(bvec, bio, i) {
-		if (bvprv && BIOVEC_PHYS_MERGEABLE(bvprv, bvec)) {
-			sg->length += bvec->bv_len;
-		} else {
-			if (bvprv && BIOVEC_NOT_VIRT_MERGEABLE(bvprv, bvec))
-				break;
-			sg = sg ? sg + 1 : iod->sg;
-			sg_set_page(sg, bvec->bv_page, bvec->bv_len,
-							bvec->bv_offset);
-			nsegs++;
-		}
-		length += bvec->bv_len;
-		bvprv = bvec;
+	for_each_sg(sgl, sg, nents, i) {
+		if (i && sg->offset)
+			return true;
+		if (i < nents - 1 && ((sg->offset + sg->length) % PAGE_SIZE))
+			return true;
 	}
-	bio->bi_idx = i;
-	iod->nents = nsegs;
-	sg_mark_end(sg);
-	if (dma_map_sg(dev, iod->sg, iod->nents, dma_dir) == 0) {
-		bio->bi_idx = old_idx;
-		return -ENOMEM;
-	}
-	return length;
-}
-
-static int nvme_submit_flush(struct nvme_queue *nvmeq, struct nvme_ns *ns,
-								int cmdid)
-{
-	struct nvme_command *cmnd = &nvmeq->sq_cmds[nvmeq->sq_tail];
-
-	memset(cmnd, 0, sizeof(*cmnd));
-	cmnd->common.opcode = nvme_cmd_flush;
-	cmnd->common.command_id = cmdid;
-	cmnd->common.nsid = cpu_to_le32(ns->ns_id);
-
-	if (++nvmeq->sq_tail == nvmeq->q_depth)
-		nvmeq->sq_tail = 0;
-	writel(nvmeq->sq_tail, nvmeq->q_db);
-
-	return 0;
-}
-
-static int nvme_submit_flush_data(struct nvme_queue *nvmeq, struct nvme_ns *ns)
-{
-	int cmdid = alloc_cmdid(nvmeq, (void *)CMD_CTX_FLUSH,
-					special_completion, NVME_IO_TIMEOUT);
-	if (unlikely(cmdid < 0))
-		return cmdid;
-
-	return nvme_submit_flush(nvmeq, ns, cmdid);
+	return false;
 }
 
 /*
- * Called with local interrupts disabled and the q_lock held.  May not sleep.
+ * Called from the block layer with a request for this hardware queue.
+ * May not sleep.
  */
-static int nvme_submit_bio_queue(struct nvme_queue *nvmeq, struct nvme_ns *ns,
-								struct bio *bio)
+static int nvme_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req)
 {
-	struct nvme_command *cmnd;
+	struct nvme_ns *ns = hctx->queue->queuedata;
+	struct nvme_queue *nvmeq = hctx->driver_data;
+	struct nvme_command cmnd;
 	struct nvme_iod *iod;
 	enum dma_data_direction dma_dir;
-	int cmdid, length, result = -ENOMEM;
+	unsigned long flags;
+	int cmdid, length;
 	u16 control;
 	u32 dsmgmt;
-	int psegs = bio_phys_segments(ns->queue, bio);
-
-	if ((bio->bi_rw & REQ_FLUSH) && psegs) {
-		result = nvme_submit_flush_data(nvmeq, ns);
-		if (result)
-			return result;
-	}
 
-	iod = nvme_alloc_iod(psegs, bio->bi_size, GFP_ATOMIC);
+	iod = nvme_alloc_iod(req->nr_phys_segments, blk_rq_bytes(req),
+								GFP_ATOMIC);
 	if (!iod)
-		goto nomem;
-	iod->private = bio;
+		return BLK_MQ_RQ_QUEUE_BUSY;
+	iod->private = req;
+	iod->nents = 0;
+
+	memset(&cmnd, 0, sizeof(cmnd));
+	dma_dir = rq_data_dir(req) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+
+	/* The block layer only hands us empty flushes */
+	if (req->cmd_flags & REQ_FLUSH) {
+		cmnd.common.opcode = nvme_cmd_flush;
+		cmnd.common.nsid = cpu_to_le32(ns->ns_id);
+		goto submit;
+	}
 
-	result = -EBUSY;
-	cmdid = alloc_cmdid(nvmeq, iod, bio_completion, NVME_IO_TIMEOUT);
-	if (unlikely(cmdid < 0))
-		goto free_iod;
+	sg_init_table(iod->sg, req->nr_phys_segments);
+	iod->nents = blk_rq_map_sg(hctx->queue, req, iod->sg);
+	if (WARN_ONCE(nvme_sg_has_gaps(iod->sg, iod->nents),
+				"nvme: request with SG gaps\n")) {
+		nvme_free_iod(nvmeq->dev, iod);
+		return BLK_MQ_RQ_QUEUE_ERROR;
+	}
+	if (!dma_map_sg(nvmeq->q_dmadev, iod->sg, iod->nents, dma_dir)) {
+		nvme_free_iod(nvmeq->dev, iod);
+		return BLK_MQ_RQ_QUEUE_BUSY;
+	}
 
-	if ((bio->bi_rw & REQ_FLUSH) && !psegs)
-		return nvme_submit_flush(nvmeq, ns, cmdid);
+	length = nvme_setup_prps(nvmeq->dev, &cmnd.common, iod,
+					blk_rq_bytes(req), GFP_ATOMIC);
+	if (length != blk_rq_bytes(req))
+		goto busy;
 
 	control = 0;
-	if (bio->bi_rw & REQ_FUA)
+	if (req->cmd_flags & REQ_FUA)
 		control |= NVME_RW_FUA;
-	if (bio->bi_rw & (REQ_FAILFAST_DEV | REQ_RAHEAD))
+	if (req->cmd_flags & (REQ_FAILFAST_DEV | REQ_RAHEAD))
 		control |= NVME_RW_LR;
 
 	dsmgmt = 0;
-	if (bio->bi_rw & REQ_RAHEAD)
+	if (req->cmd_flags & REQ_RAHEAD)
 		dsmgmt |= NVME_RW_DSM_FREQ_PREFETCH;
 
-	cmnd = &nvmeq->sq_cmds[nvmeq->sq_tail];
+	cmnd.rw.opcode = rq_data_dir(req) ? nvme_cmd_write : nvme_cmd_read;
+	cmnd.rw.nsid = cpu_to_le32(ns->ns_id);
+	cmnd.rw.slba = cpu_to_le64(blk_rq_pos(req) >> (ns->lba_shift - 9));
+	cmnd.rw.length = cpu_to_le16((length >> ns->lba_shift) - 1);
+	cmnd.rw.control = cpu_to_le16(control);
+	cmnd.rw.dsmgmt = cpu_to_le32(dsmgmt);
 
-	memset(cmnd, 0, sizeof(*cmnd));
-	if (bio_data_dir(bio)) {
-		cmnd->rw.opcode = nvme_cmd_write;
-		dma_dir = DMA_TO_DEVICE;
-	} else {
-		cmnd->rw.opcode = nvme_cmd_read;
-		dma_dir = DMA_FROM_DEVICE;
+ submit:
+	spin_lock_irqsave(&nvmeq->q_lock, flags);
+	cmdid = alloc_cmdid(nvmeq, iod, req_completion, NVME_IO_TIMEOUT);
+	if (unlikely(cmdid < 0)) {
+		spin_unlock_irqrestore(&nvmeq->q_lock, flags);
+		goto busy;
 	}
-
-	result = nvme_map_bio(nvmeq->q_dmadev, iod, bio, dma_dir, psegs);
-	if (result < 0)
-		goto free_iod;
-	length = result;
-
-	cmnd->rw.command_id = cmdid;
-	cmnd->rw.nsid = cpu_to_le32(ns->ns_id);
-	length = nvme_setup_prps(nvmeq->dev, &cmnd->common, iod, length,
-								GFP_ATOMIC);
-	cmnd->rw.slba = cpu_to_le64(bio->bi_sector >> (ns->lba_shift - 9));
-	cmnd->rw.length = cpu_to_le16((length >> ns->lba_shift) - 1);
-	cmnd->rw.control = cpu_to_le16(control);
-	cmnd->rw.dsmgmt = cpu_to_le32(dsmgmt);
-
-	bio->bi_sector += length >> 9;
-
+	cmnd.common.command_id = cmdid;
+	memcpy(&nvmeq->sq_cmds[nvmeq->sq_tail], &cmnd, sizeof(cmnd));
 	if (++nvmeq->sq_tail == nvmeq->q_depth)
 		nvmeq->sq_tail = 0;
 	writel(nvmeq->sq_tail, nvmeq->q_db);
+	spin_unlock_irqrestore(&nvmeq->q_lock, flags);
 
-	return 0;
+	return BLK_MQ_RQ_QUEUE_OK;
 
- free_iod:
+ busy:
+	/* The block layer retries the request shortly */
+	if (iod->nents)
+		dma_unmap_sg(nvmeq->q_dmadev, iod->sg, iod->nents, dma_dir);
 	nvme_free_iod(nvmeq->dev, iod);
- nomem:
-	return result;
+	return BLK_MQ_RQ_QUEUE_BUSY;
 }
 
-static void nvme_make_request(struct request_queue *q, struct bio *bio)
+static int nvme_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+							unsigned int i)
 {
-	struct nvme_ns *ns = q->queuedata;
-	struct nvme_queue *nvmeq = get_nvmeq(ns->dev);
-	int result = -EBUSY;
+	struct nvme_ns *ns = data;
 
-	spin_lock_irq(&nvmeq->q_lock);
-	if (bio_list_empty(&nvmeq->sq_cong))
-		result = nvme_submit_bio_queue(nvmeq, ns, bio);
-	if (unlikely(result)) {
-		if (bio_list_empty(&nvmeq->sq_cong))
-			add_wait_queue(&nvmeq->sq_full, &nvmeq->sq_cong_wait);
-		bio_list_add(&nvmeq->sq_cong, bio);
-	}
+	hctx->driver_data = ns->dev->queues[i + 1];
+	return 0;
+}
 
-	spin_unlock_irq(&nvmeq->q_lock);
-	put_nvmeq(nvmeq);
+static int nvme_poll(struct blk_mq_hw_ctx *hctx);
+
+static struct blk_mq_ops nvme_mq_ops = {
+	.queue_rq	= nvme_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.init_hctx	= nvme_init_hctx,
+	.poll		= nvme_poll,
+};
+
+static inline bool nvme_cqe_pending(struct nvme_queue *nvmeq)
+{
+	struct nvme_completion cqe = nvmeq->cqes[nvmeq->cq_head];
+	return (le16_to_cpu(cqe.status) & 1) == nvmeq->cq_phase;
 }
 
 static irqreturn_t nvme_process_cq(struct nvme_queue *nvmeq)
@@ -685,12 +637,30 @@ static irqreturn_t nvme_irq(int irq, void *data)
 static irqreturn_t nvme_irq_check(int irq, void *data)
 {
 	struct nvme_queue *nvmeq = data;
-	struct nvme_completion cqe = nvmeq->cqes[nvmeq->cq_head];
-	if ((le16_to_cpu(cqe.status) & 1) != nvmeq->cq_phase)
+	if (!nvme_cqe_pending(nvmeq))
 		return IRQ_NONE;
 	return IRQ_WAKE_THREAD;
 }
 
+/*
+ * Reap completions from a task waiting in blk_poll().  The interrupt
+ * stays enabled and may beat us to them.
+ */
+static int nvme_poll(struct blk_mq_hw_ctx *hctx)
+{
+	struct nvme_queue *nvmeq = hctx->driver_data;
+	irqreturn_t result;
+
+	if (!nvme_cqe_pending(nvmeq))
+		return 0;
+
+	spin_lock_irq(&nvmeq->q_lock);
+	result = nvme_process_cq(nvmeq);
+	spin_unlock_irq(&nvmeq->q_lock);
+
+	return result == IRQ_HANDLED;
+}
+
 static void nvme_abort_command(struct nvme_queue *nvmeq, int cmdid)
 {
 	spin_lock_irq(&nvmeq->q_lock);
@@ -909,8 +879,6 @@ static struct nvme_queue *nvme_alloc_queue(struct nvme_dev *dev, int qid,
 	nvmeq->cq_head = 0;
 	nvmeq->cq_phase = 1;
 	init_waitqueue_head(&nvmeq->sq_full);
-	init_waitqueue_entry(&nvmeq->sq_cong_wait, nvme_thread);
-	bio_list_init(&nvmeq->sq_cong);
 	nvmeq->q_db = &dev->dbs[qid << (dev->db_stride + 1)];
 	nvmeq->q_depth = depth;
 	nvmeq->cq_vector = vector;
@@ -1238,21 +1206,6 @@ static void nvme_timeout_ios(struct nvme_queue *nvmeq)
 	}
 }
 
-static void nvme_resubmit_bios(struct nvme_queue *nvmeq)
-{
-	while (bio_list_peek(&nvmeq->sq_cong)) {
-		struct bio *bio = bio_list_pop(&nvmeq->sq_cong);
-		struct nvme_ns *ns = bio->bi_bdev->bd_disk->private_data;
-		if (nvme_submit_bio_queue(nvmeq, ns, bio)) {
-			bio_list_add_head(&nvmeq->sq_cong, bio);
-			break;
-		}
-		if (bio_list_empty(&nvmeq->sq_cong))
-			remove_wait_queue(&nvmeq->sq_full,
-							&nvmeq->sq_cong_wait);
-	}
-}
-
 static int nvme_kthread(void *data)
 {
 	struct nvme_dev *dev;
@@ -1270,7 +1223,6 @@ static int nvme_kthread(void *data)
 				if (nvme_process_cq(nvmeq))
 					printk("process_cq did something\n");
 				nvme_timeout_ios(nvmeq);
-				nvme_resubmit_bios(nvmeq);
 				spin_unlock_irq(&nvmeq->q_lock);
 			}
 		}
@@ -1311,6 +1263,13 @@ static void nvme_put_ns_idx(int index)
 static struct nvme_ns *nvme_alloc_ns(struct nvme_dev *dev, int nsid,
 			struct nvme_id_ns *id, struct nvme_lba_range_type *rt)
 {
+	struct blk_mq_reg reg = {
+		.ops		= &nvme_mq_ops,
+		.nr_hw_queues	= dev->queue_count - 1,
+		.queue_depth	= NVME_Q_DEPTH - 1,
+		.numa_node	= NUMA_NO_NODE,
+		.flags		= BLK_MQ_F_SHOULD_MERGE,
+	};
 	struct nvme_ns *ns;
 	struct gendisk *disk;
 	int lbaf;
@@ -1321,16 +1280,14 @@ static struct nvme_ns *nvme_alloc_ns(struct nvme_dev *dev, int nsid,
 	ns = kzalloc(sizeof(*ns), GFP_KERNEL);
 	if (!ns)
 		return NULL;
-	ns->queue = blk_alloc_queue(GFP_KERNEL);
+	ns->dev = dev;
+	ns->queue = blk_mq_init_queue(&reg, ns);
 	if (!ns->queue)
 		goto out_free_ns;
-	ns->queue->queue_flags = QUEUE_FLAG_DEFAULT;
-	queue_flag_set_unlocked(QUEUE_FLAG_NOMERGES, ns->queue);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, ns->queue);
 /*	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, ns->queue); */
-	blk_queue_make_request(ns->queue, nvme_make_request);
-	ns->dev = dev;
-	ns->queue->queuedata = ns;
+	blk_queue_virt_boundary(ns->queue, PAGE_SIZE - 1);
+	blk_queue_flush(ns->queue, REQ_FLUSH | REQ_FUA);
 
 	disk = alloc_disk(NVME_MINORS);
 	if (!disk)
@@ -130,6 +130,8 @@ struct dio {
 	unsigned long refcount;		/* direct_io_worker() and bios */
 	struct bio *bio_list;		/* singly linked via bi_private */
 	struct task_struct *waiter;	/* waiting task (NULL if none) */
+	struct block_device *bio_bdev;	/* last bio submitted, for polling */
+	blk_qc_t bio_cookie;
 
 	/* AIO related stuff */
 	struct kiocb *iocb;		/* kiocb */
@@ -429,6 +431,15 @@ static inline void dio_bio_submit(struct dio *dio, struct dio_submit *sdio)
 	else
 		submit_bio(dio->rw, bio);
 
+	/*
+	 * Nobody but us completes a sync dio's bios, so @bio is still
+	 * around even if the I/O is already done.
+	 */
+	if (!dio->is_async) {
+		dio->bio_bdev = bio->bi_bdev;
+		dio->bio_cookie = bio->bi_cookie;
+	}
+
 	sdio->bio = NULL;
 	sdio->boundary = 0;
 	sdio->logical_offset_in_bio = 0;
@@ -466,7 +477,9 @@ static struct bio *dio_await_one(struct dio *dio)
 		__set_current_state(TASK_UNINTERRUPTIBLE);
 		dio->waiter = current;
 		spin_unlock_irqrestore(&dio->bio_lock, flags);
-		io_schedule();
+		if (!blk_qc_t_valid(dio->bio_cookie) ||
+		    !blk_poll(bdev_get_queue(dio->bio_bdev), dio->bio_cookie))
+			io_schedule();
 		/* wake up sets us TASK_RUNNING */
 		spin_lock_irqsave(&dio->bio_lock, flags);
 		dio->waiter = NULL;
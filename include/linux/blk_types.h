@@ -61,6 +61,8 @@ struct bio {
 
 	atomic_t		bi_cnt;		/* pin count */
 
+	unsigned int		bi_cookie;	/* blk_qc_t, for blk_poll() */
+
 	struct bio_vec		*bi_io_vec;	/* the actual vec list */
 
 	bio_end_io_t		*bi_end_io;
@@ -106,6 +108,37 @@ struct bio {
 #define BIO_POOL_MASK		(1UL << BIO_POOL_OFFSET)
 #define BIO_POOL_IDX(bio)	((bio)->bi_flags >> BIO_POOL_OFFSET)
 
+/*
+ * A poll cookie names the hardware queue and tag of the request a bio went
+ * into, so that the submitter can poll for its completion.  It is only
+ * valid for bios that got a request of their own on a blk-mq queue.
+ */
+typedef unsigned int blk_qc_t;
+#define BLK_QC_T_NONE		0U
+#define BLK_QC_T_VALID		(1U << 31)
+#define BLK_QC_T_SHIFT		16
+
+static inline bool blk_qc_t_valid(blk_qc_t cookie)
+{
+	return cookie & BLK_QC_T_VALID;
+}
+
+static inline blk_qc_t blk_tag_to_qc_t(unsigned int tag,
+				       unsigned int queue_num)
+{
+	return BLK_QC_T_VALID | (queue_num << BLK_QC_T_SHIFT) | tag;
+}
+
+static inline unsigned int blk_qc_t_to_queue_num(blk_qc_t cookie)
+{
+	return (cookie & ~BLK_QC_T_VALID) >> BLK_QC_T_SHIFT;
+}
+
+static inline unsigned int blk_qc_t_to_tag(blk_qc_t cookie)
+{
+	return cookie & ((1U << BLK_QC_T_SHIFT) - 1);
+}
+
 #endif /* CONFIG_BLOCK */
 
 /*
@@ -150,6 +183,8 @@ enum rq_flag_bits {
 	__REQ_FLUSH_SEQ,	/* request for flush sequence */
 	__REQ_IO_STAT,		/* account I/O stat */
 	__REQ_MIXED_MERGE,	/* merge of different types, fail separately */
+	__REQ_WB_TRACKED,	/* counted by writeback throttling */
+	__REQ_IO_HIST,		/* size counted in the I/O histogram */
 	__REQ_NR_BITS,		/* stops here */
 };
 
@@ -190,6 +225,8 @@ enum rq_flag_bits {
 #define REQ_FLUSH_SEQ		(1 << __REQ_FLUSH_SEQ)
 #define REQ_IO_STAT		(1 << __REQ_IO_STAT)
 #define REQ_MIXED_MERGE		(1 << __REQ_MIXED_MERGE)
+#define REQ_WB_TRACKED		(1 << __REQ_WB_TRACKED)
+#define REQ_IO_HIST		(1 << __REQ_IO_HIST)
 #define REQ_SECURE		(1 << __REQ_SECURE)
 
 #endif /* __LINUX_BLK_TYPES_H */
@@ -59,6 +59,9 @@
  * IRQF_NO_THREAD - Interrupt cannot be threaded
  * IRQF_EARLY_RESUME - Resume IRQ early during syscore instead of at device
  *                resume time.
+ * IRQF_THREAD_POLL - The threaded handler may be called again without a new
+ *                interrupt to poll for more events, up to a budget, and
+ *                returns IRQ_NONE once there is nothing left to do.
  */
 #define IRQF_DISABLED		0x00000020
 #define IRQF_SAMPLE_RANDOM	0x00000040
@@ -73,6 +76,7 @@
 #define IRQF_FORCE_RESUME	0x00008000
 #define IRQF_NO_THREAD		0x00010000
 #define IRQF_EARLY_RESUME	0x00020000
+#define IRQF_THREAD_POLL	0x00040000
 
 #define IRQF_TIMER		(__IRQF_TIMER | IRQF_NO_SUSPEND | IRQF_NO_THREAD)
 
@@ -90,6 +94,26 @@ enum {
 
 typedef irqreturn_t (*irq_handler_t)(int, void *);
 
+/**
+ * struct irq_thread_stats - statistics of a threaded handler
+ * @wakeups:	number of times the thread was woken to handle the irq
+ * @events:	calls of the threaded handler which returned IRQ_HANDLED
+ * @polls:	calls made by polling, without a new interrupt
+ * @budget_exhausted:	times polling stopped with events still pending
+ * @max_batch:	most events handled in a single wakeup
+ * @time_ns:	total time spent in the threaded handler
+ *
+ * Only updated by the irq thread, shown in /proc/irq/NN/name/thread_stats.
+ */
+struct irq_thread_stats {
+	unsigned long		wakeups;
+	unsigned long		events;
+	unsigned long		polls;
+	unsigned long		budget_exhausted;
+	unsigned int		max_batch;
+	u64			time_ns;
+};
+
 /**
  * struct irqaction - per interrupt action descriptor
  * @handler:	interrupt handler function
@@ -104,6 +128,9 @@ typedef irqreturn_t (*irq_handler_t)(int, void *);
  * @thread:	thread pointer for threaded interrupts
  * @thread_flags:	flags related to @thread
  * @thread_mask:	bitmask for keeping track of @thread activity
+ * @thread_prio:	SCHED_FIFO priority of @thread, 0 for SCHED_NORMAL
+ * @thread_budget:	max handler calls per wakeup with IRQF_THREAD_POLL
+ * @thread_stats:	statistics of @thread
  */
 struct irqaction {
 	irq_handler_t		handler;
@@ -118,6 +145,9 @@ struct irqaction {
 	unsigned long		thread_mask;
 	const char		*name;
 	struct proc_dir_entry	*dir;
+	unsigned int		thread_prio;
+	unsigned int		thread_budget;
+	struct irq_thread_stats	thread_stats;
 } ____cacheline_internodealigned_in_smp;
 
 extern irqreturn_t no_action(int cpl, void *dev_id);
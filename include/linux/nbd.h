@@ -46,19 +46,46 @@ enum {
 #define NBD_READ_ONLY 0x0001
 #define NBD_WRITE_NOCHK 0x0002
 
+/* connections per device, one NBD_SET_SOCK each */
+#define NBD_MAX_CONNECTIONS 16
+
 struct request;
+struct task_struct;
+struct nbd_device;
+
+/*
+ * One connection to the server.  Each has its own threads: one sends
+ * requests taken from the device's waiting_queue, the other reads the
+ * replies, so several requests can be in flight on each.
+ */
+struct nbd_sock {
+	struct nbd_device *nbd;
+	struct socket *sock;
+	struct file *file;
+	int index;
+	bool dead;		/* shut down, requests moved elsewhere */
+	bool tx_dead;		/* a send failed, under tx_lock */
+
+	spinlock_t queue_lock;
+	struct list_head queue_head;	/* Requests waiting result */
+	struct request *active_req;
+	wait_queue_head_t active_wq;
+
+	struct mutex tx_lock;
+	struct task_struct *send_thread;
+	struct task_struct *recv_thread;
+};
 
 struct nbd_device {
 	int flags;
 	int harderror;		/* Code of hard error			*/
-	struct socket * sock;
-	struct file * file; 	/* If == NULL, device is not ready, yet	*/
+	struct nbd_sock *socks[NBD_MAX_CONNECTIONS];
+	int num_connections;	/* 0: not ready; set under queue_lock	*/
+	int live_connections;	/* under queue_lock, while running	*/
+	wait_queue_head_t conn_wq;
 	int magic;
 
 	spinlock_t queue_lock;
-	struct list_head queue_head;	/* Requests waiting result */
-	struct request *active_req;
-	wait_queue_head_t active_wq;
 	struct list_head waiting_queue;	/* Requests to be sent */
 	wait_queue_head_t waiting_wq;
 
@@ -0,0 +1,59 @@
+/* percpu-rwsem.h: read-mostly per-cpu reader/writer semaphores
+ *
+ * Readers only touch a per-cpu counter as long as no writer is pending,
+ * so read-side scalability does not depend on a shared cacheline.
+ * Writers are expensive: they have to wait for an RCU-sched grace period
+ * on entry and on exit, so these are only useful for locks that are
+ * written very rarely.
+ */
+#ifndef _LINUX_PERCPU_RWSEM_H
+#define _LINUX_PERCPU_RWSEM_H
+
+#include <linux/atomic.h>
+#include <linux/rwsem.h>
+#include <linux/percpu.h>
+#include <linux/wait.h>
+
+struct percpu_rw_semaphore {
+	unsigned int __percpu	*fast_read_ctr;
+	atomic_t		write_ctr;
+	struct rw_semaphore	rw_sem;
+	atomic_t		slow_read_ctr;
+	wait_queue_head_t	write_waitq;
+};
+
+#define __PERCPU_RWSEM_INITIALIZER(name, ctr)				\
+	{								\
+		.fast_read_ctr	= &ctr,					\
+		.write_ctr	= ATOMIC_INIT(0),			\
+		.rw_sem		= __RWSEM_INITIALIZER(name.rw_sem),	\
+		.slow_read_ctr	= ATOMIC_INIT(0),			\
+		.write_waitq	= __WAIT_QUEUE_HEAD_INITIALIZER(name.write_waitq), \
+	}
+
+/*
+ * Statically allocated semaphores use a static per-cpu counter, so they
+ * are usable before the per-cpu allocator is up.
+ */
+#define DEFINE_STATIC_PERCPU_RWSEM(name)				\
+	static DEFINE_PER_CPU(unsigned int, __percpu_rwsem_frc_##name);	\
+	static struct percpu_rw_semaphore name =			\
+		__PERCPU_RWSEM_INITIALIZER(name, __percpu_rwsem_frc_##name)
+
+extern void percpu_down_read(struct percpu_rw_semaphore *);
+extern void percpu_up_read(struct percpu_rw_semaphore *);
+
+extern void percpu_down_write(struct percpu_rw_semaphore *);
+extern void percpu_up_write(struct percpu_rw_semaphore *);
+
+extern int __percpu_init_rwsem(struct percpu_rw_semaphore *,
+				const char *, struct lock_class_key *);
+extern void percpu_free_rwsem(struct percpu_rw_semaphore *);
+
+#define percpu_init_rwsem(brw)					\
+({								\
+	static struct lock_class_key rwsem_key;			\
+	__percpu_init_rwsem(brw, #brw, &rwsem_key);		\
+})
+
+#endif /* _LINUX_PERCPU_RWSEM_H */
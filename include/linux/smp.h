@@ -9,6 +9,7 @@
 #include <linux/errno.h>
 #include <linux/types.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/cpumask.h>
 #include <linux/init.h>
 
@@ -16,7 +17,10 @@ extern void cpu_idle(void);
 
 typedef void (*smp_call_func_t)(void *info);
 struct call_single_data {
-	struct list_head list;
+	union {
+		struct list_head list;
+		struct llist_node llist;
+	};
 	smp_call_func_t func;
 	void *info;
 	u16 flags;
@@ -87,11 +91,20 @@ int smp_call_function_any(const struct cpumask *mask,
 #ifdef CONFIG_USE_GENERIC_SMP_HELPERS
 void __init call_function_init(void);
 void generic_smp_call_function_single_interrupt(void);
-void generic_smp_call_function_interrupt(void);
-void ipi_call_lock(void);
-void ipi_call_unlock(void);
-void ipi_call_lock_irq(void);
-void ipi_call_unlock_irq(void);
+/*
+ * Multi-target calls are queued on the same per-cpu lists as single
+ * ones, so both IPIs are handled alike.
+ */
+#define generic_smp_call_function_interrupt \
+	generic_smp_call_function_single_interrupt
+/*
+ * There is no global call queue for a cpu coming online to race with
+ * anymore; these are kept for the arch bringup code.
+ */
+static inline void ipi_call_lock(void) { }
+static inline void ipi_call_unlock(void) { }
+static inline void ipi_call_lock_irq(void) { }
+static inline void ipi_call_unlock_irq(void) { }
 #else
 static inline void call_function_init(void) { }
 #endif
@@ -8,6 +8,7 @@
 
 #include <linux/clockchips.h>
 #include <linux/irqflags.h>
+#include <linux/cpumask.h>
 
 #ifdef CONFIG_GENERIC_CLOCKEVENTS
 
@@ -36,7 +37,11 @@ enum tick_nohz_mode {
  *			to resume the tick timer operation in the timeline
  *			when the CPU returns from idle
  * @tick_stopped:	Indicator that the idle tick has been stopped
+ * @full_stopped:	The tick was stopped by full dynticks while a single
+ *			task was running, rather than by the idle loop
  * @idle_jiffies:	jiffies at the entry to idle for idle time accounting
+ * @full_jiffies:	jiffies up to which the running task has been charged
+ *			for the ticks it skipped in full dynticks mode
  * @idle_calls:		Total number of idle calls
  * @idle_sleeps:	Number of idle calls, where the sched tick was stopped
  * @idle_entrytime:	Time when the idle call was entered
@@ -54,7 +59,9 @@ struct tick_sched {
 	ktime_t				idle_tick;
 	int				inidle;
 	int				tick_stopped;
+	int				full_stopped;
 	unsigned long			idle_jiffies;
+	unsigned long			full_jiffies;
 	unsigned long			idle_calls;
 	unsigned long			idle_sleeps;
 	int				idle_active;
@@ -142,4 +149,43 @@ static inline u64 get_cpu_idle_time_us(int cpu, u64 *unused) { return -1; }
 static inline u64 get_cpu_iowait_time_us(int cpu, u64 *unused) { return -1; }
 # endif /* !NO_HZ */
 
+struct task_struct;
+
+# ifdef CONFIG_NO_HZ_FULL
+extern bool tick_nohz_full_running;
+extern cpumask_var_t tick_nohz_full_mask;
+
+static inline bool tick_nohz_full_cpu(int cpu)
+{
+	if (!tick_nohz_full_running)
+		return false;
+
+	return cpumask_test_cpu(cpu, tick_nohz_full_mask);
+}
+
+extern int tick_nohz_housekeeping_cpu(void);
+extern int tick_nohz_tick_stopped_cpu(int cpu);
+extern void tick_nohz_full_kick_cpu(int cpu);
+extern void tick_nohz_full_kick_all(void);
+extern void tick_nohz_full_check(void);
+extern void __tick_nohz_task_switch(struct task_struct *prev);
+
+/*
+ * Charge the outgoing task for the ticks it skipped while it ran alone
+ * on a full dynticks CPU.
+ */
+static inline void tick_nohz_task_switch(struct task_struct *prev)
+{
+	if (tick_nohz_full_cpu(smp_processor_id()))
+		__tick_nohz_task_switch(prev);
+}
+# else
+static inline bool tick_nohz_full_cpu(int cpu) { return false; }
+static inline int tick_nohz_tick_stopped_cpu(int cpu) { return 0; }
+static inline void tick_nohz_full_kick_cpu(int cpu) { }
+static inline void tick_nohz_full_kick_all(void) { }
+static inline void tick_nohz_full_check(void) { }
+static inline void tick_nohz_task_switch(struct task_struct *prev) { }
+# endif /* !NO_HZ_FULL */
+
 #endif
@@ -436,6 +436,39 @@ DEFINE_EVENT(block_unplug, block_unplug,
 	TP_ARGS(q, depth, explicit)
 );
 
+/**
+ * block_plug_flush - plugged requests inserted into a request queue
+ * @q: request queue the requests went to
+ * @depth: number of requests taken off the plug
+ * @merged: how many of them merged into requests already queued
+ *
+ * One event per queue per plug flush.  Bios merged while still plugged
+ * show up as block_bio_backmerge and block_bio_frontmerge; this shows
+ * what merging was left for insertion time.
+ */
+TRACE_EVENT(block_plug_flush,
+
+	TP_PROTO(struct request_queue *q, unsigned int depth,
+		 unsigned int merged),
+
+	TP_ARGS(q, depth, merged),
+
+	TP_STRUCT__entry(
+		__field( unsigned int,	nr_rq			)
+		__field( unsigned int,	nr_merged		)
+		__array( char,		comm,	TASK_COMM_LEN	)
+	),
+
+	TP_fast_assign(
+		__entry->nr_rq		= depth;
+		__entry->nr_merged	= merged;
+		memcpy(__entry->comm, current->comm, TASK_COMM_LEN);
+	),
+
+	TP_printk("[%s] %u merged %u", __entry->comm,
+		  __entry->nr_rq, __entry->nr_merged)
+);
+
 /**
  * block_split - split a single bio struct into two bio structs
  * @q: queue containing the bio
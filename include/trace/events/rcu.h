@@ -34,6 +34,69 @@ TRACE_EVENT(rcu_utilization,
 	TP_printk("%s", __entry->s)
 );
 
+/*
+ * Tracepoint for a callback handed to an offloaded CPU's rcuo kthread.
+ * The first argument is the RCU flavor, the second is the CPU that
+ * queued the callback, and the third and fourth are the number of lazy
+ * and total callbacks now waiting on that CPU's offload queue.  These
+ * are not conditional on CONFIG_RCU_TRACE so that the offload backlog
+ * can be watched on production kernels.
+ */
+TRACE_EVENT(rcu_nocb_enqueue,
+
+	TP_PROTO(char *rcuname, int cpu, long qlen_lazy, long qlen),
+
+	TP_ARGS(rcuname, cpu, qlen_lazy, qlen),
+
+	TP_STRUCT__entry(
+		__field(char *, rcuname)
+		__field(int, cpu)
+		__field(long, qlen_lazy)
+		__field(long, qlen)
+	),
+
+	TP_fast_assign(
+		__entry->rcuname = rcuname;
+		__entry->cpu = cpu;
+		__entry->qlen_lazy = qlen_lazy;
+		__entry->qlen = qlen;
+	),
+
+	TP_printk("%s cpu=%d CBs=%ld/%ld",
+		  __entry->rcuname, __entry->cpu,
+		  __entry->qlen_lazy, __entry->qlen)
+);
+
+/*
+ * Tracepoint for an rcuo kthread taking over a CPU's offload queue in
+ * order to wait for a grace period and then invoke it.  The arguments
+ * are as for rcu_nocb_enqueue, the counts being the size of the batch.
+ */
+TRACE_EVENT(rcu_nocb_batch,
+
+	TP_PROTO(char *rcuname, int cpu, long qlen_lazy, long qlen),
+
+	TP_ARGS(rcuname, cpu, qlen_lazy, qlen),
+
+	TP_STRUCT__entry(
+		__field(char *, rcuname)
+		__field(int, cpu)
+		__field(long, qlen_lazy)
+		__field(long, qlen)
+	),
+
+	TP_fast_assign(
+		__entry->rcuname = rcuname;
+		__entry->cpu = cpu;
+		__entry->qlen_lazy = qlen_lazy;
+		__entry->qlen = qlen;
+	),
+
+	TP_printk("%s cpu=%d CBs=%ld/%ld",
+		  __entry->rcuname, __entry->cpu,
+		  __entry->qlen_lazy, __entry->qlen)
+);
+
 #ifdef CONFIG_RCU_TRACE
 
 #if defined(CONFIG_TREE_RCU) || defined(CONFIG_TREE_PREEMPT_RCU)
@@ -14,6 +14,7 @@
 #include <linux/kthread.h>
 #include <linux/stop_machine.h>
 #include <linux/mutex.h>
+#include <linux/percpu-rwsem.h>
 #include <linux/gfp.h>
 #include <linux/suspend.h>
 
@@ -64,84 +65,62 @@ static int cpu_hotplug_disabled;
 
 #ifdef CONFIG_HOTPLUG_CPU
 
-static struct {
-	struct task_struct *active_writer;
-	struct mutex lock; /* Synchronizes accesses to refcount, */
-	/*
-	 * Also blocks the new readers during
-	 * an ongoing cpu hotplug operation.
-	 */
-	int refcount;
-} cpu_hotplug = {
-	.active_writer = NULL,
-	.lock = __MUTEX_INITIALIZER(cpu_hotplug.lock),
-	.refcount = 0,
-};
+DEFINE_STATIC_PERCPU_RWSEM(cpu_hotplug_rwsem);
 
+/* The task currently running a cpu hotplug operation, if any. */
+static struct task_struct *cpu_hotplug_writer;
+
+/*
+ * get_online_cpus() is a per-cpu reader lock, see lib/percpu-rwsem.c, so
+ * it does not dirty a shared cacheline unless a hotplug operation is in
+ * progress.  Unlike a plain percpu_down_read() it may nest: only the
+ * outermost call of a task takes the lock, tracked in ->cpuhp_ref, so a
+ * writer arriving between two nested calls cannot deadlock against it.
+ * The hotplug writer itself may also call it.
+ */
 void get_online_cpus(void)
 {
 	might_sleep();
-	if (cpu_hotplug.active_writer == current)
+	if (cpu_hotplug_writer == current)
 		return;
-	mutex_lock(&cpu_hotplug.lock);
-	cpu_hotplug.refcount++;
-	mutex_unlock(&cpu_hotplug.lock);
-
+	if (current->cpuhp_ref++)
+		return;
+	percpu_down_read(&cpu_hotplug_rwsem);
 }
 EXPORT_SYMBOL_GPL(get_online_cpus);
 
 void put_online_cpus(void)
 {
-	if (cpu_hotplug.active_writer == current)
+	if (cpu_hotplug_writer == current)
 		return;
-	mutex_lock(&cpu_hotplug.lock);
-	if (!--cpu_hotplug.refcount && unlikely(cpu_hotplug.active_writer))
-		wake_up_process(cpu_hotplug.active_writer);
-	mutex_unlock(&cpu_hotplug.lock);
-
+	if (WARN_ON_ONCE(!current->cpuhp_ref))
+		return;
+	if (--current->cpuhp_ref)
+		return;
+	percpu_up_read(&cpu_hotplug_rwsem);
 }
 EXPORT_SYMBOL_GPL(put_online_cpus);
 
 /*
- * This ensures that the hotplug operation can begin only when the
- * refcount goes to zero.
- *
- * Note that during a cpu-hotplug operation, the new readers, if any,
- * will be blocked by the cpu_hotplug.lock
+ * This ensures that the hotplug operation can begin only when all
+ * readers are gone.  New readers are blocked until cpu_hotplug_done().
  *
  * Since cpu_hotplug_begin() is always called after invoking
  * cpu_maps_update_begin(), we can be sure that only one writer is active.
  *
- * Note that theoretically, there is a possibility of a livelock:
- * - Refcount goes to zero, last reader wakes up the sleeping
- *   writer.
- * - Last reader unlocks the cpu_hotplug.lock.
- * - A new reader arrives at this moment, bumps up the refcount.
- * - The writer acquires the cpu_hotplug.lock finds the refcount
- *   non zero and goes to sleep again.
- *
- * However, this is very difficult to achieve in practice since
- * get_online_cpus() not an api which is called all that often.
- *
+ * The writer is recorded before taking the lock, the grace periods the
+ * writer waits for end up calling get_online_cpus() themselves.
  */
 static void cpu_hotplug_begin(void)
 {
-	cpu_hotplug.active_writer = current;
-
-	for (;;) {
-		mutex_lock(&cpu_hotplug.lock);
-		if (likely(!cpu_hotplug.refcount))
-			break;
-		__set_current_state(TASK_UNINTERRUPTIBLE);
-		mutex_unlock(&cpu_hotplug.lock);
-		schedule();
-	}
+	cpu_hotplug_writer = current;
+	percpu_down_write(&cpu_hotplug_rwsem);
 }
 
 static void cpu_hotplug_done(void)
 {
-	cpu_hotplug.active_writer = NULL;
-	mutex_unlock(&cpu_hotplug.lock);
+	percpu_up_write(&cpu_hotplug_rwsem);
+	cpu_hotplug_writer = NULL;
 }
 
 #else /* #if CONFIG_HOTPLUG_CPU */
@@ -652,6 +652,17 @@ static void perf_pmu_rotate_start(struct pmu *pmu)
 		list_add(&cpuctx->rotation_list, head);
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * Contexts with events stay on the rotation list, and those need the
+ * tick for multiplexing and frequency adjustment.
+ */
+bool perf_event_can_stop_tick(void)
+{
+	return list_empty(&__get_cpu_var(rotation_list));
+}
+#endif
+
 static void get_ctx(struct perf_event_context *ctx)
 {
 	WARN_ON(!atomic_inc_not_zero(&ctx->refcount));
@@ -1204,6 +1204,9 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	INIT_LIST_HEAD(&p->children);
 	INIT_LIST_HEAD(&p->sibling);
 	rcu_copy_process(p);
+#ifdef CONFIG_HOTPLUG_CPU
+	p->cpuhp_ref = 0;
+#endif
 	p->vfork_done = NULL;
 	spin_lock_init(&p->alloc_lock);
 
@@ -23,14 +23,20 @@ extern bool noirqdebug;
  * IRQTF_WARNED    - warning "IRQ_WAKE_THREAD w/o thread_fn" has been printed
  * IRQTF_AFFINITY  - irq thread is requested to adjust affinity
  * IRQTF_FORCED_THREAD  - irq action is force threaded
+ * IRQTF_POLLED    - last wakeup polled the handler past its first call
  */
 enum {
 	IRQTF_RUNTHREAD,
 	IRQTF_WARNED,
 	IRQTF_AFFINITY,
 	IRQTF_FORCED_THREAD,
+	IRQTF_POLLED,
 };
 
+/* Default priority and IRQF_THREAD_POLL budget of irq threads */
+#define IRQ_THREAD_DEFAULT_PRIO		(MAX_USER_RT_PRIO / 2)
+#define IRQ_THREAD_DEFAULT_BUDGET	64
+
 /*
  * Bit masks for desc->state
  *
@@ -100,6 +106,7 @@ static inline void unregister_handler_proc(unsigned int irq,
 extern int irq_select_affinity_usr(unsigned int irq, struct cpumask *mask);
 
 extern void irq_set_thread_affinity(struct irq_desc *desc);
+extern int irq_thread_set_priority(struct irqaction *action, unsigned int prio);
 
 /* Inline functions for support of irq chips on slow busses */
 static inline void chip_bus_lock(struct irq_desc *desc)
@@ -748,7 +748,6 @@ irq_forced_thread_fn(struct irq_desc *desc, struct irqaction *action)
 
 	local_bh_disable();
 	ret = action->thread_fn(action->irq, action->dev_id);
-	irq_finalize_oneshot(desc, action);
 	local_bh_enable();
 	return ret;
 }
@@ -761,11 +760,81 @@ irq_forced_thread_fn(struct irq_desc *desc, struct irqaction *action)
 static irqreturn_t irq_thread_fn(struct irq_desc *desc,
 		struct irqaction *action)
 {
-	irqreturn_t ret;
+	return action->thread_fn(action->irq, action->dev_id);
+}
+
+/*
+ * Run the threaded handler for one wakeup of the irq thread.
+ *
+ * IRQF_THREAD_POLL handlers are called again, without waiting for
+ * another interrupt, as long as they report handled events, up to
+ * action->thread_budget calls.  A oneshot line stays masked meanwhile.
+ * Every time the budget runs out with events still pending, the thread
+ * sleeps for a tick, with the line still masked, so that tasks of any
+ * priority get to run, and then goes on polling.  So a busy device
+ * neither floods the CPU with interrupts and context switches nor
+ * starves the CPU.  Polling ends when the irq gets disabled or the
+ * thread is stopped, also right after such a sleep.
+ */
+static irqreturn_t irq_thread_batch(struct irq_desc *desc,
+		struct irqaction *action,
+		irqreturn_t (*handler_fn)(struct irq_desc *desc,
+					  struct irqaction *action))
+{
+	struct irq_thread_stats *st = &action->thread_stats;
+	bool poll = action->flags & IRQF_THREAD_POLL;
+	irqreturn_t ret, action_ret = IRQ_NONE;
+	unsigned int n = 0, batch = 0;
+	u64 start = local_clock();
+
+	st->wakeups++;
+	for (;;) {
+		trace_irq_threaded_handler_entry(action->irq, action);
+		ret = handler_fn(desc, action);
+		trace_irq_threaded_handler_exit(action->irq, action, ret);
+
+		if (batch)
+			st->polls++;
+		if (!(ret & IRQ_HANDLED))
+			break;
+		action_ret = IRQ_HANDLED;
+		st->events++;
+		batch++;
+
+		if (!poll || irqd_irq_disabled(&desc->irq_data) ||
+		    kthread_should_stop())
+			break;
+		if (++n >= action->thread_budget) {
+			st->budget_exhausted++;
+			n = 0;
+			st->time_ns += local_clock() - start;
+			schedule_timeout_interruptible(1);
+			start = local_clock();
+			if (irqd_irq_disabled(&desc->irq_data) ||
+			    kthread_should_stop())
+				break;
+		}
+	}
+	st->time_ns += local_clock() - start;
+	st->max_batch = max(st->max_batch, batch);
+
+	/*
+	 * Events handled by polling may have raised an interrupt which
+	 * finds nothing left to do.  Don't let the spurious interrupt
+	 * detection count that against the handler.
+	 */
+	if (poll) {
+		if (action_ret == IRQ_NONE &&
+		    test_bit(IRQTF_POLLED, &action->thread_flags))
+			action_ret = IRQ_HANDLED;
+		if (batch > 1)
+			set_bit(IRQTF_POLLED, &action->thread_flags);
+		else
+			clear_bit(IRQTF_POLLED, &action->thread_flags);
+	}
 
-	ret = action->thread_fn(action->irq, action->dev_id);
 	irq_finalize_oneshot(desc, action);
-	return ret;
+	return action_ret;
 }
 
 static void wake_threads_waitq(struct irq_desc *desc)
@@ -780,9 +849,6 @@ static void wake_threads_waitq(struct irq_desc *desc)
  */
 static int irq_thread(void *data)
 {
-	static const struct sched_param param = {
-		.sched_priority = MAX_USER_RT_PRIO/2,
-	};
 	struct irqaction *action = data;
 	struct irq_desc *desc = irq_to_desc(action->irq);
 	irqreturn_t (*handler_fn)(struct irq_desc *desc,
@@ -795,7 +861,6 @@ static int irq_thread(void *data)
 	else
 		handler_fn = irq_thread_fn;
 
-	sched_setscheduler(current, SCHED_FIFO, &param);
 	current->irq_thread = 1;
 
 	while (!irq_wait_for_interrupt(action)) {
@@ -803,11 +868,9 @@ static int irq_thread(void *data)
 
 		irq_thread_check_affinity(desc, action);
 
-		trace_irq_threaded_handler_entry(irq, action);
-		action_ret = handler_fn(desc, action);
-		trace_irq_threaded_handler_exit(irq, action, action_ret);
+		action_ret = irq_thread_batch(desc, action, handler_fn);
 		if (!noirqdebug)
-			note_interrupt(action->irq, desc, action_ret);
+			note_interrupt(irq, desc, action_ret);
 
 		wake_threads_waitq(desc);
 	}
@@ -828,6 +891,29 @@ static int irq_thread(void *data)
 	return 0;
 }
 
+/**
+ * irq_thread_set_priority - set the scheduling priority of an irq thread
+ * @action: irqaction whose thread to change
+ * @prio: SCHED_FIFO priority, or 0 for SCHED_NORMAL
+ *
+ * Used when the thread is created and from /proc/irq/NN/name/thread_priority.
+ */
+int irq_thread_set_priority(struct irqaction *action, unsigned int prio)
+{
+	struct sched_param param = { .sched_priority = prio };
+	int ret;
+
+	if (!action->thread || prio >= MAX_USER_RT_PRIO)
+		return -EINVAL;
+
+	ret = sched_setscheduler_nocheck(action->thread,
+					 prio ? SCHED_FIFO : SCHED_NORMAL,
+					 &param);
+	if (!ret)
+		action->thread_prio = prio;
+	return ret;
+}
+
 /*
  * Called from do_exit()
  */
@@ -954,6 +1040,8 @@ __setup_irq(unsigned int irq, struct irq_desc *desc, struct irqaction *new)
 		 */
 		get_task_struct(t);
 		new->thread = t;
+		irq_thread_set_priority(new, IRQ_THREAD_DEFAULT_PRIO);
+		new->thread_budget = IRQ_THREAD_DEFAULT_BUDGET;
 	}
 
 	if (!alloc_cpumask_var(&mask, GFP_KERNEL)) {
@@ -266,6 +266,107 @@ static const struct file_operations irq_spurious_proc_fops = {
 	.release	= single_release,
 };
 
+static int irq_thread_stats_proc_show(struct seq_file *m, void *v)
+{
+	struct irqaction *action = m->private;
+	struct irq_thread_stats *st = &action->thread_stats;
+
+	seq_printf(m, "wakeups %lu\n" "events %lu\n" "polls %lu\n"
+		   "budget_exhausted %lu\n" "max_batch %u\n" "time %llu ns\n",
+		   st->wakeups, st->events, st->polls, st->budget_exhausted,
+		   st->max_batch, (unsigned long long)st->time_ns);
+	return 0;
+}
+
+static int irq_thread_stats_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, irq_thread_stats_proc_show, PDE(inode)->data);
+}
+
+static const struct file_operations irq_thread_stats_proc_fops = {
+	.open		= irq_thread_stats_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int irq_thread_priority_proc_show(struct seq_file *m, void *v)
+{
+	struct irqaction *action = m->private;
+
+	seq_printf(m, "%u\n", action->thread_prio);
+	return 0;
+}
+
+static ssize_t irq_thread_priority_proc_write(struct file *file,
+		const char __user *buffer, size_t count, loff_t *pos)
+{
+	struct irqaction *action = PDE(file->f_path.dentry->d_inode)->data;
+	unsigned int prio;
+	int err;
+
+	err = kstrtouint_from_user(buffer, count, 0, &prio);
+	if (err)
+		return err;
+
+	err = irq_thread_set_priority(action, prio);
+	return err ? err : count;
+}
+
+static int irq_thread_priority_proc_open(struct inode *inode,
+					 struct file *file)
+{
+	return single_open(file, irq_thread_priority_proc_show,
+			   PDE(inode)->data);
+}
+
+static const struct file_operations irq_thread_priority_proc_fops = {
+	.open		= irq_thread_priority_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.write		= irq_thread_priority_proc_write,
+};
+
+static int irq_thread_budget_proc_show(struct seq_file *m, void *v)
+{
+	struct irqaction *action = m->private;
+
+	seq_printf(m, "%u\n", action->thread_budget);
+	return 0;
+}
+
+static ssize_t irq_thread_budget_proc_write(struct file *file,
+		const char __user *buffer, size_t count, loff_t *pos)
+{
+	struct irqaction *action = PDE(file->f_path.dentry->d_inode)->data;
+	unsigned int budget;
+	int err;
+
+	err = kstrtouint_from_user(buffer, count, 0, &budget);
+	if (err)
+		return err;
+	if (!budget)
+		return -EINVAL;
+
+	action->thread_budget = budget;
+	return count;
+}
+
+static int irq_thread_budget_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, irq_thread_budget_proc_show,
+			   PDE(inode)->data);
+}
+
+static const struct file_operations irq_thread_budget_proc_fops = {
+	.open		= irq_thread_budget_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.write		= irq_thread_budget_proc_write,
+};
+
 #define MAX_NAMELEN 128
 
 static int name_unique(unsigned int irq, struct irqaction *new_action)
@@ -301,6 +402,16 @@ void register_handler_proc(unsigned int irq, struct irqaction *action)
 
 	/* create /proc/irq/1234/handler/ */
 	action->dir = proc_mkdir(name, desc->dir);
+	if (!action->dir || !action->thread)
+		return;
+
+	/* and the files tuning and accounting its irq thread */
+	proc_create_data("thread_stats", 0444, action->dir,
+			 &irq_thread_stats_proc_fops, action);
+	proc_create_data("thread_priority", 0644, action->dir,
+			 &irq_thread_priority_proc_fops, action);
+	proc_create_data("thread_budget", 0644, action->dir,
+			 &irq_thread_budget_proc_fops, action);
 }
 
 #undef MAX_NAMELEN
@@ -369,6 +480,11 @@ void unregister_handler_proc(unsigned int irq, struct irqaction *action)
 	if (action->dir) {
 		struct irq_desc *desc = irq_to_desc(irq);
 
+		if (action->thread) {
+			remove_proc_entry("thread_stats", action->dir);
+			remove_proc_entry("thread_priority", action->dir);
+			remove_proc_entry("thread_budget", action->dir);
+		}
 		remove_proc_entry(action->dir->name, desc->dir);
 	}
 }
@@ -0,0 +1,611 @@
+/*
+ * Module-based torture test facility for locking
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Based on kernel/rcutorture.c.
+ *
+ * See also:  Documentation/locktorture.txt
+ */
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/err.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/smp.h>
+#include <linux/interrupt.h>
+#include <linux/sched.h>
+#include <linux/atomic.h>
+#include <linux/moduleparam.h>
+#include <linux/delay.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/jiffies.h>
+
+MODULE_LICENSE("GPL");
+
+static int nwriters_stress = -1; /* # writer threads, defaults to 2*ncpus */
+static int nreaders_stress = -1; /* # reader threads, rwsem only */
+static int stat_interval;	/* Interval between stats, in seconds. */
+				/*  Zero means "only at end of test". */
+static bool verbose = 1;	/* Print more debug info. */
+static int long_hold = 100;	/* Occasional long lock hold (ms). */
+static char *torture_type = "spin_lock"; /* What lock to torture. */
+
+module_param(nwriters_stress, int, 0444);
+MODULE_PARM_DESC(nwriters_stress, "Number of write-locking stress-test threads");
+module_param(nreaders_stress, int, 0444);
+MODULE_PARM_DESC(nreaders_stress, "Number of read-locking stress-test threads");
+module_param(stat_interval, int, 0644);
+MODULE_PARM_DESC(stat_interval, "Number of seconds between stats printk()s");
+module_param(verbose, bool, 0444);
+MODULE_PARM_DESC(verbose, "Enable verbose debugging printk()s");
+module_param(long_hold, int, 0444);
+MODULE_PARM_DESC(long_hold, "Do occasional long hold of lock (ms), 0=disable");
+module_param(torture_type, charp, 0444);
+MODULE_PARM_DESC(torture_type, "Type of lock to torture (spin_lock, spin_lock_irq, mutex_lock, rwsem_lock)");
+
+#define TORTURE_FLAG "-torture:"
+#define VERBOSE_PRINTK_STRING(s) \
+	do { if (verbose) printk(KERN_ALERT "%s" TORTURE_FLAG s "\n", torture_type); } while (0)
+#define VERBOSE_PRINTK_ERRSTRING(s) \
+	do { if (verbose) printk(KERN_ALERT "%s" TORTURE_FLAG "!!! " s "\n", torture_type); } while (0)
+
+static char *printk_buf;
+
+static struct task_struct *stats_task;
+static struct task_struct **writer_tasks;
+static struct task_struct **reader_tasks;
+
+static bool lock_is_write_held;
+static atomic_t lock_is_read_held;
+static unsigned long torture_start;	/* jiffies at start of test. */
+static atomic_t n_lock_torture_errors;
+
+struct lock_stress_stats {
+	long n_lock_fail;
+	long n_lock_acquired;
+};
+
+static struct lock_stress_stats *lwsa;	/* writer statistics */
+static struct lock_stress_stats *lrsa;	/* reader statistics */
+
+static int torture_runnable = 1;
+module_param(torture_runnable, int, 0444);
+MODULE_PARM_DESC(torture_runnable, "Start locktorture at module init");
+
+/*
+ * Operations vector for selecting different types of tests.
+ */
+struct lock_torture_ops {
+	void (*init)(void);
+	int (*writelock)(void);
+	void (*write_delay)(unsigned long *rrsp);
+	void (*writeunlock)(void);
+	int (*readlock)(void);
+	void (*read_delay)(unsigned long *rrsp);
+	void (*readunlock)(void);
+	const char *name;
+};
+
+static struct lock_torture_ops *cur_ops;
+
+/*
+ * Cheap per-thread pseudo-random generator, so that the random delays do
+ * not themselves become a point of contention.
+ */
+#define LOCK_TORTURE_RANDOM_MULT	39916801  /* prime */
+#define LOCK_TORTURE_RANDOM_ADD		479001701 /* prime */
+
+static unsigned long lock_torture_random(unsigned long *rrsp)
+{
+	*rrsp = *rrsp * LOCK_TORTURE_RANDOM_MULT + LOCK_TORTURE_RANDOM_ADD;
+	return swahw32(*rrsp);
+}
+
+/*
+ * Definitions for lock torture testing.
+ */
+
+static DEFINE_SPINLOCK(torture_spinlock);
+static unsigned long cxt_irqflags;	/* only valid with the lock held */
+
+static int torture_spin_lock_write_lock(void) __acquires(torture_spinlock)
+{
+	spin_lock(&torture_spinlock);
+	return 0;
+}
+
+static void torture_spin_lock_write_delay(unsigned long *rrsp)
+{
+	const unsigned long shortdelay_us = 2;
+
+	/* We want a short delay mostly to emulate likely code, and
+	 * we want a long delay occasionally to force massive contention.
+	 */
+	if (long_hold && !(lock_torture_random(rrsp) %
+			   (nwriters_stress * 2000 * long_hold)))
+		mdelay(long_hold);
+	if (!(lock_torture_random(rrsp) %
+	      (nwriters_stress * 2 * shortdelay_us)))
+		udelay(shortdelay_us);
+	/* No cond_resched() here, we must not sleep holding a spinlock. */
+}
+
+static void torture_spin_lock_write_unlock(void) __releases(torture_spinlock)
+{
+	spin_unlock(&torture_spinlock);
+}
+
+static struct lock_torture_ops spin_lock_ops = {
+	.writelock	= torture_spin_lock_write_lock,
+	.write_delay	= torture_spin_lock_write_delay,
+	.writeunlock	= torture_spin_lock_write_unlock,
+	.name		= "spin_lock"
+};
+
+static int torture_spin_lock_write_lock_irq(void)
+__acquires(torture_spinlock)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&torture_spinlock, flags);
+	cxt_irqflags = flags;
+	return 0;
+}
+
+/*
+ * Interrupts are off for the whole hold, so long_hold milliseconds would
+ * stall the CPU's interrupts and trip the lockup detectors.  Keep the
+ * occasional long hold to a bounded number of microseconds instead.
+ */
+static void torture_spin_lock_write_delay_irq(unsigned long *rrsp)
+{
+	const unsigned long shortdelay_us = 2;
+	const unsigned long longdelay_us = 100;
+
+	if (long_hold && !(lock_torture_random(rrsp) %
+			   (nwriters_stress * 2000 * long_hold)))
+		udelay(longdelay_us);
+	if (!(lock_torture_random(rrsp) %
+	      (nwriters_stress * 2 * shortdelay_us)))
+		udelay(shortdelay_us);
+}
+
+static void torture_lock_spin_write_unlock_irq(void)
+__releases(torture_spinlock)
+{
+	spin_unlock_irqrestore(&torture_spinlock, cxt_irqflags);
+}
+
+static struct lock_torture_ops spin_lock_irq_ops = {
+	.writelock	= torture_spin_lock_write_lock_irq,
+	.write_delay	= torture_spin_lock_write_delay_irq,
+	.writeunlock	= torture_lock_spin_write_unlock_irq,
+	.name		= "spin_lock_irq"
+};
+
+static DEFINE_MUTEX(torture_mutex);
+
+static int torture_mutex_lock(void) __acquires(torture_mutex)
+{
+	mutex_lock(&torture_mutex);
+	return 0;
+}
+
+static void torture_mutex_delay(unsigned long *rrsp)
+{
+	const unsigned long shortdelay_us = 10;
+
+	/* We want a short delay mostly to emulate likely code, and
+	 * we want a long delay occasionally to force massive contention.
+	 */
+	if (long_hold && !(lock_torture_random(rrsp) %
+			   (nwriters_stress * 2000 * long_hold)))
+		mdelay(long_hold * 5);
+	else
+		udelay(shortdelay_us);
+	if (!(lock_torture_random(rrsp) % (nwriters_stress * 20000)))
+		cond_resched();  /* Allow test to be preempted. */
+}
+
+static void torture_mutex_unlock(void) __releases(torture_mutex)
+{
+	mutex_unlock(&torture_mutex);
+}
+
+static struct lock_torture_ops mutex_lock_ops = {
+	.writelock	= torture_mutex_lock,
+	.write_delay	= torture_mutex_delay,
+	.writeunlock	= torture_mutex_unlock,
+	.name		= "mutex_lock"
+};
+
+static DECLARE_RWSEM(torture_rwsem);
+
+static int torture_rwsem_down_write(void) __acquires(torture_rwsem)
+{
+	down_write(&torture_rwsem);
+	return 0;
+}
+
+static void torture_rwsem_write_delay(unsigned long *rrsp)
+{
+	const unsigned long shortdelay_us = 10;
+
+	/* We want a short delay mostly to emulate likely code, and
+	 * we want a long delay occasionally to force massive contention.
+	 */
+	if (long_hold && !(lock_torture_random(rrsp) %
+			   (nwriters_stress * 2000 * long_hold)))
+		mdelay(long_hold * 10);
+	else
+		udelay(shortdelay_us);
+	if (!(lock_torture_random(rrsp) % (nwriters_stress * 20000)))
+		cond_resched();  /* Allow test to be preempted. */
+}
+
+static void torture_rwsem_up_write(void) __releases(torture_rwsem)
+{
+	up_write(&torture_rwsem);
+}
+
+static int torture_rwsem_down_read(void) __acquires(torture_rwsem)
+{
+	down_read(&torture_rwsem);
+	return 0;
+}
+
+static void torture_rwsem_read_delay(unsigned long *rrsp)
+{
+	const unsigned long shortdelay_us = 10;
+
+	/* We want a short delay mostly to emulate likely code, and
+	 * we want a long delay occasionally to force massive contention.
+	 */
+	if (long_hold && !(lock_torture_random(rrsp) %
+			   (nreaders_stress * 2000 * long_hold)))
+		mdelay(long_hold * 2);
+	else
+		udelay(shortdelay_us);
+	if (!(lock_torture_random(rrsp) % (nreaders_stress * 20000)))
+		cond_resched();  /* Allow test to be preempted. */
+}
+
+static void torture_rwsem_up_read(void) __releases(torture_rwsem)
+{
+	up_read(&torture_rwsem);
+}
+
+static struct lock_torture_ops rwsem_lock_ops = {
+	.writelock	= torture_rwsem_down_write,
+	.write_delay	= torture_rwsem_write_delay,
+	.writeunlock	= torture_rwsem_up_write,
+	.readlock	= torture_rwsem_down_read,
+	.read_delay	= torture_rwsem_read_delay,
+	.readunlock	= torture_rwsem_up_read,
+	.name		= "rwsem_lock"
+};
+
+/*
+ * Lock torture writer kthread.  Repeatedly acquires and releases
+ * the lock, checking for duplicate acquisitions.
+ */
+static int lock_torture_writer(void *arg)
+{
+	struct lock_stress_stats *lwsp = arg;
+	unsigned long rand = (unsigned long)current;
+
+	VERBOSE_PRINTK_STRING("lock_torture_writer task started");
+	set_user_nice(current, 19);
+
+	do {
+		if ((lock_torture_random(&rand) & 0xfffff) == 0)
+			schedule_timeout_uninterruptible(1);
+
+		cur_ops->writelock();
+		if (WARN_ON_ONCE(lock_is_write_held))
+			lwsp->n_lock_fail++;
+		lock_is_write_held = 1;
+		if (WARN_ON_ONCE(atomic_read(&lock_is_read_held)))
+			lwsp->n_lock_fail++; /* rare, but... */
+
+		lwsp->n_lock_acquired++;
+		cur_ops->write_delay(&rand);
+		lock_is_write_held = 0;
+		cur_ops->writeunlock();
+	} while (!kthread_should_stop());
+	VERBOSE_PRINTK_STRING("lock_torture_writer task stopping");
+	return 0;
+}
+
+/*
+ * Lock torture reader kthread.  Repeatedly acquires and releases
+ * the reader lock.
+ */
+static int lock_torture_reader(void *arg)
+{
+	struct lock_stress_stats *lrsp = arg;
+	unsigned long rand = (unsigned long)current;
+
+	VERBOSE_PRINTK_STRING("lock_torture_reader task started");
+	set_user_nice(current, 19);
+
+	do {
+		if ((lock_torture_random(&rand) & 0xfffff) == 0)
+			schedule_timeout_uninterruptible(1);
+
+		cur_ops->readlock();
+		atomic_inc(&lock_is_read_held);
+		if (WARN_ON_ONCE(lock_is_write_held))
+			lrsp->n_lock_fail++; /* rare, but... */
+
+		lrsp->n_lock_acquired++;
+		cur_ops->read_delay(&rand);
+		atomic_dec(&lock_is_read_held);
+		cur_ops->readunlock();
+	} while (!kthread_should_stop());
+	VERBOSE_PRINTK_STRING("lock_torture_reader task stopping");
+	return 0;
+}
+
+/*
+ * Create a lock-torture-statistics message in the specified buffer.
+ * The acquisition rate is the throughput figure to compare between
+ * kernels or lock implementations.
+ */
+static void __torture_print_stats(char *page,
+				  struct lock_stress_stats *statp, bool write)
+{
+	bool fail = 0;
+	int i, n_stress;
+	long max = 0, min = statp[0].n_lock_acquired;
+	unsigned long long sum = 0;
+	unsigned long secs = max(1UL, (jiffies - torture_start) / HZ);
+
+	n_stress = write ? nwriters_stress : nreaders_stress;
+	for (i = 0; i < n_stress; i++) {
+		if (statp[i].n_lock_fail)
+			fail = true;
+		sum += statp[i].n_lock_acquired;
+		if (max < statp[i].n_lock_acquired)
+			max = statp[i].n_lock_acquired;
+		if (min > statp[i].n_lock_acquired)
+			min = statp[i].n_lock_acquired;
+	}
+	page += sprintf(page,
+			"%s:  Total: %llu  Max/Min: %ld/%ld %s  Fail: %d  Rate: %llu/s\n",
+			write ? "Writes" : "Reads ",
+			sum, max, min, max / 2 > min ? "???" : "",
+			fail, div64_u64(sum, secs));
+	if (fail)
+		atomic_inc(&n_lock_torture_errors);
+}
+
+/*
+ * Print torture statistics.  Caller must ensure that there is only
+ * one call to this function at a given time!!!  This is normally
+ * accomplished by relying on the module system to only have one copy
+ * of the module loaded, and then by giving the lock_torture_stats
+ * kthread full control (or the init/cleanup functions when lock_torture_stats
+ * thread is not running).
+ */
+static void lock_torture_stats_print(void)
+{
+	__torture_print_stats(printk_buf, lwsa, true);
+	printk(KERN_ALERT "%s", printk_buf);
+
+	if (cur_ops->readlock) {
+		__torture_print_stats(printk_buf, lrsa, false);
+		printk(KERN_ALERT "%s", printk_buf);
+	}
+}
+
+/*
+ * Periodically prints torture statistics, if periodic statistics printing
+ * was specified via the stat_interval module parameter.
+ *
+ * No need to worry about fullstop here, since this one doesn't reference
+ * volatile state or register callbacks.
+ */
+static int lock_torture_stats(void *arg)
+{
+	VERBOSE_PRINTK_STRING("lock_torture_stats task started");
+	do {
+		schedule_timeout_interruptible(stat_interval * HZ);
+		lock_torture_stats_print();
+	} while (!kthread_should_stop());
+	VERBOSE_PRINTK_STRING("lock_torture_stats task stopping");
+	return 0;
+}
+
+static inline void
+lock_torture_print_module_parms(struct lock_torture_ops *cur_ops,
+				const char *tag)
+{
+	printk(KERN_ALERT "%s" TORTURE_FLAG
+	       "--- %s: nwriters_stress=%d nreaders_stress=%d stat_interval=%d verbose=%d long_hold=%d\n",
+	       torture_type, tag, nwriters_stress, nreaders_stress,
+	       stat_interval, verbose, long_hold);
+}
+
+static void lock_torture_cleanup(void)
+{
+	int i;
+
+	if (writer_tasks) {
+		for (i = 0; i < nwriters_stress; i++) {
+			if (!writer_tasks[i])
+				continue;
+			VERBOSE_PRINTK_STRING("Stopping lock_torture_writer task");
+			kthread_stop(writer_tasks[i]);
+			writer_tasks[i] = NULL;
+		}
+		kfree(writer_tasks);
+		writer_tasks = NULL;
+	}
+
+	if (reader_tasks) {
+		for (i = 0; i < nreaders_stress; i++) {
+			if (!reader_tasks[i])
+				continue;
+			VERBOSE_PRINTK_STRING("Stopping lock_torture_reader task");
+			kthread_stop(reader_tasks[i]);
+			reader_tasks[i] = NULL;
+		}
+		kfree(reader_tasks);
+		reader_tasks = NULL;
+	}
+
+	if (stats_task) {
+		VERBOSE_PRINTK_STRING("Stopping lock_torture_stats task");
+		kthread_stop(stats_task);
+		stats_task = NULL;
+	}
+
+	if (lwsa && printk_buf) {
+		lock_torture_stats_print();  /* -After- the stats thread is stopped! */
+		if (atomic_read(&n_lock_torture_errors))
+			lock_torture_print_module_parms(cur_ops,
+							"End of test: FAILURE");
+		else
+			lock_torture_print_module_parms(cur_ops,
+							"End of test: SUCCESS");
+	}
+
+	kfree(lwsa);
+	lwsa = NULL;
+	kfree(lrsa);
+	lrsa = NULL;
+	kfree(printk_buf);
+	printk_buf = NULL;
+}
+
+static int __init lock_torture_init(void)
+{
+	int i;
+	int firsterr = 0;
+	static struct lock_torture_ops *torture_ops[] = {
+		&spin_lock_ops, &spin_lock_irq_ops, &mutex_lock_ops,
+		&rwsem_lock_ops,
+	};
+
+	if (!torture_runnable)
+		return -EBUSY;
+
+	/* Process args and tell the world that the torturer is on the job. */
+	for (i = 0; i < ARRAY_SIZE(torture_ops); i++) {
+		cur_ops = torture_ops[i];
+		if (strcmp(torture_type, cur_ops->name) == 0)
+			break;
+	}
+	if (i == ARRAY_SIZE(torture_ops)) {
+		printk(KERN_ALERT "lock-torture: invalid torture type: \"%s\"\n",
+		       torture_type);
+		printk(KERN_ALERT "lock-torture types:");
+		for (i = 0; i < ARRAY_SIZE(torture_ops); i++)
+			printk(KERN_ALERT " %s", torture_ops[i]->name);
+		printk(KERN_ALERT "\n");
+		return -EINVAL;
+	}
+	if (cur_ops->init)
+		cur_ops->init(); /* no "goto unwind" prior to this point!!! */
+
+	if (nwriters_stress < 0)
+		nwriters_stress = 2 * num_online_cpus();
+	if (nwriters_stress == 0)
+		nwriters_stress = 1;
+	if (cur_ops->readlock) {
+		if (nreaders_stress < 0)
+			nreaders_stress = 2 * num_online_cpus();
+		if (nreaders_stress == 0)
+			nreaders_stress = 1;
+	} else {
+		nreaders_stress = 0;
+	}
+	lock_torture_print_module_parms(cur_ops, "Start of test");
+
+	/* Initialize the statistics so that each run gets its own numbers. */
+	printk_buf = kmalloc(256, GFP_KERNEL);
+	lwsa = kcalloc(nwriters_stress, sizeof(*lwsa), GFP_KERNEL);
+	writer_tasks = kcalloc(nwriters_stress, sizeof(writer_tasks[0]),
+			       GFP_KERNEL);
+	if (!printk_buf || !lwsa || !writer_tasks) {
+		VERBOSE_PRINTK_ERRSTRING("Out of memory");
+		firsterr = -ENOMEM;
+		goto unwind;
+	}
+	if (nreaders_stress) {
+		lrsa = kcalloc(nreaders_stress, sizeof(*lrsa), GFP_KERNEL);
+		reader_tasks = kcalloc(nreaders_stress,
+				       sizeof(reader_tasks[0]), GFP_KERNEL);
+		if (!lrsa || !reader_tasks) {
+			VERBOSE_PRINTK_ERRSTRING("Out of memory");
+			firsterr = -ENOMEM;
+			goto unwind;
+		}
+	}
+	lock_is_write_held = 0;
+	atomic_set(&lock_is_read_held, 0);
+	atomic_set(&n_lock_torture_errors, 0);
+	torture_start = jiffies;
+
+	/* Start up the kthreads. */
+	for (i = 0; i < nwriters_stress; i++) {
+		VERBOSE_PRINTK_STRING("Creating lock_torture_writer task");
+		writer_tasks[i] = kthread_run(lock_torture_writer, &lwsa[i],
+					      "lock_torture_writer");
+		if (IS_ERR(writer_tasks[i])) {
+			firsterr = PTR_ERR(writer_tasks[i]);
+			VERBOSE_PRINTK_ERRSTRING("Failed to create writer");
+			writer_tasks[i] = NULL;
+			goto unwind;
+		}
+	}
+	for (i = 0; i < nreaders_stress; i++) {
+		VERBOSE_PRINTK_STRING("Creating lock_torture_reader task");
+		reader_tasks[i] = kthread_run(lock_torture_reader, &lrsa[i],
+					      "lock_torture_reader");
+		if (IS_ERR(reader_tasks[i])) {
+			firsterr = PTR_ERR(reader_tasks[i]);
+			VERBOSE_PRINTK_ERRSTRING("Failed to create reader");
+			reader_tasks[i] = NULL;
+			goto unwind;
+		}
+	}
+	if (stat_interval > 0) {
+		VERBOSE_PRINTK_STRING("Creating lock_torture_stats task");
+		stats_task = kthread_run(lock_torture_stats, NULL,
+					 "lock_torture_stats");
+		if (IS_ERR(stats_task)) {
+			firsterr = PTR_ERR(stats_task);
+			VERBOSE_PRINTK_ERRSTRING("Failed to create stats");
+			stats_task = NULL;
+			goto unwind;
+		}
+	}
+	return 0;
+
+unwind:
+	lock_torture_cleanup();
+	return firsterr;
+}
+
+module_init(lock_torture_init);
+module_exit(lock_torture_cleanup);
@@ -41,7 +41,8 @@
 #include <linux/cpu.h>
 #include <linux/notifier.h>
 #include <linux/rculist.h>
-#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/irq_work.h>
 
 #include <asm/uaccess.h>
 
@@ -99,13 +100,6 @@ EXPORT_SYMBOL_GPL(console_drivers);
  */
 static int console_locked, console_suspended;
 
-/*
- * logbuf_lock protects log_buf, log_start, log_end, con_start and logged_chars
- * It is also used in interesting ways to provide interlocking in
- * console_unlock();.
- */
-static DEFINE_RAW_SPINLOCK(logbuf_lock);
-
 #define LOG_BUF_MASK (log_buf_len-1)
 #define LOG_BUF(idx) (log_buf[(idx) & LOG_BUF_MASK])
 
@@ -117,10 +111,7 @@ static DEFINE_RAW_SPINLOCK(logbuf_lock);
 /* Index into log_buf: next char to be read by syslog() */
 static unsigned __suspend_volatile_bss log_start;
 
-/* Index into log_buf: next char to be sent to consoles */
-static unsigned __suspend_volatile_bss con_start;
-
-/* Index into log_buf: most-recently-written-char + 1 */
+/* Index into log_buf: end of the last committed record */
 static unsigned __suspend_volatile_bss log_end;
 
 
@@ -155,6 +146,13 @@ static int console_may_schedule;
 
 #ifdef CONFIG_PRINTK
 
+/*
+ * logbuf_lock serializes the readers of log_buf: syslog(), kmsg_dump()
+ * and the resizing of the buffer at boot.  printk() itself does not take
+ * it, see "Log records" below.
+ */
+static DEFINE_RAW_SPINLOCK(logbuf_lock);
+
 static __suspend_volatile_bss char __log_buf[__LOG_BUF_LEN];
 static char *log_buf = __log_buf;
 static int log_buf_len = __LOG_BUF_LEN;
@@ -163,6 +161,271 @@ static int log_buf_len = __LOG_BUF_LEN;
 static __suspend_volatile_bss unsigned logged_chars;
 static int saved_console_loglevel = -1;
 
+/*
+ * Log records
+ *
+ * Every line printed is stored as one record, "<level>[time] text\n",
+ * laid out in log_buf just as the character ring always held it, so
+ * syslog(), kmsg_dump(), kdb and crash dumps keep reading plain text.
+ * A ring of descriptors indexed by sequence number tells the consoles
+ * where each record starts and at which level it was logged.
+ *
+ * printk() takes no lock.  A writer reserves the sequence number and the
+ * space for its record with a single cmpxchg() on log_reserve, copies
+ * the text in, and commits the record by storing its sequence number in
+ * the descriptor.  Writers may finish in any order: whoever commits the
+ * oldest outstanding record moves log_commit_seq and log_end past every
+ * record that is complete, so there are never torn records below
+ * log_end.  Text more than log_buf_len behind the reservation frontier
+ * may be being overwritten and must not be trusted by readers.
+ *
+ * log_reserve packs the low bits of the next sequence number and of the
+ * next log_buf index.  The full values are recovered relative to
+ * log_commit_seq and log_end, which writers never let fall further
+ * behind than the packed fields can express.
+ */
+#if BITS_PER_LONG == 64
+#define LOG_RES_POS_BITS	32
+#else
+#define LOG_RES_POS_BITS	20
+#endif
+#define LOG_RES_POS_MASK	((1UL << LOG_RES_POS_BITS) - 1)
+#define LOG_RES_SEQ_MASK	(~0UL >> LOG_RES_POS_BITS)
+
+/* Longest message printk() formats */
+#define PRINTK_LINE_MAX		1024
+
+/* One descriptor for every 64 bytes of the static log buffer */
+#define LOG_DESC_COUNT		(1 << (CONFIG_LOG_BUF_SHIFT - 6))
+#define LOG_DESC_MASK		(LOG_DESC_COUNT - 1)
+
+struct log_desc {
+	unsigned long id;	/* sequence number + 1 once committed */
+	unsigned begin;		/* index into log_buf of the record */
+	u16 len;		/* record length, including the newline */
+	u8 text;		/* offset of the text, past "<level>" */
+	u8 level;
+};
+
+static struct log_desc __suspend_volatile_bss log_desc[LOG_DESC_COUNT];
+
+/* Next sequence number and log_buf index to hand out, packed */
+static unsigned long __suspend_volatile_bss log_reserve;
+
+/* Oldest record not known to be committed yet */
+static unsigned long __suspend_volatile_bss log_commit_seq;
+
+/* Records printk() had no room for */
+static atomic_t __suspend_volatile_bss log_dropped;
+
+/* Next record to print on the consoles, protected by console_sem */
+static unsigned long __suspend_volatile_bss console_seq;
+
+/* Records overwritten before the consoles got to them */
+static unsigned long __suspend_volatile_bss console_dropped;
+
+/*
+ * Consoles are written from the printk kthread, console_batch records at
+ * a time, unless printk_sync_console is set.
+ */
+static struct task_struct *printk_thread;
+static bool __read_mostly printk_sync_console;
+module_param_named(synchronous, printk_sync_console, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(synchronous, "print to the consoles from printk() itself");
+
+static unsigned int __read_mostly console_batch = 32;
+module_param(console_batch, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(console_batch, "records per console_unlock() call, 0=all");
+
+static void console_kick(unsigned int cpu);
+
+static inline unsigned long log_res_seq(unsigned long res, unsigned long ref)
+{
+	return ref + (((res >> LOG_RES_POS_BITS) - ref) & LOG_RES_SEQ_MASK);
+}
+
+static inline unsigned log_res_pos(unsigned long res, unsigned ref)
+{
+	return ref + (((unsigned)res - ref) & LOG_RES_POS_MASK);
+}
+
+/* Index into log_buf up to which space has been handed out to writers */
+static unsigned log_reserved_end(void)
+{
+	unsigned end = ACCESS_ONCE(log_end);
+
+	smp_rmb();
+	return log_res_pos(ACCESS_ONCE(log_reserve), end);
+}
+
+/* Oldest index at or after @idx whose text cannot be overwritten yet */
+static unsigned log_valid_from(unsigned idx)
+{
+	unsigned res = log_reserved_end();
+
+	if (res - idx > log_buf_len)
+		return res - log_buf_len;
+	return idx;
+}
+
+/*
+ * Reserve a sequence number and @len bytes of log_buf.  Fails if so many
+ * records are still being written that the descriptor ring or the packed
+ * reservation would overflow, or that the new text would wrap around onto
+ * the text of the oldest of them, which starts at log_end.
+ */
+static bool log_reserve_record(unsigned len, unsigned long *seqp,
+			       unsigned *beginp)
+{
+	unsigned long old, new, cur, seq;
+	unsigned pos;
+
+	old = ACCESS_ONCE(log_reserve);
+	for (;;) {
+		unsigned long ref_seq;
+		unsigned ref_pos;
+
+		/* The references must not be older than @old */
+		smp_rmb();
+		ref_seq = ACCESS_ONCE(log_commit_seq);
+		ref_pos = ACCESS_ONCE(log_end);
+
+		/*
+		 * Nor newer: records reserved and committed since @old was
+		 * read would make it look far behind them.  Start over from
+		 * the current reservation then.
+		 */
+		smp_rmb();
+		cur = ACCESS_ONCE(log_reserve);
+		if (cur != old) {
+			old = cur;
+			continue;
+		}
+
+		seq = log_res_seq(old, ref_seq);
+		pos = log_res_pos(old, ref_pos);
+		if (seq - ref_seq >= min_t(unsigned long, LOG_DESC_COUNT,
+					   LOG_RES_SEQ_MASK / 2) ||
+		    pos + len - ref_pos >= LOG_RES_POS_MASK / 2 ||
+		    pos + len - ref_pos > log_buf_len)
+			return false;
+
+		new = ((seq + 1) << LOG_RES_POS_BITS) |
+		      ((pos + len) & LOG_RES_POS_MASK);
+		cur = cmpxchg(&log_reserve, old, new);
+		if (cur == old)
+			break;
+		old = cur;
+	}
+	*seqp = seq;
+	*beginp = pos;
+	return true;
+}
+
+static void log_copy_in(unsigned idx, const char *src, unsigned len)
+{
+	unsigned off = idx & LOG_BUF_MASK;
+	unsigned n = min_t(unsigned, len, log_buf_len - off);
+
+	memcpy(log_buf + off, src, n);
+	memcpy(log_buf, src + n, len - n);
+}
+
+static void log_copy_out(char *dst, unsigned idx, unsigned len)
+{
+	unsigned off = idx & LOG_BUF_MASK;
+	unsigned n = min_t(unsigned, len, log_buf_len - off);
+
+	memcpy(dst, log_buf + off, n);
+	memcpy(dst + n, log_buf, len - n);
+}
+
+/* Move log_end forward to @end, and account the new text in logged_chars */
+static void log_end_advance(unsigned end)
+{
+	unsigned old = ACCESS_ONCE(log_end), cur, chars, new;
+
+	while ((int)(end - old) > 0) {
+		cur = cmpxchg(&log_end, old, end);
+		if (cur != old) {
+			old = cur;
+			continue;
+		}
+		chars = ACCESS_ONCE(logged_chars);
+		while (chars < log_buf_len) {
+			new = min_t(unsigned, chars + end - old, log_buf_len);
+			cur = cmpxchg(&logged_chars, chars, new);
+			if (cur == chars)
+				break;
+			chars = cur;
+		}
+		break;
+	}
+}
+
+/* Move the commit frontier over every record that is complete */
+static void log_commit_advance(void)
+{
+	unsigned long seq;
+	struct log_desc *d;
+	unsigned end;
+
+	for (;;) {
+		seq = ACCESS_ONCE(log_commit_seq);
+		d = &log_desc[seq & LOG_DESC_MASK];
+		smp_rmb();
+		if (ACCESS_ONCE(d->id) != seq + 1)
+			return;
+		smp_rmb();
+		end = d->begin + d->len;
+		if (cmpxchg(&log_commit_seq, seq, seq + 1) == seq)
+			log_end_advance(end);
+	}
+}
+
+/*
+ * Copy the text of record @seq, without its "<level>" prefix, to @buf.
+ * Returns the length copied, or -1 if the record has been overwritten.
+ */
+static int log_read_record(unsigned long seq, char *buf, unsigned size,
+			   int *level)
+{
+	struct log_desc *d = &log_desc[seq & LOG_DESC_MASK];
+	unsigned begin, len;
+
+	if (ACCESS_ONCE(d->id) != seq + 1)
+		return -1;
+	smp_rmb();
+	begin = d->begin + d->text;
+	len = min_t(unsigned, d->len - d->text, size);
+	*level = d->level;
+	smp_rmb();
+	if (ACCESS_ONCE(d->id) != seq + 1)
+		return -1;
+
+	log_copy_out(buf, begin, len);
+	smp_rmb();
+	if (log_reserved_end() - begin > log_buf_len)
+		return -1;
+	return len;
+}
+
+/* Oldest record still described that starts at or after @idx */
+static unsigned long log_seq_from(unsigned idx)
+{
+	unsigned long end = ACCESS_ONCE(log_commit_seq);
+	unsigned long seq = end - min_t(unsigned long, end, LOG_DESC_COUNT);
+	struct log_desc *d;
+
+	for (; seq != end; seq++) {
+		d = &log_desc[seq & LOG_DESC_MASK];
+		if (ACCESS_ONCE(d->id) == seq + 1 &&
+		    (int)(ACCESS_ONCE(d->begin) - idx) >= 0)
+			break;
+	}
+	return seq;
+}
+
 #ifdef CONFIG_KEXEC
 /*
  * This appends the listed symbols to /proc/vmcoreinfo
@@ -201,7 +464,7 @@ early_param("log_buf_len", log_buf_len_setup);
 void __init setup_log_buf(int early)
 {
 	unsigned long flags;
-	unsigned start, dest_idx, offset;
+	unsigned start, idx;
 	char *new_log_buf;
 	int free;
 
@@ -225,24 +488,27 @@ void __init setup_log_buf(int early)
 		return;
 	}
 
+	/*
+	 * Records and readers keep their indices: the text is copied to
+	 * the same positions modulo the new length.  Whatever __log_buf
+	 * had already lost is skipped.
+	 */
 	raw_spin_lock_irqsave(&logbuf_lock, flags);
+	free = __LOG_BUF_LEN - log_end;
+	start = log_end > __LOG_BUF_LEN ? log_end - __LOG_BUF_LEN : 0;
+	for (idx = start; idx != log_end; idx++)
+		new_log_buf[idx & (new_log_buf_len - 1)] =
+			__log_buf[idx & (__LOG_BUF_LEN - 1)];
+	if ((int)(log_start - start) < 0)
+		log_start = start;
+	while (console_seq != log_commit_seq &&
+	       (int)(log_desc[console_seq & LOG_DESC_MASK].begin - start) < 0) {
+		console_seq++;
+		console_dropped++;
+	}
 	log_buf_len = new_log_buf_len;
 	log_buf = new_log_buf;
 	new_log_buf_len = 0;
-	free = __LOG_BUF_LEN - log_end;
-
-	offset = start = min(con_start, log_start);
-	dest_idx = 0;
-	while (start != log_end) {
-		unsigned log_idx_mask = start & (__LOG_BUF_LEN - 1);
-
-		log_buf[dest_idx] = __log_buf[log_idx_mask];
-		start++;
-		dest_idx++;
-	}
-	log_start -= offset;
-	con_start -= offset;
-	log_end -= offset;
 	raw_spin_unlock_irqrestore(&logbuf_lock, flags);
 
 	pr_info("log_buf_len: %d\n", log_buf_len);
@@ -379,8 +645,14 @@ int do_syslog(int type, char __user *buf, int len, bool from_file)
 			goto out;
 		i = 0;
 		raw_spin_lock_irq(&logbuf_lock);
-		while (!error && (log_start != log_end) && i < len) {
+		while (!error && i < len) {
+			log_start = log_valid_from(log_start);
+			if ((int)(log_end - log_start) <= 0)
+				break;
 			c = LOG_BUF(log_start);
+			smp_rmb();
+			if (log_valid_from(log_start) != log_start)
+				continue;
 			log_start++;
 			raw_spin_unlock_irq(&logbuf_lock);
 			error = __put_user(c,buf);
@@ -426,9 +698,10 @@ int do_syslog(int type, char __user *buf, int len, bool from_file)
 		 */
 		for (i = 0; i < count && !error; i++) {
 			j = limit-1-i;
-			if (j + log_buf_len < log_end)
-				break;
 			c = LOG_BUF(j);
+			smp_rmb();
+			if (log_reserved_end() - j > log_buf_len)
+				break;
 			raw_spin_unlock_irq(&logbuf_lock);
 			error = __put_user(c,&buf[count-1-i]);
 			cond_resched();
@@ -482,7 +755,10 @@ int do_syslog(int type, char __user *buf, int len, bool from_file)
 		break;
 	/* Number of chars in the log buffer */
 	case SYSLOG_ACTION_SIZE_UNREAD:
-		error = log_end - log_start;
+		raw_spin_lock_irq(&logbuf_lock);
+		log_start = log_valid_from(log_start);
+		error = max_t(int, log_end - log_start, 0);
+		raw_spin_unlock_irq(&logbuf_lock);
 		break;
 	/* Size of the log buffer */
 	case SYSLOG_ACTION_SIZE_BUFFER:
@@ -518,9 +794,9 @@ void kdb_syslog_data(char *syslog_data[4])
 #endif	/* CONFIG_KGDB_KDB */
 
 /*
- * Call the console drivers on a range of log_buf
+ * Call the console drivers on a line of text
  */
-static void __call_console_drivers(unsigned start, unsigned end)
+static void __call_console_drivers(const char *text, unsigned len)
 {
 	struct console *con;
 
@@ -530,7 +806,7 @@ static void __call_console_drivers(unsigned start, unsigned end)
 		if ((con->flags & CON_ENABLED) && con->write &&
 				(cpu_online(smp_processor_id()) ||
 				(con->flags & CON_ANYTIME)))
-			con->write(con, &LOG_BUF(start), end - start);
+			con->write(con, text, len);
 	}
 }
 
@@ -549,27 +825,6 @@ module_param(ignore_loglevel, bool, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(ignore_loglevel, "ignore loglevel setting, to"
 	"print all kernel messages to the console.");
 
-/*
- * Write out chars from start to end - 1 inclusive
- */
-static void _call_console_drivers(unsigned start,
-				unsigned end, int msg_log_level)
-{
-	trace_console(&LOG_BUF(0), start, end, log_buf_len);
-
-	if ((msg_log_level < console_loglevel || ignore_loglevel) &&
-			console_drivers && start != end) {
-		if ((start & LOG_BUF_MASK) > (end & LOG_BUF_MASK)) {
-			/* wrapped write */
-			__call_console_drivers(start & LOG_BUF_MASK,
-						log_buf_len);
-			__call_console_drivers(0, end & LOG_BUF_MASK);
-		} else {
-			__call_console_drivers(start, end);
-		}
-	}
-}
-
 /*
  * Parse the syslog header <[0-9]*>. The decimal value represents 32bit, the
  * lower 3 bit are the log level, the rest are the log facility. In case
@@ -632,60 +887,97 @@ static size_t log_prefix(const char *p, unsigned int *level, char *special)
 	return len;
 }
 
+/* Room for the text of any record, a power of two for trace_console */
+static char console_text[2 * PRINTK_LINE_MAX];
+
 /*
- * Call the console drivers, asking them to write out
- * log_buf[start] to log_buf[end - 1].
+ * Call the console drivers on the text of a record logged at
+ * @msg_log_level.
  * The console_lock must be held.
  */
-static void call_console_drivers(unsigned start, unsigned end)
+static void call_console_drivers(const char *text, unsigned len,
+				 int msg_log_level)
 {
-	unsigned cur_index, start_print;
-	static int msg_level = -1;
+	trace_console(text, 0, len, sizeof(console_text));
+
+	if ((msg_log_level < console_loglevel || ignore_loglevel) &&
+			console_drivers && len)
+		__call_console_drivers(text, len);
+}
 
-	BUG_ON(((int)(start - end)) > 0);
+/* Are there records the consoles have not seen yet? */
+static bool console_pending(void)
+{
+	return console_seq != ACCESS_ONCE(log_commit_seq);
+}
 
-	cur_index = start;
-	start_print = start;
-	while (cur_index != end) {
-		if (msg_level < 0 && ((end - cur_index) > 2)) {
-			/* strip log prefix */
-			cur_index += log_prefix(&LOG_BUF(cur_index), &msg_level, NULL);
-			start_print = cur_index;
+/*
+ * Print the pending records on the consoles, all of them if @all is set
+ * and at most console_batch otherwise.  Returns true if records are left.
+ * The console_lock must be held.
+ */
+static bool console_flush(bool all)
+{
+	unsigned int budget = all ? 0 : console_batch;
+	unsigned long end, dropped;
+	char msg[64];
+	int len, level, n;
+
+	while (console_pending()) {
+		end = ACCESS_ONCE(log_commit_seq);
+		if (end - console_seq > LOG_DESC_COUNT) {
+			console_dropped += end - LOG_DESC_COUNT - console_seq;
+			console_seq = end - LOG_DESC_COUNT;
 		}
-		while (cur_index != end) {
-			char c = LOG_BUF(cur_index);
-
-			cur_index++;
-			if (c == '\n') {
-				if (msg_level < 0) {
-					/*
-					 * printk() has already given us loglevel tags in
-					 * the buffer.  This code is here in case the
-					 * log buffer has wrapped right round and scribbled
-					 * on those tags
-					 */
-					msg_level = default_message_loglevel;
-				}
-				_call_console_drivers(start_print, cur_index, msg_level);
-				msg_level = -1;
-				start_print = cur_index;
-				break;
-			}
+		len = log_read_record(console_seq, console_text,
+				      sizeof(console_text), &level);
+		console_seq++;
+		if (len < 0) {
+			console_dropped++;
+			continue;
+		}
+
+		dropped = console_dropped + atomic_xchg(&log_dropped, 0);
+		console_dropped = 0;
+		if (dropped) {
+			n = scnprintf(msg, sizeof(msg),
+				      "** %lu printk messages dropped **\n",
+				      dropped);
+			call_console_drivers(msg, n, 4);
 		}
+		call_console_drivers(console_text, len, level);
+
+		if (budget && !--budget)
+			return console_pending();
 	}
-	_call_console_drivers(start_print, end, msg_level);
+	return false;
+}
+
+/*
+ * Consoles are written to from printk() itself until the printk thread
+ * runs, while oopsing, when the system is going down and the thread may
+ * not run again, and when asked to on the command line.
+ */
+static bool printk_console_sync(void)
+{
+	return !printk_thread || printk_sync_console || oops_in_progress ||
+	       system_state > SYSTEM_RUNNING;
 }
 
-static void emit_log_char(char c)
+static void console_wake(void)
 {
-	LOG_BUF(log_end) = c;
-	log_end++;
-	if (log_end - log_start > log_buf_len)
-		log_start = log_end - log_buf_len;
-	if (log_end - con_start > log_buf_len)
-		con_start = log_end - log_buf_len;
-	if (logged_chars < log_buf_len)
-		logged_chars++;
+	if (printk_thread)
+		wake_up_process(printk_thread);
+}
+
+/* Replay the records syslog() has not read yet */
+static void console_rewind(void)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&logbuf_lock, flags);
+	console_seq = log_seq_from(log_start);
+	raw_spin_unlock_irqrestore(&logbuf_lock, flags);
 }
 
 /*
@@ -738,11 +1030,14 @@ static int have_callable_console(void)
  *
  * This is printk().  It can be called from any context.  We want it to work.
  *
- * We try to grab the console_lock.  If we succeed, it's easy - we log the output and
- * call the console drivers.  If we fail to get the semaphore we place the output
- * into the log buffer and return.  The current holder of the console_sem will
- * notice the new output in console_unlock(); and will send it to the
- * consoles before releasing the lock.
+ * The message is stored in the log buffer without taking any lock, and
+ * the consoles are written to later by the printk thread, which is
+ * woken from the next timer tick.  Until that thread runs, while oopsing
+ * or with printk.synchronous set, we instead try to grab the console_lock.
+ * If we succeed, we call the console drivers; if we fail, the current
+ * holder of the console_sem will notice the new output in
+ * console_unlock(); and will send it to the consoles before releasing the
+ * lock.
  *
  * One effect of this deferred printing is that code which calls printk() and
  * then changes console_loglevel may break. This is because console_loglevel
@@ -774,9 +1069,6 @@ asmlinkage int printk(const char *fmt, ...)
 	return r;
 }
 
-/* cpu currently holding logbuf_lock */
-static volatile unsigned int printk_cpu = UINT_MAX;
-
 /*
  * Can we actually use the console at this time on this cpu?
  *
@@ -795,42 +1087,185 @@ static inline int can_use_console(unsigned int cpu)
  * messages from a 'printk'. Return true (and with the
  * console_lock held, and 'console_locked' set) if it
  * is successful, false otherwise.
- *
- * This gets called with the 'logbuf_lock' spinlock held and
- * interrupts disabled. It should return with 'lockbuf_lock'
- * released but interrupts still disabled.
  */
 static int console_trylock_for_printk(unsigned int cpu)
-	__releases(&logbuf_lock)
 {
-	int retval = 0, wake = 0;
-
-	if (console_trylock()) {
-		retval = 1;
+	if (!console_trylock())
+		return 0;
 
-		/*
-		 * If we can't use the console, we need to release
-		 * the console semaphore by hand to avoid flushing
-		 * the buffer. We need to hold the console semaphore
-		 * in order to do this test safely.
-		 */
-		if (!can_use_console(cpu)) {
-			console_locked = 0;
-			wake = 1;
-			retval = 0;
-		}
-	}
-	printk_cpu = UINT_MAX;
-	if (wake)
+	/*
+	 * If we can't use the console, we need to release
+	 * the console semaphore by hand to avoid flushing
+	 * the buffer. We need to hold the console semaphore
+	 * in order to do this test safely.
+	 */
+	if (!can_use_console(cpu)) {
+		console_locked = 0;
 		up(&console_sem);
-	raw_spin_unlock(&logbuf_lock);
-	return retval;
+		return 0;
+	}
+	return 1;
 }
+
 static const char recursion_bug_msg [] =
-		KERN_CRIT "BUG: recent printk recursion!\n";
+		"BUG: recent printk recursion!";
 static int recursion_bug;
-static int new_text_line = 1;
-static __suspend_volatile_bss char printk_buf[1024];
+
+/*
+ * printk() formats its message into a per-cpu buffer with interrupts
+ * off.  A printk() from NMI context, or one recursing from within
+ * printk(), uses the second buffer; deeper recursion is dropped.
+ */
+#define PRINTK_NEST_MAX		2
+
+static DEFINE_PER_CPU(char [PRINTK_NEST_MAX][PRINTK_LINE_MAX], printk_buf);
+static DEFINE_PER_CPU(int, printk_nest);
+
+/*
+ * A line printed in several pieces is assembled here and logged as one
+ * record once it is complete: at its newline, at the next printk() on
+ * this CPU that starts a new line, when the buffer fills up, or from the
+ * timer tick if the rest of the line does not show up.
+ */
+struct log_cont {
+	char buf[PRINTK_LINE_MAX];
+	unsigned len;
+	char prefix[16];
+	unsigned prefix_len;
+	int level;
+	u64 ts;
+	unsigned long jiffies;
+};
+
+static DEFINE_PER_CPU(struct log_cont, log_cont);
+
+/*
+ * Store one line as a record: @prefix, the time stamp if enabled, @text
+ * and a newline.
+ */
+static void log_store(const char *prefix, unsigned plen, int level, u64 ts,
+		      const char *text, unsigned len)
+{
+	char tbuf[32];
+	unsigned tlen = 0, total, begin;
+	unsigned long seq;
+	struct log_desc *d;
+
+	if (printk_time) {
+		unsigned long nanosec_rem = do_div(ts, 1000000000);
+
+		tlen = sprintf(tbuf, "[%5lu.%06lu] ", (unsigned long)ts,
+			       nanosec_rem / 1000);
+	}
+	total = plen + tlen + len + 1;
+	if (!log_reserve_record(total, &seq, &begin)) {
+		atomic_inc(&log_dropped);
+		return;
+	}
+
+	/* Readers of the record that used this descriptor must notice */
+	d = &log_desc[seq & LOG_DESC_MASK];
+	ACCESS_ONCE(d->id) = seq;
+	smp_wmb();
+
+	log_copy_in(begin, prefix, plen);
+	log_copy_in(begin + plen, tbuf, tlen);
+	log_copy_in(begin + plen + tlen, text, len);
+	LOG_BUF(begin + total - 1) = '\n';
+	d->begin = begin;
+	d->len = total;
+	d->text = plen;
+	d->level = level;
+	smp_wmb();
+	ACCESS_ONCE(d->id) = seq + 1;
+
+	/* Pairs with the cmpxchg() of whoever holds up the frontier */
+	smp_mb();
+	log_commit_advance();
+}
+
+static void log_cont_flush(struct log_cont *cont)
+{
+	log_store(cont->prefix, cont->prefix_len, cont->level, cont->ts,
+		  cont->buf, cont->len);
+	cont->len = 0;
+}
+
+static void log_cont_add(struct log_cont *cont, const char *text,
+			 unsigned len)
+{
+	unsigned n;
+
+	while (len) {
+		n = min_t(unsigned, len, sizeof(cont->buf) - cont->len);
+		memcpy(cont->buf + cont->len, text, n);
+		cont->len += n;
+		text += n;
+		len -= n;
+		if (cont->len == sizeof(cont->buf))
+			log_cont_flush(cont);
+	}
+}
+
+static void log_cont_tick(void)
+{
+	struct log_cont *cont = &__get_cpu_var(log_cont);
+
+	if (cont->len && time_after(jiffies, cont->jiffies)) {
+		log_cont_flush(cont);
+		console_kick(smp_processor_id());
+	}
+}
+
+static bool log_cont_pending(void)
+{
+	return __this_cpu_read(log_cont.len) != 0;
+}
+
+/*
+ * Log the text of one printk() call.  @prefix is the "<level>" header it
+ * came with, if any, and @special the KERN_CONT/KERN_DEFAULT marker.
+ * Complete lines become records right away, a trailing partial line is
+ * kept in @cont if there is one.
+ */
+static void log_text(struct log_cont *cont, const char *prefix,
+		     unsigned plen, char special, int level, const char *text)
+{
+	char lvl[3] = { '<', '0' + level, '>' };
+	u64 ts = local_clock();
+	const char *nl;
+	unsigned len;
+
+	/* Unprefixed text and KERN_CONT continue the current line */
+	if (cont && cont->len && plen && special != 'c')
+		log_cont_flush(cont);
+	if (!plen || special || plen > sizeof(cont->prefix)) {
+		prefix = lvl;
+		plen = sizeof(lvl);
+	}
+
+	while (*text) {
+		nl = strchr(text, '\n');
+		len = nl ? nl - text : strlen(text);
+		if (cont && cont->len) {
+			log_cont_add(cont, text, len);
+			if (nl)
+				log_cont_flush(cont);
+		} else if (nl || !cont) {
+			log_store(prefix, plen, level, ts, text, len);
+		} else {
+			memcpy(cont->prefix, prefix, plen);
+			cont->prefix_len = plen;
+			cont->level = level;
+			cont->ts = ts;
+			cont->jiffies = jiffies;
+			log_cont_add(cont, text, len);
+		}
+		if (!nl)
+			break;
+		text = nl + 1;
+	}
+}
 
 int printk_delay_msec __read_mostly;
 
@@ -848,138 +1283,64 @@ static inline void printk_delay(void)
 
 asmlinkage int vprintk(const char *fmt, va_list args)
 {
-	int printed_len = 0;
-	int current_log_level = default_message_loglevel;
+	int printed_len;
+	unsigned int current_log_level = default_message_loglevel;
 	unsigned long flags;
-	int this_cpu;
-	char *p;
+	int this_cpu, nest;
+	char *buf;
 	size_t plen;
-	char special;
+	char special = 0;
 
 	boot_delay_msec();
 	printk_delay();
 
-	/* This stops the holder of console_sem just where we want him */
 	local_irq_save(flags);
 	this_cpu = smp_processor_id();
+	nest = __this_cpu_read(printk_nest);
 
 	/*
 	 * Ouch, printk recursed into itself!
 	 */
-	if (unlikely(printk_cpu == this_cpu)) {
+	if (unlikely(nest)) {
 		/*
 		 * If a crash is occurring during printk() on this CPU,
-		 * then try to get the crash message out but make sure
-		 * we can't deadlock. Otherwise just return to avoid the
-		 * recursion and return - but flag the recursion so that
+		 * make sure the console can't deadlock.  Past the last
+		 * buffer, just return - but flag the recursion so that
 		 * it can be printed at the next appropriate moment:
 		 */
-		if (!oops_in_progress && !lockdep_recursing(current)) {
+		if (oops_in_progress)
+			zap_locks();
+		if (nest >= PRINTK_NEST_MAX) {
 			recursion_bug = 1;
-			goto out_restore_irqs;
+			local_irq_restore(flags);
+			return 0;
 		}
-		zap_locks();
 	}
+	__this_cpu_write(printk_nest, nest + 1);
 
-	lockdep_off();
-	raw_spin_lock(&logbuf_lock);
-	printk_cpu = this_cpu;
-
-	if (recursion_bug) {
+	if (unlikely(recursion_bug) && !nest) {
 		recursion_bug = 0;
-		strcpy(printk_buf, recursion_bug_msg);
-		printed_len = strlen(recursion_bug_msg);
+		log_text(NULL, NULL, 0, 0, 2, recursion_bug_msg);
 	}
-	/* Emit the output into the temporary buffer */
-	printed_len += vscnprintf(printk_buf + printed_len,
-				  sizeof(printk_buf) - printed_len, fmt, args);
 
-	p = printk_buf;
+	/* Emit the output into the temporary buffer */
+	buf = __get_cpu_var(printk_buf)[nest];
+	printed_len = vscnprintf(buf, PRINTK_LINE_MAX, fmt, args);
 
 	/* Read log level and handle special printk prefix */
-	plen = log_prefix(p, &current_log_level, &special);
-	if (plen) {
-		p += plen;
-
-		switch (special) {
-		case 'c': /* Strip <c> KERN_CONT, continue line */
-			plen = 0;
-			break;
-		case 'd': /* Strip <d> KERN_DEFAULT, start new line */
-			plen = 0;
-		default:
-			if (!new_text_line) {
-				emit_log_char('\n');
-				new_text_line = 1;
-			}
-		}
-	}
-
-	/*
-	 * Copy the output into log_buf. If the caller didn't provide
-	 * the appropriate log prefix, we insert them here
-	 */
-	for (; *p; p++) {
-		if (new_text_line) {
-			new_text_line = 0;
-
-			if (plen) {
-				/* Copy original log prefix */
-				int i;
-
-				for (i = 0; i < plen; i++)
-					emit_log_char(printk_buf[i]);
-				printed_len += plen;
-			} else {
-				/* Add log prefix */
-				emit_log_char('<');
-				emit_log_char(current_log_level + '0');
-				emit_log_char('>');
-				printed_len += 3;
-			}
-
-			if (printk_time) {
-				/* Add the current time stamp */
-				char tbuf[50], *tp;
-				unsigned tlen;
-				unsigned long long t;
-				unsigned long nanosec_rem;
-
-				t = cpu_clock(printk_cpu);
-				nanosec_rem = do_div(t, 1000000000);
-				tlen = sprintf(tbuf, "[%5lu.%06lu] ",
-						(unsigned long) t,
-						nanosec_rem / 1000);
-
-				for (tp = tbuf; tp < tbuf + tlen; tp++)
-					emit_log_char(*tp);
-				printed_len += tlen;
-			}
-
-			if (!*p)
-				break;
-		}
+	plen = log_prefix(buf, &current_log_level, &special);
+	log_text(nest || in_nmi() ? NULL : &__get_cpu_var(log_cont), buf, plen,
+		 special, current_log_level, buf + plen);
 
-		emit_log_char(*p);
-		if (*p == '\n')
-			new_text_line = 1;
-	}
+	__this_cpu_write(printk_nest, nest);
 
 	/*
-	 * Try to acquire and then immediately release the
-	 * console semaphore. The release will do all the
-	 * actual magic (print out buffers, wake up klogd,
-	 * etc). 
-	 *
-	 * The console_trylock_for_printk() function
-	 * will release 'logbuf_lock' regardless of whether it
-	 * actually gets the semaphore or not.
+	 * Get the new records to the consoles, right here or from the
+	 * printk thread.
 	 */
-	if (console_trylock_for_printk(this_cpu))
-		console_unlock();
-
+	lockdep_off();
+	console_kick(this_cpu);
 	lockdep_on();
-out_restore_irqs:
 	local_irq_restore(flags);
 
 	return printed_len;
@@ -989,8 +1350,36 @@ EXPORT_SYMBOL(vprintk);
 
 #else
 
-static void call_console_drivers(unsigned start, unsigned end)
+static bool console_pending(void)
+{
+	return false;
+}
+
+static bool console_flush(bool all)
+{
+	return false;
+}
+
+static bool printk_console_sync(void)
 {
+	return true;
+}
+
+static void console_wake(void)
+{
+}
+
+static void console_rewind(void)
+{
+}
+
+static void log_cont_tick(void)
+{
+}
+
+static bool log_cont_pending(void)
+{
+	return false;
 }
 
 #endif
@@ -1233,18 +1622,22 @@ int is_console_locked(void)
 
 #define PRINTK_PENDING_WAKEUP	0x01
 #define PRINTK_PENDING_SCHED	0x02
+#define PRINTK_PENDING_OUTPUT	0x04
 
 static DEFINE_PER_CPU(int, printk_pending);
 static DEFINE_PER_CPU(char [PRINTK_BUF_SIZE], printk_sched_buf);
 
 void printk_tick(void)
 {
+	log_cont_tick();
 	if (__this_cpu_read(printk_pending)) {
 		int pending = __this_cpu_xchg(printk_pending, 0);
 		if (pending & PRINTK_PENDING_SCHED) {
 			char *buf = __get_cpu_var(printk_sched_buf);
 			printk(KERN_WARNING "[sched_delayed] %s", buf);
 		}
+		if (pending & PRINTK_PENDING_OUTPUT)
+			console_wake();
 		if (pending & PRINTK_PENDING_WAKEUP)
 			wake_up_interruptible(&log_wait);
 	}
@@ -1254,7 +1647,7 @@ int printk_needs_cpu(int cpu)
 {
 	if (cpu_is_offline(cpu))
 		printk_tick();
-	return __this_cpu_read(printk_pending);
+	return __this_cpu_read(printk_pending) || log_cont_pending();
 }
 
 void wake_up_klogd(void)
@@ -1263,13 +1656,44 @@ void wake_up_klogd(void)
 		this_cpu_or(printk_pending, PRINTK_PENDING_WAKEUP);
 }
 
-static void console_unlock_work_fn(struct work_struct *work)
+#ifdef CONFIG_IRQ_WORK
+static void console_wake_work_func(struct irq_work *work)
 {
-	if (console_trylock())
-		console_unlock();
+	console_wake();
 }
 
-static DECLARE_WORK(console_unlock_work, console_unlock_work_fn);
+static DEFINE_PER_CPU(struct irq_work, console_wake_work) = {
+	.func = console_wake_work_func,
+};
+#endif
+
+/*
+ * Have the printk thread print what is pending.  We may be called with
+ * the scheduler's locks held, so the thread is woken from an irq_work,
+ * which runs as soon as interrupts are enabled again, or failing that
+ * from the next timer tick on this CPU.
+ */
+static void console_defer(void)
+{
+#ifdef CONFIG_IRQ_WORK
+	irq_work_queue(&__get_cpu_var(console_wake_work));
+#else
+	this_cpu_or(printk_pending, PRINTK_PENDING_OUTPUT);
+#endif
+}
+
+#ifdef CONFIG_PRINTK
+/* Get new records printed, here or from the printk thread */
+static void console_kick(unsigned int cpu)
+{
+	if (printk_console_sync()) {
+		if (console_trylock_for_printk(cpu))
+			console_unlock();
+	} else {
+		console_defer();
+	}
+}
+#endif
 
 /**
  * console_unlock - unlock the console system
@@ -1279,7 +1703,9 @@ static DECLARE_WORK(console_unlock_work, console_unlock_work_fn);
  *
  * While the console_lock was held, console output may have been buffered
  * by printk().  If this is the case, console_unlock(); emits
- * the output prior to releasing the lock.
+ * the output prior to releasing the lock.  Unless printk() is printing
+ * synchronously, at most console_batch records are emitted; the printk
+ * thread takes care of the rest.
  *
  * If there is output waiting for klogd, we wake it up.
  *
@@ -1287,9 +1713,7 @@ static DECLARE_WORK(console_unlock_work, console_unlock_work_fn);
  */
 void console_unlock(void)
 {
-	unsigned long flags;
-	unsigned _con_start, _log_end;
-	unsigned wake_klogd = 0;
+	bool more, wake_klogd;
 
 	if (console_suspended) {
 		up(&console_sem);
@@ -1298,19 +1722,11 @@ void console_unlock(void)
 
 	console_may_schedule = 0;
 
-	raw_spin_lock_irqsave(&logbuf_lock, flags);
-	wake_klogd |= log_start - log_end;
-	if (con_start != log_end) {
-		_con_start = con_start;
-		_log_end = log_end;
-		con_start = log_end;		/* Flush */
-		raw_spin_unlock(&logbuf_lock);
-		stop_critical_timings();	/* don't trace print latency */
-		call_console_drivers(_con_start, _log_end);
-		start_critical_timings();
-	} else {
-		raw_spin_unlock(&logbuf_lock);
-	}
+again:
+	wake_klogd = log_start != ACCESS_ONCE(log_end);
+	stop_critical_timings();	/* don't trace print latency */
+	more = console_flush(printk_console_sync() || exclusive_console);
+	start_critical_timings();
 
 	console_locked = 0;
 
@@ -1321,14 +1737,18 @@ void console_unlock(void)
 	up(&console_sem);
 
 	/*
-	 * Someone could have filled up the buffer again, so re-check and
-	 * schedule work if there's something to flush.
+	 * Someone could have logged more records since we looked, or we
+	 * left some behind.  Print them now or leave them to the printk
+	 * thread.
 	 */
-	raw_spin_lock(&logbuf_lock);
-	if (con_start != log_end)
-		if (!work_pending(&console_unlock_work))
-			schedule_work(&console_unlock_work);
-	raw_spin_unlock_irqrestore(&logbuf_lock, flags);
+	if (more || console_pending()) {
+		if (printk_console_sync()) {
+			if (console_trylock())
+				goto again;
+		} else {
+			console_defer();
+		}
+	}
 
 	if (wake_klogd)
 		wake_up_klogd();
@@ -1448,7 +1868,6 @@ early_param("keep_bootcon", keep_bootcon_setup);
 void register_console(struct console *newcon)
 {
 	int i;
-	unsigned long flags;
 	struct console *bcon = NULL;
 
 	/*
@@ -1559,9 +1978,7 @@ void register_console(struct console *newcon)
 		 * console_unlock(); will print out the buffered messages
 		 * for us.
 		 */
-		raw_spin_lock_irqsave(&logbuf_lock, flags);
-		con_start = log_start;
-		raw_spin_unlock_irqrestore(&logbuf_lock, flags);
+		console_rewind();
 		/*
 		 * We're about to replay the log buffer.  Only do this to the
 		 * just-registered console to avoid excessive message spam to
@@ -1654,6 +2071,35 @@ late_initcall(printk_late_init);
 
 #if defined CONFIG_PRINTK
 
+static int printk_thread_fn(void *unused)
+{
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!console_pending() || console_suspended)
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		console_lock();
+		console_unlock();
+		cond_resched();
+	}
+	return 0;
+}
+
+static int __init printk_thread_init(void)
+{
+	struct task_struct *t;
+
+	t = kthread_run(printk_thread_fn, NULL, "printk");
+	if (IS_ERR(t)) {
+		pr_err("printk: cannot start thread, printing synchronously\n");
+		return PTR_ERR(t);
+	}
+	printk_thread = t;
+	return 0;
+}
+early_initcall(printk_thread_init);
+
 int printk_sched(const char *fmt, ...)
 {
 	unsigned long flags;
@@ -52,6 +52,10 @@
 #include <linux/prefetch.h>
 #include <linux/delay.h>
 #include <linux/stop_machine.h>
+#include <linux/tick.h>
+#include <linux/bootmem.h>
+
+#include <asm/irq_regs.h>
 
 #include "rcutree.h"
 #include <trace/events/rcu.h>
@@ -62,7 +66,7 @@
 
 static struct lock_class_key rcu_node_class[NUM_RCU_LVLS];
 
-#define RCU_STATE_INITIALIZER(structname) { \
+#define RCU_STATE_INITIALIZER(structname, sabbr) { \
 	.level = { &structname##_state.node[0] }, \
 	.levelcnt = { \
 		NUM_RCU_LVL_0,  /* root of hierarchy. */ \
@@ -76,15 +80,18 @@ static struct lock_class_key rcu_node_class[NUM_RCU_LVLS];
 	.completed = -300, \
 	.onofflock = __RAW_SPIN_LOCK_UNLOCKED(&structname##_state.onofflock), \
 	.fqslock = __RAW_SPIN_LOCK_UNLOCKED(&structname##_state.fqslock), \
+	.sync_lock = __RAW_SPIN_LOCK_UNLOCKED(&structname##_state.sync_lock), \
+	.sync_wq = __WAIT_QUEUE_HEAD_INITIALIZER(structname##_state.sync_wq), \
 	.n_force_qs = 0, \
 	.n_force_qs_ngp = 0, \
 	.name = #structname, \
+	.abbr = sabbr, \
 }
 
-struct rcu_state rcu_sched_state = RCU_STATE_INITIALIZER(rcu_sched);
+struct rcu_state rcu_sched_state = RCU_STATE_INITIALIZER(rcu_sched, 's');
 DEFINE_PER_CPU(struct rcu_data, rcu_sched_data);
 
-struct rcu_state rcu_bh_state = RCU_STATE_INITIALIZER(rcu_bh);
+struct rcu_state rcu_bh_state = RCU_STATE_INITIALIZER(rcu_bh, 'b');
 DEFINE_PER_CPU(struct rcu_data, rcu_bh_data);
 
 static struct rcu_state *rcu_state;
@@ -691,6 +698,13 @@ static int rcu_implicit_dynticks_qs(struct rcu_data *rdp)
 		return 1;
 	}
 
+	/*
+	 * A full dynticks CPU running a single task may have stopped its
+	 * tick before noticing this grace period.  Kick it so that it
+	 * restarts the tick until it has reported a quiescent state.
+	 */
+	tick_nohz_full_kick_cpu(rdp->cpu);
+
 	/* Go check for the CPU being offline. */
 	return rcu_implicit_offline_qs(rdp);
 }
@@ -1822,6 +1836,12 @@ __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
 	local_irq_save(flags);
 	rdp = this_cpu_ptr(rsp->rda);
 
+	/* Offloaded CPUs hand the callback to their rcuo kthread. */
+	if (is_nocb_cpu(rdp->cpu) && __call_rcu_nocb(rdp, head, lazy, flags)) {
+		local_irq_restore(flags);
+		return;
+	}
+
 	/* Add the callback to our list. */
 	*rdp->nxttail[RCU_NEXT_TAIL] = head;
 	rdp->nxttail[RCU_NEXT_TAIL] = &head->next;
@@ -1835,6 +1855,14 @@ __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
 	else
 		trace_rcu_callback(rsp->name, head, rdp->qlen_lazy, rdp->qlen);
 
+	/*
+	 * A full dynticks CPU with its tick stopped would otherwise sit
+	 * on the callback until its next interrupt.
+	 */
+	if (tick_nohz_full_cpu(rdp->cpu) &&
+	    tick_nohz_tick_stopped_cpu(rdp->cpu))
+		tick_nohz_full_kick_cpu(rdp->cpu);
+
 	/* If interrupts were disabled, don't dive into RCU core. */
 	if (irqs_disabled_flags(flags)) {
 		local_irq_restore(flags);
@@ -1893,6 +1921,67 @@ void call_rcu_bh(struct rcu_head *head, void (*func)(struct rcu_head *rcu))
 }
 EXPORT_SYMBOL_GPL(call_rcu_bh);
 
+/*
+ * Synchronous grace-period waits are batched, so that concurrent
+ * callers of synchronize_sched() and friends share a single callback and
+ * thus a single grace period.  At most one batch is in flight per flavor:
+ * a caller arriving while it is in flight cannot use it, since that grace
+ * period may have started before the caller's updates, so the caller
+ * instead joins the next batch, which is posted from the completion of
+ * the current one.  However many callers arrive meanwhile, they are all
+ * covered by that next grace period.
+ */
+static void rcu_sync_batch_done(struct rcu_head *head);
+
+/* Post the next batch's callback.  Caller must hold ->sync_lock. */
+static void rcu_sync_batch_post(struct rcu_state *rsp)
+{
+	rsp->sync_posted++;
+	__call_rcu(&rsp->sync_head, rcu_sync_batch_done, rsp, 0);
+}
+
+static void rcu_sync_batch_done(struct rcu_head *head)
+{
+	struct rcu_state *rsp = container_of(head, struct rcu_state, sync_head);
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&rsp->sync_lock, flags);
+	rsp->sync_completed = rsp->sync_posted;
+	if (rsp->sync_next_wanted) {
+		rsp->sync_next_wanted = false;
+		rcu_sync_batch_post(rsp);
+	}
+	raw_spin_unlock_irqrestore(&rsp->sync_lock, flags);
+	wake_up_all(&rsp->sync_wq);
+}
+
+/*
+ * Wait for a grace period of the specified flavor, sharing it with any
+ * concurrent waiters.  A caller that posts the callback also kicks this
+ * CPU's RCU core so that the grace period starts now rather than at the
+ * next scheduling-clock interrupt.
+ */
+static void rcu_wait_gp_batched(struct rcu_state *rsp)
+{
+	unsigned long flags;
+	unsigned long snap;
+
+	raw_spin_lock_irqsave(&rsp->sync_lock, flags);
+	rsp->n_sync_waiters++;
+	if (rsp->sync_completed == rsp->sync_posted) {
+		rcu_sync_batch_post(rsp);
+		snap = rsp->sync_posted;
+		invoke_rcu_core();
+	} else {
+		rsp->sync_next_wanted = true;
+		snap = rsp->sync_posted + 1;
+	}
+	raw_spin_unlock_irqrestore(&rsp->sync_lock, flags);
+	wait_event(rsp->sync_wq,
+		   ULONG_CMP_GE(ACCESS_ONCE(rsp->sync_completed), snap));
+	smp_mb(); /* ensure test happens before caller kfree */
+}
+
 /**
  * synchronize_sched - wait until an rcu-sched grace period has elapsed.
  *
@@ -1924,7 +2013,7 @@ void synchronize_sched(void)
 			   "Illegal synchronize_sched() in RCU-sched read-side critical section");
 	if (rcu_blocking_is_gp())
 		return;
-	wait_rcu_gp(call_rcu_sched);
+	rcu_wait_gp_batched(&rcu_sched_state);
 }
 EXPORT_SYMBOL_GPL(synchronize_sched);
 
@@ -1945,7 +2034,7 @@ void synchronize_rcu_bh(void)
 			   "Illegal synchronize_rcu_bh() in RCU-bh read-side critical section");
 	if (rcu_blocking_is_gp())
 		return;
-	wait_rcu_gp(call_rcu_bh);
+	rcu_wait_gp_batched(&rcu_bh_state);
 }
 EXPORT_SYMBOL_GPL(synchronize_rcu_bh);
 
@@ -1969,6 +2058,64 @@ static int synchronize_sched_expedited_cpu_stop(void *data)
 	return 0;
 }
 
+/*
+ * Find out whether this CPU was interrupted from a quiescent state:
+ * userspace, or the idle loop outside of any nested interrupt.  Such
+ * CPUs need not be stopped.  This is the same test that
+ * rcu_check_callbacks() applies from the scheduling-clock interrupt.
+ */
+static void synchronize_sched_expedited_ipi(void *data)
+{
+	struct cpumask *cm = data;
+	struct pt_regs *regs = get_irq_regs();
+
+	smp_mb(); /* Order caller's prior accesses before our check. */
+	if (rcu_is_cpu_rrupt_from_idle() ||
+	    (hardirq_count() <= HARDIRQ_OFFSET && !in_softirq() &&
+	     regs && user_mode(regs)))
+		cpumask_clear_cpu(smp_processor_id(), cm);
+}
+
+/*
+ * Force a context switch on every online CPU that is not already in a
+ * quiescent state.  CPUs in dyntick-idle are skipped outright, and the
+ * remaining ones other than our own get a plain IPI to find out whether
+ * they are in userspace or idle.  Only those found in the kernel are
+ * handed to try_stop_cpus(), so that an expedited grace period no longer
+ * preempts the tasks of every CPU on the system.  Our own CPU is in a
+ * quiescent state by virtue of the caller being allowed to sleep.
+ * Returns -EAGAIN if try_stop_cpus() does.
+ */
+static int synchronize_sched_expedited_stop(void)
+{
+	cpumask_var_t cm;
+	int cpu;
+	int ret = 0;
+
+	if (!zalloc_cpumask_var(&cm, GFP_KERNEL))
+		return try_stop_cpus(cpu_online_mask,
+				     synchronize_sched_expedited_cpu_stop,
+				     NULL);
+	preempt_disable();
+	for_each_online_cpu(cpu) {
+		atomic_t *dt = &per_cpu(rcu_dynticks, cpu).dynticks;
+
+		if (cpu == smp_processor_id())
+			continue;
+		/* Even ->dynticks means dyntick-idle, a quiescent state. */
+		if (!(atomic_add_return(0, dt) & 0x1))
+			continue;
+		cpumask_set_cpu(cpu, cm);
+	}
+	smp_call_function_many(cm, synchronize_sched_expedited_ipi, cm, 1);
+	preempt_enable();
+	if (!cpumask_empty(cm))
+		ret = try_stop_cpus(cm, synchronize_sched_expedited_cpu_stop,
+				    NULL);
+	free_cpumask_var(cm);
+	return ret;
+}
+
 /**
  * synchronize_sched_expedited - Brute-force RCU-sched grace period
  *
@@ -1990,9 +2137,10 @@ static int synchronize_sched_expedited_cpu_stop(void *data)
  * sync_sched_expedited_done taking on the roles of the halves
  * of the ticket-lock word.  Each task atomically increments
  * sync_sched_expedited_started upon entry, snapshotting the old value,
- * then attempts to stop all the CPUs.  If this succeeds, then each
- * CPU will have executed a context switch, resulting in an RCU-sched
- * grace period.  We are then done, so we use atomic_cmpxchg() to
+ * then attempts to stop all the CPUs that are not idle or in userspace,
+ * see synchronize_sched_expedited_stop().  If this succeeds, then each
+ * CPU will have passed through a quiescent state, resulting in an
+ * RCU-sched grace period.  We are then done, so we use atomic_cmpxchg() to
  * update sync_sched_expedited_done to match our snapshot -- but
  * only if someone else has not already advanced past our snapshot.
  *
@@ -2019,9 +2167,7 @@ void synchronize_sched_expedited(void)
 	 * Each pass through the following loop attempts to force a
 	 * context switch on each CPU.
 	 */
-	while (try_stop_cpus(cpu_online_mask,
-			     synchronize_sched_expedited_cpu_stop,
-			     NULL) == -EAGAIN) {
+	while (synchronize_sched_expedited_stop() == -EAGAIN) {
 		put_online_cpus();
 
 		/* No joy, try again later.  Or just synchronize_sched(). */
@@ -2153,6 +2299,30 @@ static int rcu_pending(int cpu)
 	       rcu_preempt_pending(cpu);
 }
 
+/*
+ * Is the current grace period of the specified flavor still waiting
+ * for a quiescent state from the specified CPU?
+ */
+static int __rcu_needs_cpu_qs(struct rcu_state *rsp, struct rcu_data *rdp)
+{
+	return rcu_gp_in_progress(rsp) &&
+	       (ACCESS_ONCE(rdp->mynode->qsmask) & rdp->grpmask);
+}
+
+/*
+ * Does any grace period wait on the specified CPU?  Full dynticks CPUs
+ * keep their tick until the answer is no, since nothing else reports a
+ * quiescent state for a busy CPU.  This function is part of the RCU
+ * implementation; it is -not- an exported member of the RCU API.
+ */
+int rcu_needs_cpu_qs(int cpu)
+{
+	return __rcu_needs_cpu_qs(&rcu_sched_state,
+				  &per_cpu(rcu_sched_data, cpu)) ||
+	       __rcu_needs_cpu_qs(&rcu_bh_state, &per_cpu(rcu_bh_data, cpu)) ||
+	       rcu_preempt_needs_cpu_qs(cpu);
+}
+
 /*
  * Check to see if any future RCU-related work will need to be done
  * by the current CPU, even if none need be done immediately, returning
@@ -2211,12 +2381,14 @@ static void _rcu_barrier(struct rcu_state *rsp,
 	 * decrement rcu_barrier_cpu_count -- otherwise the first CPU
 	 * might complete its grace period before all of the other CPUs
 	 * did their increment, causing this function to return too
-	 * early.  Note that on_each_cpu() disables irqs, which prevents
-	 * any CPUs from coming online or going offline until each online
-	 * CPU has queued its RCU-barrier callback.
+	 * early.  CPU hotplug is held off so that offline no-CBs CPUs,
+	 * whose kthreads may still hold callbacks, can be covered too.
 	 */
+	get_online_cpus();
 	atomic_set(&rcu_barrier_cpu_count, 1);
 	on_each_cpu(rcu_barrier_func, (void *)call_rcu_func, 1);
+	rcu_barrier_nocb_offline(rsp);
+	put_online_cpus();
 	if (atomic_dec_and_test(&rcu_barrier_cpu_count))
 		complete(&rcu_barrier_completion);
 	wait_for_completion(&rcu_barrier_completion);
@@ -2265,6 +2437,7 @@ rcu_boot_init_percpu_data(int cpu, struct rcu_state *rsp)
 	WARN_ON_ONCE(atomic_read(&rdp->dynticks->dynticks) != 1);
 	rdp->cpu = cpu;
 	rdp->rsp = rsp;
+	rcu_boot_init_nocb_percpu_data(rdp);
 	raw_spin_unlock_irqrestore(&rnp->lock, flags);
 }
 
@@ -2507,6 +2680,7 @@ void __init rcu_init(void)
 	rcu_init_one(&rcu_sched_state, &rcu_sched_data);
 	rcu_init_one(&rcu_bh_state, &rcu_bh_data);
 	__rcu_init_preempt();
+	rcu_init_nocb();
 	 open_softirq(RCU_SOFTIRQ, rcu_process_callbacks);
 
 	/*
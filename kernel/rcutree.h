@@ -23,6 +23,8 @@
  */
 
 #include <linux/cache.h>
+#include <linux/irq_work.h>
+#include <linux/wait.h>
 #include <linux/spinlock.h>
 #include <linux/threads.h>
 #include <linux/cpumask.h>
@@ -301,6 +303,24 @@ struct rcu_data {
 	unsigned long n_rp_need_fqs;
 	unsigned long n_rp_need_nothing;
 
+	/* 6) Callback offloading, see rcu_nocb_kthread(). */
+#ifdef CONFIG_RCU_NOCB_CPU
+	struct rcu_head *nocb_head;	/* CBs waiting for kthread. */
+	struct rcu_head **nocb_tail;
+	atomic_long_t nocb_q_count;	/* # CBs waiting for kthread */
+	atomic_long_t nocb_q_count_lazy; /*  (approximate). */
+	struct rcu_head *nocb_gp_head;	/* CBs waiting for grace period. */
+	struct rcu_head **nocb_gp_tail;
+	long nocb_gp_count;
+	long nocb_gp_count_lazy;
+	unsigned long n_nocbs_invoked;	/* count of offloaded cbs invoked. */
+	struct irq_work nocb_wake_work;	/* Wakeup from irqs-off call_rcu(). */
+	struct rcu_data *nocb_leader;	/* CPU whose kthread serves us. */
+	struct rcu_data *nocb_next;	/* Next CPU in leader's group. */
+	wait_queue_head_t nocb_wq;	/* Leader only: kthread sleeps here. */
+	struct task_struct *nocb_kthread; /* Leader only. */
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+
 	int cpu;
 	struct rcu_state *rsp;
 };
@@ -387,7 +407,19 @@ struct rcu_state {
 						/*  for CPU stalls. */
 	unsigned long gp_max;			/* Maximum GP duration in */
 						/*  jiffies. */
+
+	/* Sharing of grace periods among synchronous waiters. */
+
+	raw_spinlock_t sync_lock;		/* Protects following fields. */
+	unsigned long sync_posted;		/* # of batches posted. */
+	unsigned long sync_completed;		/* # of batches completed. */
+	bool sync_next_wanted;			/* Waiters for next batch. */
+	struct rcu_head sync_head;		/* Callback of current batch. */
+	wait_queue_head_t sync_wq;		/* Waiters for any batch. */
+	unsigned long n_sync_waiters;		/* # of synchronous waits. */
+
 	char *name;				/* Name of structure. */
+	char abbr;				/* Abbreviated name. */
 };
 
 /* Return values for rcu_preempt_offline_tasks(). */
@@ -448,6 +480,13 @@ static void rcu_report_exp_rnp(struct rcu_state *rsp, struct rcu_node *rnp,
 			       bool wake);
 #endif /* #if defined(CONFIG_HOTPLUG_CPU) || defined(CONFIG_TREE_PREEMPT_RCU) */
 static int rcu_preempt_pending(int cpu);
+static int rcu_preempt_needs_cpu_qs(int cpu);
+static bool is_nocb_cpu(int cpu);
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp,
+			    bool lazy, unsigned long flags);
+static void rcu_barrier_nocb_offline(struct rcu_state *rsp);
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp);
+static void __init rcu_init_nocb(void);
 static int rcu_preempt_cpu_has_callbacks(int cpu);
 static void __cpuinit rcu_preempt_init_percpu_data(int cpu);
 static void rcu_preempt_cleanup_dying_cpu(void);
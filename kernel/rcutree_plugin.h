@@ -74,7 +74,7 @@ static void __init rcu_bootup_announce_oddness(void)
 
 #ifdef CONFIG_TREE_PREEMPT_RCU
 
-struct rcu_state rcu_preempt_state = RCU_STATE_INITIALIZER(rcu_preempt);
+struct rcu_state rcu_preempt_state = RCU_STATE_INITIALIZER(rcu_preempt, 'p');
 DEFINE_PER_CPU(struct rcu_data, rcu_preempt_data);
 static struct rcu_state *rcu_state = &rcu_preempt_state;
 
@@ -737,7 +737,7 @@ void synchronize_rcu(void)
 			   "Illegal synchronize_rcu() in RCU read-side critical section");
 	if (!rcu_scheduler_active)
 		return;
-	wait_rcu_gp(call_rcu);
+	rcu_wait_gp_batched(&rcu_preempt_state);
 }
 EXPORT_SYMBOL_GPL(synchronize_rcu);
 
@@ -927,6 +927,15 @@ static int rcu_preempt_pending(int cpu)
 			     &per_cpu(rcu_preempt_data, cpu));
 }
 
+/*
+ * Is the current preemptible-RCU grace period waiting on this CPU?
+ */
+static int rcu_preempt_needs_cpu_qs(int cpu)
+{
+	return __rcu_needs_cpu_qs(&rcu_preempt_state,
+				  &per_cpu(rcu_preempt_data, cpu));
+}
+
 /*
  * Does preemptible RCU have callbacks on this CPU?
  */
@@ -1168,6 +1177,14 @@ static int rcu_preempt_pending(int cpu)
 	return 0;
 }
 
+/*
+ * Because preemptible RCU does not exist, it never waits on any CPU.
+ */
+static int rcu_preempt_needs_cpu_qs(int cpu)
+{
+	return 0;
+}
+
 /*
  * Because preemptible RCU does not exist, it never has callbacks
  */
@@ -2299,3 +2316,397 @@ static void increment_cpu_stall_ticks(void)
 }
 
 #endif /* #else #ifdef CONFIG_RCU_CPU_STALL_INFO */
+
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Offload callback invocation from the CPUs in rcu_nocb_mask.  Such a
+ * CPU still reports quiescent states, but call_rcu() and friends queue
+ * its callbacks on a lockless per-CPU list instead of ->nxtlist.  The
+ * CPUs are split into groups of rcu_nocb_group_size, and one "rcuo"
+ * kthread per group and flavor collects the lists of all CPUs in its
+ * group, waits for a grace period, and invokes them.  These kthreads
+ * are bound to the non-offloaded CPUs by default, but are otherwise
+ * ordinary tasks that may be re-bound and re-prioritized from userspace.
+ */
+
+static cpumask_var_t rcu_nocb_mask;	/* CPUs to have callbacks offloaded. */
+static bool have_rcu_nocb_mask;		/* Was rcu_nocb_mask allocated? */
+static int rcu_nocb_group_size;		/* 0: sqrt(nr_cpu_ids). */
+module_param(rcu_nocb_group_size, int, 0444);
+static int rcu_nocb_prio;		/* 0: SCHED_NORMAL, else SCHED_FIFO. */
+module_param(rcu_nocb_prio, int, 0444);
+
+/* Parse the boot-time rcu_nocbs= CPU list from the kernel parameters. */
+static int __init rcu_nocb_setup(char *str)
+{
+	alloc_bootmem_cpumask_var(&rcu_nocb_mask);
+	have_rcu_nocb_mask = true;
+	cpulist_parse(str, rcu_nocb_mask);
+	return 1;
+}
+__setup("rcu_nocbs=", rcu_nocb_setup);
+
+/* Is the specified CPU a no-CBs CPU? */
+static bool is_nocb_cpu(int cpu)
+{
+	if (have_rcu_nocb_mask)
+		return cpumask_test_cpu(cpu, rcu_nocb_mask);
+	return false;
+}
+
+/* Does any CPU in the leader's group have callbacks waiting? */
+static bool rcu_nocb_group_pending(struct rcu_data *leader)
+{
+	struct rcu_data *rdp;
+
+	for (rdp = leader; rdp; rdp = rdp->nocb_next)
+		if (ACCESS_ONCE(rdp->nocb_head))
+			return true;
+	return false;
+}
+
+/*
+ * Wake up the kthread serving the specified CPU.  Called from
+ * irq_work if call_rcu() was invoked with interrupts disabled, as the
+ * caller might then hold scheduler locks.
+ */
+static void rcu_nocb_wake(struct irq_work *work)
+{
+	struct rcu_data *rdp = container_of(work, struct rcu_data,
+					    nocb_wake_work);
+
+	wake_up(&rdp->nocb_leader->nocb_wq);
+}
+
+/*
+ * Enqueue the specified callback onto the specified no-CBs CPU's list,
+ * waking the group's kthread if the list was empty.  Any number of
+ * enqueuers may race here, but only one kthread ever dequeues, see
+ * rcu_nocb_kthread().
+ */
+static void __call_rcu_nocb_enqueue(struct rcu_data *rdp,
+				    struct rcu_head *rhp, bool lazy,
+				    bool irqs_off)
+{
+	struct rcu_head **old_rhpp;
+	long len;
+
+	len = atomic_long_inc_return(&rdp->nocb_q_count);
+	if (lazy)
+		atomic_long_inc(&rdp->nocb_q_count_lazy);
+	old_rhpp = xchg(&rdp->nocb_tail, &rhp->next);
+	ACCESS_ONCE(*old_rhpp) = rhp;
+	trace_rcu_nocb_enqueue(rdp->rsp->name, rdp->cpu,
+			       atomic_long_read(&rdp->nocb_q_count_lazy), len);
+
+	/* Only the enqueuer that found the list empty need wake. */
+	if (old_rhpp != &rdp->nocb_head || !rdp->nocb_leader->nocb_kthread)
+		return;
+	if (irqs_off)
+		irq_work_queue(&rdp->nocb_wake_work);
+	else
+		wake_up(&rdp->nocb_leader->nocb_wq);
+}
+
+static void rcu_nocb_gp_done(struct rcu_head *rhp);
+
+/*
+ * Hand a callback from __call_rcu() to the current no-CBs CPU's kthread.
+ * Returns false for the grace-period callbacks that the kthreads post
+ * themselves, which must take the normal path: should a kthread have
+ * been bound to a no-CBs CPU, it would otherwise be waiting on itself.
+ */
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp,
+			    bool lazy, unsigned long flags)
+{
+	if (rhp->func == rcu_nocb_gp_done)
+		return false;
+	__call_rcu_nocb_enqueue(rdp, rhp, lazy, irqs_disabled_flags(flags));
+	return true;
+}
+
+/*
+ * rcu_barrier() reaches the online CPUs through on_each_cpu(), but an
+ * offline no-CBs CPU may still have callbacks queued for its kthread,
+ * so post the barrier callback on its behalf.  The caller holds off
+ * CPU hotplug.
+ */
+static void rcu_barrier_nocb_offline(struct rcu_state *rsp)
+{
+	int cpu;
+
+	if (!have_rcu_nocb_mask)
+		return;
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		struct rcu_head *head = &per_cpu(rcu_barrier_head, cpu);
+
+		if (cpu_online(cpu))
+			continue;
+		atomic_inc(&rcu_barrier_cpu_count);
+		head->func = rcu_barrier_callback;
+		head->next = NULL;
+		debug_rcu_head_queue(head);
+		__call_rcu_nocb_enqueue(per_cpu_ptr(rsp->rda, cpu), head,
+					false, false);
+	}
+}
+
+struct rcu_nocb_gp {
+	struct rcu_head rh;
+	struct completion done;
+};
+
+static void rcu_nocb_gp_done(struct rcu_head *rhp)
+{
+	struct rcu_nocb_gp *gp = container_of(rhp, struct rcu_nocb_gp, rh);
+
+	complete(&gp->done);
+}
+
+/* Wait for a full grace period of the specified flavor. */
+static void rcu_nocb_wait_gp(struct rcu_state *rsp)
+{
+	struct rcu_nocb_gp gp;
+
+	init_rcu_head_on_stack(&gp.rh);
+	init_completion(&gp.done);
+	__call_rcu(&gp.rh, rcu_nocb_gp_done, rsp, false);
+	wait_for_completion(&gp.done);
+	destroy_rcu_head_on_stack(&gp.rh);
+}
+
+/*
+ * Move the specified CPU's offloaded callbacks over to its ->nocb_gp
+ * list, returning false if there were none.  The list is emptied by
+ * swinging ->nocb_tail back to ->nocb_head: enqueuers that beat the
+ * xchg() may still be linking their callbacks into the old list, which
+ * rcu_nocb_invoke() waits for.
+ */
+static bool rcu_nocb_grab(struct rcu_data *rdp)
+{
+	struct rcu_head *list;
+
+	list = ACCESS_ONCE(rdp->nocb_head);
+	if (!list)
+		return false;
+	ACCESS_ONCE(rdp->nocb_head) = NULL;
+	rdp->nocb_gp_head = list;
+	rdp->nocb_gp_tail = xchg(&rdp->nocb_tail, &rdp->nocb_head);
+	rdp->nocb_gp_count = atomic_long_xchg(&rdp->nocb_q_count, 0);
+	rdp->nocb_gp_count_lazy = atomic_long_xchg(&rdp->nocb_q_count_lazy, 0);
+	trace_rcu_nocb_batch(rdp->rsp->name, rdp->cpu,
+			     rdp->nocb_gp_count_lazy, rdp->nocb_gp_count);
+	return true;
+}
+
+/* Invoke the specified CPU's callbacks whose grace period has ended. */
+static void rcu_nocb_invoke(struct rcu_data *rdp)
+{
+	struct rcu_state *rsp = rdp->rsp;
+	struct rcu_head *list = rdp->nocb_gp_head;
+	struct rcu_head **tail = rdp->nocb_gp_tail;
+	struct rcu_head *next;
+	long count = 0;
+
+	if (!list)
+		return;
+	trace_rcu_batch_start(rsp->name, rdp->nocb_gp_count_lazy,
+			      rdp->nocb_gp_count, -1);
+	while (list) {
+		next = ACCESS_ONCE(list->next);
+		/* Wait for enqueuers that raced with rcu_nocb_grab(). */
+		while (next == NULL && &list->next != tail) {
+			schedule_timeout_interruptible(1);
+			next = ACCESS_ONCE(list->next);
+		}
+		debug_rcu_head_unqueue(list);
+		local_bh_disable();
+		__rcu_reclaim(rsp->name, list);
+		local_bh_enable();
+		list = next;
+		count++;
+		cond_resched();
+	}
+	trace_rcu_batch_end(rsp->name, count, 0, need_resched(),
+			    is_idle_task(current), rcu_is_callbacks_kthread());
+	rdp->n_nocbs_invoked += count;
+	rdp->nocb_gp_head = NULL;
+}
+
+/*
+ * Per-group kthread: wait for callbacks from any CPU in the leader's
+ * group, wait for a grace period to elapse, then invoke them.  Callbacks
+ * queued meanwhile wait for the next pass.
+ */
+static int rcu_nocb_kthread(void *arg)
+{
+	struct rcu_data *leader = arg;
+	struct rcu_data *rdp;
+	bool any;
+
+	for (;;) {
+		wait_event_interruptible(leader->nocb_wq,
+					 rcu_nocb_group_pending(leader));
+		any = false;
+		for (rdp = leader; rdp; rdp = rdp->nocb_next)
+			any |= rcu_nocb_grab(rdp);
+		if (!any)
+			continue;
+		rcu_nocb_wait_gp(leader->rsp);
+		for (rdp = leader; rdp; rdp = rdp->nocb_next)
+			rcu_nocb_invoke(rdp);
+	}
+	return 0;
+}
+
+/* Initialize the offload fields of a CPU's rcu_data at boot. */
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+	rdp->nocb_tail = &rdp->nocb_head;
+	init_irq_work(&rdp->nocb_wake_work, rcu_nocb_wake);
+	init_waitqueue_head(&rdp->nocb_wq);
+}
+
+/*
+ * Split the no-CBs CPUs of the specified flavor into groups, the first
+ * no-CBs CPU of each block of rcu_nocb_group_size CPUs leading its group.
+ */
+static void __init rcu_organize_nocb_groups(struct rcu_state *rsp)
+{
+	struct rcu_data *leader = NULL;
+	struct rcu_data *prev = NULL;
+	struct rcu_data *rdp;
+	int group = -1;
+	int cpu;
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		if (cpu / rcu_nocb_group_size != group) {
+			group = cpu / rcu_nocb_group_size;
+			leader = rdp;
+		} else {
+			prev->nocb_next = rdp;
+		}
+		rdp->nocb_leader = leader;
+		prev = rdp;
+	}
+}
+
+/*
+ * Finalize rcu_nocb_mask: full dynticks CPUs are always offloaded, and
+ * the boot CPU never is, since someone has to run the kthreads.
+ */
+static void __init rcu_init_nocb(void)
+{
+	char buf[256];
+
+#ifdef CONFIG_NO_HZ_FULL
+	if (tick_nohz_full_running) {
+		if (!have_rcu_nocb_mask &&
+		    zalloc_cpumask_var(&rcu_nocb_mask, GFP_KERNEL))
+			have_rcu_nocb_mask = true;
+		if (have_rcu_nocb_mask)
+			cpumask_or(rcu_nocb_mask, rcu_nocb_mask,
+				   tick_nohz_full_mask);
+	}
+#endif /* #ifdef CONFIG_NO_HZ_FULL */
+	if (!have_rcu_nocb_mask)
+		return;
+	if (cpumask_test_cpu(smp_processor_id(), rcu_nocb_mask)) {
+		printk(KERN_INFO "\tRCU callbacks cannot be offloaded from boot CPU %d.\n",
+		       smp_processor_id());
+		cpumask_clear_cpu(smp_processor_id(), rcu_nocb_mask);
+	}
+	cpumask_and(rcu_nocb_mask, rcu_nocb_mask, cpu_possible_mask);
+	if (cpumask_empty(rcu_nocb_mask)) {
+		have_rcu_nocb_mask = false;
+		return;
+	}
+	cpulist_scnprintf(buf, sizeof(buf), rcu_nocb_mask);
+	printk(KERN_INFO "\tOffload RCU callbacks from CPUs: %s.\n", buf);
+	if (rcu_nocb_group_size <= 0)
+		rcu_nocb_group_size = max_t(int, int_sqrt(nr_cpu_ids), 1);
+	rcu_organize_nocb_groups(&rcu_sched_state);
+	rcu_organize_nocb_groups(&rcu_bh_state);
+	if (rcu_state != &rcu_sched_state)
+		rcu_organize_nocb_groups(rcu_state);
+}
+
+/* Spawn the kthreads for the group leaders of the specified flavor. */
+static void __init rcu_spawn_nocb_kthreads(struct rcu_state *rsp,
+					   const struct cpumask *affinity)
+{
+	struct sched_param sp;
+	struct rcu_data *rdp;
+	struct task_struct *t;
+	int cpu;
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		if (rdp->nocb_leader != rdp)
+			continue;
+		t = kthread_create(rcu_nocb_kthread, rdp,
+				   "rcuo%c/%d", rsp->abbr, cpu);
+		if (WARN_ON_ONCE(IS_ERR(t)))
+			continue;
+		if (!cpumask_empty(affinity))
+			set_cpus_allowed_ptr(t, affinity);
+		if (rcu_nocb_prio > 0) {
+			sp.sched_priority = min(rcu_nocb_prio, MAX_RT_PRIO - 1);
+			sched_setscheduler_nocheck(t, SCHED_FIFO, &sp);
+		}
+		ACCESS_ONCE(rdp->nocb_kthread) = t;
+		wake_up_process(t);
+	}
+}
+
+/*
+ * Spawn the rcuo kthreads, bound to the CPUs that are not offloaded.
+ * Callbacks queued before this point sit on their lists until the
+ * kthreads start.
+ */
+static int __init rcu_spawn_nocb_kthreads_all(void)
+{
+	cpumask_var_t affinity;
+
+	if (!have_rcu_nocb_mask)
+		return 0;
+	if (!zalloc_cpumask_var(&affinity, GFP_KERNEL))
+		return -ENOMEM;
+	cpumask_andnot(affinity, cpu_possible_mask, rcu_nocb_mask);
+	rcu_spawn_nocb_kthreads(&rcu_sched_state, affinity);
+	rcu_spawn_nocb_kthreads(&rcu_bh_state, affinity);
+	if (rcu_state != &rcu_sched_state)
+		rcu_spawn_nocb_kthreads(rcu_state, affinity);
+	free_cpumask_var(affinity);
+	return 0;
+}
+early_initcall(rcu_spawn_nocb_kthreads_all);
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static bool is_nocb_cpu(int cpu)
+{
+	return false;
+}
+
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp,
+			    bool lazy, unsigned long flags)
+{
+	return false;
+}
+
+static void rcu_barrier_nocb_offline(struct rcu_state *rsp)
+{
+}
+
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+}
+
+static void __init rcu_init_nocb(void)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
@@ -337,8 +337,11 @@ static void show_one_rcugp(struct seq_file *m, struct rcu_state *rsp)
 		gpage = jiffies - rsp->gp_start;
 	gpmax = rsp->gp_max;
 	raw_spin_unlock_irqrestore(&rnp->lock, flags);
-	seq_printf(m, "%s: completed=%ld  gpnum=%lu  age=%ld  max=%ld\n",
-		   rsp->name, completed, gpnum, gpage, gpmax);
+	seq_printf(m,
+		   "%s: completed=%ld  gpnum=%lu  age=%ld  max=%ld  sync=%lu/%lu\n",
+		   rsp->name, completed, gpnum, gpage, gpmax,
+		   ACCESS_ONCE(rsp->n_sync_waiters),
+		   ACCESS_ONCE(rsp->sync_completed));
 }
 
 static int show_rcugp(struct seq_file *m, void *unused)
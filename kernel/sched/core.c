@@ -558,7 +558,7 @@ int get_nohz_timer_target(void)
 	rcu_read_lock();
 	for_each_domain(cpu, sd) {
 		for_each_cpu(i, sched_domain_span(sd)) {
-			if (!idle_cpu(i)) {
+			if (!idle_cpu(i) && !tick_nohz_full_cpu(i)) {
 				cpu = i;
 				goto unlock;
 			}
@@ -608,6 +608,24 @@ void wake_up_idle_cpu(int cpu)
 		smp_send_reschedule(cpu);
 }
 
+/*
+ * Like wake_up_idle_cpu(), but also for a full dynticks CPU which may
+ * have stopped its tick while busy; the IPI makes it re-evaluate the
+ * next timer event on the way out of the interrupt.  Also called for
+ * the local CPU, since the tick is not re-evaluated on syscall return.
+ */
+void wake_up_nohz_cpu(int cpu)
+{
+	if (tick_nohz_full_cpu(cpu)) {
+		if (cpu != smp_processor_id() ||
+		    tick_nohz_tick_stopped_cpu(cpu))
+			smp_send_reschedule(cpu);
+		return;
+	}
+
+	wake_up_idle_cpu(cpu);
+}
+
 static inline bool got_nohz_idle_kick(void)
 {
 	int cpu = smp_processor_id();
@@ -1111,6 +1129,8 @@ void set_task_cpu(struct task_struct *p, unsigned int new_cpu)
 	trace_sched_migrate_task(p, new_cpu);
 
 	if (task_cpu(p) != new_cpu) {
+		if (p->sched_class->migrate_task_rq)
+			p->sched_class->migrate_task_rq(p, new_cpu);
 		p->se.nr_migrations++;
 		perf_sw_event(PERF_COUNT_SW_CPU_MIGRATIONS, 1, NULL, 0);
 	}
@@ -1415,6 +1435,11 @@ ttwu_do_wakeup(struct rq *rq, struct task_struct *p, int wake_flags)
 	check_preempt_curr(rq, p, wake_flags);
 
 	p->state = TASK_RUNNING;
+#ifdef CONFIG_SCHEDSTATS
+	/* stamp the wakeup for sched_account_wakeup_lat() */
+	if (p != rq->curr && p->sched_class == &fair_sched_class)
+		p->se.statistics.wakeup_start = rq->clock;
+#endif
 #ifdef CONFIG_SMP
 	if (p->sched_class->task_woken)
 		p->sched_class->task_woken(rq, p);
@@ -1485,7 +1510,9 @@ static void sched_ttwu_pending(void)
 
 void scheduler_ipi(void)
 {
-	if (llist_empty(&this_rq()->wake_list) && !got_nohz_idle_kick())
+	if (llist_empty(&this_rq()->wake_list) &&
+	    !tick_nohz_full_cpu(smp_processor_id()) &&
+	    !got_nohz_idle_kick())
 		return;
 
 	/*
@@ -1502,6 +1529,7 @@ void scheduler_ipi(void)
 	 * somewhat pessimize the simple resched case.
 	 */
 	irq_enter();
+	tick_nohz_full_check();
 	sched_ttwu_pending();
 
 	/*
@@ -1716,6 +1744,14 @@ static void __sched_fork(struct task_struct *p)
 	p->se.vruntime			= 0;
 	INIT_LIST_HEAD(&p->se.group_node);
 
+#ifdef CONFIG_SMP
+	/*
+	 * Don't inherit the parent's load-tracking state; the averages are
+	 * seeded by init_task_runnable_average() once the child has a cpu.
+	 */
+	memset(&p->se.avg, 0, sizeof(p->se.avg));
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	memset(&p->se.statistics, 0, sizeof(p->se.statistics));
 #endif
@@ -1826,6 +1862,8 @@ void wake_up_new_task(struct task_struct *p)
 	set_task_cpu(p, select_task_rq(p, SD_BALANCE_FORK, 0));
 #endif
 
+	/* Initialize new task's runnable average */
+	init_task_runnable_average(p);
 	rq = __task_rq_lock(p);
 	activate_task(rq, p, 0);
 	p->on_rq = 1;
@@ -1914,6 +1952,7 @@ prepare_task_switch(struct rq *rq, struct task_struct *prev,
 		    struct task_struct *next)
 {
 	sched_info_switch(prev, next);
+	tick_nohz_task_switch(prev);
 	perf_event_task_sched_out(prev, next);
 	fire_sched_out_preempt_notifiers(prev, next);
 	prepare_lock_switch(rq, next);
@@ -2482,6 +2521,23 @@ decay_load_missed(unsigned long load, unsigned long missed_updates, int idx)
 	return load;
 }
 
+#ifdef CONFIG_SMP
+/*
+ * With per-entity load tracking the runqueue load is the sum of the
+ * decayed contributions of the runnable entities rather than their
+ * instantaneous weight.
+ */
+static inline unsigned long get_rq_runnable_load(struct rq *rq)
+{
+	return rq->cfs.runnable_load_avg;
+}
+#else
+static inline unsigned long get_rq_runnable_load(struct rq *rq)
+{
+	return rq->load.weight;
+}
+#endif
+
 /*
  * Update rq->cpu_load[] statistics. This function is usually called every
  * scheduler tick (TICK_NSEC). With tickless idle this will not be called
@@ -2489,7 +2545,7 @@ decay_load_missed(unsigned long load, unsigned long missed_updates, int idx)
  */
 void update_cpu_load(struct rq *this_rq)
 {
-	unsigned long this_load = this_rq->load.weight;
+	unsigned long this_load = get_rq_runnable_load(this_rq);
 	unsigned long curr_jiffies = jiffies;
 	unsigned long pending_updates;
 	int i, scale;
@@ -3027,8 +3083,9 @@ void scheduler_tick(void)
 
 	raw_spin_lock(&rq->lock);
 	update_rq_clock(rq);
-	update_cpu_load_active(rq);
 	curr->sched_class->task_tick(rq, curr, 0);
+	/* sample the load after the tick has refreshed the averages */
+	update_cpu_load_active(rq);
 	raw_spin_unlock(&rq->lock);
 
 	perf_event_task_tick();
@@ -3039,6 +3096,80 @@ void scheduler_tick(void)
 #endif
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+/**
+ * sched_can_stop_tick - may a full dynticks CPU stop its tick?
+ *
+ * Only while it runs a single task: with more than one there is
+ * preemption to do.  Called with interrupts disabled.
+ */
+bool sched_can_stop_tick(void)
+{
+	struct rq *rq = this_rq();
+
+	/* Make sure rq->nr_running update is visible after the IPI */
+	smp_rmb();
+
+	return rq->nr_running <= 1;
+}
+
+/*
+ * A busy full dynticks CPU does not run scheduler_tick(), which leaves
+ * the runtime statistics, load averages and cpu_load[] of its runqueue
+ * to go stale.  Update them once a second from a housekeeping CPU
+ * instead; the rq lock makes this safe to do remotely.
+ */
+struct tick_work {
+	int			cpu;
+	struct delayed_work	work;
+};
+
+static DEFINE_PER_CPU(struct tick_work, tick_work_cpu);
+
+static void sched_tick_remote(struct work_struct *work)
+{
+	struct delayed_work *dwork = to_delayed_work(work);
+	struct tick_work *twork = container_of(dwork, struct tick_work, work);
+	int cpu = twork->cpu;
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long flags;
+
+	if (cpu_online(cpu) && !idle_cpu(cpu) &&
+	    tick_nohz_tick_stopped_cpu(cpu)) {
+		struct task_struct *curr;
+
+		raw_spin_lock_irqsave(&rq->lock, flags);
+		curr = rq->curr;
+		update_rq_clock(rq);
+		curr->sched_class->task_tick(rq, curr, 0);
+		update_cpu_load_active(rq);
+		raw_spin_unlock_irqrestore(&rq->lock, flags);
+	}
+
+	queue_delayed_work_on(tick_nohz_housekeeping_cpu(), system_wq,
+			      dwork, HZ);
+}
+
+static int __init sched_tick_offload_init(void)
+{
+	int cpu;
+
+	if (!tick_nohz_full_running)
+		return 0;
+
+	for_each_cpu(cpu, tick_nohz_full_mask) {
+		struct tick_work *twork = &per_cpu(tick_work_cpu, cpu);
+
+		twork->cpu = cpu;
+		INIT_DELAYED_WORK(&twork->work, sched_tick_remote);
+		queue_delayed_work_on(tick_nohz_housekeeping_cpu(), system_wq,
+				      &twork->work, HZ);
+	}
+	return 0;
+}
+late_initcall(sched_tick_offload_init);
+#endif /* CONFIG_NO_HZ_FULL */
+
 notrace unsigned long get_parent_ip(unsigned long addr)
 {
 	if (in_lock_functions(addr)) {
@@ -5826,9 +5957,14 @@ static void destroy_sched_domains(struct sched_domain *sd, int cpu)
  * Also keep a unique ID per domain (we use the first cpu number in
  * the cpumask of the domain), this allows us to quickly tell if
  * two cpus are in the same cache domain, see cpus_share_cache().
+ *
+ * sd_llc_idle_cores, only meaningful for the cpu whose number is the
+ * ID, hints that the cache domain may have a core with all of its SMT
+ * siblings idle, see select_idle_core().
  */
 DEFINE_PER_CPU(struct sched_domain *, sd_llc);
 DEFINE_PER_CPU(int, sd_llc_id);
+DEFINE_PER_CPU(int, sd_llc_idle_cores);
 
 static void update_top_cache_domain(int cpu)
 {
@@ -6884,6 +7020,9 @@ int in_sched_functions(unsigned long addr)
 
 #ifdef CONFIG_CGROUP_SCHED
 struct task_group root_task_group;
+#ifdef CONFIG_SCHEDSTATS
+static DEFINE_PER_CPU(struct sched_lat_hist, root_wakeup_lat);
+#endif
 #endif
 
 DECLARE_PER_CPU(cpumask_var_t, load_balance_tmpmask);
@@ -6942,6 +7081,9 @@ void __init sched_init(void)
 #endif /* CONFIG_RT_GROUP_SCHED */
 
 #ifdef CONFIG_CGROUP_SCHED
+#ifdef CONFIG_SCHEDSTATS
+	root_task_group.wakeup_lat = &root_wakeup_lat;
+#endif
 	list_add(&root_task_group.list, &task_groups);
 	INIT_LIST_HEAD(&root_task_group.children);
 	INIT_LIST_HEAD(&root_task_group.siblings);
@@ -7224,6 +7366,9 @@ static void free_sched_group(struct task_group *tg)
 	free_fair_sched_group(tg);
 	free_rt_sched_group(tg);
 	autogroup_free(tg);
+#ifdef CONFIG_SCHEDSTATS
+	free_percpu(tg->wakeup_lat);
+#endif
 	kfree(tg);
 }
 
@@ -7243,6 +7388,12 @@ struct task_group *sched_create_group(struct task_group *parent)
 	if (!alloc_rt_sched_group(tg, parent))
 		goto err;
 
+#ifdef CONFIG_SCHEDSTATS
+	tg->wakeup_lat = alloc_percpu(struct sched_lat_hist);
+	if (!tg->wakeup_lat)
+		goto err;
+#endif
+
 	spin_lock_irqsave(&task_group_lock, flags);
 	list_add_rcu(&tg->list, &task_groups);
 
@@ -7699,7 +7850,8 @@ const u64 min_cfs_quota_period = 1 * NSEC_PER_MSEC; /* 1ms */
 
 static int __cfs_schedulable(struct task_group *tg, u64 period, u64 runtime);
 
-static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
+static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota,
+				u64 burst)
 {
 	int i, ret = 0, runtime_enabled, runtime_was_enabled;
 	struct cfs_bandwidth *cfs_b = &tg->cfs_bandwidth;
@@ -7723,6 +7875,10 @@ static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
 	if (period > max_cfs_quota_period)
 		return -EINVAL;
 
+	/* the carry-over may at most double the runtime of a period */
+	if (quota != RUNTIME_INF && burst > quota)
+		return -EINVAL;
+
 	mutex_lock(&cfs_constraints_mutex);
 	ret = __cfs_schedulable(tg, period, quota);
 	if (ret)
@@ -7734,7 +7890,11 @@ static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
 	raw_spin_lock_irq(&cfs_b->lock);
 	cfs_b->period = ns_to_ktime(period);
 	cfs_b->quota = quota;
+	cfs_b->burst = burst;
 
+	/* start over from a full quota, nothing carried over */
+	cfs_b->runtime = 0;
+	cfs_b->runtime_snap = 0;
 	__refill_cfs_bandwidth_runtime(cfs_b);
 	/* restart the period timer (if active) to handle new period expiry */
 	if (runtime_enabled && cfs_b->timer_active) {
@@ -7772,7 +7932,7 @@ int tg_set_cfs_quota(struct task_group *tg, long cfs_quota_us)
 	else
 		quota = (u64)cfs_quota_us * NSEC_PER_USEC;
 
-	return tg_set_cfs_bandwidth(tg, period, quota);
+	return tg_set_cfs_bandwidth(tg, period, quota, tg->cfs_bandwidth.burst);
 }
 
 long tg_get_cfs_quota(struct task_group *tg)
@@ -7795,7 +7955,7 @@ int tg_set_cfs_period(struct task_group *tg, long cfs_period_us)
 	period = (u64)cfs_period_us * NSEC_PER_USEC;
 	quota = tg->cfs_bandwidth.quota;
 
-	return tg_set_cfs_bandwidth(tg, period, quota);
+	return tg_set_cfs_bandwidth(tg, period, quota, tg->cfs_bandwidth.burst);
 }
 
 long tg_get_cfs_period(struct task_group *tg)
@@ -7808,6 +7968,62 @@ long tg_get_cfs_period(struct task_group *tg)
 	return cfs_period_us;
 }
 
+int tg_set_cfs_burst(struct task_group *tg, long cfs_burst_us)
+{
+	u64 quota, period, burst;
+
+	if (cfs_burst_us < 0 ||
+	    (u64)cfs_burst_us > max_cfs_quota_period / NSEC_PER_USEC)
+		return -EINVAL;
+
+	period = ktime_to_ns(tg->cfs_bandwidth.period);
+	quota = tg->cfs_bandwidth.quota;
+	burst = (u64)cfs_burst_us * NSEC_PER_USEC;
+
+	return tg_set_cfs_bandwidth(tg, period, quota, burst);
+}
+
+long tg_get_cfs_burst(struct task_group *tg)
+{
+	u64 burst_us;
+
+	burst_us = tg->cfs_bandwidth.burst;
+	do_div(burst_us, NSEC_PER_USEC);
+
+	return burst_us;
+}
+
+/*
+ * The slice only sets how much runtime a cpu takes from the group's pool
+ * at a time, so it can change without going through the constraints.
+ */
+int tg_set_cfs_slice(struct task_group *tg, long cfs_slice_us)
+{
+	u64 slice;
+
+	if (tg == &root_task_group)
+		return -EINVAL;
+
+	if (cfs_slice_us < 0 ||
+	    (u64)cfs_slice_us > max_cfs_quota_period / NSEC_PER_USEC)
+		return -EINVAL;
+
+	slice = (u64)cfs_slice_us * NSEC_PER_USEC;
+	ACCESS_ONCE(tg->cfs_bandwidth.slice) = slice;
+
+	return 0;
+}
+
+long tg_get_cfs_slice(struct task_group *tg)
+{
+	u64 slice_us;
+
+	slice_us = tg->cfs_bandwidth.slice;
+	do_div(slice_us, NSEC_PER_USEC);
+
+	return slice_us;
+}
+
 static s64 cpu_cfs_quota_read_s64(struct cgroup *cgrp, struct cftype *cft)
 {
 	return tg_get_cfs_quota(cgroup_tg(cgrp));
@@ -7830,6 +8046,28 @@ static int cpu_cfs_period_write_u64(struct cgroup *cgrp, struct cftype *cftype,
 	return tg_set_cfs_period(cgroup_tg(cgrp), cfs_period_us);
 }
 
+static u64 cpu_cfs_burst_read_u64(struct cgroup *cgrp, struct cftype *cft)
+{
+	return tg_get_cfs_burst(cgroup_tg(cgrp));
+}
+
+static int cpu_cfs_burst_write_u64(struct cgroup *cgrp, struct cftype *cftype,
+				u64 cfs_burst_us)
+{
+	return tg_set_cfs_burst(cgroup_tg(cgrp), cfs_burst_us);
+}
+
+static u64 cpu_cfs_slice_read_u64(struct cgroup *cgrp, struct cftype *cft)
+{
+	return tg_get_cfs_slice(cgroup_tg(cgrp));
+}
+
+static int cpu_cfs_slice_write_u64(struct cgroup *cgrp, struct cftype *cftype,
+				u64 cfs_slice_us)
+{
+	return tg_set_cfs_slice(cgroup_tg(cgrp), cfs_slice_us);
+}
+
 struct cfs_schedulable_data {
 	struct task_group *tg;
 	u64 period, quota;
@@ -7917,12 +8155,83 @@ static int cpu_stats_show(struct cgroup *cgrp, struct cftype *cft,
 	cb->fill(cb, "nr_periods", cfs_b->nr_periods);
 	cb->fill(cb, "nr_throttled", cfs_b->nr_throttled);
 	cb->fill(cb, "throttled_time", cfs_b->throttled_time);
+	cb->fill(cb, "nr_bursts", cfs_b->nr_bursts);
+	cb->fill(cb, "burst_time", cfs_b->burst_time);
+
+	return 0;
+}
+
+/*
+ * cpu.cfs_throttle_hist: how long each throttle of one of the group's
+ * cfs_rqs lasted, as a log2 histogram in microseconds.
+ */
+static int cpu_cfs_throttle_hist_show(struct cgroup *cgrp, struct cftype *cft,
+		struct cgroup_map_cb *cb)
+{
+	struct cfs_bandwidth *cfs_b = &cgroup_tg(cgrp)->cfs_bandwidth;
+	unsigned long hist[CFS_THROTTLE_BUCKETS];
+
+	raw_spin_lock_irq(&cfs_b->lock);
+	memcpy(hist, cfs_b->throttled_hist, sizeof(hist));
+	raw_spin_unlock_irq(&cfs_b->lock);
+
+	sched_hist_fill(cb, hist, CFS_THROTTLE_BUCKETS);
 
 	return 0;
 }
 #endif /* CONFIG_CFS_BANDWIDTH */
 #endif /* CONFIG_FAIR_GROUP_SCHED */
 
+#ifdef CONFIG_SCHEDSTATS
+/*
+ * cpu.wakeup_latency: the wakeup latency histogram of the group and its
+ * children, along with percentiles estimated from it.  A percentile is
+ * the upper bound of the bucket it falls in, or the lower bound for the
+ * last, open-ended bucket.
+ */
+static int cpu_wakeup_latency_show(struct cgroup *cgrp, struct cftype *cft,
+		struct cgroup_map_cb *cb)
+{
+	static const struct {
+		const char *name;
+		unsigned int permille;
+	} pct[] = {
+		{ "p50_us", 500 }, { "p90_us", 900 },
+		{ "p99_us", 990 }, { "p999_us", 999 },
+	};
+	struct task_group *tg = cgroup_tg(cgrp);
+	struct sched_lat_hist hist;
+	u64 total = 0, sum, rank;
+	int cpu, i, p;
+
+	memset(&hist, 0, sizeof(hist));
+	for_each_possible_cpu(cpu) {
+		struct sched_lat_hist *h = per_cpu_ptr(tg->wakeup_lat, cpu);
+
+		for (i = 0; i < SCHED_LAT_BUCKETS; i++)
+			hist.count[i] += h->count[i];
+	}
+	for (i = 0; i < SCHED_LAT_BUCKETS; i++)
+		total += hist.count[i];
+
+	cb->fill(cb, "wakeups", total);
+	for (p = 0; p < ARRAY_SIZE(pct); p++) {
+		rank = div_u64(total * pct[p].permille + 999, 1000);
+		sum = 0;
+		for (i = 0; i < SCHED_LAT_BUCKETS - 1; i++) {
+			sum += hist.count[i];
+			if (sum >= rank)
+				break;
+		}
+		cb->fill(cb, pct[p].name, total ?
+			 1ULL << (i < SCHED_LAT_BUCKETS - 1 ? i : i - 1) : 0);
+	}
+	sched_hist_fill(cb, hist.count, SCHED_LAT_BUCKETS);
+
+	return 0;
+}
+#endif /* CONFIG_SCHEDSTATS */
+
 #ifdef CONFIG_RT_GROUP_SCHED
 static int cpu_rt_runtime_write(struct cgroup *cgrp, struct cftype *cft,
 				s64 val)
@@ -7966,10 +8275,24 @@ static struct cftype cpu_files[] = {
 		.read_u64 = cpu_cfs_period_read_u64,
 		.write_u64 = cpu_cfs_period_write_u64,
 	},
+	{
+		.name = "cfs_burst_us",
+		.read_u64 = cpu_cfs_burst_read_u64,
+		.write_u64 = cpu_cfs_burst_write_u64,
+	},
+	{
+		.name = "cfs_slice_us",
+		.read_u64 = cpu_cfs_slice_read_u64,
+		.write_u64 = cpu_cfs_slice_write_u64,
+	},
 	{
 		.name = "stat",
 		.read_map = cpu_stats_show,
 	},
+	{
+		.name = "cfs_throttle_hist",
+		.read_map = cpu_cfs_throttle_hist_show,
+	},
 #endif
 #ifdef CONFIG_RT_GROUP_SCHED
 	{
@@ -7983,6 +8306,12 @@ static struct cftype cpu_files[] = {
 		.write_u64 = cpu_rt_period_write_uint,
 	},
 #endif
+#ifdef CONFIG_SCHEDSTATS
+	{
+		.name = "wakeup_latency",
+		.read_map = cpu_wakeup_latency_show,
+	},
+#endif
 };
 
 static int cpu_cgroup_populate(struct cgroup_subsys *ss, struct cgroup *cont)
@@ -66,6 +66,14 @@ SCHED_FEAT(NONTASK_POWER, true)
  */
 SCHED_FEAT(TTWU_QUEUE, true)
 
+/*
+ * When looking for an idle cpu to wake a task on, bound the scan of the
+ * cache domain by the average idle time of this cpu (SIS_PROP), or skip
+ * it altogether when that is shorter than scanning a cpu (SIS_AVG_CPU).
+ */
+SCHED_FEAT(SIS_AVG_CPU, false)
+SCHED_FEAT(SIS_PROP, true)
+
 SCHED_FEAT(FORCE_SD_OVERLAP, false)
 SCHED_FEAT(RT_RUNTIME_SHARE, true)
 SCHED_FEAT(LB_MIN, false)
@@ -3,6 +3,7 @@
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/stop_machine.h>
+#include <linux/tick.h>
 
 #include "cpupri.h"
 
@@ -82,6 +83,15 @@ struct rt_rq;
 
 static LIST_HEAD(task_groups);
 
+#ifdef CONFIG_CFS_BANDWIDTH
+/*
+ * log2 histogram of how long a cfs_rq stayed throttled: bucket 0 counts
+ * throttles shorter than 1us, bucket i those in [2^(i-1), 2^i) us and
+ * the last bucket everything longer.
+ */
+#define CFS_THROTTLE_BUCKETS	24
+#endif
+
 struct cfs_bandwidth {
 #ifdef CONFIG_CFS_BANDWIDTH
 	raw_spinlock_t lock;
@@ -89,17 +99,37 @@ struct cfs_bandwidth {
 	u64 quota, runtime;
 	s64 hierarchal_quota;
 	u64 runtime_expires;
+	/* unused quota carried into the next period, on top of quota */
+	u64 burst;
+	/* runtime left in the pool right after the last refill */
+	u64 runtime_snap;
+	/* local slice size, 0 uses sysctl_sched_cfs_bandwidth_slice */
+	u64 slice;
 
 	int idle, timer_active;
 	struct hrtimer period_timer, slack_timer;
 	struct list_head throttled_cfs_rq;
 
 	/* statistics */
-	int nr_periods, nr_throttled;
-	u64 throttled_time;
+	int nr_periods, nr_throttled, nr_bursts;
+	u64 throttled_time, burst_time;
+	unsigned long throttled_hist[CFS_THROTTLE_BUCKETS];
 #endif
 };
 
+#ifdef CONFIG_SCHEDSTATS
+/*
+ * log2 histogram of wakeup latencies, the time from a CFS task's wakeup
+ * until it gets the CPU: bucket 0 counts latencies below 1us, bucket i
+ * those in [2^(i-1), 2^i) us and the last bucket everything longer.
+ */
+#define SCHED_LAT_BUCKETS	24
+
+struct sched_lat_hist {
+	unsigned long count[SCHED_LAT_BUCKETS];
+};
+#endif
+
 /* task group related information */
 struct task_group {
 	struct cgroup_subsys_state css;
@@ -111,7 +141,10 @@ struct task_group {
 	struct cfs_rq **cfs_rq;
 	unsigned long shares;
 
-	atomic_t load_weight;
+#ifdef	CONFIG_SMP
+	atomic64_t load_avg;
+	atomic_t runnable_avg;
+#endif
 #endif
 
 #ifdef CONFIG_RT_GROUP_SCHED
@@ -132,6 +165,11 @@ struct task_group {
 	struct autogroup *autogroup;
 #endif
 
+#ifdef CONFIG_SCHEDSTATS
+	/* wakeup latencies of the tasks in this group and below */
+	struct sched_lat_hist __percpu *wakeup_lat;
+#endif
+
 	struct cfs_bandwidth cfs_bandwidth;
 };
 
@@ -222,6 +260,23 @@ struct cfs_rq {
 	unsigned int nr_spread_over;
 #endif
 
+#ifdef CONFIG_SMP
+	/*
+	 * CFS Load tracking
+	 * Under CFS, load is tracked on a per-entity basis and aggregated up.
+	 * This allows for the description of both thread and group usage (in
+	 * the FAIR_GROUP_SCHED case).
+	 *
+	 * runnable_load_avg is the sum of the load contributions of the
+	 * entities currently queued on this cfs_rq; blocked_load_avg is the
+	 * (decaying) sum of the contributions of entities that went to sleep
+	 * while queued here.
+	 */
+	unsigned long runnable_load_avg, blocked_load_avg;
+	atomic64_t decay_counter, removed_load;
+	u64 last_decay;
+#endif /* CONFIG_SMP */
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	struct rq *rq;	/* cpu runqueue to which this cfs_rq is attached */
 
@@ -249,15 +304,11 @@ struct cfs_rq {
 	/*
 	 * Maintaining per-cpu shares distribution for group scheduling
 	 *
-	 * load_stamp is the last time we updated the load average
-	 * load_last is the last time we updated the load average and saw load
-	 * load_unacc_exec_time is currently unaccounted execution time
+	 * tg_load_contrib is this cfs_rq's last published contribution to
+	 * tg->load_avg, tg_runnable_contrib the one to tg->runnable_avg.
 	 */
-	u64 load_avg;
-	u64 load_period;
-	u64 load_stamp, load_last, load_unacc_exec_time;
-
-	unsigned long load_contribution;
+	u32 tg_runnable_contrib;
+	u64 tg_load_contrib;
 #endif /* CONFIG_SMP */
 #ifdef CONFIG_CFS_BANDWIDTH
 	int runtime_enabled;
@@ -265,6 +316,7 @@ struct cfs_rq {
 	s64 runtime_remaining;
 
 	u64 throttled_timestamp;
+	u64 throttled_clock_task, throttled_clock_task_time;
 	int throttled, throttle_count;
 	struct list_head throttled_list;
 #endif /* CONFIG_CFS_BANDWIDTH */
@@ -418,6 +470,9 @@ struct rq {
 	u64 age_stamp;
 	u64 idle_stamp;
 	u64 avg_idle;
+
+	/* runnable average of the whole cpu, see update_rq_runnable_avg() */
+	struct sched_avg avg;
 #endif
 
 #ifdef CONFIG_IRQ_TIME_ACCOUNTING
@@ -458,6 +513,8 @@ struct rq {
 	/* try_to_wake_up() stats */
 	unsigned int ttwu_count;
 	unsigned int ttwu_local;
+
+	struct sched_lat_hist wakeup_lat;
 #endif
 
 #ifdef CONFIG_SMP
@@ -525,6 +582,7 @@ static inline struct sched_domain *highest_flag_domain(int cpu, int flag)
 
 DECLARE_PER_CPU(struct sched_domain *, sd_llc);
 DECLARE_PER_CPU(int, sd_llc_id);
+DECLARE_PER_CPU(int, sd_llc_idle_cores);
 
 #endif /* CONFIG_SMP */
 
@@ -862,6 +920,14 @@ static inline void idle_balance(int cpu, struct rq *rq)
 
 #endif
 
+#if defined(CONFIG_SMP) && defined(CONFIG_SCHED_SMT)
+extern void update_idle_core(struct rq *rq);
+#else
+static inline void update_idle_core(struct rq *rq)
+{
+}
+#endif
+
 extern void sysrq_sched_debug_show(void);
 extern void sched_init_granularity(void);
 extern void update_max_interval(void);
@@ -878,6 +944,12 @@ extern void init_rt_bandwidth(struct rt_bandwidth *rt_b, u64 period, u64 runtime
 
 extern void update_cpu_load(struct rq *this_rq);
 
+#ifdef CONFIG_SMP
+extern void init_task_runnable_average(struct task_struct *p);
+#else
+static inline void init_task_runnable_average(struct task_struct *p) { }
+#endif
+
 #ifdef CONFIG_CGROUP_CPUACCT
 #include <linux/cgroup.h>
 /* track cpu usage of a group of tasks and its child groups */
@@ -917,6 +989,18 @@ static inline void cpuacct_charge(struct task_struct *tsk, u64 cputime) {}
 static inline void inc_nr_running(struct rq *rq)
 {
 	rq->nr_running++;
+
+#ifdef CONFIG_NO_HZ_FULL
+	/*
+	 * A second runnable task needs the tick back for preemption;
+	 * the scheduler IPI makes a tickless CPU restart it.
+	 */
+	if (rq->nr_running == 2 && tick_nohz_full_cpu(rq->cpu)) {
+		/* Order rq->nr_running write against the IPI */
+		smp_wmb();
+		smp_send_reschedule(rq->cpu);
+	}
+#endif
 }
 
 static inline void dec_nr_running(struct rq *rq)
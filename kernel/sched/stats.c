@@ -10,11 +10,40 @@
  * bump this up when changing the output format or the meaning of an existing
  * format, so that tools can adapt (or abort)
  */
-#define SCHEDSTAT_VERSION 15
+#define SCHEDSTAT_VERSION 16
+
+/**
+ * sched_account_wakeup_lat - account the wakeup latency of a task
+ * @rq: runqueue @p is about to run on
+ * @p: CFS task getting the CPU after a wakeup
+ *
+ * Add the time since @p was woken up to the histograms of @rq and of
+ * every task group @p belongs to, up to the root.  Called with @rq's
+ * lock held.
+ */
+void sched_account_wakeup_lat(struct rq *rq, struct task_struct *p)
+{
+	s64 delta = rq->clock - p->se.statistics.wakeup_start;
+	int bucket = 0;
+#ifdef CONFIG_CGROUP_SCHED
+	struct task_group *tg;
+#endif
+
+	p->se.statistics.wakeup_start = 0;
+	/* the task may have been woken on another cpu's clock */
+	if (delta > 0)
+		bucket = sched_hist_bucket(delta, SCHED_LAT_BUCKETS);
+
+	rq->wakeup_lat.count[bucket]++;
+#ifdef CONFIG_CGROUP_SCHED
+	for (tg = task_group(p); tg; tg = tg->parent)
+		per_cpu_ptr(tg->wakeup_lat, cpu_of(rq))->count[bucket]++;
+#endif
+}
 
 static int show_schedstat(struct seq_file *seq, void *v)
 {
-	int cpu;
+	int cpu, i;
 	int mask_len = DIV_ROUND_UP(NR_CPUS, 32) * 9;
 	char *mask_str = kmalloc(mask_len, GFP_KERNEL);
 
@@ -39,6 +68,9 @@ static int show_schedstat(struct seq_file *seq, void *v)
 		    rq->rq_cpu_time,
 		    rq->rq_sched_info.run_delay, rq->rq_sched_info.pcount);
 
+		for (i = 0; i < SCHED_LAT_BUCKETS; i++)
+			seq_printf(seq, " %lu", rq->wakeup_lat.count[i]);
+
 		seq_printf(seq, "\n");
 
 #ifdef CONFIG_SMP
@@ -79,7 +111,7 @@ static int show_schedstat(struct seq_file *seq, void *v)
 
 static int schedstat_open(struct inode *inode, struct file *file)
 {
-	unsigned int size = PAGE_SIZE * (1 + num_online_cpus() / 32);
+	unsigned int size = PAGE_SIZE * (1 + num_online_cpus() / 16);
 	char *buf = kmalloc(size, GFP_KERNEL);
 	struct seq_file *m;
 	int res;
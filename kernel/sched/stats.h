@@ -1,4 +1,29 @@
 
+/*
+ * Latency histograms use log2 buckets in microseconds: bucket i counts
+ * samples below 2^i us, the last one everything from 2^(nr-2) us up.
+ */
+static inline int sched_hist_bucket(u64 delta_ns, int nr)
+{
+	return min_t(int, fls64(div_u64(delta_ns, NSEC_PER_USEC)), nr - 1);
+}
+
+#ifdef CONFIG_CGROUP_SCHED
+static inline void sched_hist_fill(struct cgroup_map_cb *cb,
+				   const unsigned long *count, int nr)
+{
+	char key[24];
+	int i;
+
+	for (i = 0; i < nr - 1; i++) {
+		snprintf(key, sizeof(key), "lt_%lluus", 1ULL << i);
+		cb->fill(cb, key, count[i]);
+	}
+	snprintf(key, sizeof(key), "ge_%lluus", 1ULL << (i - 1));
+	cb->fill(cb, key, count[i]);
+}
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 
 /*
@@ -29,6 +54,8 @@ rq_sched_info_dequeued(struct rq *rq, unsigned long long delta)
 	if (rq)
 		rq->rq_sched_info.run_delay += delta;
 }
+
+extern void sched_account_wakeup_lat(struct rq *rq, struct task_struct *p);
 # define schedstat_inc(rq, field)	do { (rq)->field++; } while (0)
 # define schedstat_add(rq, field, amt)	do { (rq)->field += (amt); } while (0)
 # define schedstat_set(var, val)	do { var = (val); } while (0)
@@ -42,6 +69,9 @@ rq_sched_info_dequeued(struct rq *rq, unsigned long long delta)
 static inline void
 rq_sched_info_depart(struct rq *rq, unsigned long long delta)
 {}
+static inline void
+sched_account_wakeup_lat(struct rq *rq, struct task_struct *p)
+{}
 # define schedstat_inc(rq, field)	do { } while (0)
 # define schedstat_add(rq, field, amt)	do { } while (0)
 # define schedstat_set(var, val)	do { } while (0)
@@ -11,6 +11,7 @@
  *
  *  Distribute under GPLv2.
  */
+#include <linux/bootmem.h>
 #include <linux/cpu.h>
 #include <linux/err.h>
 #include <linux/hrtimer.h>
@@ -20,6 +21,8 @@
 #include <linux/profile.h>
 #include <linux/sched.h>
 #include <linux/module.h>
+#include <linux/perf_event.h>
+#include <linux/posix-timers.h>
 
 #include <asm/irq_regs.h>
 
@@ -271,49 +274,19 @@ u64 get_cpu_iowait_time_us(int cpu, u64 *last_update_time)
 }
 EXPORT_SYMBOL_GPL(get_cpu_iowait_time_us);
 
-static void tick_nohz_stop_sched_tick(struct tick_sched *ts)
+/*
+ * Stop the tick, or push it out to the next pending timer event if it
+ * is stopped already.  Shared by the idle loop and by full dynticks;
+ * the callers have checked that stopping the tick is allowed at all.
+ */
+static void tick_nohz_stop_sched_tick(struct tick_sched *ts, ktime_t now,
+				      int cpu)
 {
 	unsigned long seq, last_jiffies, next_jiffies, delta_jiffies;
-	ktime_t last_update, expires, now;
 	struct clock_event_device *dev = __get_cpu_var(tick_cpu_device).evtdev;
+	ktime_t last_update, expires;
 	u64 time_delta;
-	int cpu;
-
-	cpu = smp_processor_id();
-	ts = &per_cpu(tick_cpu_sched, cpu);
-
-	now = tick_nohz_start_idle(cpu, ts);
-
-	/*
-	 * If this cpu is offline and it is the one which updates
-	 * jiffies, then give up the assignment and let it be taken by
-	 * the cpu which runs the tick timer next. If we don't drop
-	 * this here the jiffies might be stale and do_timer() never
-	 * invoked.
-	 */
-	if (unlikely(!cpu_online(cpu))) {
-		if (cpu == tick_do_timer_cpu)
-			tick_do_timer_cpu = TICK_DO_TIMER_NONE;
-	}
-
-	if (unlikely(ts->nohz_mode == NOHZ_MODE_INACTIVE))
-		return;
-
-	if (need_resched())
-		return;
-
-	if (unlikely(local_softirq_pending() && cpu_online(cpu))) {
-		static int ratelimit;
-
-		if (ratelimit < 10) {
-			printk(KERN_ERR "NOHZ: local_softirq_pending %02x\n",
-			       (unsigned int) local_softirq_pending());
-			ratelimit++;
-		}
-		return;
-	}
 
-	ts->idle_calls++;
 	/* Read jiffies and the time when jiffies were updated last */
 	do {
 		seq = read_seqbegin(&xtime_lock);
@@ -400,11 +373,8 @@ static void tick_nohz_stop_sched_tick(struct tick_sched *ts)
 		 * the scheduler tick in nohz_restart_sched_tick.
 		 */
 		if (!ts->tick_stopped) {
-			select_nohz_load_balancer(1);
-
 			ts->idle_tick = hrtimer_get_expires(&ts->sched_timer);
 			ts->tick_stopped = 1;
-			ts->idle_jiffies = last_jiffies;
 		}
 
 		ts->idle_sleeps++;
@@ -444,6 +414,349 @@ out:
 	ts->sleep_length = ktime_sub(dev->next_event, now);
 }
 
+static void tick_nohz_restart(struct tick_sched *ts, ktime_t now)
+{
+	hrtimer_cancel(&ts->sched_timer);
+	hrtimer_set_expires(&ts->sched_timer, ts->idle_tick);
+
+	while (1) {
+		/* Forward the time to expire in the future */
+		hrtimer_forward(&ts->sched_timer, now, tick_period);
+
+		if (ts->nohz_mode == NOHZ_MODE_HIGHRES) {
+			hrtimer_start_expires(&ts->sched_timer,
+					      HRTIMER_MODE_ABS_PINNED);
+			/* Check, if the timer was already in the past */
+			if (hrtimer_active(&ts->sched_timer))
+				break;
+		} else {
+			if (!tick_program_event(
+				hrtimer_get_expires(&ts->sched_timer), 0))
+				break;
+		}
+		/* Reread time and update jiffies */
+		now = ktime_get();
+		tick_do_update_jiffies64(now);
+	}
+}
+
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * CPUs listed in nohz_full= try to stop their tick whenever they run a
+ * single task.  The boot CPU is never part of the set so that there is
+ * always somebody left to do timekeeping.
+ */
+cpumask_var_t tick_nohz_full_mask;
+bool tick_nohz_full_running;
+
+static int __init tick_nohz_full_setup(char *str)
+{
+	int cpu = smp_processor_id();
+
+	alloc_bootmem_cpumask_var(&tick_nohz_full_mask);
+	if (cpulist_parse(str, tick_nohz_full_mask) < 0) {
+		printk(KERN_WARNING "NOHZ: Incorrect nohz_full cpumask\n");
+		return 1;
+	}
+
+	if (cpumask_test_cpu(cpu, tick_nohz_full_mask)) {
+		printk(KERN_WARNING
+		       "NOHZ: Clearing boot CPU %d from nohz_full range\n",
+		       cpu);
+		cpumask_clear_cpu(cpu, tick_nohz_full_mask);
+	}
+
+	if (!cpumask_empty(tick_nohz_full_mask))
+		tick_nohz_full_running = true;
+	return 1;
+}
+__setup("nohz_full=", tick_nohz_full_setup);
+
+/**
+ * tick_nohz_housekeeping_cpu - pick a CPU for work the full dynticks
+ * CPUs have handed off
+ *
+ * Prefers the calling CPU.  Only the boot CPU is guaranteed to be a
+ * housekeeper, so fall back to it if nothing else is online.
+ */
+int tick_nohz_housekeeping_cpu(void)
+{
+	int cpu = raw_smp_processor_id();
+
+	if (!tick_nohz_full_cpu(cpu))
+		return cpu;
+
+	for_each_online_cpu(cpu) {
+		if (!tick_nohz_full_cpu(cpu))
+			return cpu;
+	}
+	return cpumask_first(cpu_online_mask);
+}
+
+int tick_nohz_tick_stopped_cpu(int cpu)
+{
+	return per_cpu(tick_cpu_sched, cpu).tick_stopped;
+}
+
+/*
+ * Charge the ticks a task skipped while it ran tickless.  We cannot
+ * tell how the time was split between user and kernel mode, so it all
+ * goes to user time, which is where tasks that qualify for full
+ * dynticks spend nearly all of it.
+ */
+static void tick_nohz_full_account_ticks(struct tick_sched *ts,
+					 struct task_struct *p)
+{
+#ifndef CONFIG_VIRT_CPU_ACCOUNTING
+	unsigned long ticks = jiffies - ts->full_jiffies;
+
+	if (ticks && ticks < LONG_MAX) {
+		cputime_t delta = jiffies_to_cputime(ticks);
+
+		account_user_time(p, delta, cputime_to_scaled(delta));
+	}
+#endif
+	ts->full_jiffies = jiffies;
+}
+
+void __tick_nohz_task_switch(struct task_struct *prev)
+{
+	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
+
+	if (ts->full_stopped)
+		tick_nohz_full_account_ticks(ts, prev);
+}
+
+static bool can_stop_full_tick(int cpu)
+{
+	WARN_ON_ONCE(!irqs_disabled());
+
+	if (!sched_can_stop_tick())
+		return false;
+
+	if (!posix_cpu_timers_can_stop_tick(current))
+		return false;
+
+	if (!perf_event_can_stop_tick())
+		return false;
+
+	/*
+	 * Callbacks need the tick to advance, and nothing reports a
+	 * quiescent state on behalf of a busy tickless CPU.
+	 */
+	if (rcu_needs_cpu(cpu) || rcu_needs_cpu_qs(cpu))
+		return false;
+
+	return true;
+}
+
+static void tick_nohz_full_stop_tick(struct tick_sched *ts)
+{
+	int cpu = smp_processor_id();
+	int was_stopped = ts->tick_stopped;
+
+	if (!tick_nohz_full_cpu(cpu) || is_idle_task(current))
+		return;
+
+	if (unlikely(ts->nohz_mode == NOHZ_MODE_INACTIVE))
+		return;
+
+	if (need_resched() || local_softirq_pending())
+		return;
+
+	if (!can_stop_full_tick(cpu))
+		return;
+
+	tick_nohz_stop_sched_tick(ts, ktime_get(), cpu);
+
+	if (!was_stopped && ts->tick_stopped) {
+		ts->full_stopped = 1;
+		ts->full_jiffies = ts->last_jiffies;
+	}
+}
+
+static void tick_nohz_full_restart(struct tick_sched *ts)
+{
+	ktime_t now = ktime_get();
+
+	tick_do_update_jiffies64(now);
+	tick_nohz_full_account_ticks(ts, current);
+	touch_softlockup_watchdog();
+
+	ts->tick_stopped = 0;
+	ts->full_stopped = 0;
+	tick_nohz_restart(ts, now);
+}
+
+/**
+ * tick_nohz_full_check - restart the tick if it can no longer be stopped
+ *
+ * Called from the scheduler IPI after a remote CPU queued a second task
+ * or something else that needs the tick on this CPU.
+ */
+void tick_nohz_full_check(void)
+{
+	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
+	unsigned long flags;
+
+	if (!tick_nohz_full_cpu(smp_processor_id()))
+		return;
+
+	local_irq_save(flags);
+	if (ts->full_stopped && !can_stop_full_tick(smp_processor_id()))
+		tick_nohz_full_restart(ts);
+	local_irq_restore(flags);
+}
+
+/**
+ * tick_nohz_full_kick_cpu - make a full dynticks CPU re-evaluate its tick
+ * @cpu: the CPU to kick
+ *
+ * The scheduler IPI restarts the tick if it is needed again and the
+ * interrupt exit path reprograms it for any timer queued meanwhile.
+ */
+void tick_nohz_full_kick_cpu(int cpu)
+{
+	if (tick_nohz_full_cpu(cpu))
+		smp_send_reschedule(cpu);
+}
+
+/**
+ * tick_nohz_full_kick_all - kick every online full dynticks CPU
+ *
+ * Used when state the tick depends on changed without telling us where
+ * the affected task runs, e.g. a new posix CPU timer.
+ */
+void tick_nohz_full_kick_all(void)
+{
+	int cpu;
+
+	if (!tick_nohz_full_running)
+		return;
+
+	preempt_disable();
+	for_each_cpu_and(cpu, tick_nohz_full_mask, cpu_online_mask)
+		smp_send_reschedule(cpu);
+	preempt_enable();
+}
+
+/*
+ * The timekeeping CPU never stops its tick while full dynticks is in
+ * use, so it must not be unplugged either.
+ */
+static int __cpuinit tick_nohz_cpu_down_callback(struct notifier_block *nfb,
+						 unsigned long action,
+						 void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+
+	switch (action & ~CPU_TASKS_FROZEN) {
+	case CPU_DOWN_PREPARE:
+		if (tick_nohz_full_running && tick_do_timer_cpu == cpu)
+			return NOTIFY_BAD;
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static int __init tick_nohz_full_init(void)
+{
+	char buf[256];
+
+	if (!tick_nohz_full_running)
+		return 0;
+
+	cpulist_scnprintf(buf, sizeof(buf), tick_nohz_full_mask);
+	printk(KERN_INFO "NOHZ: Full dynticks CPUs: %s.\n", buf);
+
+	hotcpu_notifier(tick_nohz_cpu_down_callback, 0);
+	return 0;
+}
+early_initcall(tick_nohz_full_init);
+#else
+static inline void tick_nohz_full_stop_tick(struct tick_sched *ts) { }
+#endif /* CONFIG_NO_HZ_FULL */
+
+static bool can_stop_idle_tick(int cpu, struct tick_sched *ts)
+{
+	/*
+	 * If this cpu is offline and it is the one which updates
+	 * jiffies, then give up the assignment and let it be taken by
+	 * the cpu which runs the tick timer next. If we don't drop
+	 * this here the jiffies might be stale and do_timer() never
+	 * invoked.
+	 */
+	if (unlikely(!cpu_online(cpu))) {
+		if (cpu == tick_do_timer_cpu)
+			tick_do_timer_cpu = TICK_DO_TIMER_NONE;
+	}
+
+	if (unlikely(ts->nohz_mode == NOHZ_MODE_INACTIVE))
+		return false;
+
+	if (need_resched())
+		return false;
+
+	if (unlikely(local_softirq_pending() && cpu_online(cpu))) {
+		static int ratelimit;
+
+		if (ratelimit < 10) {
+			printk(KERN_ERR "NOHZ: local_softirq_pending %02x\n",
+			       (unsigned int) local_softirq_pending());
+			ratelimit++;
+		}
+		return false;
+	}
+
+#ifdef CONFIG_NO_HZ_FULL
+	/*
+	 * Full dynticks CPUs rely on the timekeeper to keep jiffies
+	 * going, so it keeps its tick even when idle.  Nobody must
+	 * stop the tick before the duty has been assigned at all.
+	 */
+	if (tick_nohz_full_running) {
+		if (cpu == tick_do_timer_cpu)
+			return false;
+		if (tick_do_timer_cpu == TICK_DO_TIMER_NONE)
+			return false;
+	}
+#endif
+
+	return true;
+}
+
+static void __tick_nohz_idle_enter(struct tick_sched *ts)
+{
+	int cpu = smp_processor_id();
+	int was_stopped;
+	ktime_t now;
+
+	/*
+	 * A tick stopped by full dynticks is taken over by the idle
+	 * code; the outgoing task got its ticks on the context switch.
+	 */
+	if (ts->full_stopped) {
+		ts->full_stopped = 0;
+		ts->idle_jiffies = jiffies;
+		select_nohz_load_balancer(1);
+	}
+
+	now = tick_nohz_start_idle(cpu, ts);
+
+	if (!can_stop_idle_tick(cpu, ts))
+		return;
+
+	ts->idle_calls++;
+	was_stopped = ts->tick_stopped;
+
+	tick_nohz_stop_sched_tick(ts, now, cpu);
+
+	if (!was_stopped && ts->tick_stopped) {
+		select_nohz_load_balancer(1);
+		ts->idle_jiffies = ts->last_jiffies;
+	}
+}
+
 /**
  * tick_nohz_idle_enter - stop the idle tick from the idle task
  *
@@ -479,7 +792,7 @@ void tick_nohz_idle_enter(void)
 	 * update of the idle time accounting in tick_nohz_start_idle().
 	 */
 	ts->inidle = 1;
-	tick_nohz_stop_sched_tick(ts);
+	__tick_nohz_idle_enter(ts);
 
 	local_irq_enable();
 }
@@ -491,15 +804,18 @@ void tick_nohz_idle_enter(void)
  * a reschedule, it may still add, modify or delete a timer, enqueue
  * an RCU callback, etc...
  * So we need to re-calculate and reprogram the next tick event.
+ *
+ * On a full dynticks CPU the same applies while it runs a single task,
+ * and this is also where the tick gets stopped in the first place.
  */
 void tick_nohz_irq_exit(void)
 {
 	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
 
-	if (!ts->inidle)
-		return;
-
-	tick_nohz_stop_sched_tick(ts);
+	if (ts->inidle)
+		__tick_nohz_idle_enter(ts);
+	else
+		tick_nohz_full_stop_tick(ts);
 }
 
 /**
@@ -514,32 +830,6 @@ ktime_t tick_nohz_get_sleep_length(void)
 	return ts->sleep_length;
 }
 
-static void tick_nohz_restart(struct tick_sched *ts, ktime_t now)
-{
-	hrtimer_cancel(&ts->sched_timer);
-	hrtimer_set_expires(&ts->sched_timer, ts->idle_tick);
-
-	while (1) {
-		/* Forward the time to expire in the future */
-		hrtimer_forward(&ts->sched_timer, now, tick_period);
-
-		if (ts->nohz_mode == NOHZ_MODE_HIGHRES) {
-			hrtimer_start_expires(&ts->sched_timer,
-					      HRTIMER_MODE_ABS_PINNED);
-			/* Check, if the timer was already in the past */
-			if (hrtimer_active(&ts->sched_timer))
-				break;
-		} else {
-			if (!tick_program_event(
-				hrtimer_get_expires(&ts->sched_timer), 0))
-				break;
-		}
-		/* Reread time and update jiffies */
-		now = ktime_get();
-		tick_do_update_jiffies64(now);
-	}
-}
-
 /**
  * tick_nohz_idle_exit - restart the idle tick from the idle task
  *
@@ -628,7 +918,8 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 
 	/* Check, if the jiffies need an update */
@@ -645,7 +936,10 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 	 */
 	if (ts->tick_stopped) {
 		touch_softlockup_watchdog();
-		ts->idle_jiffies++;
+		if (ts->full_stopped)
+			ts->full_jiffies++;
+		else
+			ts->idle_jiffies++;
 	}
 
 	update_process_times(user_mode(regs));
@@ -780,7 +1074,8 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 #endif
 
@@ -803,7 +1098,10 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 		 */
 		if (ts->tick_stopped) {
 			touch_softlockup_watchdog();
-			ts->idle_jiffies++;
+			if (ts->full_stopped)
+				ts->full_jiffies++;
+			else
+				ts->idle_jiffies++;
 		}
 		update_process_times(user_mode(regs));
 		profile_tick(CPU_PROFILING);
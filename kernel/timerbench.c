@@ -0,0 +1,338 @@
+/*
+ * Module-based benchmark for the timer wheel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * One kthread per CPU arms its share of the timers with random
+ * timeouts, re-arms them all once (as a TCP retransmit timer is on every
+ * ACK), cancels a fraction of them and lets the rest expire.  The cost
+ * of each phase, the lateness of every expiry and the softirq time spent
+ * meanwhile are reported at the end of the run.
+ *
+ * See also:  Documentation/timers/timerbench.txt
+ */
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/err.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/kernel_stat.h>
+#include <linux/completion.h>
+#include <linux/wait.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/atomic.h>
+
+MODULE_LICENSE("GPL");
+
+static int ntimers = 1000000;	/* Total number of timers armed. */
+static int nthreads;		/* Arming threads, 0 means one per CPU. */
+static int max_delay = 30000;	/* Longest timeout armed (ms). */
+static int cancel_pct = 50;	/* Share of timers cancelled before expiry. */
+
+module_param(ntimers, int, 0444);
+MODULE_PARM_DESC(ntimers, "Total number of timers to arm");
+module_param(nthreads, int, 0444);
+MODULE_PARM_DESC(nthreads, "Number of arming threads, 0=one per online CPU");
+module_param(max_delay, int, 0444);
+MODULE_PARM_DESC(max_delay, "Maximum timeout armed (ms)");
+module_param(cancel_pct, int, 0444);
+MODULE_PARM_DESC(cancel_pct, "Percentage of timers cancelled before expiry");
+
+#define TB_FLAG "timerbench: "
+
+/*
+ * Lateness histogram in jiffies: bucket 0 is on time, bucket n counts
+ * [2^(n-1), 2^n).  The last bucket also takes anything later.
+ */
+#define TB_HIST_BUCKETS	32
+
+struct tb_cpu_stats {
+	unsigned long hist[TB_HIST_BUCKETS];
+	unsigned long n_expired;
+	unsigned long n_early;
+	unsigned long max_late;
+};
+
+static DEFINE_PER_CPU(struct tb_cpu_stats, tb_stats);
+
+enum {
+	TB_ARM,
+	TB_REARM,
+	TB_CANCEL,
+	TB_NR_PHASES
+};
+
+static const char * const tb_phase_name[TB_NR_PHASES] = {
+	"arm", "rearm", "cancel"
+};
+
+struct tb_thread {
+	struct task_struct *task;
+	int cpu;
+	unsigned long first;		/* First timer owned. */
+	unsigned long nr;		/* Number of timers owned. */
+	u64 ns[TB_NR_PHASES];		/* Total time spent per phase. */
+	u64 max_ns[TB_NR_PHASES];	/* Slowest single operation. */
+	unsigned long ops[TB_NR_PHASES];
+	unsigned long rand;
+};
+
+static struct timer_list *tb_timers;
+static struct tb_thread *tb_threads;
+static int tb_nthreads;
+static atomic_t tb_outstanding;
+static atomic_t tb_running;
+static DECLARE_WAIT_QUEUE_HEAD(tb_wq);
+static DECLARE_COMPLETION(tb_armed);
+
+/* Same cheap generator as the torture tests, per thread. */
+#define TB_RANDOM_MULT	39916801  /* prime */
+#define TB_RANDOM_ADD	479001701 /* prime */
+
+static unsigned long tb_random(struct tb_thread *t)
+{
+	t->rand = t->rand * TB_RANDOM_MULT + TB_RANDOM_ADD;
+	return swahw32(t->rand);
+}
+
+static unsigned long tb_random_timeout(struct tb_thread *t)
+{
+	return 1 + tb_random(t) % msecs_to_jiffies(max_delay);
+}
+
+static void tb_timer_fn(unsigned long data)
+{
+	struct timer_list *timer = (struct timer_list *)data;
+	struct tb_cpu_stats *st = &__get_cpu_var(tb_stats);
+	long late = (long)(jiffies - timer->expires);
+
+	st->n_expired++;
+	if (late < 0) {
+		st->n_early++;
+		late = 0;
+	}
+	st->hist[min_t(unsigned int, fls_long(late), TB_HIST_BUCKETS - 1)]++;
+	if (late > st->max_late)
+		st->max_late = late;
+	if (atomic_dec_and_test(&tb_outstanding))
+		wake_up(&tb_wq);
+}
+
+static void tb_account(struct tb_thread *t, int phase, u64 start)
+{
+	u64 delta = local_clock() - start;
+
+	t->ns[phase] += delta;
+	t->ops[phase]++;
+	if (delta > t->max_ns[phase])
+		t->max_ns[phase] = delta;
+}
+
+static int tb_thread_fn(void *arg)
+{
+	struct tb_thread *t = arg;
+	struct timer_list *timer;
+	unsigned long i;
+	u64 start;
+
+	for (i = 0; i < t->nr; i++) {
+		timer = &tb_timers[t->first + i];
+		start = local_clock();
+		mod_timer(timer, jiffies + tb_random_timeout(t));
+		tb_account(t, TB_ARM, start);
+		cond_resched();
+	}
+	for (i = 0; i < t->nr; i++) {
+		timer = &tb_timers[t->first + i];
+		start = local_clock();
+		mod_timer_pending(timer, jiffies + tb_random_timeout(t));
+		tb_account(t, TB_REARM, start);
+		cond_resched();
+	}
+	for (i = 0; i < t->nr; i++) {
+		if (tb_random(t) % 100 >= cancel_pct)
+			continue;
+		timer = &tb_timers[t->first + i];
+		start = local_clock();
+		if (del_timer(timer) && atomic_dec_and_test(&tb_outstanding))
+			wake_up(&tb_wq);
+		tb_account(t, TB_CANCEL, start);
+		cond_resched();
+	}
+	if (atomic_dec_and_test(&tb_running))
+		complete(&tb_armed);
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+static u64 tb_softirq_time(void)
+{
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += kcpustat_cpu(cpu).cpustat[CPUTIME_SOFTIRQ];
+	return sum;
+}
+
+static void tb_print_results(unsigned long elapsed, u64 softirq)
+{
+	struct tb_cpu_stats sum;
+	u64 ns, max_ns;
+	unsigned long ops;
+	int cpu, i, p;
+
+	for (p = 0; p < TB_NR_PHASES; p++) {
+		ns = max_ns = 0;
+		ops = 0;
+		for (i = 0; i < tb_nthreads; i++) {
+			ns += tb_threads[i].ns[p];
+			ops += tb_threads[i].ops[p];
+			max_ns = max(max_ns, tb_threads[i].max_ns[p]);
+		}
+		if (ops)
+			do_div(ns, ops);
+		printk(KERN_INFO TB_FLAG "%-6s %lu ops, avg %llu ns, max %llu ns\n",
+		       tb_phase_name[p], ops, (unsigned long long)ns,
+		       (unsigned long long)max_ns);
+	}
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		struct tb_cpu_stats *st = &per_cpu(tb_stats, cpu);
+
+		for (i = 0; i < TB_HIST_BUCKETS; i++)
+			sum.hist[i] += st->hist[i];
+		sum.n_expired += st->n_expired;
+		sum.n_early += st->n_early;
+		sum.max_late = max(sum.max_late, st->max_late);
+	}
+	printk(KERN_INFO TB_FLAG "expired %lu, early %lu, max late %u ms\n",
+	       sum.n_expired, sum.n_early, jiffies_to_msecs(sum.max_late));
+	for (i = 0; i < TB_HIST_BUCKETS; i++) {
+		if (!sum.hist[i])
+			continue;
+		printk(KERN_INFO TB_FLAG "late <= %6u ms: %lu\n",
+		       jiffies_to_msecs((1UL << i) - 1), sum.hist[i]);
+	}
+	printk(KERN_INFO TB_FLAG "softirq time %u ms over %u ms\n",
+	       jiffies_to_msecs(cputime64_to_jiffies64(softirq)),
+	       jiffies_to_msecs(elapsed));
+}
+
+static void tb_stop_threads(void)
+{
+	int i;
+
+	for (i = 0; i < tb_nthreads; i++)
+		if (tb_threads[i].task)
+			kthread_stop(tb_threads[i].task);
+}
+
+static int __init timer_bench_init(void)
+{
+	unsigned long start, i, per_thread;
+	u64 softirq;
+	int cpu, n = 0;
+
+	if (ntimers <= 0 || max_delay <= 0 || cancel_pct < 0 ||
+	    cancel_pct > 100)
+		return -EINVAL;
+
+	get_online_cpus();
+	tb_nthreads = nthreads > 0 ? nthreads : num_online_cpus();
+	tb_threads = kcalloc(tb_nthreads, sizeof(*tb_threads), GFP_KERNEL);
+	tb_timers = vmalloc(ntimers * sizeof(*tb_timers));
+	if (!tb_threads || !tb_timers) {
+		put_online_cpus();
+		vfree(tb_timers);
+		kfree(tb_threads);
+		return -ENOMEM;
+	}
+	for (i = 0; i < ntimers; i++)
+		setup_timer(&tb_timers[i], tb_timer_fn,
+			    (unsigned long)&tb_timers[i]);
+
+	printk(KERN_INFO TB_FLAG "%d timers, %d threads, max_delay %d ms, cancel %d%%\n",
+	       ntimers, tb_nthreads, max_delay, cancel_pct);
+
+	atomic_set(&tb_outstanding, ntimers);
+	atomic_set(&tb_running, tb_nthreads);
+	per_thread = DIV_ROUND_UP(ntimers, tb_nthreads);
+	cpu = cpumask_first(cpu_online_mask);
+	softirq = tb_softirq_time();
+	start = jiffies;
+	for (n = 0; n < tb_nthreads; n++) {
+		struct tb_thread *t = &tb_threads[n];
+
+		t->cpu = cpu;
+		t->first = min_t(unsigned long, n * per_thread, ntimers);
+		t->nr = min_t(unsigned long, per_thread, ntimers - t->first);
+		t->rand = (n + 1) * jiffies;
+		t->task = kthread_create(tb_thread_fn, t, "timerbench/%d", cpu);
+		if (IS_ERR(t->task)) {
+			t->task = NULL;
+			break;
+		}
+		kthread_bind(t->task, cpu);
+		wake_up_process(t->task);
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	}
+	put_online_cpus();
+
+	if (n < tb_nthreads) {
+		printk(KERN_ERR TB_FLAG "failed to create thread %d\n", n);
+		/* Account for the threads that will never finish arming. */
+		if (atomic_sub_and_test(tb_nthreads - n, &tb_running))
+			complete(&tb_armed);
+	}
+	wait_for_completion(&tb_armed);
+
+	/* Let the survivors expire; anything still queued is cancelled. */
+	wait_event_timeout(tb_wq, !atomic_read(&tb_outstanding),
+			   msecs_to_jiffies(max_delay) * 2 + HZ);
+	softirq = tb_softirq_time() - softirq;
+	tb_stop_threads();
+	for (i = 0; i < ntimers; i++)
+		del_timer_sync(&tb_timers[i]);
+
+	tb_print_results(jiffies - start, softirq);
+	if (atomic_read(&tb_outstanding))
+		printk(KERN_ERR TB_FLAG "%d timers did not expire in time\n",
+		       atomic_read(&tb_outstanding));
+	vfree(tb_timers);
+	kfree(tb_threads);
+	return 0;
+}
+
+static void __exit timer_bench_cleanup(void)
+{
+}
+
+module_init(timer_bench_init);
+module_exit(timer_bench_cleanup);
@@ -41,6 +41,8 @@
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
 #include <linux/idr.h>
+#include <linux/device.h>
+#include <linux/moduleparam.h>
 
 #include "workqueue_sched.h"
 
@@ -137,12 +139,17 @@ struct worker {
 	unsigned int		flags;		/* X: flags */
 	int			id;		/* I: worker id */
 	struct work_struct	rebind_work;	/* L: rebind worker to cpu */
+
+	/* unbound workers only, see worker_apply_attrs() */
+	unsigned long		attrs_seq;	/* attrs currently applied */
+	cpumask_var_t		cpumask;	/* CPUs currently allowed */
 };
 
 /*
  * Global per-cpu workqueue.  There's one and only one for each cpu
  * and all works are queued and processed here regardless of their
- * target workqueues.
+ * target workqueues.  Unbound workqueues are served by one more gcwq
+ * per NUMA node.
  */
 struct global_cwq {
 	spinlock_t		lock;		/* the gcwq lock */
@@ -224,7 +231,7 @@ struct workqueue_struct {
 	unsigned int		flags;		/* W: WQ_* flags */
 	union {
 		struct cpu_workqueue_struct __percpu	*pcpu;
-		struct cpu_workqueue_struct		*single;
+		struct cpu_workqueue_struct		**nodes;
 		unsigned long				v;
 	} cpu_wq;				/* I: cwq's */
 	struct list_head	list;		/* W: list of all workqueues */
@@ -242,6 +249,10 @@ struct workqueue_struct {
 
 	int			nr_drainers;	/* W: drain in progress */
 	int			saved_max_active; /* W: saved cwq max_active */
+
+	struct workqueue_attrs	*unbound_attrs;	/* W: only for unbound wqs */
+	unsigned long		attrs_seq;	/* W: unbound_attrs id */
+	struct wq_device	*wq_dev;	/* I: for sysfs interface */
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map	lockdep_map;
 #endif
@@ -271,6 +282,8 @@ EXPORT_SYMBOL_GPL(system_nrt_freezable_wq);
 static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				  unsigned int sw)
 {
+	int node;
+
 	if (cpu < nr_cpu_ids) {
 		if (sw & 1) {
 			cpu = cpumask_next(cpu, mask);
@@ -278,7 +291,11 @@ static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				return cpu;
 		}
 		if (sw & 2)
-			return WORK_CPU_UNBOUND;
+			return WORK_CPU_UNBOUND + first_node(node_possible_map);
+	} else if (cpu >= WORK_CPU_UNBOUND) {
+		node = next_node(cpu - WORK_CPU_UNBOUND, node_possible_map);
+		if (node < MAX_NUMNODES)
+			return WORK_CPU_UNBOUND + node;
 	}
 	return WORK_CPU_NONE;
 }
@@ -292,15 +309,16 @@ static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
 /*
  * CPU iterators
  *
- * An extra gcwq is defined for an invalid cpu number
- * (WORK_CPU_UNBOUND) to host workqueues which are not bound to any
- * specific CPU.  The following iterators are similar to
- * for_each_*_cpu() iterators but also considers the unbound gcwq.
+ * Extra gcwqs are defined for invalid cpu numbers, one for each
+ * possible NUMA node (WORK_CPU_UNBOUND + node), to host workqueues
+ * which are not bound to any specific CPU.  The following iterators
+ * are similar to for_each_*_cpu() iterators but also consider the
+ * unbound gcwqs.
  *
- * for_each_gcwq_cpu()		: possible CPUs + WORK_CPU_UNBOUND
- * for_each_online_gcwq_cpu()	: online CPUs + WORK_CPU_UNBOUND
+ * for_each_gcwq_cpu()		: possible CPUs + unbound gcwqs
+ * for_each_online_gcwq_cpu()	: online CPUs + unbound gcwqs
  * for_each_cwq_cpu()		: possible CPUs for bound workqueues,
- *				  WORK_CPU_UNBOUND for unbound workqueues
+ *				  unbound gcwqs for unbound workqueues
  */
 #define for_each_gcwq_cpu(cpu)						\
 	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, 3);		\
@@ -447,26 +465,35 @@ static DEFINE_PER_CPU(struct global_cwq, global_cwq);
 static DEFINE_PER_CPU_SHARED_ALIGNED(atomic_t, gcwq_nr_running);
 
 /*
- * Global cpu workqueue and nr_running counter for unbound gcwq.  The
- * gcwq is always online, has GCWQ_DISASSOCIATED set, and all its
- * workers have WORKER_UNBOUND set.
+ * Global cpu workqueues and nr_running counter for the unbound gcwqs,
+ * one gcwq per NUMA node.  They are always online, have
+ * GCWQ_DISASSOCIATED set, and all their workers have WORKER_UNBOUND
+ * set.
  */
-static struct global_cwq unbound_global_cwq;
+static struct global_cwq unbound_global_cwq[MAX_NUMNODES];
 static atomic_t unbound_gcwq_nr_running = ATOMIC_INIT(0);	/* always 0 */
 
+/*
+ * Unbound workers normally stay on the CPUs of their gcwq's node.
+ * workqueue.disable_numa=1 makes all unbound workqueues use the first
+ * node's gcwq and run wherever their cpumask allows instead.
+ */
+static bool wq_disable_numa;
+module_param_named(disable_numa, wq_disable_numa, bool, 0444);
+
 static int worker_thread(void *__worker);
 
 static struct global_cwq *get_gcwq(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (cpu < WORK_CPU_UNBOUND)
 		return &per_cpu(global_cwq, cpu);
 	else
-		return &unbound_global_cwq;
+		return &unbound_global_cwq[cpu - WORK_CPU_UNBOUND];
 }
 
 static atomic_t *get_gcwq_nr_running(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (cpu < WORK_CPU_UNBOUND)
 		return &per_cpu(gcwq_nr_running, cpu);
 	else
 		return &unbound_gcwq_nr_running;
@@ -478,11 +505,54 @@ static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 	if (!(wq->flags & WQ_UNBOUND)) {
 		if (likely(cpu < nr_cpu_ids))
 			return per_cpu_ptr(wq->cpu_wq.pcpu, cpu);
-	} else if (likely(cpu == WORK_CPU_UNBOUND))
-		return wq->cpu_wq.single;
+	} else if (likely(cpu >= WORK_CPU_UNBOUND && cpu < WORK_CPU_NONE))
+		return wq->cpu_wq.nodes[cpu - WORK_CPU_UNBOUND];
 	return NULL;
 }
 
+static bool wq_numa_affine(struct workqueue_struct *wq)
+{
+	return !wq_disable_numa && !(wq->flags & WQ_ORDERED) &&
+		!wq->unbound_attrs->no_numa;
+}
+
+/*
+ * Pick the unbound gcwq a work item of @wq queued for @cpu goes to:
+ * the one of @cpu's node, or of the local node for WORK_CPU_UNBOUND,
+ * so that the work item executes close to the memory its submitter
+ * was using.  Ordered workqueues, those with NUMA affinity disabled
+ * and those not allowed on the node at all use the first node's gcwq.
+ */
+static unsigned int wq_unbound_cpu(struct workqueue_struct *wq,
+				   unsigned int cpu)
+{
+	int node = first_node(node_possible_map);
+
+	if (wq_numa_affine(wq)) {
+		int local;
+
+		local = cpu < nr_cpu_ids ? cpu_to_node(cpu) : numa_node_id();
+		if (likely(cpumask_intersects(wq->unbound_attrs->cpumask,
+					      cpumask_of_node(local))))
+			node = local;
+	}
+	return WORK_CPU_UNBOUND + node;
+}
+
+/*
+ * The CPUs an unbound worker of @node runs work items on, given the
+ * @allowed CPUs of their workqueue: those of @node if there are any and
+ * the workqueue is NUMA affine, all @allowed ones otherwise.
+ */
+static void wq_calc_node_cpumask(const struct cpumask *allowed, bool numa,
+				 int node, struct cpumask *mask)
+{
+	if (numa && !wq_disable_numa &&
+	    cpumask_and(mask, allowed, cpumask_of_node(node)))
+		return;
+	cpumask_copy(mask, allowed);
+}
+
 static unsigned int work_color_to_flags(int color)
 {
 	return color << WORK_STRUCT_COLOR_SHIFT;
@@ -561,7 +631,7 @@ static struct global_cwq *get_work_gcwq(struct work_struct *work)
 	if (cpu == WORK_CPU_NONE)
 		return NULL;
 
-	BUG_ON(cpu >= nr_cpu_ids && cpu != WORK_CPU_UNBOUND);
+	BUG_ON(cpu >= nr_cpu_ids && cpu < WORK_CPU_UNBOUND);
 	return get_gcwq(cpu);
 }
 
@@ -979,7 +1049,7 @@ static bool is_chained_work(struct workqueue_struct *wq)
 static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
-	struct global_cwq *gcwq;
+	struct global_cwq *gcwq, *last_gcwq;
 	struct cpu_workqueue_struct *cwq;
 	struct list_head *worklist;
 	unsigned int work_flags;
@@ -994,39 +1064,37 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 
 	/* determine gcwq to use */
 	if (!(wq->flags & WQ_UNBOUND)) {
-		struct global_cwq *last_gcwq;
-
 		if (unlikely(cpu == WORK_CPU_UNBOUND))
 			cpu = raw_smp_processor_id();
-
-		/*
-		 * It's multi cpu.  If @wq is non-reentrant and @work
-		 * was previously on a different cpu, it might still
-		 * be running there, in which case the work needs to
-		 * be queued on that cpu to guarantee non-reentrance.
-		 */
 		gcwq = get_gcwq(cpu);
-		if (wq->flags & WQ_NON_REENTRANT &&
-		    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
-			struct worker *worker;
+	} else
+		gcwq = get_gcwq(wq_unbound_cpu(wq, cpu));
 
-			spin_lock_irqsave(&last_gcwq->lock, flags);
+	/*
+	 * If @wq is non-reentrant and @work was previously on a
+	 * different gcwq, it might still be running there, in which
+	 * case the work needs to be queued on that gcwq to guarantee
+	 * non-reentrance.  Unbound workqueues have always been
+	 * non-reentrant as they used to share a single gcwq; keep it
+	 * that way now that there is one per node.
+	 */
+	if (wq->flags & (WQ_NON_REENTRANT | WQ_UNBOUND) &&
+	    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
+		struct worker *worker;
 
-			worker = find_worker_executing_work(last_gcwq, work);
+		spin_lock_irqsave(&last_gcwq->lock, flags);
 
-			if (worker && worker->current_cwq->wq == wq)
-				gcwq = last_gcwq;
-			else {
-				/* meh... not running there, queue here */
-				spin_unlock_irqrestore(&last_gcwq->lock, flags);
-				spin_lock_irqsave(&gcwq->lock, flags);
-			}
-		} else
+		worker = find_worker_executing_work(last_gcwq, work);
+
+		if (worker && worker->current_cwq->wq == wq)
+			gcwq = last_gcwq;
+		else {
+			/* meh... not running there, queue here */
+			spin_unlock_irqrestore(&last_gcwq->lock, flags);
 			spin_lock_irqsave(&gcwq->lock, flags);
-	} else {
-		gcwq = get_gcwq(WORK_CPU_UNBOUND);
+		}
+	} else
 		spin_lock_irqsave(&gcwq->lock, flags);
-	}
 
 	/* gcwq determined, get cwq and queue */
 	cwq = get_cwq(gcwq->cpu, wq);
@@ -1154,12 +1222,12 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 		if (!(wq->flags & WQ_UNBOUND)) {
 			struct global_cwq *gcwq = get_work_gcwq(work);
 
-			if (gcwq && gcwq->cpu != WORK_CPU_UNBOUND)
+			if (gcwq && gcwq->cpu < WORK_CPU_UNBOUND)
 				lcpu = gcwq->cpu;
 			else
 				lcpu = raw_smp_processor_id();
 		} else
-			lcpu = WORK_CPU_UNBOUND;
+			lcpu = wq_unbound_cpu(wq, WORK_CPU_UNBOUND);
 
 		set_work_cwq(work, get_cwq(lcpu, wq), 0);
 
@@ -1349,7 +1417,8 @@ static struct worker *alloc_worker(void)
  */
 static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 {
-	bool on_unbound_cpu = gcwq->cpu == WORK_CPU_UNBOUND;
+	bool on_unbound_cpu = gcwq->cpu >= WORK_CPU_UNBOUND;
+	int node = on_unbound_cpu ? gcwq->cpu - WORK_CPU_UNBOUND : 0;
 	struct worker *worker = NULL;
 	int id = -1;
 
@@ -1375,11 +1444,25 @@ static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 						      cpu_to_node(gcwq->cpu),
 						      "kworker/%u:%d", gcwq->cpu, id);
 	else
-		worker->task = kthread_create(worker_thread, worker,
-					      "kworker/u:%d", id);
+		worker->task = kthread_create_on_node(worker_thread, worker,
+						      node, "kworker/u%d:%d",
+						      node, id);
 	if (IS_ERR(worker->task))
 		goto fail;
 
+	/*
+	 * Unbound workers start out on the CPUs of their node with the
+	 * default attributes, attrs_seq 0.  This must happen before
+	 * PF_THREAD_BOUND is set below.
+	 */
+	if (on_unbound_cpu) {
+		if (!alloc_cpumask_var(&worker->cpumask, GFP_KERNEL))
+			goto fail_task;
+		wq_calc_node_cpumask(cpu_possible_mask, true, node,
+				     worker->cpumask);
+		set_cpus_allowed_ptr(worker->task, worker->cpumask);
+	}
+
 	/*
 	 * A rogue worker will become a regular one if CPU comes
 	 * online later on.  Make sure every worker has
@@ -1394,6 +1477,8 @@ static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 	}
 
 	return worker;
+fail_task:
+	kthread_stop(worker->task);
 fail:
 	if (id >= 0) {
 		spin_lock_irq(&gcwq->lock);
@@ -1450,6 +1535,7 @@ static void destroy_worker(struct worker *worker)
 	spin_unlock_irq(&gcwq->lock);
 
 	kthread_stop(worker->task);
+	free_cpumask_var(worker->cpumask);
 	kfree(worker);
 
 	spin_lock_irq(&gcwq->lock);
@@ -1493,8 +1579,8 @@ static bool send_mayday(struct work_struct *work)
 
 	/* mayday mayday mayday */
 	cpu = cwq->gcwq->cpu;
-	/* WORK_CPU_UNBOUND can't be set in cpumask, use cpu 0 instead */
-	if (cpu == WORK_CPU_UNBOUND)
+	/* unbound gcwqs can't be set in cpumask, use cpu 0 instead */
+	if (cpu >= WORK_CPU_UNBOUND)
 		cpu = 0;
 	if (!mayday_test_and_set_cpu(cpu, wq->mayday_mask))
 		wake_up_process(wq->rescuer->task);
@@ -1777,6 +1863,39 @@ static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color,
 		complete(&cwq->wq->first_flusher->done);
 }
 
+/**
+ * worker_apply_attrs - switch an unbound worker to the attrs of a workqueue
+ * @worker: self
+ * @wq: workqueue of the work item about to be processed
+ *
+ * Make @worker run with the nice level and on the CPUs @wq's attributes
+ * ask for.  Workqueues with the default attributes share attrs_seq 0
+ * (or 1 when not NUMA affine), so workers only switch when they move
+ * between workqueues configured differently.
+ *
+ * CONTEXT:
+ * Might sleep.  Grabs and releases workqueue_lock.
+ */
+static void worker_apply_attrs(struct worker *worker,
+			       struct workqueue_struct *wq)
+{
+	int node = worker->gcwq->cpu - WORK_CPU_UNBOUND;
+	int nice;
+
+	if (likely(worker->attrs_seq == ACCESS_ONCE(wq->attrs_seq)))
+		return;
+
+	spin_lock(&workqueue_lock);
+	worker->attrs_seq = wq->attrs_seq;
+	nice = wq->unbound_attrs->nice;
+	wq_calc_node_cpumask(wq->unbound_attrs->cpumask, wq_numa_affine(wq),
+			     node, worker->cpumask);
+	spin_unlock(&workqueue_lock);
+
+	set_user_nice(current, nice);
+	set_cpus_allowed_ptr(current, worker->cpumask);
+}
+
 /**
  * process_one_work - process single work
  * @worker: self
@@ -1859,6 +1978,9 @@ __acquires(&gcwq->lock)
 
 	spin_unlock_irq(&gcwq->lock);
 
+	if (worker->flags & WORKER_UNBOUND)
+		worker_apply_attrs(worker, cwq->wq);
+
 	work_clear_pending(work);
 	lock_map_acquire_read(&cwq->wq->lockdep_map);
 	lock_map_acquire(&lockdep_map);
@@ -2021,13 +2143,45 @@ sleep:
  *
  * This should happen rarely.
  */
+static void rescue_cwq(struct worker *rescuer,
+		       struct cpu_workqueue_struct *cwq)
+{
+	struct list_head *scheduled = &rescuer->scheduled;
+	struct global_cwq *gcwq = cwq->gcwq;
+	struct work_struct *work, *n;
+
+	/* migrate to the target cpu if possible */
+	rescuer->gcwq = gcwq;
+	worker_maybe_bind_and_lock(rescuer);
+
+	/*
+	 * Slurp in all works issued via this workqueue and
+	 * process'em.
+	 */
+	BUG_ON(!list_empty(&rescuer->scheduled));
+	list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
+		if (get_work_cwq(work) == cwq)
+			move_linked_works(work, scheduled, &n);
+
+	process_scheduled_works(rescuer);
+
+	/*
+	 * Leave this gcwq.  If keep_working() is %true, notify a
+	 * regular worker; otherwise, we end up with 0 concurrency
+	 * and stalling the execution.
+	 */
+	if (keep_working(gcwq))
+		wake_up_worker(gcwq);
+
+	spin_unlock_irq(&gcwq->lock);
+}
+
 static int rescuer_thread(void *__wq)
 {
 	struct workqueue_struct *wq = __wq;
 	struct worker *rescuer = wq->rescuer;
-	struct list_head *scheduled = &rescuer->scheduled;
 	bool is_unbound = wq->flags & WQ_UNBOUND;
-	unsigned int cpu;
+	unsigned int cpu, tcpu;
 
 	set_user_nice(current, RESCUER_NICE_LEVEL);
 repeat:
@@ -2038,41 +2192,18 @@ repeat:
 
 	/*
 	 * See whether any cpu is asking for help.  Unbounded
-	 * workqueues use cpu 0 in mayday_mask for CPU_UNBOUND.
+	 * workqueues use cpu 0 in mayday_mask for all their node
+	 * gcwqs, so rescue every one of them.
 	 */
 	for_each_mayday_cpu(cpu, wq->mayday_mask) {
-		unsigned int tcpu = is_unbound ? WORK_CPU_UNBOUND : cpu;
-		struct cpu_workqueue_struct *cwq = get_cwq(tcpu, wq);
-		struct global_cwq *gcwq = cwq->gcwq;
-		struct work_struct *work, *n;
-
 		__set_current_state(TASK_RUNNING);
 		mayday_clear_cpu(cpu, wq->mayday_mask);
 
-		/* migrate to the target cpu if possible */
-		rescuer->gcwq = gcwq;
-		worker_maybe_bind_and_lock(rescuer);
-
-		/*
-		 * Slurp in all works issued via this workqueue and
-		 * process'em.
-		 */
-		BUG_ON(!list_empty(&rescuer->scheduled));
-		list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
-			if (get_work_cwq(work) == cwq)
-				move_linked_works(work, scheduled, &n);
-
-		process_scheduled_works(rescuer);
-
-		/*
-		 * Leave this gcwq.  If keep_working() is %true, notify a
-		 * regular worker; otherwise, we end up with 0 concurrency
-		 * and stalling the execution.
-		 */
-		if (keep_working(gcwq))
-			wake_up_worker(gcwq);
-
-		spin_unlock_irq(&gcwq->lock);
+		if (is_unbound) {
+			for_each_cwq_cpu(tcpu, wq)
+				rescue_cwq(rescuer, get_cwq(tcpu, wq));
+		} else
+			rescue_cwq(rescuer, get_cwq(cpu, wq));
 	}
 
 	schedule();
@@ -2884,6 +3015,396 @@ int keventd_up(void)
 	return system_wq != NULL;
 }
 
+/* last attrs_seq handed out, 0 and 1 are reserved for the defaults */
+static unsigned long wq_attrs_seq_last = 1;
+
+/**
+ * free_workqueue_attrs - free a workqueue_attrs
+ * @attrs: workqueue_attrs to free
+ *
+ * Undo alloc_workqueue_attrs().
+ */
+void free_workqueue_attrs(struct workqueue_attrs *attrs)
+{
+	if (attrs) {
+		free_cpumask_var(attrs->cpumask);
+		kfree(attrs);
+	}
+}
+EXPORT_SYMBOL_GPL(free_workqueue_attrs);
+
+/**
+ * alloc_workqueue_attrs - allocate a workqueue_attrs
+ * @gfp_mask: allocation mask to use
+ *
+ * Allocate a new workqueue_attrs, initialize with the default settings
+ * (nice 0, all possible CPUs, NUMA affine) and return it.
+ *
+ * RETURNS:
+ * The allocated workqueue_attrs on success, %NULL on failure.
+ */
+struct workqueue_attrs *alloc_workqueue_attrs(gfp_t gfp_mask)
+{
+	struct workqueue_attrs *attrs;
+
+	attrs = kzalloc(sizeof(*attrs), gfp_mask);
+	if (!attrs)
+		return NULL;
+	if (!alloc_cpumask_var(&attrs->cpumask, gfp_mask)) {
+		kfree(attrs);
+		return NULL;
+	}
+	cpumask_copy(attrs->cpumask, cpu_possible_mask);
+	return attrs;
+}
+EXPORT_SYMBOL_GPL(alloc_workqueue_attrs);
+
+/*
+ * Workers compare attrs_seq to tell whether they need to switch
+ * attributes.  All workqueues with the default attributes share 0, or
+ * 1 if they aren't NUMA affine; the others get a new one each time
+ * their attributes change.  Called with workqueue_lock held.
+ */
+static void wq_update_attrs_seq(struct workqueue_struct *wq)
+{
+	struct workqueue_attrs *attrs = wq->unbound_attrs;
+
+	if (!attrs->nice && cpumask_equal(attrs->cpumask, cpu_possible_mask))
+		wq->attrs_seq = wq_numa_affine(wq) ? 0 : 1;
+	else
+		wq->attrs_seq = ++wq_attrs_seq_last;
+}
+
+/**
+ * apply_workqueue_attrs - apply new workqueue_attrs to an unbound workqueue
+ * @wq: the target workqueue
+ * @attrs: the workqueue_attrs to apply, allocated with alloc_workqueue_attrs()
+ *
+ * Apply @attrs to the unbound workqueue @wq.  Work items already
+ * executing keep their attributes; the workers pick up the new ones
+ * for the next work item of @wq they process.  Ordered workqueues
+ * can't be changed.
+ *
+ * CONTEXT:
+ * Grabs and releases workqueue_lock.
+ *
+ * RETURNS:
+ * 0 on success and -errno on failure.
+ */
+int apply_workqueue_attrs(struct workqueue_struct *wq,
+			  const struct workqueue_attrs *attrs)
+{
+	if (WARN_ON(!(wq->flags & WQ_UNBOUND) || (wq->flags & WQ_ORDERED)))
+		return -EINVAL;
+	if (attrs->nice < -20 || attrs->nice > 19 ||
+	    !cpumask_intersects(attrs->cpumask, cpu_possible_mask))
+		return -EINVAL;
+
+	spin_lock(&workqueue_lock);
+	wq->unbound_attrs->nice = attrs->nice;
+	cpumask_and(wq->unbound_attrs->cpumask, attrs->cpumask,
+		    cpu_possible_mask);
+	wq->unbound_attrs->no_numa = attrs->no_numa;
+	wq_update_attrs_seq(wq);
+	spin_unlock(&workqueue_lock);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(apply_workqueue_attrs);
+
+#ifdef CONFIG_SYSFS
+/*
+ * Workqueues created with WQ_SYSFS show up under
+ * /sys/bus/workqueue/devices/ with the following attributes:
+ *
+ *  per_cpu	RO bool	: whether the workqueue is per-cpu or unbound
+ *  max_active	RW int	: maximum number of in-flight work items
+ *
+ * Unbound workqueues also have:
+ *
+ *  nice	RW int	: nice level of the workers
+ *  cpumask	RW mask	: CPUs the workers are allowed to run on
+ *  numa	RW bool	: whether work items stay on their submitter's node
+ */
+struct wq_device {
+	struct workqueue_struct		*wq;
+	struct device			dev;
+};
+
+static struct workqueue_struct *dev_to_wq(struct device *dev)
+{
+	struct wq_device *wq_dev = container_of(dev, struct wq_device, dev);
+
+	return wq_dev->wq;
+}
+
+static ssize_t wq_per_cpu_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", !(wq->flags & WQ_UNBOUND));
+}
+
+static ssize_t wq_max_active_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", wq->saved_max_active);
+}
+
+static ssize_t wq_max_active_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int val;
+
+	if (sscanf(buf, "%d", &val) != 1 || val <= 0)
+		return -EINVAL;
+
+	workqueue_set_max_active(wq, val);
+	return count;
+}
+
+static struct device_attribute wq_sysfs_attrs[] = {
+	__ATTR(per_cpu, 0444, wq_per_cpu_show, NULL),
+	__ATTR(max_active, 0644, wq_max_active_show, wq_max_active_store),
+	__ATTR_NULL,
+};
+
+static ssize_t wq_nice_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int nice;
+
+	spin_lock(&workqueue_lock);
+	nice = wq->unbound_attrs->nice;
+	spin_unlock(&workqueue_lock);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", nice);
+}
+
+static ssize_t wq_cpumask_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int written;
+
+	spin_lock(&workqueue_lock);
+	written = cpumask_scnprintf(buf, PAGE_SIZE - 1,
+				    wq->unbound_attrs->cpumask);
+	spin_unlock(&workqueue_lock);
+
+	buf[written++] = '\n';
+	return written;
+}
+
+static ssize_t wq_numa_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int numa;
+
+	spin_lock(&workqueue_lock);
+	numa = !wq->unbound_attrs->no_numa;
+	spin_unlock(&workqueue_lock);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", numa);
+}
+
+/* copy of @wq's current attrs for a sysfs store to modify and apply */
+static struct workqueue_attrs *wq_sysfs_prep_attrs(struct workqueue_struct *wq)
+{
+	struct workqueue_attrs *attrs;
+
+	attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!attrs)
+		return NULL;
+
+	spin_lock(&workqueue_lock);
+	attrs->nice = wq->unbound_attrs->nice;
+	cpumask_copy(attrs->cpumask, wq->unbound_attrs->cpumask);
+	attrs->no_numa = wq->unbound_attrs->no_numa;
+	spin_unlock(&workqueue_lock);
+	return attrs;
+}
+
+static ssize_t wq_nice_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	struct workqueue_attrs *attrs;
+	int ret = -EINVAL;
+
+	attrs = wq_sysfs_prep_attrs(wq);
+	if (!attrs)
+		return -ENOMEM;
+
+	if (sscanf(buf, "%d", &attrs->nice) == 1)
+		ret = apply_workqueue_attrs(wq, attrs);
+
+	free_workqueue_attrs(attrs);
+	return ret ?: count;
+}
+
+static ssize_t wq_cpumask_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	struct workqueue_attrs *attrs;
+	int ret;
+
+	attrs = wq_sysfs_prep_attrs(wq);
+	if (!attrs)
+		return -ENOMEM;
+
+	ret = bitmap_parse(buf, count, cpumask_bits(attrs->cpumask),
+			   nr_cpumask_bits);
+	if (!ret)
+		ret = apply_workqueue_attrs(wq, attrs);
+
+	free_workqueue_attrs(attrs);
+	return ret ?: count;
+}
+
+static ssize_t wq_numa_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	struct workqueue_attrs *attrs;
+	int ret = -EINVAL, v;
+
+	attrs = wq_sysfs_prep_attrs(wq);
+	if (!attrs)
+		return -ENOMEM;
+
+	if (sscanf(buf, "%d", &v) == 1) {
+		attrs->no_numa = !v;
+		ret = apply_workqueue_attrs(wq, attrs);
+	}
+
+	free_workqueue_attrs(attrs);
+	return ret ?: count;
+}
+
+static struct device_attribute wq_sysfs_unbound_attrs[] = {
+	__ATTR(nice, 0644, wq_nice_show, wq_nice_store),
+	__ATTR(cpumask, 0644, wq_cpumask_show, wq_cpumask_store),
+	__ATTR(numa, 0644, wq_numa_show, wq_numa_store),
+};
+
+static struct bus_type wq_subsys = {
+	.name				= "workqueue",
+	.dev_attrs			= wq_sysfs_attrs,
+};
+
+static bool wq_subsys_registered;
+
+static void wq_device_release(struct device *dev)
+{
+	kfree(container_of(dev, struct wq_device, dev));
+}
+
+/**
+ * workqueue_sysfs_register - make a workqueue visible in sysfs
+ * @wq: the workqueue to register
+ *
+ * Expose @wq in sysfs under /sys/bus/workqueue/devices.  Called for
+ * WQ_SYSFS workqueues on creation, or from wq_sysfs_init() for those
+ * created before the workqueue subsystem was registered.  Ordered
+ * workqueues are defined by their max_active and can't be exposed.
+ *
+ * RETURNS:
+ * 0 on success, -errno on failure.
+ */
+static int workqueue_sysfs_register(struct workqueue_struct *wq)
+{
+	struct wq_device *wq_dev;
+	int ret, i;
+
+	if (WARN_ON(wq->flags & WQ_ORDERED))
+		return -EINVAL;
+	if (!wq_subsys_registered)
+		return 0;
+
+	wq->wq_dev = wq_dev = kzalloc(sizeof(*wq_dev), GFP_KERNEL);
+	if (!wq_dev)
+		return -ENOMEM;
+
+	wq_dev->wq = wq;
+	wq_dev->dev.bus = &wq_subsys;
+	wq_dev->dev.release = wq_device_release;
+	dev_set_name(&wq_dev->dev, "%s", wq->name);
+
+	ret = device_register(&wq_dev->dev);
+	if (ret) {
+		put_device(&wq_dev->dev);
+		wq->wq_dev = NULL;
+		return ret;
+	}
+
+	if (wq->flags & WQ_UNBOUND) {
+		for (i = 0; i < ARRAY_SIZE(wq_sysfs_unbound_attrs); i++) {
+			ret = device_create_file(&wq_dev->dev,
+						 &wq_sysfs_unbound_attrs[i]);
+			if (ret) {
+				device_unregister(&wq_dev->dev);
+				wq->wq_dev = NULL;
+				return ret;
+			}
+		}
+	}
+	return 0;
+}
+
+static void workqueue_sysfs_unregister(struct workqueue_struct *wq)
+{
+	struct wq_device *wq_dev = wq->wq_dev;
+
+	if (!wq_dev)
+		return;
+
+	wq->wq_dev = NULL;
+	device_unregister(&wq_dev->dev);
+}
+
+static int __init wq_sysfs_init(void)
+{
+	struct workqueue_struct *wq;
+	int ret;
+
+	ret = subsys_system_register(&wq_subsys, NULL);
+	if (ret)
+		return ret;
+	wq_subsys_registered = true;
+
+	/*
+	 * Pick up the WQ_SYSFS workqueues created by early initcalls.
+	 * Nothing else creates or destroys workqueues concurrently
+	 * this early, so no need to hold workqueue_lock.
+	 */
+	list_for_each_entry(wq, &workqueues, list)
+		if (wq->flags & WQ_SYSFS)
+			workqueue_sysfs_register(wq);
+	return 0;
+}
+core_initcall(wq_sysfs_init);
+#else	/* CONFIG_SYSFS */
+static int workqueue_sysfs_register(struct workqueue_struct *wq)
+{
+	return 0;
+}
+
+static void workqueue_sysfs_unregister(struct workqueue_struct *wq)
+{
+}
+#endif	/* CONFIG_SYSFS */
+
 static int alloc_cwqs(struct workqueue_struct *wq)
 {
 	/*
@@ -2895,36 +3416,59 @@ static int alloc_cwqs(struct workqueue_struct *wq)
 	const size_t align = max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,
 				   __alignof__(unsigned long long));
 
-	if (!(wq->flags & WQ_UNBOUND))
+	int node;
+
+	if (!(wq->flags & WQ_UNBOUND)) {
 		wq->cpu_wq.pcpu = __alloc_percpu(size, align);
-	else {
+		/* just in case, make sure it's actually aligned */
+		BUG_ON(!IS_ALIGNED(wq->cpu_wq.v, align));
+		return wq->cpu_wq.v ? 0 : -ENOMEM;
+	}
+
+	wq->cpu_wq.nodes = kcalloc(nr_node_ids, sizeof(wq->cpu_wq.nodes[0]),
+				   GFP_KERNEL);
+	if (!wq->cpu_wq.nodes)
+		return -ENOMEM;
+
+	for_each_node(node) {
+		struct cpu_workqueue_struct *cwq;
 		void *ptr;
 
 		/*
 		 * Allocate enough room to align cwq and put an extra
 		 * pointer at the end pointing back to the originally
-		 * allocated pointer which will be used for free.
+		 * allocated pointer which will be used for free.  Each
+		 * cwq lives on the node its gcwq serves.
 		 */
-		ptr = kzalloc(size + align + sizeof(void *), GFP_KERNEL);
-		if (ptr) {
-			wq->cpu_wq.single = PTR_ALIGN(ptr, align);
-			*(void **)(wq->cpu_wq.single + 1) = ptr;
-		}
+		ptr = kzalloc_node(size + align + sizeof(void *), GFP_KERNEL,
+				   node);
+		if (!ptr)
+			return -ENOMEM;
+		cwq = PTR_ALIGN(ptr, align);
+		*(void **)(cwq + 1) = ptr;
+		wq->cpu_wq.nodes[node] = cwq;
 	}
-
-	/* just in case, make sure it's actually aligned */
-	BUG_ON(!IS_ALIGNED(wq->cpu_wq.v, align));
-	return wq->cpu_wq.v ? 0 : -ENOMEM;
+	return 0;
 }
 
 static void free_cwqs(struct workqueue_struct *wq)
 {
-	if (!(wq->flags & WQ_UNBOUND))
+	int node;
+
+	if (!(wq->flags & WQ_UNBOUND)) {
 		free_percpu(wq->cpu_wq.pcpu);
-	else if (wq->cpu_wq.single) {
+		return;
+	}
+	if (!wq->cpu_wq.nodes)
+		return;
+	for_each_node(node) {
+		struct cpu_workqueue_struct *cwq = wq->cpu_wq.nodes[node];
+
 		/* the pointer to free is stored right after the cwq */
-		kfree(*(void **)(wq->cpu_wq.single + 1));
+		if (cwq)
+			kfree(*(void **)(cwq + 1));
 	}
+	kfree(wq->cpu_wq.nodes);
 }
 
 static int wq_clamp_max_active(int max_active, unsigned int flags,
@@ -2973,10 +3517,15 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 
 	/*
 	 * Unbound workqueues aren't concurrency managed and should be
-	 * dispatched to workers immediately.
+	 * dispatched to workers immediately.  Those with max_active of
+	 * one have always executed their work items in order and must
+	 * keep doing so, which means sticking to a single node.
 	 */
-	if (flags & WQ_UNBOUND)
+	if (flags & WQ_UNBOUND) {
 		flags |= WQ_HIGHPRI;
+		if (max_active == 1)
+			flags |= WQ_ORDERED;
+	}
 
 	max_active = max_active ?: WQ_DFL_ACTIVE;
 	max_active = wq_clamp_max_active(max_active, flags, wq->name);
@@ -2992,6 +3541,13 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 	lockdep_init_map(&wq->lockdep_map, lock_name, key, 0);
 	INIT_LIST_HEAD(&wq->list);
 
+	if (flags & WQ_UNBOUND) {
+		wq->unbound_attrs = alloc_workqueue_attrs(GFP_KERNEL);
+		if (!wq->unbound_attrs)
+			goto err;
+		wq_update_attrs_seq(wq);
+	}
+
 	if (alloc_cwqs(wq) < 0)
 		goto err;
 
@@ -3041,10 +3597,16 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 
 	spin_unlock(&workqueue_lock);
 
+	if ((wq->flags & WQ_SYSFS) && workqueue_sysfs_register(wq)) {
+		destroy_workqueue(wq);
+		return NULL;
+	}
+
 	return wq;
 err:
 	if (wq) {
 		free_cwqs(wq);
+		free_workqueue_attrs(wq->unbound_attrs);
 		free_mayday_mask(wq->mayday_mask);
 		kfree(wq->rescuer);
 		kfree(wq);
@@ -3066,6 +3628,8 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	/* drain it before proceeding with destruction */
 	drain_workqueue(wq);
 
+	workqueue_sysfs_unregister(wq);
+
 	/*
 	 * wq list is used to freeze wq, remove from list after
 	 * flushing is complete in case freeze races us.
@@ -3092,6 +3656,7 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	}
 
 	free_cwqs(wq);
+	free_workqueue_attrs(wq->unbound_attrs);
 	kfree(wq);
 }
 EXPORT_SYMBOL_GPL(destroy_workqueue);
@@ -3101,7 +3666,8 @@ EXPORT_SYMBOL_GPL(destroy_workqueue);
  * @wq: target workqueue
  * @max_active: new max_active value.
  *
- * Set max_active of @wq to @max_active.
+ * Set max_active of @wq to @max_active.  For unbound workqueues the
+ * limit applies to each NUMA node separately.
  *
  * CONTEXT:
  * Don't call from IRQ context.
@@ -3137,8 +3703,10 @@ EXPORT_SYMBOL_GPL(workqueue_set_max_active);
  * @cpu: CPU in question
  * @wq: target workqueue
  *
- * Test whether @wq's cpu workqueue for @cpu is congested.  There is
- * no synchronization around this function and the test result is
+ * Test whether @wq's cpu workqueue for @cpu is congested.  For
+ * unbound workqueues, the queue of @cpu's node is tested, or of the
+ * local node if @cpu is WORK_CPU_UNBOUND.  There is no
+ * synchronization around this function and the test result is
  * unreliable and only useful as advisory hints or for debugging.
  *
  * RETURNS:
@@ -3146,7 +3714,11 @@ EXPORT_SYMBOL_GPL(workqueue_set_max_active);
  */
 bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq)
 {
-	struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	struct cpu_workqueue_struct *cwq;
+
+	if (wq->flags & WQ_UNBOUND)
+		cpu = wq_unbound_cpu(wq, cpu);
+	cwq = get_cwq(cpu, wq);
 
 	return !list_empty(&cwq->delayed_works);
 }
@@ -3157,13 +3729,16 @@ EXPORT_SYMBOL_GPL(workqueue_congested);
  * @work: the work of interest
  *
  * RETURNS:
- * CPU number if @work was ever queued.  WORK_CPU_NONE otherwise.
+ * CPU number if @work was ever queued, WORK_CPU_UNBOUND if it was last
+ * queued on an unbound workqueue.  WORK_CPU_NONE otherwise.
  */
 unsigned int work_cpu(struct work_struct *work)
 {
 	struct global_cwq *gcwq = get_work_gcwq(work);
 
-	return gcwq ? gcwq->cpu : WORK_CPU_NONE;
+	if (!gcwq)
+		return WORK_CPU_NONE;
+	return min_t(unsigned int, gcwq->cpu, WORK_CPU_UNBOUND);
 }
 EXPORT_SYMBOL_GPL(work_cpu);
 
@@ -3803,7 +4378,7 @@ static int __init init_workqueues(void)
 		struct global_cwq *gcwq = get_gcwq(cpu);
 		struct worker *worker;
 
-		if (cpu != WORK_CPU_UNBOUND)
+		if (cpu < WORK_CPU_UNBOUND)
 			gcwq->flags &= ~GCWQ_DISASSOCIATED;
 		worker = create_worker(gcwq, true);
 		BUG_ON(!worker);
@@ -3815,7 +4390,8 @@ static int __init init_workqueues(void)
 	system_wq = alloc_workqueue("events", 0, 0);
 	system_long_wq = alloc_workqueue("events_long", 0, 0);
 	system_nrt_wq = alloc_workqueue("events_nrt", WQ_NON_REENTRANT, 0);
-	system_unbound_wq = alloc_workqueue("events_unbound", WQ_UNBOUND,
+	system_unbound_wq = alloc_workqueue("events_unbound",
+					    WQ_UNBOUND | WQ_SYSFS,
 					    WQ_UNBOUND_MAX_ACTIVE);
 	system_freezable_wq = alloc_workqueue("events_freezable",
 					      WQ_FREEZABLE, 0);
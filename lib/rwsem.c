@@ -7,6 +7,7 @@
 #include <linux/sched.h>
 #include <linux/init.h>
 #include <linux/export.h>
+#include <linux/mcs_spinlock.h>
 
 /*
  * Initialize an rwsem:
@@ -24,6 +25,11 @@ void __init_rwsem(struct rw_semaphore *sem, const char *name,
 	sem->count = RWSEM_UNLOCKED_VALUE;
 	raw_spin_lock_init(&sem->wait_lock);
 	INIT_LIST_HEAD(&sem->wait_list);
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+	sem->owner = NULL;
+	sem->mcs_lock = NULL;
+	sem->handoff = 0;
+#endif
 }
 
 EXPORT_SYMBOL(__init_rwsem);
@@ -34,8 +40,28 @@ struct rwsem_waiter {
 	unsigned int flags;
 #define RWSEM_WAITING_FOR_READ	0x00000001
 #define RWSEM_WAITING_FOR_WRITE	0x00000002
+	unsigned long timeout;
 };
 
+/*
+ * A queued writer that has been waiting for longer than this while
+ * optimistic spinners keep stealing the lock from under it requests a
+ * handoff: spinners then back off and queue until the waiter got it.
+ */
+#define RWSEM_WAIT_TIMEOUT	DIV_ROUND_UP(HZ, 250)
+
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+static inline void rwsem_set_handoff(struct rw_semaphore *sem, int handoff)
+{
+	if (sem->handoff != handoff)
+		ACCESS_ONCE(sem->handoff) = handoff;
+}
+#else
+static inline void rwsem_set_handoff(struct rw_semaphore *sem, int handoff)
+{
+}
+#endif
+
 /* Wake types for __rwsem_do_wake().  Note that RWSEM_WAKE_NO_ACTIVE and
  * RWSEM_WAKE_READ_OWNED imply that the spinlock must have been kept held
  * since the rwsem value was observed.
@@ -86,6 +112,8 @@ __rwsem_do_wake(struct rw_semaphore *sem, int wake_type)
 		/* Someone grabbed the sem already */
 		goto undo_write;
 
+	rwsem_set_handoff(sem, 0);
+
 	/* We must be careful not to touch 'waiter' after we set ->task = NULL.
 	 * It is an allocated on the waiter's stack and may become invalid at
 	 * any time after that point (due to a wakeup from another source).
@@ -140,6 +168,7 @@ __rwsem_do_wake(struct rw_semaphore *sem, int wake_type)
 		adjustment -= RWSEM_WAITING_BIAS;
 
 	rwsem_atomic_add(adjustment, sem);
+	rwsem_set_handoff(sem, 0);
 
 	next = sem->wait_list.next;
 	for (loop = woken; loop > 0; loop--) {
@@ -161,11 +190,163 @@ __rwsem_do_wake(struct rw_semaphore *sem, int wake_type)
 	/* undo the change to the active count, but check for a transition
 	 * 1->0 */
  undo_write:
-	if (rwsem_atomic_update(-adjustment, sem) & RWSEM_ACTIVE_MASK)
+	if (rwsem_atomic_update(-adjustment, sem) & RWSEM_ACTIVE_MASK) {
+		/* The lock was taken from under a waiter that has waited
+		 * for too long already, make optimistic spinners back off.
+		 */
+		if (time_after(jiffies, waiter->timeout))
+			rwsem_set_handoff(sem, 1);
 		goto out;
+	}
 	goto try_again_write;
 }
 
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+/*
+ * Try to acquire the write lock without queueing: only possible while
+ * there is no active locker and no starving waiter asked for a handoff.
+ * If there are waiters queued, the waiting bias stays in the count and
+ * the waiters are woken once we release the lock.
+ */
+static inline bool rwsem_try_write_lock_unqueued(struct rw_semaphore *sem)
+{
+	long old, count = ACCESS_ONCE(sem->count);
+
+	while (!ACCESS_ONCE(sem->handoff)) {
+		if (!(count == 0 || count == RWSEM_WAITING_BIAS))
+			return false;
+
+		old = cmpxchg(&sem->count, count,
+			      count + RWSEM_ACTIVE_WRITE_BIAS);
+		if (old == count)
+			return true;
+
+		count = old;
+	}
+	return false;
+}
+
+static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
+{
+	struct task_struct *owner;
+	bool on_cpu = true;
+
+	if (need_resched())
+		return false;
+
+	/*
+	 * If sem->owner is not set, the rwsem may have just been acquired
+	 * for write and the owner not recorded yet, spin a little to find
+	 * out.  Readers cannot be spun on, we would not know when they
+	 * are all gone.
+	 */
+	rcu_read_lock();
+	owner = ACCESS_ONCE(sem->owner);
+	if (owner == RWSEM_READER_OWNED)
+		on_cpu = false;
+	else if (owner)
+		on_cpu = owner->on_cpu;
+	rcu_read_unlock();
+
+	return on_cpu;
+}
+
+static inline bool owner_running(struct rw_semaphore *sem,
+				 struct task_struct *owner)
+{
+	if (sem->owner != owner)
+		return false;
+
+	/*
+	 * Ensure we emit the owner->on_cpu, dereference _after_ checking
+	 * sem->owner still matches owner, if that fails, owner might
+	 * point to free()d memory, if it still matches, the rcu_read_lock()
+	 * ensures the memory stays valid.
+	 */
+	barrier();
+
+	return owner->on_cpu;
+}
+
+static noinline
+bool rwsem_spin_on_owner(struct rw_semaphore *sem, struct task_struct *owner)
+{
+	rcu_read_lock();
+	while (owner_running(sem, owner)) {
+		if (need_resched())
+			break;
+
+		arch_mutex_cpu_relax();
+	}
+	rcu_read_unlock();
+
+	/*
+	 * We break out the loop above on need_resched() or when the
+	 * owner changed, which is a sign for heavy contention.  Keep
+	 * spinning only when the rwsem was released by a writer.
+	 */
+	return ACCESS_ONCE(sem->owner) == NULL;
+}
+
+/*
+ * Spin for the write lock while the current write owner is running.  The
+ * spinners queue on an MCS lock first so that only one of them polls the
+ * rwsem cacheline at a time.
+ */
+static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
+{
+	struct task_struct *owner;
+	struct mcs_spinlock node;
+	bool taken = false;
+
+	preempt_disable();
+
+	/* sem->mcs_lock and sem->owner are not protected by any lock */
+	if (!rwsem_can_spin_on_owner(sem))
+		goto done;
+
+	mcs_spin_lock(&sem->mcs_lock, &node);
+
+	for (;;) {
+		owner = ACCESS_ONCE(sem->owner);
+		if (owner == RWSEM_READER_OWNED)
+			break;
+		if (owner && !rwsem_spin_on_owner(sem, owner))
+			break;
+
+		if (rwsem_try_write_lock_unqueued(sem)) {
+			taken = true;
+			break;
+		}
+
+		/* A starving waiter asked for the lock, stop stealing it. */
+		if (ACCESS_ONCE(sem->handoff))
+			break;
+
+		/*
+		 * When there's no owner, we might have preempted between the
+		 * owner acquiring the lock and setting the owner field. If
+		 * we're an RT task that will live-lock because we won't let
+		 * the owner complete.
+		 */
+		if (!owner && (need_resched() || rt_task(current)))
+			break;
+
+		/*
+		 * The cpu_relax() call is a compiler barrier which forces
+		 * everything in this loop to be re-loaded. We don't need
+		 * memory barriers as we'll eventually observe the right
+		 * values at the cost of a few extra spins.
+		 */
+		arch_mutex_cpu_relax();
+	}
+	mcs_spin_unlock(&sem->mcs_lock, &node);
+done:
+	preempt_enable();
+	return taken;
+}
+#endif /* CONFIG_RWSEM_SPIN_ON_OWNER */
+
 /*
  * wait for a lock to be granted
  */
@@ -183,6 +364,7 @@ rwsem_down_failed_common(struct rw_semaphore *sem,
 	raw_spin_lock_irq(&sem->wait_lock);
 	waiter.task = tsk;
 	waiter.flags = flags;
+	waiter.timeout = jiffies + RWSEM_WAIT_TIMEOUT;
 	get_task_struct(tsk);
 
 	if (list_empty(&sem->wait_list))
@@ -201,7 +383,7 @@ rwsem_down_failed_common(struct rw_semaphore *sem,
 	if (count == RWSEM_WAITING_BIAS)
 		sem = __rwsem_do_wake(sem, RWSEM_WAKE_NO_ACTIVE);
 	else if (count > RWSEM_WAITING_BIAS &&
-		 adjustment == -RWSEM_ACTIVE_WRITE_BIAS)
+		 (flags & RWSEM_WAITING_FOR_WRITE))
 		sem = __rwsem_do_wake(sem, RWSEM_WAKE_READ_OWNED);
 
 	raw_spin_unlock_irq(&sem->wait_lock);
@@ -233,8 +415,23 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
  */
 struct rw_semaphore __sched *rwsem_down_write_failed(struct rw_semaphore *sem)
 {
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+	/* undo write bias from down_write operation, stop active locking */
+	rwsem_atomic_update(-RWSEM_ACTIVE_WRITE_BIAS, sem);
+
+	/* do optimistic spinning and steal lock if possible */
+	if (rwsem_optimistic_spin(sem))
+		return sem;
+
+	/*
+	 * Optimistic spinning failed, queue up and sleep.  The write bias
+	 * has been dropped already, so only the waiting bias is adjusted.
+	 */
+	return rwsem_down_failed_common(sem, RWSEM_WAITING_FOR_WRITE, 0);
+#else
 	return rwsem_down_failed_common(sem, RWSEM_WAITING_FOR_WRITE,
 					-RWSEM_ACTIVE_WRITE_BIAS);
+#endif
 }
 
 /*
@@ -0,0 +1,115 @@
+#!/bin/bash
+#
+# Compare io schedulers on the disk that holds a directory.
+#
+#	iosched-bench.sh [-s "flash deadline noop"] [-t seconds] DIR
+#
+# For each scheduler, and each workload below, a 4k random reader runs
+# against a file in DIR, alone or next to some other load, and its IOPS,
+# mean and 99th percentile completion latency are printed:
+#
+#	randread	the reader alone
+#	+bufwrite	next to a buffered streaming writer (writeback)
+#	+syncwrite	next to a writer doing 16k writes with fsync each
+#	+seqread	next to a reader streaming 128k reads, 32 deep
+#
+# The last number of each line belongs to the other job: its IOPS, for
+# seeing what the reader's latency costs it.
+#
+# Needs fio and root, for switching schedulers and dropping caches.
+# Files are created in DIR; nothing else on the disk is touched.
+#
+
+SCHEDS="flash deadline noop"
+RUNTIME=30
+SIZE=512m
+
+while getopts "s:t:" opt; do
+	case $opt in
+	s) SCHEDS="$OPTARG" ;;
+	t) RUNTIME="$OPTARG" ;;
+	*) echo "usage: $0 [-s schedulers] [-t seconds] DIR" >&2; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+DIR="$1"
+if [ -z "$DIR" ] || [ ! -d "$DIR" ]; then
+	echo "usage: $0 [-s schedulers] [-t seconds] DIR" >&2
+	exit 1
+fi
+
+if ! type fio >/dev/null 2>&1; then
+	echo "fio not found" >&2
+	exit 1
+fi
+
+# /sys/block/<disk>/queue of the disk holding DIR, partition or not
+dev=$(df -P "$DIR" | awk 'NR == 2 { print $1 }')
+sys=$(readlink -f /sys/class/block/$(basename $(readlink -f "$dev")))
+[ -f "$sys/partition" ] && sys=$(dirname "$sys")
+QUEUE="$sys/queue"
+if [ ! -w "$QUEUE/scheduler" ]; then
+	echo "cannot switch schedulers of $dev" >&2
+	exit 1
+fi
+OLD_SCHED=$(sed 's/.*\[\(.*\)\].*/\1/' "$QUEUE/scheduler")
+trap 'echo $OLD_SCHED > $QUEUE/scheduler' EXIT
+
+COMMON="--directory=$DIR --size=$SIZE --runtime=$RUNTIME --time_based
+	--minimal --ioengine=libaio"
+READER="--name=reader --rw=randread --bs=4k --direct=1 --iodepth=1"
+
+workload()
+{
+	case $1 in
+	randread)
+		;;
+	+bufwrite)
+		echo "--name=other --rw=write --bs=1m --direct=0 --end_fsync=1"
+		;;
+	+syncwrite)
+		echo "--name=other --rw=randwrite --bs=16k --direct=0 --fsync=1"
+		;;
+	+seqread)
+		echo "--name=other --rw=read --bs=128k --direct=1 --iodepth=32"
+		;;
+	esac
+}
+
+# terse format: field 8 read iops, 16 mean clat (usec), 18-37 read clat
+# percentiles, 49 write iops
+report()
+{
+	awk -F';' -v sched=$1 -v load=$2 '
+	$3 == "reader" {
+		p99 = 0
+		for (i = 18; i <= 37; i++)
+			if ($i ~ /^99\.0+%=/) {
+				split($i, kv, "=")
+				p99 = kv[2]
+			}
+		iops = $8; mean = $16; p = p99
+	}
+	$3 == "other" { other = $8 + $49 }
+	END {
+		printf "%-10s %-10s %8d %10.0f %10d %8d\n",
+			sched, load, iops, mean, p, other
+	}'
+}
+
+printf "%-10s %-10s %8s %10s %10s %8s\n" \
+	sched load iops mean_us p99_us other
+for sched in $SCHEDS; do
+	if ! echo $sched > "$QUEUE/scheduler" 2>/dev/null; then
+		echo "$sched: not available, skipped" >&2
+		continue
+	fi
+	for load in randread +bufwrite +syncwrite +seqread; do
+		sync
+		echo 3 > /proc/sys/vm/drop_caches
+		fio $COMMON $READER $(workload $load) | report $sched $load
+	done
+done
+
+rm -f "$DIR"/reader.* "$DIR"/other.*
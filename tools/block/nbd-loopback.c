@@ -0,0 +1,243 @@
+/*
+ * nbd-loopback - serve an nbd device from memory, over several local
+ * connections
+ *
+ *	nbd-loopback [-c connections] [-s size_mb] [-l latency_us]
+ *		     [-f seconds] /dev/nbdN
+ *
+ * Sets up /dev/nbdN with one socketpair per connection and serves it
+ * from a memory buffer, one thread per connection.  Each thread answers
+ * its requests one at a time and waits latency_us before each, standing
+ * in for a remote backend; so one connection tops out at about
+ * 1/latency requests a second, and more connections should scale that
+ * up.  With -f, connection 0 is closed after that many seconds, to
+ * watch the others take over its requests.
+ *
+ * Runs until interrupted, then disconnects the device.  Needs root and
+ * the nbd driver; tools/block/nbd-scaling.sh drives it with fio.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <linux/nbd.h>
+
+#define MAX_CONNS	16
+#define BLKSIZE		4096
+
+static char *disk;
+static uint64_t disk_size;
+static unsigned int latency_us = 200;
+static int server_fd[MAX_CONNS];
+static volatile sig_atomic_t stop;
+
+static int xfer(int fd, void *buf, size_t len, int send)
+{
+	char *p = buf;
+
+	while (len) {
+		ssize_t n = send ? write(fd, p, len) : read(fd, p, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void *serve(void *arg)
+{
+	int fd = server_fd[(long)arg];
+	struct nbd_request req;
+	struct nbd_reply reply;
+	uint64_t from;
+	uint32_t len, type;
+
+	reply.magic = htonl(NBD_REPLY_MAGIC);
+	for (;;) {
+		if (xfer(fd, &req, sizeof(req), 0))
+			break;
+		if (ntohl(req.magic) != NBD_REQUEST_MAGIC) {
+			fprintf(stderr, "connection %ld: bad magic\n",
+				(long)arg);
+			break;
+		}
+		type = ntohl(req.type);
+		from = be64toh(req.from);
+		len = ntohl(req.len);
+		if (type == NBD_CMD_DISC)
+			break;
+
+		memcpy(reply.handle, req.handle, sizeof(reply.handle));
+		reply.error = 0;
+		if (from + len > disk_size || from + len < from)
+			reply.error = htonl(EINVAL);
+
+		if (type == NBD_CMD_WRITE) {
+			static char sink[1 << 17];
+			char *dst = reply.error ? sink : disk + from;
+
+			if (reply.error && len > sizeof(sink))
+				break;
+			if (xfer(fd, dst, len, 0))
+				break;
+		}
+		if (latency_us)
+			usleep(latency_us);
+
+		if (xfer(fd, &reply, sizeof(reply), 1))
+			break;
+		if (type == NBD_CMD_READ && !reply.error &&
+		    xfer(fd, disk + from, len, 1))
+			break;
+	}
+	close(fd);
+	return NULL;
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-c connections] [-s size_mb] "
+		"[-l latency_us] [-f seconds] /dev/nbdN\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int conns = 1, fail_after = 0, client_fd[MAX_CONNS];
+	pthread_t thread[MAX_CONNS];
+	const char *dev;
+	pid_t pid;
+	long i;
+	int fd, opt, status;
+
+	disk_size = 256ULL << 20;
+	while ((opt = getopt(argc, argv, "c:s:l:f:")) != -1) {
+		switch (opt) {
+		case 'c':
+			conns = atoi(optarg);
+			break;
+		case 's':
+			disk_size = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'l':
+			latency_us = atoi(optarg);
+			break;
+		case 'f':
+			fail_after = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || conns < 1 || conns > MAX_CONNS ||
+	    !disk_size)
+		usage(argv[0]);
+	dev = argv[optind];
+
+	disk = calloc(1, disk_size);
+	if (!disk) {
+		perror("calloc");
+		return 1;
+	}
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	ioctl(fd, NBD_CLEAR_SOCK);
+	if (ioctl(fd, NBD_SET_BLKSIZE, BLKSIZE) < 0 ||
+	    ioctl(fd, NBD_SET_SIZE_BLOCKS, disk_size / BLKSIZE) < 0) {
+		perror("setting device size");
+		return 1;
+	}
+	for (i = 0; i < conns; i++) {
+		int sv[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+			perror("socketpair");
+			return 1;
+		}
+		client_fd[i] = sv[0];
+		server_fd[i] = sv[1];
+		if (ioctl(fd, NBD_SET_SOCK, client_fd[i]) < 0) {
+			perror(i ? "NBD_SET_SOCK, more than one connection "
+				   "supported?" : "NBD_SET_SOCK");
+			ioctl(fd, NBD_CLEAR_SOCK);
+			return 1;
+		}
+	}
+
+	/* the child sits in NBD_DO_IT for as long as the device is up */
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (!pid) {
+		/* ^C is for the parent, which then disconnects cleanly */
+		signal(SIGINT, SIG_IGN);
+		for (i = 0; i < conns; i++)
+			close(server_fd[i]);
+		if (ioctl(fd, NBD_DO_IT) < 0)
+			perror("NBD_DO_IT");
+		ioctl(fd, NBD_CLEAR_SOCK);
+		_exit(0);
+	}
+
+	for (i = 0; i < conns; i++) {
+		close(client_fd[i]);
+		if (pthread_create(&thread[i], NULL, serve, (void *)i)) {
+			fprintf(stderr, "cannot start server threads\n");
+			kill(pid, SIGKILL);
+			return 1;
+		}
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	printf("%s: %llu MB, %d connection(s), %u us per request\n", dev,
+	       (unsigned long long)(disk_size >> 20), conns, latency_us);
+	fflush(stdout);
+
+	if (fail_after) {
+		sleep(fail_after);
+		if (!stop) {
+			printf("closing connection 0\n");
+			fflush(stdout);
+			shutdown(server_fd[0], SHUT_RDWR);
+		}
+	}
+	while (!stop)
+		pause();
+
+	ioctl(fd, NBD_DISCONNECT);
+	ioctl(fd, NBD_CLEAR_SOCK);
+	waitpid(pid, &status, 0);
+	for (i = 0; i < conns; i++)
+		pthread_join(thread[i], NULL);
+	close(fd);
+	return 0;
+}
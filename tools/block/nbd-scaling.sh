@@ -0,0 +1,77 @@
+#!/bin/bash
+#
+# Show nbd throughput against the number of connections.
+#
+#	nbd-scaling.sh [-c "1 2 4 8"] [-l latency_us] [-t seconds] /dev/nbdN
+#
+# For each connection count, nbd-loopback serves the device from memory
+# over that many local connections, each answering one request at a
+# time after latency_us, and fio runs 4k random reads 32 deep against
+# it.  IOPS should grow with the connection count until the client
+# side, not the server, is the limit.
+#
+# Needs fio, root and the nbd driver.  Build nbd-loopback first with
+# make in this directory.  Nothing but the nbd device is touched.
+#
+
+CONNS="1 2 4 8"
+LATENCY=200
+RUNTIME=20
+
+while getopts "c:l:t:" opt; do
+	case $opt in
+	c) CONNS="$OPTARG" ;;
+	l) LATENCY="$OPTARG" ;;
+	t) RUNTIME="$OPTARG" ;;
+	*) echo "usage: $0 [-c counts] [-l latency_us] [-t seconds] DEV" >&2
+	   exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+DEV="$1"
+if [ -z "$DEV" ] || [ ! -b "$DEV" ]; then
+	echo "usage: $0 [-c counts] [-l latency_us] [-t seconds] DEV" >&2
+	exit 1
+fi
+
+SERVER=$(dirname "$0")/nbd-loopback
+if [ ! -x "$SERVER" ]; then
+	echo "$SERVER not found, run make first" >&2
+	exit 1
+fi
+if ! type fio >/dev/null 2>&1; then
+	echo "fio not found" >&2
+	exit 1
+fi
+
+SYS=/sys/block/$(basename "$DEV")
+
+printf "%6s %10s %10s %10s\n" conns iops MB/s mean_us
+for c in $CONNS; do
+	"$SERVER" -c $c -l $LATENCY "$DEV" >/dev/null &
+	server=$!
+
+	# up once the driver has started every connection
+	for i in $(seq 50); do
+		[ "$(cat $SYS/connections 2>/dev/null)" = "$c $c" ] && break
+		sleep 0.1
+	done
+	if [ "$(cat $SYS/connections 2>/dev/null)" != "$c $c" ]; then
+		echo "$c: device did not come up" >&2
+		kill -INT $server
+		wait $server
+		continue
+	fi
+
+	# terse format: field 7 read KB/s, 8 read iops, 16 mean clat (usec)
+	fio --name=nbd --filename="$DEV" --rw=randread --bs=4k --direct=1 \
+		--ioengine=libaio --iodepth=32 --runtime=$RUNTIME \
+		--time_based --minimal |
+	awk -F';' -v c=$c '{
+		printf "%6d %10d %10.1f %10.0f\n", c, $8, $7 / 1024, $16
+	}'
+
+	kill -INT $server
+	wait $server
+done